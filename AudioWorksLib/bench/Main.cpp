@@ -0,0 +1,801 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include "AcousticTracer.h"
+#include "Adpcm.h"
+#include "Ambisonics.h"
+#include "BiquadBank.h"
+#include "FFT.h"
+#include "Hrtf.h"
+#include "Mixer.h"
+#include "Resampler.h"
+#include "SampleBuffer.h"
+#include "Bitmaths.h"
+
+using namespace Banshee;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// Shortest time every measurement runs for, set with --time.
+static double minSeconds = 0.2;
+
+// Repeats fn until at least seconds have passed and returns nanoseconds per call.
+template<typename Fn>
+static double timeCalls(Fn fn, double seconds) {
+	// Warm caches and the plan before timing.
+	fn();
+
+	long long calls = 0;
+	long long batch = 1;
+	Clock::time_point start = Clock::now();
+	double elapsed = 0.0;
+	while(elapsed < seconds) {
+		for(long long i = 0; i < batch; i++) {
+			fn();
+		}
+		calls += batch;
+		batch *= 2;
+		elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+	}
+	return elapsed * 1e9 / (double)calls;
+}
+
+template<typename Fn>
+static double timeCalls(Fn fn) {
+	return timeCalls(fn, minSeconds);
+}
+
+// One measurement. samples is how many samples one call processes, what counts as a sample is
+// up to the benchmark: output samples for kernels, voice samples for the mixer.
+struct Result {
+	std::string group;
+	std::string name;
+	std::string simd;
+	int blockFrames;
+	int voices;
+	double nsPerSample;
+	double samplesPerSecond;
+};
+
+static std::vector<Result> results;
+
+static void printHeader(const char* group) {
+	std::cout << "\n" << group << "\n";
+	printf("%-26s %-7s %7s %7s %12s %14s\n", "name", "simd", "block", "voices", "ns/sample", "Msamples/s");
+}
+
+static void report(const char* group, const std::string& name, const char* simd, int blockFrames, int voices, double nsPerCall, double samples) {
+	Result result;
+	result.group = group;
+	result.name = name;
+	result.simd = simd;
+	result.blockFrames = blockFrames;
+	result.voices = voices;
+	result.nsPerSample = nsPerCall / samples;
+	result.samplesPerSecond = samples * 1e9 / nsPerCall;
+	results.push_back(result);
+
+	printf("%-26s %-7s %7d %7d %12.3f %14.1f\n", name.c_str(), simd, blockFrames, voices, result.nsPerSample, result.samplesPerSecond * 1e-6);
+}
+
+static void fillNoise(float* data, size_t count, uint32_t seed) {
+	for(size_t i = 0; i < count; i++) {
+		seed = seed * 1664525u + 1013904223u;
+		data[i] = (float)(seed >> 8) / (float)(1 << 24) - 0.5f;
+	}
+}
+
+static const int BLOCK_SIZES[] = { 64, 256, 1024, 4096 };
+
+// Every kernel on every instruction set this CPU runs, so the SIMD versions are measured against scalar.
+static void benchmarkKernels() {
+	printHeader("Kernels");
+
+	const int maxBlock = 4096;
+	std::vector<float> src(maxBlock * 2), dst(maxBlock * 2), right(maxBlock);
+	std::vector<int16_t> pcm16(maxBlock);
+	std::vector<uint8_t> pcm24(maxBlock * 3);
+	fillNoise(src.data(), src.size(), 1);
+	fillNoise(right.data(), right.size(), 2);
+	for(int i = 0; i < maxBlock; i++) {
+		pcm16[i] = (int16_t)(src[i] * 65535.f);
+		memcpy(&pcm24[i * 3], &pcm16[i], 2);
+		pcm24[i * 3 + 2] = (uint8_t)i;
+	}
+
+	// ADPCM blocks of a mono clip, one per ADPCM_BLOCK_FRAMES frames.
+	FrameView view;
+	view.data = (const uint8_t*)src.data();
+	view.frameCount = maxBlock;
+	view.format.sampleFormat = SampleFormat::FLOAT32;
+	view.format.channels = 1;
+	view.format.sampleRate = 48000;
+	view.format.frameSize = sizeof(float);
+	std::vector<uint8_t> adpcm;
+	encodeAdpcm(view, adpcm);
+	std::vector<const uint8_t*> adpcmBlocks(maxBlock / ADPCM_BLOCK_FRAMES);
+	for(size_t b = 0; b < adpcmBlocks.size(); b++) {
+		adpcmBlocks[b] = adpcm.data() + b * ADPCM_BLOCK_BYTES;
+	}
+
+	// A low pass in every lane, filtered in place so the state stays bounded.
+	std::vector<float> lanes(BIQUAD_LANES * maxBlock);
+	fillNoise(lanes.data(), lanes.size(), 3);
+	float* channels[BIQUAD_LANES];
+	for(int l = 0; l < BIQUAD_LANES; l++) {
+		channels[l] = lanes.data() + l * maxBlock;
+	}
+	BiquadCoefficients lowPass = BiquadCoefficients::design(FilterType::LOW_PASS, 2000.f, BUTTERWORTH_Q, 0.f, 48000);
+	std::vector<float> coefficients(BIQUAD_LANES * 10, 0.f);
+	std::vector<float> biquadState(BIQUAD_LANES * 2, 0.f);
+	for(int l = 0; l < BIQUAD_LANES; l++) {
+		coefficients[l] = lowPass.b0;
+		coefficients[BIQUAD_LANES + l] = lowPass.b1;
+		coefficients[BIQUAD_LANES * 2 + l] = lowPass.b2;
+		coefficients[BIQUAD_LANES * 3 + l] = lowPass.a1;
+		coefficients[BIQUAD_LANES * 4 + l] = lowPass.a2;
+	}
+
+	for(int level = (int)SimdLevel::SCALAR; level <= (int)SimdLevel::AVX2; level++) {
+		const MixKernels* k = kernelsFor((SimdLevel)level);
+		if(k == nullptr) continue;
+		const char* simd = simdLevelName((SimdLevel)level);
+
+		for(int block : BLOCK_SIZES) {
+			size_t n = (size_t)block;
+			uint32_t dither = 1;
+
+			report("kernels", "mixGain", simd, block, 1, timeCalls([&]() {
+				k->mixGain(dst.data(), src.data(), 0.5f, n);
+			}), (double)n);
+			report("kernels", "panMono", simd, block, 1, timeCalls([&]() {
+				k->panMono(dst.data(), src.data(), 0.5f, 0.25f, 0.f, 0.f, n);
+			}), (double)n);
+			report("kernels", "panStereo", simd, block, 1, timeCalls([&]() {
+				k->panStereo(dst.data(), src.data(), right.data(), 0.5f, 0.25f, 0.f, 0.f, n);
+			}), (double)n * 2);
+			report("kernels", "s16ToFloat", simd, block, 1, timeCalls([&]() {
+				k->s16ToFloat(dst.data(), pcm16.data(), n);
+			}), (double)n);
+			report("kernels", "s24ToFloat", simd, block, 1, timeCalls([&]() {
+				k->s24ToFloat(dst.data(), pcm24.data(), n);
+			}), (double)n);
+			report("kernels", "floatToS16Dither", simd, block, 1, timeCalls([&]() {
+				k->floatToS16Dither(pcm16.data(), src.data(), n, &dither);
+			}), (double)n);
+			report("kernels", "adpcmDecode", simd, block, 1, timeCalls([&]() {
+				k->adpcmDecode(dst.data(), adpcmBlocks.data(), n / ADPCM_BLOCK_FRAMES);
+			}), (double)n);
+			report("kernels", "biquadLanes", simd, block, BIQUAD_LANES, timeCalls([&]() {
+				k->biquadLanes(channels, coefficients.data(), biquadState.data(), n);
+			}), (double)n * BIQUAD_LANES);
+		}
+	}
+}
+
+static void benchmarkResampler() {
+	printHeader("Resampler");
+	const char* simd = simdLevelName(detectSimdLevel());
+	Resampler::initTables();
+
+	const ResampleQuality qualities[] = { ResampleQuality::LINEAR, ResampleQuality::CUBIC, ResampleQuality::SINC };
+	const char* qualityNames[] = { "linear", "cubic", "sinc" };
+	// Up a fifth, and 44.1 kHz to 48 kHz.
+	const double steps[] = { 1.5, 44100.0 / 48000.0 };
+
+	std::vector<float> dst(4096);
+	std::vector<float> src(Resampler::sourceFrames(0.5, 1.5, 1.5, 4096));
+	fillNoise(src.data(), src.size(), 4);
+
+	for(int q = 0; q < 3; q++) {
+		for(double step : steps) {
+			char name[64];
+			snprintf(name, sizeof(name), "%s x%.3f", qualityNames[q], step);
+			for(int block : BLOCK_SIZES) {
+				report("resampler", name, simd, block, 1, timeCalls([&]() {
+					Resampler::process(qualities[q], dst.data(), src.data(), 0.5, step, step, block);
+				}), (double)block);
+			}
+		}
+	}
+}
+
+static void benchmarkBiquadBank() {
+	printHeader("BiquadBank");
+	const char* simd = simdLevelName(detectSimdLevel());
+
+	BiquadCoefficients from = BiquadCoefficients::design(FilterType::LOW_PASS, 2000.f, BUTTERWORTH_Q, 0.f, 48000);
+	BiquadCoefficients to = BiquadCoefficients::design(FilterType::LOW_PASS, 3000.f, BUTTERWORTH_Q, 0.f, 48000);
+
+	for(int laneCount : { 8, 32, 128 }) {
+		for(int block : BLOCK_SIZES) {
+			BiquadBank bank(laneCount, block);
+			std::vector<float> input(block), output(block);
+			fillNoise(input.data(), input.size(), 5);
+
+			// A whole block the way the mixer runs it: set up, load, filter and store every lane.
+			report("biquad", "ramped bank", simd, block, laneCount, timeCalls([&]() {
+				for(int l = 0; l < laneCount; l++) {
+					bank.setLane(l, from, to, BiquadState());
+					bank.loadLane(l, input.data());
+				}
+				bank.process(laneCount);
+				for(int l = 0; l < laneCount; l++) {
+					bank.storeLane(l, output.data());
+				}
+			}), (double)block * laneCount);
+		}
+	}
+}
+
+// Reference real DFT with a precomputed table of W(N)^k, O(N^2). Sums in double so it is
+// the more accurate of the two.
+struct NaiveDft {
+	int size;
+	std::vector<float> cosTable;
+	std::vector<float> sinTable;
+
+	explicit NaiveDft(int size) : size(size), cosTable(size), sinTable(size) {
+		for(int i = 0; i < size; i++) {
+			cosTable[i] = (float)cos(6.28318530717958647692 * i / size);
+			sinTable[i] = (float)sin(6.28318530717958647692 * i / size);
+		}
+	}
+
+	void forward(const float* input, float* re, float* im) const {
+		for(int k = 0; k <= size / 2; k++) {
+			double sumRe = 0.0;
+			double sumIm = 0.0;
+			int index = 0;
+			for(int n = 0; n < size; n++) {
+				sumRe += input[n] * cosTable[index];
+				sumIm -= input[n] * sinTable[index];
+				index = (index + k) & (size - 1);
+			}
+			re[k] = (float)sumRe;
+			im[k] = (float)sumIm;
+		}
+	}
+};
+
+static void benchmarkFft() {
+	printHeader("FFT");
+	const char* simd = simdLevelName(detectSimdLevel());
+
+	// Speedup and accuracy against the naive DFT, printed after the timings.
+	std::vector<std::string> accuracy;
+
+	for(int size = 16; size <= 65536; size *= 2) {
+		const FFT* fft = FFT::get(size);
+		int bins = fft->getBins();
+
+		std::vector<float> input(size);
+		fillNoise(input.data(), input.size(), 1);
+
+		std::vector<float> re(bins), im(bins), output(size), data(size);
+		double fftNs = timeCalls([&]() {
+			fft->forward(input.data(), re.data(), im.data());
+		});
+		report("fft", "forward", simd, size, 1, fftNs, (double)size);
+		report("fft", "inverse", simd, size, 1, timeCalls([&]() {
+			fft->inverse(re.data(), im.data(), output.data());
+		}), (double)size);
+
+		// Round trip error of the out of place and in place variants.
+		fft->forward(input.data(), re.data(), im.data());
+		fft->inverse(re.data(), im.data(), output.data());
+		data = input;
+		fft->forwardInPlace(data.data());
+		fft->inverseInPlace(data.data());
+		double roundTrip = 0.0;
+		for(int i = 0; i < size; i++) {
+			roundTrip = fmax(roundTrip, fabs(output[i] - input[i]));
+			roundTrip = fmax(roundTrip, fabs(data[i] - input[i]));
+		}
+
+		// The naive DFT gets too slow to time past a few thousand points.
+		double maxError = -1.0;
+		double dftNs = 0.0;
+		if(size <= 8192) {
+			NaiveDft dft(size);
+			std::vector<float> dftRe(bins), dftIm(bins);
+			dftNs = timeCalls([&]() {
+				dft.forward(input.data(), dftRe.data(), dftIm.data());
+			}, minSeconds / 4);
+			report("fft", "naive dft", "scalar", size, 1, dftNs, (double)size);
+			maxError = 0.0;
+			for(int k = 0; k < bins; k++) {
+				maxError = fmax(maxError, fabs(re[k] - dftRe[k]));
+				maxError = fmax(maxError, fabs(im[k] - dftIm[k]));
+			}
+		}
+
+		char line[128];
+		if(maxError < 0.0) {
+			snprintf(line, sizeof(line), "%8d %10s %12s %12.2e", size, "-", "-", roundTrip);
+		}
+		else {
+			snprintf(line, sizeof(line), "%8d %9.1fx %12.2e %12.2e", size, dftNs / fftNs, maxError, roundTrip);
+		}
+		accuracy.push_back(line);
+	}
+
+	printf("\n%8s %10s %12s %12s\n", "size", "speedup", "dft error", "round trip");
+	for(const std::string& line : accuracy) {
+		std::cout << line << "\n";
+	}
+}
+
+static void benchmarkConversion() {
+	printHeader("Conversion");
+	const char* simd = simdLevelName(detectSimdLevel());
+
+	const int maxBlock = 4096;
+	std::vector<float> clip(maxBlock * 2), dst(maxBlock * 2);
+	fillNoise(clip.data(), clip.size(), 6);
+
+	// Every source format the mixer reads, through convertToFloat() and decodeAdpcm().
+	const SampleFormat formats[] = { SampleFormat::PCM_U8, SampleFormat::PCM_S16, SampleFormat::PCM_S24, SampleFormat::PCM_S32, SampleFormat::FLOAT32 };
+	const char* formatNames[] = { "u8", "s16", "s24", "s32", "float" };
+	std::vector<uint8_t> raw(maxBlock * 2 * 4);
+	fillNoise((float*)raw.data(), maxBlock * 2, 7);
+
+	for(int f = 0; f < 5; f++) {
+		std::string name = std::string(formatNames[f]) + " to float";
+		for(int block : BLOCK_SIZES) {
+			report("conversion", name, simd, block, 1, timeCalls([&]() {
+				convertToFloat(dst.data(), raw.data(), formats[f], (size_t)block);
+			}), (double)block);
+		}
+	}
+
+	for(int channels = 1; channels <= 2; channels++) {
+		FrameView view;
+		view.data = (const uint8_t*)clip.data();
+		view.frameCount = maxBlock;
+		view.format.sampleFormat = SampleFormat::FLOAT32;
+		view.format.channels = channels;
+		view.format.sampleRate = 48000;
+		view.format.frameSize = channels * (int)sizeof(float);
+		std::vector<uint8_t> adpcm;
+		encodeAdpcm(view, adpcm);
+
+		std::string name = channels == 1 ? "adpcm mono" : "adpcm stereo";
+		for(int block : BLOCK_SIZES) {
+			// Odd start so every run pays for the partial first block like the mixer does.
+			size_t start = block < maxBlock ? 37 : 0;
+			report("conversion", name, simd, block, 1, timeCalls([&]() {
+				decodeAdpcm(dst.data(), adpcm.data(), channels, start, (size_t)block);
+			}), (double)block * channels);
+		}
+	}
+}
+
+static void benchmarkMixer() {
+	printHeader("Mixer");
+	const char* simd = simdLevelName(detectSimdLevel());
+
+	// A second of looped mono 16-bit noise, the common case for sound effects.
+	const int clipFrames = 48000;
+	std::vector<float> noise(clipFrames);
+	fillNoise(noise.data(), noise.size(), 8);
+	std::vector<int16_t> pcm(clipFrames);
+	for(int i = 0; i < clipFrames; i++) {
+		pcm[i] = (int16_t)(noise[i] * 32767.f);
+	}
+	FrameView clip;
+	clip.data = (const uint8_t*)pcm.data();
+	clip.frameCount = clipFrames;
+	clip.format.sampleFormat = SampleFormat::PCM_S16;
+	clip.format.channels = 1;
+	clip.format.sampleRate = 48000;
+	clip.format.frameSize = 2;
+	SampleBuffer compressed = SampleBuffer::compressed(clip);
+
+	struct Scenario {
+		const char* name;
+		int voices;
+		int realVoices;
+		bool pitched;
+		bool adpcm;
+	};
+	const Scenario scenarios[] = {
+		{ "unpitched", 16, 16, false, false },
+		{ "unpitched", 64, 64, false, false },
+		{ "pitched", 16, 16, true, false },
+		{ "pitched", 64, 64, true, false },
+		{ "pitched", 256, 256, true, false },
+		{ "pitched adpcm", 64, 64, true, true },
+		// Most voices virtual, the budget most games run with.
+		{ "pitched 64 real", 1024, 64, true, false }
+	};
+
+	std::vector<float> out(BLOCK_FRAMES * OUTPUT_CHANNELS);
+	for(const Scenario& scenario : scenarios) {
+		Mixer mixer(scenario.voices, scenario.realVoices, 48000, 4096, 32);
+		for(int v = 0; v < scenario.voices; v++) {
+			float pan = (float)(v % 17) / 8.f - 1.f;
+			VoiceHandle voice = scenario.adpcm ? mixer.play(compressed, 0.1f, pan, true, v) : mixer.play(clip, 0.1f, pan, true, v);
+			if(scenario.pitched) {
+				mixer.setPitch(voice, 0.75f + 0.5f * (float)(v % 13) / 13.f);
+			}
+		}
+		mixer.update();
+
+		// Samples are voice samples: every real voice renders one per frame.
+		report("mixer", scenario.name, simd, BLOCK_FRAMES, scenario.voices, timeCalls([&]() {
+			mixer.render(out.data());
+		}), (double)BLOCK_FRAMES * scenario.realVoices);
+	}
+}
+
+// Rotating and decoding a block of the soundfield, and the mixer encoding voices into it.
+// Samples are output frames for the decode and voice samples for the mixer, as in the mixer group.
+static void benchmarkAmbisonics() {
+	printHeader("Ambisonics");
+	const char* simd = simdLevelName(detectSimdLevel());
+
+	std::vector<float> soundfield(MAX_AMBISONIC_CHANNELS * BLOCK_FRAMES);
+	fillNoise(soundfield.data(), soundfield.size(), 9);
+	std::vector<float> out(BLOCK_FRAMES * OUTPUT_CHANNELS);
+	ScratchArena scratch(AMBISONIC_SCRATCH_BYTES);
+
+	const int orders[] = { 1, 3 };
+	for(int order : orders) {
+		for(int binaural = 0; binaural < 2; binaural++) {
+			AmbisonicBus bus(order, binaural ? AmbisonicDecode::BINAURAL : AmbisonicDecode::STEREO, 48000, BLOCK_FRAMES);
+			// Turning every block, the worst case for the rotation.
+			Listener listener;
+			float angle = 0.f;
+			std::string name = std::string(binaural ? "binaural" : "stereo") + " order " + std::to_string(order);
+			report("ambisonics", name, simd, BLOCK_FRAMES, bus.getChannelCount(), timeCalls([&]() {
+				angle += 0.01f;
+				listener.forward = { sinf(angle), 0.f, -cosf(angle) };
+				listener.right = { cosf(angle), 0.f, sinf(angle) };
+				bus.setListener(listener);
+				scratch.reset();
+				bus.process(soundfield.data(), BLOCK_FRAMES, out.data(), scratch);
+			}), (double)BLOCK_FRAMES);
+		}
+	}
+
+	const int clipFrames = 48000;
+	std::vector<float> noise(clipFrames);
+	fillNoise(noise.data(), noise.size(), 10);
+	std::vector<int16_t> pcm(clipFrames);
+	for(int i = 0; i < clipFrames; i++) {
+		pcm[i] = (int16_t)(noise[i] * 32767.f);
+	}
+	FrameView clip;
+	clip.data = (const uint8_t*)pcm.data();
+	clip.frameCount = clipFrames;
+	clip.format.sampleFormat = SampleFormat::PCM_S16;
+	clip.format.channels = 1;
+	clip.format.sampleRate = 48000;
+	clip.format.frameSize = 2;
+
+	// Same voices as the unpitched mixer rows, encoded instead of panned.
+	const int voiceCounts[] = { 16, 64 };
+	for(int voices : voiceCounts) {
+		Mixer mixer(voices, voices, 48000, 4096, 32);
+		AmbisonicBus bus(3, AmbisonicDecode::BINAURAL, 48000, BLOCK_FRAMES);
+		mixer.setAmbisonics(&bus);
+		for(int v = 0; v < voices; v++) {
+			VoiceHandle voice = mixer.play(clip, 0.1f, 0.f, true, v);
+			float angle = v * 0.7f;
+			mixer.setDirection(voice, cosf(angle), 0.f, sinf(angle));
+		}
+		mixer.update();
+
+		report("ambisonics", "mixer encode order 3", simd, BLOCK_FRAMES, voices, timeCalls([&]() {
+			mixer.render(out.data());
+		}), (double)BLOCK_FRAMES * voices);
+	}
+}
+
+// Stand-in HRIR set with a measurement every 15 degrees: each ear hears an impulse after a spherical
+// head's delay, louder on its own side, followed by a decaying noise tail. 300 taps so the filters
+// take two partitions, like most measured sets.
+static void buildHrtfSet(HrtfSet& set) {
+	const int length = 300;
+	std::vector<HrtfMeasurement> measurements;
+	for(int elevation = -45; elevation <= 90; elevation += 15) {
+		for(int azimuth = 0; azimuth < 360; azimuth += 15) {
+			measurements.push_back({ (float)azimuth, (float)elevation });
+		}
+	}
+
+	std::vector<float> samples(measurements.size() * 2 * length, 0.f);
+	std::vector<float> tail(length);
+	for(size_t m = 0; m < measurements.size(); m++) {
+		float azimuth = measurements[m].azimuth * 0.0174533f;
+		float elevation = measurements[m].elevation * 0.0174533f;
+		float left = sinf(azimuth) * cosf(elevation);
+		for(int ear = 0; ear < 2; ear++) {
+			float side = ear == 0 ? left : -left;
+			int onset = 20 + (int)(16.f * (1.f - side));
+			float gain = 0.6f + 0.4f * side;
+			float* response = &samples[(m * 2 + ear) * length];
+			fillNoise(tail.data(), length, (uint32_t)(m * 2 + ear + 1));
+			response[onset] = gain;
+			for(int i = onset + 1; i < length; i++) {
+				response[i] = gain * tail[i] * 0.6f * expf(-(i - onset) / 40.f);
+			}
+		}
+	}
+	set.build(measurements.data(), (int)measurements.size(), samples.data(), length, 48000, 48000);
+}
+
+// One voice convolved with and without a change of direction every block, and the mixer with more
+// voices asking for HRTF than it allows, where the rest are panned.
+static void benchmarkHrtf() {
+	printHeader("HRTF");
+	const char* simd = simdLevelName(detectSimdLevel());
+
+	HrtfSet set;
+	buildHrtfSet(set);
+	std::vector<float> input(BLOCK_FRAMES);
+	fillNoise(input.data(), input.size(), 11);
+	std::vector<float> out(BLOCK_FRAMES * OUTPUT_CHANNELS);
+	ScratchArena scratch(HRTF_SCRATCH_BYTES);
+
+	for(int moving = 0; moving < 2; moving++) {
+		HrtfConvolver convolver;
+		float direction[3] = { 0.f, 0.f, 1.f };
+		float angle = 0.f;
+		report("hrtf", moving ? "convolve moving" : "convolve", simd, BLOCK_FRAMES, 1, timeCalls([&]() {
+			if(moving) {
+				angle += 0.01f;
+				direction[0] = sinf(angle);
+				direction[2] = cosf(angle);
+			}
+			convolver.process(set, input.data(), BLOCK_FRAMES, direction, 0.5f, 0.5f, out.data(), scratch);
+		}), (double)BLOCK_FRAMES);
+	}
+
+	const int clipFrames = 48000;
+	std::vector<float> noise(clipFrames);
+	fillNoise(noise.data(), noise.size(), 12);
+	std::vector<int16_t> pcm(clipFrames);
+	for(int i = 0; i < clipFrames; i++) {
+		pcm[i] = (int16_t)(noise[i] * 32767.f);
+	}
+	FrameView clip;
+	clip.data = (const uint8_t*)pcm.data();
+	clip.frameCount = clipFrames;
+	clip.format.sampleFormat = SampleFormat::PCM_S16;
+	clip.format.channels = 1;
+	clip.format.sampleRate = 48000;
+	clip.format.frameSize = 2;
+
+	// Every voice turns a little each block, so every convolution crossfades.
+	const int maxHrtfVoices = 16;
+	const int voiceCounts[] = { 16, 64 };
+	for(int voices : voiceCounts) {
+		Mixer mixer(voices, voices, 48000, 4096, 32);
+		mixer.setHrtf(&set, maxHrtfVoices);
+		std::vector<VoiceHandle> handles;
+		for(int v = 0; v < voices; v++) {
+			handles.push_back(mixer.play(clip, 0.1f, 0.f, true, v));
+		}
+		mixer.update();
+
+		float angle = 0.f;
+		std::string name = "mixer " + std::to_string(maxHrtfVoices) + " hrtf voices";
+		report("hrtf", name, simd, BLOCK_FRAMES, voices, timeCalls([&]() {
+			angle += 0.01f;
+			for(int v = 0; v < voices; v++) {
+				float a = angle + v * 0.7f;
+				mixer.setHrtfDirection(handles[v], sinf(a), 0.f, cosf(a));
+			}
+			mixer.render(out.data());
+		}), (double)BLOCK_FRAMES * voices);
+	}
+}
+
+// Unit cube, the same corners as the Simulator's Cube without its normals and uvs.
+static const float CUBE_CORNERS[8 * 3] = {
+	-0.5f, -0.5f, -0.5f,	0.5f, -0.5f, -0.5f,	-0.5f, 0.5f, -0.5f,	0.5f, 0.5f, -0.5f,
+	-0.5f, -0.5f, 0.5f,	0.5f, -0.5f, 0.5f,	-0.5f, 0.5f, 0.5f,	0.5f, 0.5f, 0.5f
+};
+static const uint32_t CUBE_INDICES[36] = {
+	0, 1, 3, 0, 3, 2,	4, 7, 5, 4, 6, 7,	0, 4, 5, 0, 5, 1,
+	2, 3, 7, 2, 7, 6,	0, 2, 6, 0, 6, 4,	1, 5, 7, 1, 7, 3
+};
+
+// Looked up from the solution directory, the bench directory and its build output.
+static bool loadSphere(std::vector<float>& vertices, std::vector<uint32_t>& indices) {
+	const char* paths[] = {
+		"Simulator/res/Models/Sphere.obj",
+		"../Simulator/res/Models/Sphere.obj",
+		"../../Simulator/res/Models/Sphere.obj",
+		"../../../../Simulator/res/Models/Sphere.obj"
+	};
+	for(const char* path : paths) {
+		std::ifstream file(path);
+		if(file && AcousticScene::loadObj(path, vertices, indices)) return true;
+	}
+	return false;
+}
+
+// A 40 by 10 by 40 room of cubes with a grid of spheres in it.
+static void buildAcousticScene(AcousticScene& scene) {
+	const float room[3][4] = {
+		{40.f, 0.f, 0.f, 0.f},
+		{0.f, 10.f, 0.f, 0.f},
+		{0.f, 0.f, 40.f, 0.f}
+	};
+	scene.addMesh(CUBE_CORNERS, 8, 3, CUBE_INDICES, 36, room);
+
+	// Pillars, as the Simulator places its cubes.
+	for(int i = 0; i < 16; i++) {
+		const float pillar[3][4] = {
+			{1.f, 0.f, 0.f, (float)(i % 4) * 8.f - 12.f},
+			{0.f, 10.f, 0.f, 0.f},
+			{0.f, 0.f, 1.f, (float)(i / 4) * 8.f - 12.f}
+		};
+		scene.addMesh(CUBE_CORNERS, 8, 3, CUBE_INDICES, 36, pillar);
+	}
+
+	std::vector<float> vertices;
+	std::vector<uint32_t> indices;
+	if(!loadSphere(vertices, indices)) {
+		std::cout << "Sphere.obj not found, tracing against the cubes only" << std::endl;
+		return;
+	}
+	for(int i = 0; i < 64; i++) {
+		const float sphere[3][4] = {
+			{1.f, 0.f, 0.f, (float)(i % 8) * 4.f - 14.f},
+			{0.f, 1.f, 0.f, (float)(i % 3) * 2.f - 2.f},
+			{0.f, 0.f, 1.f, (float)(i / 8) * 4.f - 14.f}
+		};
+		scene.addMesh(vertices.data(), vertices.size() / 3, 3, indices.data(), indices.size(), sphere);
+	}
+}
+
+// Samples are triangles for the build and rays per thread for tracing, so Msamples/s of a trace
+// reads as Mrays/s per core. The block column is the rays in a round.
+static void benchmarkAcoustics() {
+	printHeader("Acoustics");
+	const char* simd = "scalar";
+
+	AcousticScene scene;
+	buildAcousticScene(scene);
+	report("acoustics", "bvh build", simd, 0, 1, timeCalls([&]() {
+		scene.build();
+	}), (double)scene.getTriangleCount());
+
+	int cores = (int)std::thread::hardware_concurrency();
+	cores = cores > 0 ? cores : 1;
+	std::vector<int> threadCounts = { 1 };
+	if(cores > 1) {
+		threadCounts.push_back(cores);
+	}
+
+	for(int threads : threadCounts) {
+		AcousticTracerSettings settings;
+		settings.threads = threads;
+		AcousticTracer tracer(scene, settings);
+		for(int s = 0; s < 4; s++) {
+			tracer.addSource({ (float)s * 6.f - 9.f, 1.f, 15.f });
+		}
+		tracer.setListener({ 0.f, 1.f, -15.f });
+
+		// Rays are counted from the tracer since a round may hand its rays out unevenly.
+		uint64_t before = 0;
+		uint64_t calls = 0;
+		double nsPerRound = timeCalls([&]() {
+			if(calls++ == 1) {
+				before = tracer.getRaysTraced();
+			}
+			tracer.update();
+			tracer.finish();
+		});
+		double raysPerRound = (double)(tracer.getRaysTraced() - before) / (double)(calls - 1);
+		report("acoustics", "trace " + std::to_string(threads) + " threads", simd, settings.raysPerRound, threads, nsPerRound, raysPerRound / threads);
+	}
+}
+
+static std::string escapeJson(const std::string& text) {
+	std::string escaped;
+	for(char c : text) {
+		if(c == '"' || c == '\\') {
+			escaped += '\\';
+		}
+		escaped += c;
+	}
+	return escaped;
+}
+
+// One result per line so two runs diff cleanly.
+static bool writeJson(const std::string& path) {
+	std::ofstream file(path);
+	if(!file) {
+		std::cout << "Could not write " << path << std::endl;
+		return false;
+	}
+
+	file << "{\n";
+	file << "\t\"simd\": \"" << simdLevelName(detectSimdLevel()) << "\",\n";
+	file << "\t\"minSeconds\": " << minSeconds << ",\n";
+	file << "\t\"results\": [\n";
+	for(size_t i = 0; i < results.size(); i++) {
+		const Result& r = results[i];
+		char numbers[128];
+		snprintf(numbers, sizeof(numbers), "\"nsPerSample\": %.4f, \"samplesPerSecond\": %.0f", r.nsPerSample, r.samplesPerSecond);
+		file << "\t\t{ \"group\": \"" << escapeJson(r.group) << "\", \"name\": \"" << escapeJson(r.name) << "\", \"simd\": \"" << r.simd
+			<< "\", \"block\": " << r.blockFrames << ", \"voices\": " << r.voices << ", " << numbers << " }"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	file << "\t]\n";
+	file << "}\n";
+	return true;
+}
+
+static void printUsage() {
+	std::cout << "Usage: AudioWorksBench [--json results.json] [--time seconds] [group...]\n";
+	std::cout << "Groups: kernels resampler biquad fft conversion mixer ambisonics hrtf acoustics, all of them by default." << std::endl;
+}
+
+int main(int argc, char** argv) {
+	std::string jsonPath = "bench_results.json";
+	std::vector<std::string> groups;
+
+	for(int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if(arg == "--json" && i + 1 < argc) {
+			jsonPath = argv[++i];
+		}
+		else if(arg == "--time" && i + 1 < argc) {
+			minSeconds = atof(argv[++i]);
+		}
+		else if(arg == "--help" || arg[0] == '-') {
+			printUsage();
+			return arg == "--help" ? 0 : 1;
+		}
+		else {
+			groups.push_back(arg);
+		}
+	}
+
+	struct Group {
+		const char* name;
+		void (*run)();
+	};
+	const Group all[] = {
+		{ "kernels", benchmarkKernels },
+		{ "resampler", benchmarkResampler },
+		{ "biquad", benchmarkBiquadBank },
+		{ "fft", benchmarkFft },
+		{ "conversion", benchmarkConversion },
+		{ "mixer", benchmarkMixer },
+		{ "ambisonics", benchmarkAmbisonics },
+		{ "hrtf", benchmarkHrtf },
+		{ "acoustics", benchmarkAcoustics }
+	};
+
+	std::cout << "AudioWorksLib benchmarks, " << simdLevelName(detectSimdLevel()) << " kernels" << std::endl;
+	for(const Group& group : all) {
+		bool selected = groups.empty();
+		for(const std::string& name : groups) {
+			selected = selected || name == group.name;
+		}
+		if(selected) {
+			group.run();
+		}
+	}
+
+	if(!writeJson(jsonPath)) {
+		return 1;
+	}
+	std::cout << "\nWrote " << results.size() << " results to " << jsonPath << std::endl;
+	return 0;
+}
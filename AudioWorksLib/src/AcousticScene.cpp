@@ -0,0 +1,438 @@
+#include "pch.h"
+
+#include "includes/AcousticScene.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "Bitmaths.h"
+
+namespace Banshee {
+
+	// Bins the surface area heuristic is evaluated over on each axis.
+	constexpr int SAH_BINS = 12;
+	// Leaves above this size are split even when the heuristic says it does not pay.
+	constexpr int BVH_MAX_LEAF_TRIANGLES = 16;
+	// Deepest stack a traversal needs, one entry per level at most.
+	constexpr int BVH_STACK = 64;
+	// Deepest node build() makes. The heuristic can peel one triangle off at a time, so a node that
+	// could otherwise run past this is split at its median instead.
+	constexpr int BVH_MAX_DEPTH = BVH_STACK - 1;
+
+	// Levels of median splits it takes to get count triangles down to one per leaf.
+	static inline int medianLevels(uint32_t count) {
+		int levels = 0;
+		while(((uint64_t)1 << levels) < count) {
+			levels++;
+		}
+		return levels;
+	}
+
+	struct Bounds {
+		float min[3];
+		float max[3];
+
+		Bounds() {
+			reset();
+		};
+
+		inline void reset() {
+			min[0] = min[1] = min[2] = INFINITY;
+			max[0] = max[1] = max[2] = -INFINITY;
+		};
+		inline void grow(const float* point) {
+			for(int axis = 0; axis < 3; axis++) {
+				min[axis] = point[axis] < min[axis] ? point[axis] : min[axis];
+				max[axis] = point[axis] > max[axis] ? point[axis] : max[axis];
+			}
+		};
+		inline void grow(const Bounds& other) {
+			for(int axis = 0; axis < 3; axis++) {
+				min[axis] = other.min[axis] < min[axis] ? other.min[axis] : min[axis];
+				max[axis] = other.max[axis] > max[axis] ? other.max[axis] : max[axis];
+			}
+		};
+		inline float area() const {
+			float x = max[0] - min[0];
+			float y = max[1] - min[1];
+			float z = max[2] - min[2];
+			return x < 0.f ? 0.f : 2.f * (x * y + y * z + z * x);
+		};
+	};
+
+	// Distance the ray enters the box at, false if it misses it or only reaches it past maxDistance.
+	static inline bool rayHitsBox(const float* min, const float* max, const float* origin, const float* inverse, float maxDistance, float& entry) {
+		float enter = 0.f;
+		float leave = maxDistance;
+		for(int axis = 0; axis < 3; axis++) {
+			float t0 = (min[axis] - origin[axis]) * inverse[axis];
+			float t1 = (max[axis] - origin[axis]) * inverse[axis];
+			enter = std::max(enter, std::min(t0, t1));
+			leave = std::min(leave, std::max(t0, t1));
+		}
+		entry = enter;
+		return enter <= leave;
+	}
+
+	AcousticScene::AcousticScene() {
+		materials.push_back(AcousticMaterial());
+	}
+
+	uint16_t AcousticScene::addMaterial(const AcousticMaterial& material) {
+		if(materials.size() > UINT16_MAX) {
+			return 0;
+		}
+		materials.push_back(material);
+		return (uint16_t)(materials.size() - 1);
+	}
+
+	void AcousticScene::addMesh(const float* vertices, size_t vertexCount, size_t stride, const uint32_t* indices, size_t indexCount,
+		const float (&m)[3][4], uint16_t material) {
+		std::vector<Vector3> world(vertexCount);
+		for(size_t i = 0; i < vertexCount; i++) {
+			const float* v = vertices + i * stride;
+			world[i] = Vector3(
+				m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2] + m[0][3],
+				m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2] + m[1][3],
+				m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2] + m[2][3]);
+		}
+
+		for(size_t i = 0; i + 2 < indexCount; i += 3) {
+			if(indices[i] >= vertexCount || indices[i + 1] >= vertexCount || indices[i + 2] >= vertexCount) continue;
+
+			Triangle triangle;
+			triangle.v0 = world[indices[i]];
+			triangle.edge1 = sub(world[indices[i + 1]], triangle.v0);
+			triangle.edge2 = sub(world[indices[i + 2]], triangle.v0);
+			// Nothing can hit a triangle without area.
+			Vector3 normal = cross(triangle.edge1, triangle.edge2);
+			if(dot(normal, normal) < 1e-20f) continue;
+
+			triangles.push_back(triangle);
+			triangleMaterials.push_back(material < materials.size() ? material : 0);
+		}
+		nodes.clear();
+	}
+
+	void AcousticScene::clear() {
+		triangles.clear();
+		triangleMaterials.clear();
+		nodes.clear();
+	}
+
+	void AcousticScene::build() {
+		nodes.clear();
+		const uint32_t count = (uint32_t)triangles.size();
+		if(count == 0) return;
+
+		// Bounds and centroid of every triangle, sorted along with order.
+		std::vector<Bounds> boxes(count);
+		std::vector<float> centroids(count * 3);
+		std::vector<uint32_t> order(count);
+		for(uint32_t i = 0; i < count; i++) {
+			const Triangle& t = triangles[i];
+			float corners[3][3] = {
+				{ t.v0.x, t.v0.y, t.v0.z },
+				{ t.v0.x + t.edge1.x, t.v0.y + t.edge1.y, t.v0.z + t.edge1.z },
+				{ t.v0.x + t.edge2.x, t.v0.y + t.edge2.y, t.v0.z + t.edge2.z }
+			};
+			for(int c = 0; c < 3; c++) {
+				boxes[i].grow(corners[c]);
+			}
+			for(int axis = 0; axis < 3; axis++) {
+				centroids[i * 3 + axis] = (boxes[i].min[axis] + boxes[i].max[axis]) * 0.5f;
+			}
+			order[i] = i;
+		}
+
+		// A binary tree over count leaves has fewer than 2 * count nodes, so the nodes never move.
+		nodes.reserve(count * 2);
+		Node root;
+		root.first = 0;
+		root.count = count;
+		nodes.push_back(root);
+
+		std::vector<uint32_t> pending;
+		std::vector<int> pendingDepth;
+		pending.push_back(0);
+		pendingDepth.push_back(0);
+
+		// Turns node index into the parent of its triangles before and from middle.
+		auto split = [&](uint32_t index, uint32_t middle, int depth) {
+			Node left;
+			left.first = nodes[index].first;
+			left.count = middle - left.first;
+			Node right;
+			right.first = middle;
+			right.count = nodes[index].first + nodes[index].count - middle;
+
+			nodes[index].first = (uint32_t)nodes.size();
+			nodes[index].count = 0;
+			for(const Node& child : { left, right }) {
+				pending.push_back((uint32_t)nodes.size());
+				pendingDepth.push_back(depth + 1);
+				nodes.push_back(child);
+			}
+		};
+		while(!pending.empty()) {
+			const uint32_t index = pending.back();
+			const int depth = pendingDepth.back();
+			pending.pop_back();
+			pendingDepth.pop_back();
+
+			const uint32_t first = nodes[index].first;
+			const uint32_t size = nodes[index].count;
+
+			Bounds bounds;
+			Bounds centres;
+			for(uint32_t i = first; i < first + size; i++) {
+				bounds.grow(boxes[order[i]]);
+				centres.grow(&centroids[order[i] * 3]);
+			}
+			for(int axis = 0; axis < 3; axis++) {
+				nodes[index].min[axis] = bounds.min[axis];
+				nodes[index].max[axis] = bounds.max[axis];
+			}
+
+			if(size <= (uint32_t)BVH_LEAF_TRIANGLES) continue;
+
+			// Halving keeps depth + medianLevels(size) from growing, so once a node is split at its
+			// median its subtree stays within BVH_MAX_DEPTH.
+			if(depth + 1 + medianLevels(size) >= BVH_MAX_DEPTH) {
+				int axis = 0;
+				for(int a = 1; a < 3; a++) {
+					if(centres.max[a] - centres.min[a] > centres.max[axis] - centres.min[axis]) axis = a;
+				}
+				const uint32_t middle = first + size / 2;
+				std::nth_element(order.data() + first, order.data() + middle, order.data() + first + size, [&](uint32_t a, uint32_t b) {
+					return centroids[a * 3 + axis] < centroids[b * 3 + axis];
+				});
+				split(index, middle, depth);
+				continue;
+			}
+
+			// Cheapest split over the bins of every axis. Costs are in triangle tests, a leaf costs one per triangle.
+			float bestCost = INFINITY;
+			int bestAxis = -1;
+			int bestBin = 0;
+			for(int axis = 0; axis < 3; axis++) {
+				const float low = centres.min[axis];
+				const float extent = centres.max[axis] - low;
+				if(extent <= 0.f) continue;
+
+				const float scale = SAH_BINS / extent;
+				Bounds binBounds[SAH_BINS];
+				uint32_t binCounts[SAH_BINS] = {};
+				for(uint32_t i = first; i < first + size; i++) {
+					int bin = std::min(SAH_BINS - 1, (int)((centroids[order[i] * 3 + axis] - low) * scale));
+					binBounds[bin].grow(boxes[order[i]]);
+					binCounts[bin]++;
+				}
+
+				// Sweep from the right for the area and count right of every plane, then from the left.
+				float rightArea[SAH_BINS];
+				uint32_t rightCount[SAH_BINS];
+				Bounds sweep;
+				uint32_t sum = 0;
+				for(int b = SAH_BINS - 1; b > 0; b--) {
+					sweep.grow(binBounds[b]);
+					sum += binCounts[b];
+					rightArea[b] = sweep.area();
+					rightCount[b] = sum;
+				}
+
+				sweep.reset();
+				sum = 0;
+				for(int b = 0; b < SAH_BINS - 1; b++) {
+					sweep.grow(binBounds[b]);
+					sum += binCounts[b];
+					if(sum == 0 || rightCount[b + 1] == 0) continue;
+					float cost = sweep.area() * sum + rightArea[b + 1] * rightCount[b + 1];
+					if(cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestBin = b;
+					}
+				}
+			}
+
+			const float parentArea = bounds.area();
+			const float leafCost = (float)size;
+			const float splitCost = 1.f + (parentArea > 0.f ? bestCost / parentArea : 0.f);
+			if((bestAxis < 0 || splitCost >= leafCost) && size <= (uint32_t)BVH_MAX_LEAF_TRIANGLES) continue;
+
+			uint32_t middle;
+			if(bestAxis >= 0) {
+				const float low = centres.min[bestAxis];
+				const float scale = SAH_BINS / (centres.max[bestAxis] - low);
+				uint32_t* split = std::partition(order.data() + first, order.data() + first + size, [&](uint32_t t) {
+					return std::min(SAH_BINS - 1, (int)((centroids[t * 3 + bestAxis] - low) * scale)) <= bestBin;
+				});
+				middle = (uint32_t)(split - order.data());
+			}
+			else {
+				// Centroids all in one place, halve the list so a big leaf still gets split.
+				middle = first + size / 2;
+			}
+
+			split(index, middle, depth);
+		}
+
+		// Put the triangles in leaf order.
+		std::vector<Triangle> sorted(count);
+		std::vector<uint16_t> sortedMaterials(count);
+		for(uint32_t i = 0; i < count; i++) {
+			sorted[i] = triangles[order[i]];
+			sortedMaterials[i] = triangleMaterials[order[i]];
+		}
+		triangles.swap(sorted);
+		triangleMaterials.swap(sortedMaterials);
+	}
+
+	bool AcousticScene::intersect(const Vector3& origin, const Vector3& direction, float maxDistance, RayHit& hit) const {
+		if(nodes.empty()) return false;
+
+		const float o[3] = { origin.x, origin.y, origin.z };
+		const float d[3] = { direction.x, direction.y, direction.z };
+		float inverse[3];
+		for(int axis = 0; axis < 3; axis++) {
+			// Large enough to act as infinity without 0 * inf turning into NaN.
+			inverse[axis] = fabsf(d[axis]) > 1e-20f ? 1.f / d[axis] : (d[axis] < 0.f ? -1e30f : 1e30f);
+		}
+
+		float best = maxDistance;
+		uint32_t bestTriangle = UINT32_MAX;
+
+		uint32_t stack[BVH_STACK];
+		float stackEntry[BVH_STACK];
+		int top = 0;
+
+		float entry;
+		if(!rayHitsBox(nodes[0].min, nodes[0].max, o, inverse, best, entry)) return false;
+		stack[top] = 0;
+		stackEntry[top++] = entry;
+
+		while(top > 0) {
+			top--;
+			// Something nearer was found after the node was pushed.
+			if(stackEntry[top] > best) continue;
+			uint32_t index = stack[top];
+
+			while(true) {
+				const Node& node = nodes[index];
+				if(node.count > 0) {
+					for(uint32_t i = node.first; i < node.first + node.count; i++) {
+						const Triangle& t = triangles[i];
+						Vector3 p = cross(direction, t.edge2);
+						float det = dot(t.edge1, p);
+						if(fabsf(det) < 1e-12f) continue;
+
+						float inv = 1.f / det;
+						Vector3 s = sub(origin, t.v0);
+						float u = dot(s, p) * inv;
+						if(u < 0.f || u > 1.f) continue;
+						Vector3 q = cross(s, t.edge1);
+						float v = dot(direction, q) * inv;
+						if(v < 0.f || u + v > 1.f) continue;
+
+						float distance = dot(t.edge2, q) * inv;
+						// Skips the surface a reflected ray starts on.
+						if(distance > 1e-4f && distance < best) {
+							best = distance;
+							bestTriangle = i;
+						}
+					}
+					break;
+				}
+
+				const uint32_t left = node.first;
+				const uint32_t right = left + 1;
+				float leftEntry, rightEntry;
+				bool hitLeft = rayHitsBox(nodes[left].min, nodes[left].max, o, inverse, best, leftEntry);
+				bool hitRight = rayHitsBox(nodes[right].min, nodes[right].max, o, inverse, best, rightEntry);
+
+				if(hitLeft && hitRight) {
+					// Nearer child first, the other waits on the stack. build() bounds the depth.
+					bool leftFirst = leftEntry <= rightEntry;
+					assert(top < BVH_STACK);
+					stack[top] = leftFirst ? right : left;
+					stackEntry[top++] = leftFirst ? rightEntry : leftEntry;
+					index = leftFirst ? left : right;
+				}
+				else if(hitLeft) {
+					index = left;
+				}
+				else if(hitRight) {
+					index = right;
+				}
+				else {
+					break;
+				}
+			}
+		}
+
+		if(bestTriangle == UINT32_MAX) return false;
+
+		const Triangle& t = triangles[bestTriangle];
+		Vector3 normal = cross(t.edge1, t.edge2);
+		float length = sqrtf(dot(normal, normal));
+		float sign = dot(normal, direction) > 0.f ? -1.f : 1.f;
+		hit.distance = best;
+		hit.normal = Vector3(normal.x * sign / length, normal.y * sign / length, normal.z * sign / length);
+		hit.triangle = bestTriangle;
+		hit.material = triangleMaterials[bestTriangle];
+		return true;
+	}
+
+	bool AcousticScene::loadObj(const std::string& path, std::vector<float>& vertices, std::vector<uint32_t>& indices) {
+		std::ifstream file(path);
+		if(!file) {
+			std::cout << "Could not open model: " << path << std::endl;
+			return false;
+		}
+
+		vertices.clear();
+		indices.clear();
+
+		std::string line;
+		std::vector<uint32_t> face;
+		while(std::getline(file, line)) {
+			if(line.size() < 2 || line[1] != ' ') continue;
+
+			std::istringstream stream(line.substr(2));
+			if(line[0] == 'v') {
+				float x = 0.f, y = 0.f, z = 0.f;
+				stream >> x >> y >> z;
+				vertices.push_back(x);
+				vertices.push_back(y);
+				vertices.push_back(z);
+			}
+			else if(line[0] == 'f') {
+				face.clear();
+				std::string corner;
+				while(stream >> corner) {
+					// Only the position index before the first slash, negative ones count back from the end.
+					long index = strtol(corner.c_str(), nullptr, 10);
+					long vertexCount = (long)(vertices.size() / 3);
+					index = index < 0 ? vertexCount + index : index - 1;
+					if(index < 0 || index >= vertexCount) {
+						std::cout << "Model has a face with a bad vertex index: " << path << std::endl;
+						return false;
+					}
+					face.push_back((uint32_t)index);
+				}
+
+				for(size_t i = 2; i < face.size(); i++) {
+					indices.push_back(face[0]);
+					indices.push_back(face[i - 1]);
+					indices.push_back(face[i]);
+				}
+			}
+		}
+		return !indices.empty();
+	}
+};
@@ -0,0 +1,324 @@
+#include "pch.h"
+
+#include "includes/AcousticTracer.h"
+
+#include <cmath>
+
+#include "Bitmaths.h"
+
+namespace Banshee {
+
+	// xorshift32, state must not be 0.
+	static inline uint32_t nextRandom(uint32_t& state) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	// 0 to 1, from the top 24 bits.
+	static inline float randomUnit(uint32_t& state) {
+		return (nextRandom(state) >> 8) * (1.f / 16777216.f);
+	}
+
+	static inline uint32_t hashSeed(uint32_t a, uint32_t b, uint32_t c) {
+		uint32_t h = a * 0x9E3779B1u ^ b * 0x85EBCA77u ^ c * 0xC2B2AE3Du;
+		h ^= h >> 16;
+		h *= 0x7FEB352Du;
+		h ^= h >> 15;
+		return h != 0 ? h : 1;
+	}
+
+	static inline Vector3 randomDirection(uint32_t& state) {
+		float z = 2.f * randomUnit(state) - 1.f;
+		float r = sqrtf(1.f - z * z > 0.f ? 1.f - z * z : 0.f);
+		float angle = TWO_PI_f * randomUnit(state);
+		return { r * cosf(angle), r * sinf(angle), z };
+	}
+
+	// Lambertian direction around a unit normal.
+	static inline Vector3 randomDiffuse(const Vector3& normal, uint32_t& state) {
+		Vector3 tangent = fabsf(normal.x) > 0.5f ? Vector3{ normal.y, -normal.x, 0.f } : Vector3{ 0.f, normal.z, -normal.y };
+		float length = sqrtf(dot(tangent, tangent));
+		tangent = { tangent.x / length, tangent.y / length, tangent.z / length };
+		Vector3 bitangent = {
+			normal.y * tangent.z - normal.z * tangent.y,
+			normal.z * tangent.x - normal.x * tangent.z,
+			normal.x * tangent.y - normal.y * tangent.x
+		};
+
+		float u = randomUnit(state);
+		float r = sqrtf(u);
+		float angle = TWO_PI_f * randomUnit(state);
+		float a = r * cosf(angle);
+		float b = r * sinf(angle);
+		float c = sqrtf(1.f - u);
+		return {
+			tangent.x * a + bitangent.x * b + normal.x * c,
+			tangent.y * a + bitangent.y * b + normal.y * c,
+			tangent.z * a + bitangent.z * b + normal.z * c
+		};
+	}
+
+	AcousticTracer::AcousticTracer(const AcousticScene& scene, const AcousticTracerSettings& value) : scene(scene), settings(value) {
+		if(settings.threads <= 0) {
+			settings.threads = (int)std::thread::hardware_concurrency();
+			settings.threads = settings.threads > 0 ? settings.threads : 1;
+		}
+		settings.raysPerRound = settings.raysPerRound > RAYS_PER_TASK ? settings.raysPerRound : RAYS_PER_TASK;
+		settings.bins = settings.bins > 1 ? settings.bins : 1;
+		settings.listenerRadius = settings.listenerRadius > 0.01f ? settings.listenerRadius : 0.01f;
+
+		const int maxTasks = settings.raysPerRound / RAYS_PER_TASK;
+		tasks.reserve(maxTasks);
+		ready.reserve(maxTasks);
+		taskEnergy.assign((size_t)maxTasks * settings.bins, 0.f);
+
+		// Every task is ready at the start, so the round thread's deque has to hold them all.
+		pool.reset(new AudioWorkerPool(settings.threads - 1, maxTasks));
+
+		running.store(true, std::memory_order_release);
+		thread = std::thread(&AcousticTracer::roundLoop, this);
+	}
+
+	AcousticTracer::~AcousticTracer() {
+		running.store(false, std::memory_order_release);
+		{
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			wake.notify_all();
+		}
+		thread.join();
+	}
+
+	TraceSourceId AcousticTracer::addSource(const Vector3& position) {
+		TraceSourceId id;
+		if(freeSources.empty()) {
+			id = (TraceSourceId)sources.size();
+			sources.emplace_back();
+		}
+		else {
+			id = freeSources.back();
+			freeSources.pop_back();
+		}
+
+		Source& source = sources[id];
+		source.used = true;
+		source.version++;
+		source.position = position;
+		source.anchor = position;
+		source.energy.assign(settings.bins, 0.f);
+		source.response.assign(settings.bins, 0.f);
+		source.rays = 0.0;
+		return id;
+	}
+
+	void AcousticTracer::removeSource(TraceSourceId source) {
+		if(!isValid(source)) return;
+		sources[source].used = false;
+		freeSources.push_back(source);
+	}
+
+	void AcousticTracer::setSourcePosition(TraceSourceId id, const Vector3& position) {
+		if(!isValid(id)) return;
+		Source& source = sources[id];
+		source.position = position;
+		if(distanceSquared(position, source.anchor) <= settings.moveThreshold * settings.moveThreshold) return;
+
+		for(float& energy : source.energy) {
+			energy *= settings.history;
+		}
+		source.rays *= settings.history;
+		source.anchor = position;
+	}
+
+	void AcousticTracer::setListener(const Vector3& position) {
+		listener = position;
+		if(distanceSquared(position, listenerAnchor) <= settings.moveThreshold * settings.moveThreshold) return;
+
+		// Every path ends at the listener, so all of them fade.
+		for(Source& source : sources) {
+			if(!source.used) continue;
+			for(float& energy : source.energy) {
+				energy *= settings.history;
+			}
+			source.rays *= settings.history;
+		}
+		listenerAnchor = position;
+	}
+
+	void AcousticTracer::update() {
+		if(roundPending) {
+			if(!roundDone.load(std::memory_order_acquire)) return;
+			collect();
+		}
+		startRound();
+	}
+
+	void AcousticTracer::finish() {
+		if(!roundPending) return;
+		while(!roundDone.load(std::memory_order_acquire)) {
+			std::this_thread::yield();
+		}
+		collect();
+	}
+
+	const std::vector<float>& AcousticTracer::getEnergyResponse(TraceSourceId source) const {
+		static const std::vector<float> empty;
+		return isValid(source) ? sources[source].response : empty;
+	}
+
+	double AcousticTracer::getRayCount(TraceSourceId source) const {
+		return isValid(source) ? sources[source].rays : 0.0;
+	}
+
+	bool AcousticTracer::isValid(TraceSourceId source) const {
+		return source < sources.size() && sources[source].used;
+	}
+
+	void AcousticTracer::collect() {
+		roundPending = false;
+		const int bins = settings.bins;
+		// Chance of a ray from one unit away passing through the listener sphere is r^2 / 4.
+		const double scale = 4.0 / ((double)settings.listenerRadius * settings.listenerRadius);
+
+		for(size_t t = 0; t < tasks.size(); t++) {
+			const Task& task = tasks[t];
+			raysTraced += task.rays;
+			if(!isValid(task.source) || sources[task.source].version != task.version) continue;
+
+			Source& source = sources[task.source];
+			const float* energy = &taskEnergy[t * bins];
+			for(int i = 0; i < bins; i++) {
+				source.energy[i] += energy[i];
+			}
+			source.rays += task.rays;
+
+			// The last task of a source in the round normalises it.
+			if(t + 1 < tasks.size() && tasks[t + 1].source == task.source) continue;
+			const float norm = (float)(scale / source.rays);
+			for(int i = 0; i < bins; i++) {
+				source.response[i] = source.energy[i] * norm;
+			}
+		}
+		rounds++;
+	}
+
+	void AcousticTracer::startRound() {
+		tasks.clear();
+		ready.clear();
+		if(!scene.isBuilt()) return;
+
+		int active = 0;
+		for(const Source& source : sources) {
+			active += source.used ? 1 : 0;
+		}
+		if(active == 0) return;
+
+		// Tasks are shared out evenly. With more sources than tasks, the next round carries on
+		// from the source this one stopped at.
+		const int maxTasks = settings.raysPerRound / RAYS_PER_TASK;
+		const int perSource = maxTasks / active > 1 ? maxTasks / active : 1;
+		const uint32_t count = (uint32_t)sources.size();
+		round++;
+		for(uint32_t i = 0; i < count && (int)tasks.size() + perSource <= maxTasks; i++) {
+			const TraceSourceId id = (cursor + i) % count;
+			const Source& source = sources[id];
+			if(!source.used) continue;
+			for(int k = 0; k < perSource; k++) {
+				Task task;
+				task.source = id;
+				task.version = source.version;
+				task.origin = source.position;
+				task.seed = hashSeed(id, round, k);
+				task.rays = RAYS_PER_TASK;
+				ready.push_back((uint32_t)tasks.size());
+				tasks.push_back(task);
+			}
+			cursor = (id + 1) % count;
+		}
+
+		roundListener = listener;
+		roundPending = true;
+		roundDone.store(false, std::memory_order_relaxed);
+		{
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			generation++;
+		}
+		wake.notify_all();
+	}
+
+	void AcousticTracer::roundLoop() {
+		uint32_t seen = 0;
+		while(true) {
+			{
+				std::unique_lock<std::mutex> lock(wakeMutex);
+				wake.wait(lock, [&] { return !running.load(std::memory_order_acquire) || generation != seen; });
+				if(!running.load(std::memory_order_acquire)) return;
+				seen = generation;
+			}
+			pool->run(ready.data(), (int)ready.size(), (int)tasks.size(), &AcousticTracer::traceTask, this);
+			roundDone.store(true, std::memory_order_release);
+		}
+	}
+
+	void AcousticTracer::traceTask(uint32_t task, int, void* userData) {
+		AcousticTracer& tracer = *(AcousticTracer*)userData;
+		tracer.trace(tracer.tasks[task], &tracer.taskEnergy[(size_t)task * tracer.settings.bins]);
+	}
+
+	void AcousticTracer::trace(const Task& task, float* energy) const {
+		const int bins = settings.bins;
+		for(int i = 0; i < bins; i++) {
+			energy[i] = 0.f;
+		}
+
+		const float radius = settings.listenerRadius;
+		const float radiusSquared = radius * radius;
+		const float binsPerUnit = 1.f / (settings.speedOfSound * settings.binSeconds);
+		// Path length at which a ray runs off the end of the histogram.
+		const float maxPath = bins / binsPerUnit;
+		const Vector3 ear = roundListener;
+
+		uint32_t state = task.seed;
+		for(uint32_t r = 0; r < task.rays; r++) {
+			Vector3 origin = task.origin;
+			Vector3 direction = randomDirection(state);
+			float carried = 1.f;
+			float travelled = 0.f;
+
+			for(int bounce = 0; bounce <= settings.maxBounces; bounce++) {
+				RayHit hit;
+				const float reach = maxPath - travelled;
+				const bool blocked = scene.intersect(origin, direction, reach, hit);
+				const float length = blocked ? hit.distance : reach;
+
+				// Passing through the listener on this leg, counted at the closest point to its centre.
+				Vector3 toEar = { ear.x - origin.x, ear.y - origin.y, ear.z - origin.z };
+				float along = dot(toEar, direction);
+				float missSquared = dot(toEar, toEar) - along * along;
+				if(along > 0.f && along <= length && missSquared <= radiusSquared) {
+					int bin = (int)((travelled + along) * binsPerUnit);
+					if(bin < bins) {
+						energy[bin] += carried;
+					}
+				}
+
+				if(!blocked) break;
+
+				const AcousticMaterial& material = scene.getMaterial(hit.material);
+				carried *= 1.f - material.absorption;
+				travelled += hit.distance;
+				if(carried < settings.minEnergy) break;
+
+				origin = { origin.x + direction.x * hit.distance, origin.y + direction.y * hit.distance, origin.z + direction.z * hit.distance };
+				if(randomUnit(state) < material.scattering) {
+					direction = randomDiffuse(hit.normal, state);
+				}
+				else {
+					float d = 2.f * dot(direction, hit.normal);
+					direction = { direction.x - hit.normal.x * d, direction.y - hit.normal.y * d, direction.z - hit.normal.z * d };
+				}
+			}
+		}
+	}
+};
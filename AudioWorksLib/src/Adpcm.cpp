@@ -0,0 +1,142 @@
+#include "pch.h"
+
+#include "includes/Adpcm.h"
+
+#include <cmath>
+#include <cstring>
+
+#include "Bitmaths.h"
+
+namespace Banshee {
+
+	// Channel blocks decoded per kernel call, a few times the widest SIMD lanes.
+	constexpr int ADPCM_DECODE_BATCH = 16;
+
+	struct AdpcmEncoder {
+		int predictor = 0;
+		int index = 0;
+
+		// Picks the nibble that lands closest to sample and steps the decoder state the same way
+		// the decoders will.
+		inline uint8_t encode(int sample) {
+			int step = ADPCM_STEP_TABLE[index];
+			int diff = sample - predictor;
+			uint8_t nibble = 0;
+			if(diff < 0) {
+				nibble = 8;
+				diff = -diff;
+			}
+
+			int delta = step >> 3;
+			if(diff >= step) {
+				nibble |= 4;
+				diff -= step;
+				delta += step;
+			}
+			step >>= 1;
+			if(diff >= step) {
+				nibble |= 2;
+				diff -= step;
+				delta += step;
+			}
+			step >>= 1;
+			if(diff >= step) {
+				nibble |= 1;
+				delta += step;
+			}
+
+			predictor += nibble & 8 ? -delta : delta;
+			predictor = predictor > 32767 ? 32767 : (predictor < -32768 ? -32768 : predictor);
+			index += ADPCM_INDEX_TABLE[nibble];
+			index = index < 0 ? 0 : (index > 88 ? 88 : index);
+			return nibble;
+		}
+	};
+
+	AudioFormat encodeAdpcm(const FrameView& frames, std::vector<uint8_t>& out) {
+		out.clear();
+		const int channels = frames.format.channels;
+		if(frames.empty() || frames.format.frameSize == 0 || channels <= 0 || channels > ADPCM_MAX_CHANNELS) {
+			return AudioFormat();
+		}
+
+		std::vector<float> samples(frames.frameCount * channels);
+		convertToFloat(samples.data(), frames.data, frames.format.sampleFormat, samples.size());
+
+		AudioFormat format;
+		format.sampleFormat = SampleFormat::IMA_ADPCM;
+		format.channels = channels;
+		format.sampleRate = frames.format.sampleRate;
+		out.resize(frameBytes(format, frames.frameCount));
+
+		AdpcmEncoder encoders[ADPCM_MAX_CHANNELS];
+		for(int c = 0; c < channels; c++) {
+			// Start on the first sample so the first block does not open with a jump.
+			encoders[c].predictor = (int)lrintf(fminf(fmaxf(samples[c], -1.f), 1.f) * 32767.f);
+		}
+
+		const size_t blockCount = out.size() / (ADPCM_BLOCK_BYTES * channels);
+		for(size_t b = 0; b < blockCount; b++) {
+			for(int c = 0; c < channels; c++) {
+				AdpcmEncoder& encoder = encoders[c];
+				uint8_t* block = out.data() + (b * channels + c) * ADPCM_BLOCK_BYTES;
+
+				// The state the decoder starts the block from.
+				block[0] = (uint8_t)(encoder.predictor & 0xFF);
+				block[1] = (uint8_t)((encoder.predictor >> 8) & 0xFF);
+				block[2] = (uint8_t)encoder.index;
+				block[3] = 0;
+
+				for(int i = 0; i < ADPCM_BLOCK_FRAMES; i++) {
+					// The last block is padded with the final frame.
+					size_t frame = b * ADPCM_BLOCK_FRAMES + i;
+					frame = frame < frames.frameCount ? frame : frames.frameCount - 1;
+					float value = fminf(fmaxf(samples[frame * channels + c], -1.f), 1.f);
+
+					uint8_t nibble = encoder.encode((int)lrintf(value * 32767.f));
+					block[4 + i / 2] |= (uint8_t)(nibble << ((i & 1) * 4));
+				}
+			}
+		}
+
+		return format;
+	}
+
+	void decodeAdpcm(float* dst, const uint8_t* data, int channels, size_t startFrame, size_t count) {
+		float decoded[ADPCM_DECODE_BATCH * ADPCM_BLOCK_FRAMES];
+		const uint8_t* blocks[ADPCM_DECODE_BATCH];
+		const size_t batch = channels < ADPCM_DECODE_BATCH ? ADPCM_DECODE_BATCH / channels : 1;
+
+		size_t frame = startFrame;
+		const size_t end = startFrame + count;
+		while(frame < end) {
+			size_t first = frame / ADPCM_BLOCK_FRAMES;
+			size_t needed = (end - 1) / ADPCM_BLOCK_FRAMES - first + 1;
+			size_t blockCount = needed < batch ? needed : batch;
+
+			for(size_t k = 0; k < blockCount; k++) {
+				for(int c = 0; c < channels; c++) {
+					blocks[k * channels + c] = data + ((first + k) * channels + c) * ADPCM_BLOCK_BYTES;
+				}
+			}
+			kernels().adpcmDecode(decoded, blocks, blockCount * channels);
+
+			size_t stop = (first + blockCount) * ADPCM_BLOCK_FRAMES;
+			stop = stop < end ? stop : end;
+			if(channels == 1) {
+				memcpy(dst, decoded + (frame - first * ADPCM_BLOCK_FRAMES), (stop - frame) * sizeof(float));
+				dst += stop - frame;
+				frame = stop;
+				continue;
+			}
+
+			for(; frame < stop; frame++) {
+				size_t k = frame / ADPCM_BLOCK_FRAMES - first;
+				size_t i = frame % ADPCM_BLOCK_FRAMES;
+				for(int c = 0; c < channels; c++) {
+					*dst++ = decoded[(k * channels + c) * ADPCM_BLOCK_FRAMES + i];
+				}
+			}
+		}
+	}
+};
@@ -0,0 +1,444 @@
+#include "pch.h"
+
+#include "includes/Ambisonics.h"
+
+#include <cmath>
+#include <cstring>
+
+#include "Bitmaths.h"
+
+namespace Banshee {
+
+	// Golden angle, spaces the points of a spherical Fibonacci lattice evenly.
+	constexpr float GOLDEN_ANGLE_f = 2.39996323f;
+	// Directions the decoder level is averaged over.
+	constexpr int NORMALISE_POINTS = 256;
+	// Spherical head model, an average adult head in metres.
+	constexpr float HEAD_RADIUS = 0.0875f;
+	// Head shadow of the ear furthest from the sound, Brown and Duda's model.
+	constexpr float SHADOW_MIN_ALPHA = 0.1f;
+	constexpr float SHADOW_MIN_ANGLE = 150.f * PI_f / 180.f;
+
+	// Order of an ACN channel.
+	static inline int channelOrder(int channel) {
+		return channel < 1 ? 0 : (channel < 4 ? 1 : (channel < 9 ? 2 : 3));
+	}
+
+	// Point i of n spread evenly over the unit sphere.
+	static void fibonacciPoint(int i, int n, float* point) {
+		float z = 1.f - (2.f * i + 1.f) / n;
+		float r = sqrtf(1.f - z * z);
+		float angle = GOLDEN_ANGLE_f * i;
+		point[0] = r * cosf(angle);
+		point[1] = r * sinf(angle);
+		point[2] = z;
+	}
+
+	// Speaker i of an even count: the left half spread evenly like fibonacciPoint(), and every
+	// odd speaker the mirror image of the one before on the right, so both ears hear the same layout.
+	static void speakerPoint(int i, int n, float* point) {
+		const int half = n / 2;
+		const int j = i / 2;
+		float y = 1.f - (j + 0.5f) / half;
+		float r = sqrtf(1.f - y * y);
+		float angle = GOLDEN_ANGLE_f * j;
+		point[0] = r * cosf(angle);
+		point[1] = (i & 1) ? -y : y;
+		point[2] = r * sinf(angle);
+	}
+
+	// Power gain of a first order filter for white noise, the sum of its squared impulse response.
+	static float noisePower(const BiquadCoefficients& filter) {
+		double power = 0.0;
+		double x1 = 0.0, y1 = 0.0;
+		for(int i = 0; i < 1024; i++) {
+			double x = i == 0 ? 1.0 : 0.0;
+			double y = filter.b0 * x + filter.b1 * x1 - filter.a1 * y1;
+			power += y * y;
+			x1 = x;
+			y1 = y;
+		}
+		return (float)power;
+	}
+
+	// Inverts the n by n matrix in place by Gauss-Jordan elimination. False if it is singular.
+	static bool invertMatrix(double* matrix, int n) {
+		double work[MAX_AMBISONIC_CHANNELS][MAX_AMBISONIC_CHANNELS * 2];
+		for(int row = 0; row < n; row++) {
+			for(int column = 0; column < n; column++) {
+				work[row][column] = matrix[row * n + column];
+				work[row][n + column] = row == column ? 1.0 : 0.0;
+			}
+		}
+
+		for(int column = 0; column < n; column++) {
+			int pivot = column;
+			for(int row = column + 1; row < n; row++) {
+				if(fabs(work[row][column]) > fabs(work[pivot][column])) {
+					pivot = row;
+				}
+			}
+			if(fabs(work[pivot][column]) < 1e-12) return false;
+
+			for(int k = 0; k < n * 2; k++) {
+				double swap = work[column][k];
+				work[column][k] = work[pivot][k];
+				work[pivot][k] = swap;
+			}
+
+			double scale = 1.0 / work[column][column];
+			for(int k = 0; k < n * 2; k++) {
+				work[column][k] *= scale;
+			}
+			for(int row = 0; row < n; row++) {
+				if(row == column) continue;
+				double factor = work[row][column];
+				for(int k = 0; k < n * 2; k++) {
+					work[row][k] -= factor * work[column][k];
+				}
+			}
+		}
+
+		for(int row = 0; row < n; row++) {
+			for(int column = 0; column < n; column++) {
+				matrix[row * n + column] = work[row][n + column];
+			}
+		}
+		return true;
+	}
+
+	// Least squares inverse of the rows by points matrix, rows <= points: points by rows.
+	static bool pseudoInverse(const double* matrix, int rows, int points, double* inverse) {
+		double gram[MAX_AMBISONIC_CHANNELS * MAX_AMBISONIC_CHANNELS];
+		for(int a = 0; a < rows; a++) {
+			for(int b = 0; b < rows; b++) {
+				double sum = 0.0;
+				for(int k = 0; k < points; k++) {
+					sum += matrix[a * points + k] * matrix[b * points + k];
+				}
+				gram[a * rows + b] = sum;
+			}
+		}
+		if(!invertMatrix(gram, rows)) return false;
+
+		for(int k = 0; k < points; k++) {
+			for(int b = 0; b < rows; b++) {
+				double sum = 0.0;
+				for(int a = 0; a < rows; a++) {
+					sum += matrix[a * points + k] * gram[a * rows + b];
+				}
+				inverse[k * rows + b] = sum;
+			}
+		}
+		return true;
+	}
+
+	static void listenerAxes(const Listener& listener, float (&matrix)[3][3]) {
+		const Vector3 axes[3] = {
+			listener.forward,
+			{ -listener.right.x, -listener.right.y, -listener.right.z },
+			listener.up
+		};
+		for(int row = 0; row < 3; row++) {
+			matrix[row][0] = axes[row].x;
+			matrix[row][1] = axes[row].y;
+			matrix[row][2] = axes[row].z;
+		}
+	}
+
+	void encodeAmbisonics(float x, float y, float z, int order, float* c) {
+		const float SQRT3 = 1.7320508f;
+		const float SQRT15 = 3.8729833f;
+		const float SQRT5_8 = 0.7905694f;
+		const float SQRT3_8 = 0.6123724f;
+
+		c[0] = 1.f;
+		if(order < 1) return;
+		c[1] = y;
+		c[2] = z;
+		c[3] = x;
+		if(order < 2) return;
+		c[4] = SQRT3 * x * y;
+		c[5] = SQRT3 * y * z;
+		c[6] = 0.5f * (3.f * z * z - 1.f);
+		c[7] = SQRT3 * x * z;
+		c[8] = 0.5f * SQRT3 * (x * x - y * y);
+		if(order < 3) return;
+		c[9] = SQRT5_8 * y * (3.f * x * x - y * y);
+		c[10] = SQRT15 * x * y * z;
+		c[11] = SQRT3_8 * y * (5.f * z * z - 1.f);
+		c[12] = 0.5f * z * (5.f * z * z - 3.f);
+		c[13] = SQRT3_8 * x * (5.f * z * z - 1.f);
+		c[14] = 0.5f * SQRT15 * z * (x * x - y * y);
+		c[15] = SQRT5_8 * x * (x * x - 3.f * y * y);
+	}
+
+	// The arena budget and the filter bank are sized for AMBISONIC_MAX_FRAMES.
+	static inline int clampBlockFrames(int frames) {
+		return frames < 1 ? 1 : (frames > AMBISONIC_MAX_FRAMES ? AMBISONIC_MAX_FRAMES : frames);
+	}
+
+	AmbisonicBus::AmbisonicBus(int orderValue, AmbisonicDecode decodeValue, int sampleRate, int blockFrames)
+		: decode(decodeValue), sampleRate(sampleRate), blockFrames(clampBlockFrames(blockFrames)), orientations(4),
+		bank(MAX_AMBISONIC_SPEAKERS * 2, clampBlockFrames(blockFrames)) {
+		order = orderValue < 1 ? 1 : (orderValue > MAX_AMBISONIC_ORDER ? MAX_AMBISONIC_ORDER : orderValue);
+		channels = ambisonicChannels(order);
+		speakers = channels * 2;
+		outputs = decode == AmbisonicDecode::STEREO ? 2 : speakers;
+
+		// Rotation: each order is solved on its own, only harmonics of the same order mix.
+		for(int k = 0; k < ROTATION_POINTS; k++) {
+			fibonacciPoint(k, ROTATION_POINTS, rotationPoints[k]);
+		}
+		memset(rotationInverse, 0, sizeof(rotationInverse));
+		for(int l = 0; l <= order; l++) {
+			const int first = l * l;
+			const int count = 2 * l + 1;
+			double harmonics[7 * ROTATION_POINTS];
+			double inverse[ROTATION_POINTS * 7];
+			for(int k = 0; k < ROTATION_POINTS; k++) {
+				float all[MAX_AMBISONIC_CHANNELS];
+				encodeAmbisonics(rotationPoints[k][0], rotationPoints[k][1], rotationPoints[k][2], order, all);
+				for(int j = 0; j < count; j++) {
+					harmonics[j * ROTATION_POINTS + k] = all[first + j];
+				}
+			}
+			pseudoInverse(harmonics, count, ROTATION_POINTS, inverse);
+			for(int k = 0; k < ROTATION_POINTS; k++) {
+				for(int j = 0; j < count; j++) {
+					rotationInverse[k][first + j] = (float)inverse[k * count + j];
+				}
+			}
+		}
+
+		// Mode matching decode, max rE weighted so the energy points at the source.
+		float speakerPoints[MAX_AMBISONIC_SPEAKERS][3];
+		double harmonics[MAX_AMBISONIC_CHANNELS * MAX_AMBISONIC_SPEAKERS];
+		double speakerDecode[MAX_AMBISONIC_SPEAKERS * MAX_AMBISONIC_CHANNELS];
+		for(int k = 0; k < speakers; k++) {
+			speakerPoint(k, speakers, speakerPoints[k]);
+			float all[MAX_AMBISONIC_CHANNELS];
+			encodeAmbisonics(speakerPoints[k][0], speakerPoints[k][1], speakerPoints[k][2], order, all);
+			for(int c = 0; c < channels; c++) {
+				harmonics[c * speakers + k] = all[c];
+			}
+		}
+		pseudoInverse(harmonics, channels, speakers, speakerDecode);
+
+		const double x = cos(137.9 * 3.14159265358979 / 180.0 / (order + 1.51));
+		const double weights[MAX_AMBISONIC_ORDER + 1] = { 1.0, x, 0.5 * (3.0 * x * x - 1.0), 0.5 * (5.0 * x * x * x - 3.0 * x) };
+
+		memset(decoder, 0, sizeof(decoder));
+		for(int k = 0; k < speakers; k++) {
+			// The mixer's constant power pan law by how far right the speaker is, y points left.
+			float angle = (1.f - speakerPoints[k][1]) * QUARTER_PI_f;
+			for(int c = 0; c < channels; c++) {
+				float gain = (float)(speakerDecode[k * channels + c] * weights[channelOrder(c)]);
+				if(decode == AmbisonicDecode::STEREO) {
+					decoder[0][c] += cosf(angle) * gain;
+					decoder[1][c] += sinf(angle) * gain;
+				}
+				else {
+					decoder[k][c] = gain;
+				}
+			}
+		}
+
+		if(decode == AmbisonicDecode::BINAURAL) {
+			const float headTime = HEAD_RADIUS / SPEED_OF_SOUND;
+			// Bilinear transform of the one pole, one zero shadow filter, corner at c / 2a.
+			const float tk = 2.f * sampleRate / (2.f * SPEED_OF_SOUND / HEAD_RADIUS);
+			for(int k = 0; k < speakers; k++) {
+				for(int ear = 0; ear < 2; ear++) {
+					// Angle between the speaker and the ear, the left ear is on +y.
+					float facing = ear == 0 ? speakerPoints[k][1] : -speakerPoints[k][1];
+					float angle = acosf(facing < -1.f ? -1.f : (facing > 1.f ? 1.f : facing));
+
+					// Woodworth: straight to a facing ear, round the head to a turned away one.
+					float delay = angle < 0.5f * PI_f ? headTime * (1.f - facing) : headTime * (1.f + angle - 0.5f * PI_f);
+					int samples = (int)(delay * sampleRate + 0.5f);
+					earDelay[k][ear] = samples < MAX_EAR_DELAY ? samples : MAX_EAR_DELAY;
+
+					float alpha = (1.f + 0.5f * SHADOW_MIN_ALPHA) + (1.f - 0.5f * SHADOW_MIN_ALPHA) * cosf(angle / SHADOW_MIN_ANGLE * PI_f);
+					BiquadCoefficients& filter = earFilter[k][ear];
+					filter.b0 = (1.f + alpha * tk) / (1.f + tk);
+					filter.b1 = (1.f - alpha * tk) / (1.f + tk);
+					filter.b2 = 0.f;
+					filter.a1 = (1.f - tk) / (1.f + tk);
+					filter.a2 = 0.f;
+				}
+			}
+			history.assign((size_t)speakers * MAX_EAR_DELAY, 0.f);
+		}
+
+		// A voice at gain 1 comes out at about the power it would have panned, on average over directions.
+		float rowPower[MAX_AMBISONIC_SPEAKERS];
+		for(int row = 0; row < outputs; row++) {
+			// Speakers go through the head shadow of both ears.
+			rowPower[row] = decode == AmbisonicDecode::BINAURAL ? noisePower(earFilter[row][0]) + noisePower(earFilter[row][1]) : 1.f;
+		}
+		double energy = 0.0;
+		for(int i = 0; i < NORMALISE_POINTS; i++) {
+			float point[3];
+			float all[MAX_AMBISONIC_CHANNELS];
+			fibonacciPoint(i, NORMALISE_POINTS, point);
+			encodeAmbisonics(point[0], point[1], point[2], order, all);
+			for(int row = 0; row < outputs; row++) {
+				double sum = 0.0;
+				for(int c = 0; c < channels; c++) {
+					sum += decoder[row][c] * all[c];
+				}
+				energy += sum * sum * rowPower[row];
+			}
+		}
+		const float scale = energy > 0.0 ? (float)sqrt(NORMALISE_POINTS / energy) : 1.f;
+		for(int row = 0; row < outputs; row++) {
+			for(int c = 0; c < channels; c++) {
+				decoder[row][c] *= scale;
+			}
+		}
+
+		listenerAxes(Listener(), orientation.matrix);
+		updateTarget();
+		memcpy(current, target, sizeof(current));
+		turned = false;
+	}
+
+	void AmbisonicBus::setListener(const Listener& listener) {
+		Orientation next;
+		listenerAxes(listener, next.matrix);
+		// With the ring full the audio thread is not running, the newest one is all that matters anyway.
+		orientations.push(next);
+	}
+
+	void AmbisonicBus::updateTarget() {
+		const float (&m)[3][3] = orientation.matrix;
+		float turnedHarmonics[ROTATION_POINTS][MAX_AMBISONIC_CHANNELS];
+		for(int k = 0; k < ROTATION_POINTS; k++) {
+			const float* p = rotationPoints[k];
+			encodeAmbisonics(m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2],
+				m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2],
+				m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2], order, turnedHarmonics[k]);
+		}
+
+		// Block diagonal, one block per order.
+		float rotation[MAX_AMBISONIC_CHANNELS][MAX_AMBISONIC_CHANNELS];
+		memset(rotation, 0, sizeof(rotation));
+		for(int l = 0; l <= order; l++) {
+			const int first = l * l;
+			const int last = (l + 1) * (l + 1);
+			for(int a = first; a < last; a++) {
+				for(int b = first; b < last; b++) {
+					float sum = 0.f;
+					for(int k = 0; k < ROTATION_POINTS; k++) {
+						sum += turnedHarmonics[k][a] * rotationInverse[k][b];
+					}
+					rotation[a][b] = sum;
+				}
+			}
+		}
+
+		for(int row = 0; row < outputs; row++) {
+			for(int b = 0; b < channels; b++) {
+				float sum = 0.f;
+				for(int a = 0; a < channels; a++) {
+					sum += decoder[row][a] * rotation[a][b];
+				}
+				target[row][b] = sum;
+			}
+		}
+	}
+
+	void AmbisonicBus::process(const float* soundfield, int frames, float* out, ScratchArena& scratch) {
+		if(frames != blockFrames) return;
+
+		Orientation next;
+		while(orientations.pop(next)) {
+			orientation = next;
+			turned = true;
+		}
+		if(turned) {
+			updateTarget();
+			turned = false;
+		}
+
+		const MixKernels& k = kernels();
+		const float rampStep = 1.f / frames;
+		const int planes = getPlaneCount();
+
+		size_t mark = scratch.getUsed();
+		float* planar = scratch.allocate<float>(planes * 2 * frames);
+		if(planar == nullptr) {
+			scratch.rewind(mark);
+			return;
+		}
+		for(int p = 0; p < planes; p++) {
+			const float* pair = soundfield + (size_t)p * frames * 2;
+			float* first = planar + (size_t)p * 2 * frames;
+			float* second = first + frames;
+			for(int i = 0; i < frames; i++) {
+				first[i] = pair[i * 2];
+				second[i] = pair[i * 2 + 1];
+			}
+		}
+
+		if(decode == AmbisonicDecode::STEREO) {
+			for(int c = 0; c < channels; c++) {
+				k.panMono(out, planar + (size_t)c * frames, current[0][c], current[1][c],
+					(target[0][c] - current[0][c]) * rampStep, (target[1][c] - current[1][c]) * rampStep, frames);
+			}
+			memcpy(current, target, sizeof(current));
+			scratch.rewind(mark);
+			return;
+		}
+
+		// Speaker feeds in interleaved pairs too, so each channel goes to two speakers per pan.
+		float* feeds = scratch.allocate<float>(speakers * frames);
+		// Each speaker reaches each ear late and filtered, the lanes of both ears run side by side.
+		float* line = scratch.allocate<float>(MAX_EAR_DELAY + frames);
+		float* earOut = scratch.allocate<float>(frames);
+		if(feeds == nullptr || line == nullptr || earOut == nullptr) {
+			scratch.rewind(mark);
+			return;
+		}
+		memset(feeds, 0, speakers * frames * sizeof(float));
+		for(int p = 0; p < speakers / 2; p++) {
+			float* pair = feeds + (size_t)p * frames * 2;
+			const int a = p * 2;
+			const int b = a + 1;
+			for(int c = 0; c < channels; c++) {
+				k.panMono(pair, planar + (size_t)c * frames, current[a][c], current[b][c],
+					(target[a][c] - current[a][c]) * rampStep, (target[b][c] - current[b][c]) * rampStep, frames);
+			}
+		}
+		memcpy(current, target, sizeof(current));
+
+		int lane = 0;
+		for(int s = 0; s < speakers; s++) {
+			float* past = &history[(size_t)s * MAX_EAR_DELAY];
+			memcpy(line, past, MAX_EAR_DELAY * sizeof(float));
+			const float* feed = feeds + (size_t)(s / 2) * frames * 2 + (s & 1);
+			for(int i = 0; i < frames; i++) {
+				line[MAX_EAR_DELAY + i] = feed[i * 2];
+			}
+			memcpy(past, line + frames, MAX_EAR_DELAY * sizeof(float));
+
+			for(int ear = 0; ear < 2; ear++) {
+				bank.setLane(lane, earFilter[s][ear], earFilter[s][ear], earState[s][ear]);
+				bank.loadLane(lane, line + MAX_EAR_DELAY - earDelay[s][ear]);
+				lane++;
+			}
+		}
+
+		bank.process(lane);
+
+		lane = 0;
+		for(int s = 0; s < speakers; s++) {
+			for(int ear = 0; ear < 2; ear++) {
+				earState[s][ear] = bank.storeLane(lane++, earOut);
+				k.panMono(out, earOut, ear == 0 ? 1.f : 0.f, ear == 1 ? 1.f : 0.f, 0.f, 0.f, frames);
+			}
+		}
+		scratch.rewind(mark);
+	}
+};
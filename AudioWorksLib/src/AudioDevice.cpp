@@ -0,0 +1,226 @@
+#include "pch.h"
+
+#include "includes/AudioDevice.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "includes/ScratchArena.h"
+#include "Bitmaths.h"
+
+namespace Banshee {
+
+	typedef std::chrono::steady_clock Clock;
+
+	bool AudioDevice::open(const DeviceConfig& deviceConfig, RenderCallback renderCallback, void* user) {
+		if(isRunning() || renderCallback == nullptr || deviceConfig.blockFrames <= 0 ||
+			deviceConfig.channels <= 0 || deviceConfig.sampleRate <= 0) {
+			return false;
+		}
+
+		config = deviceConfig;
+		callback = renderCallback;
+		userData = user;
+		blocksRendered = 0;
+		busyNanoseconds = 0;
+		lateBlocks = 0;
+		return true;
+	}
+
+	bool AudioDevice::start() {
+		if(callback == nullptr || isRunning()) {
+			return false;
+		}
+
+		// A finished device thread may still need joining.
+		if(thread.joinable()) {
+			thread.join();
+		}
+
+		running.store(true, std::memory_order_release);
+		thread = std::thread(&AudioDevice::run, this);
+		return true;
+	}
+
+	void AudioDevice::stop() {
+		running.store(false, std::memory_order_release);
+		if(thread.joinable()) {
+			thread.join();
+		}
+	}
+
+	void AudioDevice::close() {
+		stop();
+		callback = nullptr;
+		userData = nullptr;
+	}
+
+	DeviceStats AudioDevice::getStats() const {
+		DeviceStats stats;
+		stats.blocksRendered = blocksRendered.load(std::memory_order_relaxed);
+		stats.framesRendered = stats.blocksRendered * config.blockFrames;
+		stats.busySeconds = busyNanoseconds.load(std::memory_order_relaxed) * 1e-9;
+		stats.lateBlocks = lateBlocks.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	void AudioDevice::renderBlock(float* out) {
+		Clock::time_point begin = Clock::now();
+		{
+			AudioThreadScope scope;
+			callback(out, config.blockFrames, config.channels, userData);
+		}
+		Clock::time_point end = Clock::now();
+
+		uint64_t elapsed = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+		busyNanoseconds.fetch_add(elapsed, std::memory_order_relaxed);
+		blocksRendered.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	NullDevice::~NullDevice() {
+		close();
+	}
+
+	void NullDevice::run() {
+		std::vector<float> buffer((size_t)config.blockFrames * config.channels);
+
+		const Clock::duration period = std::chrono::duration_cast<Clock::duration>(
+			std::chrono::duration<double>((double)config.blockFrames / config.sampleRate));
+		// OS sleeps overshoot, so sleep until shortly before the deadline and spin the rest.
+		const Clock::duration spinWindow = std::chrono::milliseconds(1);
+
+		Clock::time_point deadline = Clock::now();
+
+		while(running.load(std::memory_order_acquire)) {
+			renderBlock(buffer.data());
+			deadline += period;
+
+			Clock::time_point now = Clock::now();
+			if(now > deadline) {
+				lateBlocks.fetch_add(1, std::memory_order_relaxed);
+				// Too far behind to catch up without a burst of blocks, restart the schedule.
+				if(now - deadline > period * 4) {
+					deadline = now;
+				}
+				continue;
+			}
+
+			if(deadline - now > spinWindow) {
+				std::this_thread::sleep_until(deadline - spinWindow);
+			}
+			while(Clock::now() < deadline) {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	FileDevice::FileDevice(const std::string& path, double durationSeconds, bool writeFloat)
+		: path(path), durationSeconds(durationSeconds), writeFloat(writeFloat) {
+	}
+
+	FileDevice::~FileDevice() {
+		close();
+	}
+
+	bool FileDevice::open(const DeviceConfig& deviceConfig, RenderCallback renderCallback, void* user) {
+		if(!AudioDevice::open(deviceConfig, renderCallback, user)) {
+			return false;
+		}
+
+		finished = false;
+		return true;
+	}
+
+	void FileDevice::waitUntilFinished() {
+		if(durationSeconds <= 0.0) return;
+
+		if(thread.joinable()) {
+			thread.join();
+		}
+	}
+
+	static void writeU16(FILE* file, uint16_t value) {
+		uint8_t bytes[2] = {(uint8_t)value, (uint8_t)(value >> 8)};
+		fwrite(bytes, 1, 2, file);
+	}
+
+	static void writeU32(FILE* file, uint32_t value) {
+		uint8_t bytes[4] = {(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)};
+		fwrite(bytes, 1, 4, file);
+	}
+
+	// Writes a 44 byte canonical WAVE header.
+	static void writeWaveHeader(FILE* file, int channels, int sampleRate, bool isFloat, uint32_t dataBytes) {
+		int bytesPerSample = isFloat ? 4 : 2;
+
+		fwrite("RIFF", 1, 4, file);
+		writeU32(file, 36 + dataBytes);
+		fwrite("WAVE", 1, 4, file);
+
+		fwrite("fmt ", 1, 4, file);
+		writeU32(file, 16);
+		writeU16(file, isFloat ? 3 : 1);
+		writeU16(file, (uint16_t)channels);
+		writeU32(file, (uint32_t)sampleRate);
+		writeU32(file, (uint32_t)(sampleRate * channels * bytesPerSample));
+		writeU16(file, (uint16_t)(channels * bytesPerSample));
+		writeU16(file, (uint16_t)(bytesPerSample * 8));
+
+		fwrite("data", 1, 4, file);
+		writeU32(file, dataBytes);
+	}
+
+	void FileDevice::run() {
+		FILE* file = fopen(path.c_str(), "wb");
+		if(file == nullptr) {
+			std::cout << "FileDevice could not create " << path << std::endl;
+			finished = true;
+			running = false;
+			return;
+		}
+
+		// Sizes are patched once rendering stops.
+		writeWaveHeader(file, config.channels, config.sampleRate, writeFloat, 0);
+
+		size_t samples = (size_t)config.blockFrames * config.channels;
+		std::vector<float> buffer(samples);
+		std::vector<int16_t> pcm(samples);
+		uint32_t ditherState = 0x9E3779B9u;
+
+		uint64_t totalFrames = (uint64_t)(durationSeconds * config.sampleRate);
+		uint64_t frames = 0;
+		// RIFF sizes are 32-bit.
+		const uint64_t maxBytes = 0xFFFFFFFFull - 36;
+		uint64_t bytes = 0;
+
+		while(running.load(std::memory_order_acquire)) {
+			if(totalFrames > 0 && frames >= totalFrames) break;
+
+			renderBlock(buffer.data());
+			frames += config.blockFrames;
+
+			size_t blockBytes;
+			if(writeFloat) {
+				blockBytes = samples * sizeof(float);
+				if(bytes + blockBytes > maxBytes) break;
+				fwrite(buffer.data(), 1, blockBytes, file);
+			}
+			else {
+				blockBytes = samples * sizeof(int16_t);
+				if(bytes + blockBytes > maxBytes) break;
+				kernels().floatToS16Dither(pcm.data(), buffer.data(), samples, &ditherState);
+				fwrite(pcm.data(), 1, blockBytes, file);
+			}
+			bytes += blockBytes;
+		}
+
+		fseek(file, 0, SEEK_SET);
+		writeWaveHeader(file, config.channels, config.sampleRate, writeFloat, (uint32_t)bytes);
+		fclose(file);
+
+		finished.store(true, std::memory_order_release);
+		running.store(false, std::memory_order_release);
+	}
+};
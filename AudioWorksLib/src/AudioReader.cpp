@@ -2,14 +2,424 @@
 
 #include "includes/AudioReader.h"
 
-void TesterLib::helpme() {
-	printf("Manz need help");
-}
+#include <cstring>
+
+#include "Bitmaths.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace Banshee {
 
-	void printMessage() {
-		printf("Aloha!");
+	// WAVE format tags.
+	constexpr uint16_t WAVE_FORMAT_PCM = 0x0001;
+	constexpr uint16_t WAVE_FORMAT_IEEE_FLOAT = 0x0003;
+	constexpr uint16_t WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
+	static inline uint16_t readU16(const uint8_t* p) {
+		return (uint16_t)(p[0] | (p[1] << 8));
 	}
-};
 
+	static inline uint32_t readU32(const uint8_t* p) {
+		return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+	static size_t pageSize() {
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwPageSize;
+#else
+		return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+	}
+
+	int bytesPerSample(SampleFormat format) {
+		switch(format) {
+		case SampleFormat::PCM_U8:
+			return 1;
+		case SampleFormat::PCM_S16:
+			return 2;
+		case SampleFormat::PCM_S24:
+			return 3;
+		case SampleFormat::PCM_S32:
+		case SampleFormat::FLOAT32:
+			return 4;
+		default:
+			return 0;
+		}
+	}
+
+	size_t frameBytes(const AudioFormat& format, size_t frameCount) {
+		if(format.sampleFormat == SampleFormat::IMA_ADPCM) {
+			size_t blocks = (frameCount + ADPCM_BLOCK_FRAMES - 1) / ADPCM_BLOCK_FRAMES;
+			return blocks * ADPCM_BLOCK_BYTES * format.channels;
+		}
+		return frameCount * format.frameSize;
+	}
+
+	void convertToFloat(float* dst, const uint8_t* src, SampleFormat format, size_t sampleCount) {
+		switch(format) {
+		case SampleFormat::PCM_U8:
+			for(size_t i = 0; i < sampleCount; i++) {
+				dst[i] = ((int)src[i] - 128) * (1.f / 128.f);
+			}
+			break;
+		case SampleFormat::PCM_S16:
+			kernels().s16ToFloat(dst, (const int16_t*)src, sampleCount);
+			break;
+		case SampleFormat::PCM_S24:
+			kernels().s24ToFloat(dst, src, sampleCount);
+			break;
+		case SampleFormat::PCM_S32:
+			for(size_t i = 0; i < sampleCount; i++) {
+				int32_t s;
+				memcpy(&s, src + i * 4, 4);
+				dst[i] = (float)(s * (1.0 / 2147483648.0));
+			}
+			break;
+		case SampleFormat::FLOAT32:
+			memcpy(dst, src, sampleCount * sizeof(float));
+			break;
+		default:
+			memset(dst, 0, sampleCount * sizeof(float));
+			break;
+		}
+	}
+
+	MappedFile::~MappedFile() {
+		close();
+	}
+
+	bool MappedFile::open(const std::string& path) {
+		close();
+
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if(file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+
+		LARGE_INTEGER fileSize;
+		if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+			CloseHandle(file);
+			return false;
+		}
+
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if(mapping == NULL) {
+			CloseHandle(file);
+			return false;
+		}
+
+		void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if(view == nullptr) {
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+
+		m_FileHandle = file;
+		m_MappingHandle = mapping;
+		m_Data = (const uint8_t*)view;
+		m_Size = (size_t)fileSize.QuadPart;
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if(fd < 0) {
+			return false;
+		}
+
+		struct stat info;
+		if(fstat(fd, &info) != 0 || info.st_size == 0) {
+			::close(fd);
+			return false;
+		}
+
+		void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(view == MAP_FAILED) {
+			::close(fd);
+			return false;
+		}
+
+		m_FileDescriptor = fd;
+		m_Data = (const uint8_t*)view;
+		m_Size = (size_t)info.st_size;
+#endif
+		return true;
+	}
+
+	void MappedFile::close() {
+#ifdef _WIN32
+		if(m_Data != nullptr) {
+			UnmapViewOfFile(m_Data);
+		}
+		if(m_MappingHandle != nullptr) {
+			CloseHandle(m_MappingHandle);
+		}
+		if(m_FileHandle != nullptr) {
+			CloseHandle(m_FileHandle);
+		}
+		m_MappingHandle = nullptr;
+		m_FileHandle = nullptr;
+#else
+		if(m_Data != nullptr) {
+			munmap((void*)m_Data, m_Size);
+		}
+		if(m_FileDescriptor >= 0) {
+			::close(m_FileDescriptor);
+		}
+		m_FileDescriptor = -1;
+#endif
+		m_Data = nullptr;
+		m_Size = 0;
+	}
+
+	void MappedFile::prefetch(size_t offset, size_t length) const {
+		if(m_Data == nullptr || offset >= m_Size || length == 0) return;
+		if(length > m_Size - offset) length = m_Size - offset;
+
+		// Range has to start on a page boundary.
+		size_t page = pageSize();
+		size_t start = offset - (offset % page);
+		length += offset - start;
+
+#ifdef _WIN32
+		WIN32_MEMORY_RANGE_ENTRY range;
+		range.VirtualAddress = (void*)(m_Data + start);
+		range.NumberOfBytes = length;
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+		madvise((void*)(m_Data + start), length, MADV_WILLNEED);
+#endif
+	}
+
+	void MappedFile::release(size_t offset, size_t length) const {
+		if(m_Data == nullptr || offset >= m_Size || length == 0) return;
+		if(length > m_Size - offset) length = m_Size - offset;
+
+		// Only whole pages inside the range can be dropped.
+		size_t page = pageSize();
+		size_t start = (offset + page - 1) / page * page;
+		size_t end = (offset + length) / page * page;
+		if(end <= start) return;
+
+#ifdef _WIN32
+		// Unlocking pages that are not locked removes them from the working set.
+		VirtualUnlock((void*)(m_Data + start), end - start);
+#else
+		madvise((void*)(m_Data + start), end - start, MADV_DONTNEED);
+#endif
+	}
+
+	void MappedFile::adviseSequential() const {
+		if(m_Data == nullptr) return;
+#ifndef _WIN32
+		madvise((void*)m_Data, m_Size, MADV_SEQUENTIAL);
+#endif
+	}
+
+	AudioReader::~AudioReader() {
+		close();
+	}
+
+	bool AudioReader::open(const std::string& path) {
+		close();
+
+		if(!file.open(path)) {
+			std::cout << "Could not map audio file: " << path << std::endl;
+			return false;
+		}
+
+		filePath = path;
+
+		if(!parseHeader()) {
+			std::cout << "Unsupported or corrupt WAVE file: " << path << std::endl;
+			close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void AudioReader::close() {
+		file.close();
+		filePath.clear();
+		format = AudioFormat();
+		sampleData = nullptr;
+		frameCount = 0;
+		cursor = 0;
+		releasedFrames = 0;
+		streaming = false;
+	}
+
+	bool AudioReader::parseHeader() {
+		const uint8_t* data = file.data();
+		size_t size = file.size();
+
+		if(size < 12 || memcmp(data, "RIFF", 4) != 0 || memcmp(data + 8, "WAVE", 4) != 0) {
+			return false;
+		}
+
+		bool foundFormat = false;
+		size_t offset = 12;
+
+		// Walk the chunk list until the data chunk. Chunks are padded to an even size.
+		while(offset + 8 <= size) {
+			const uint8_t* chunk = data + offset;
+			uint32_t chunkSize = readU32(chunk + 4);
+			const uint8_t* body = chunk + 8;
+			size_t available = size - offset - 8;
+
+			if(memcmp(chunk, "fmt ", 4) == 0) {
+				if(chunkSize < 16 || available < 16) return false;
+
+				uint16_t tag = readU16(body);
+				int channels = readU16(body + 2);
+				int sampleRate = (int)readU32(body + 4);
+				int blockAlign = readU16(body + 12);
+				int bits = readU16(body + 14);
+
+				// Extensible files store the real format tag at the start of the sub format GUID.
+				if(tag == WAVE_FORMAT_EXTENSIBLE) {
+					if(chunkSize < 40 || available < 40) return false;
+					tag = readU16(body + 24);
+				}
+
+				if(tag == WAVE_FORMAT_PCM) {
+					switch(bits) {
+					case 8:
+						format.sampleFormat = SampleFormat::PCM_U8;
+						break;
+					case 16:
+						format.sampleFormat = SampleFormat::PCM_S16;
+						break;
+					case 24:
+						format.sampleFormat = SampleFormat::PCM_S24;
+						break;
+					case 32:
+						format.sampleFormat = SampleFormat::PCM_S32;
+						break;
+					default:
+						return false;
+					}
+				}
+				else if(tag == WAVE_FORMAT_IEEE_FLOAT && bits == 32) {
+					format.sampleFormat = SampleFormat::FLOAT32;
+				}
+				else {
+					return false;
+				}
+
+				format.channels = channels;
+				format.sampleRate = sampleRate;
+				format.frameSize = bytesPerSample(format.sampleFormat) * channels;
+
+				if(channels <= 0 || sampleRate <= 0 || blockAlign != format.frameSize) {
+					return false;
+				}
+
+				foundFormat = true;
+			}
+			else if(memcmp(chunk, "data", 4) == 0) {
+				if(!foundFormat) return false;
+
+				// Writers that crash or stream often leave a wrong size, so trust the file length.
+				size_t dataSize = chunkSize;
+				if(dataSize > available) {
+					dataSize = available;
+				}
+
+				sampleData = body;
+				frameCount = dataSize / format.frameSize;
+				return true;
+			}
+
+			offset += 8 + (size_t)chunkSize + (chunkSize & 1);
+		}
+
+		return false;
+	}
+
+	FrameView AudioReader::getFrames(size_t startFrame, size_t count) const {
+		FrameView view;
+		view.format = format;
+
+		if(sampleData == nullptr || startFrame >= frameCount) {
+			return view;
+		}
+
+		if(count > frameCount - startFrame) {
+			count = frameCount - startFrame;
+		}
+
+		view.data = sampleData + startFrame * format.frameSize;
+		view.frameCount = count;
+		return view;
+	}
+
+	void AudioReader::setStreaming(bool enable, size_t blockSize) {
+		streaming = enable;
+		if(blockSize > 0) {
+			blockFrames = blockSize;
+		}
+
+		if(streaming) {
+			file.adviseSequential();
+			prefetchFrames(cursor, blockFrames);
+		}
+	}
+
+	FrameView AudioReader::readBlock() {
+		FrameView view = getFrames(cursor, blockFrames);
+		cursor += view.frameCount;
+
+		if(streaming && !view.empty()) {
+			// Start reading the next block while this one is being used.
+			prefetchFrames(cursor, blockFrames);
+
+			// Keep the previous block resident, anything older can go.
+			size_t blockStart = cursor - view.frameCount;
+			size_t keepFrom = blockStart > blockFrames ? blockStart - blockFrames : 0;
+			if(keepFrom > releasedFrames) {
+				size_t base = sampleData - file.data();
+				file.release(base + releasedFrames * format.frameSize, (keepFrom - releasedFrames) * format.frameSize);
+				releasedFrames = keepFrom;
+			}
+		}
+
+		return view;
+	}
+
+	void AudioReader::seek(size_t frame) {
+		cursor = frame < frameCount ? frame : frameCount;
+		if(cursor < releasedFrames) {
+			releasedFrames = cursor;
+		}
+
+		if(streaming) {
+			prefetchFrames(cursor, blockFrames);
+		}
+	}
+
+	void AudioReader::prefetchFrames(size_t startFrame, size_t count) const {
+		if(sampleData == nullptr || startFrame >= frameCount) return;
+
+		size_t base = sampleData - file.data();
+		file.prefetch(base + startFrame * format.frameSize, count * format.frameSize);
+	}
+
+	void AudioReader::releaseFrames(size_t startFrame, size_t count) const {
+		if(sampleData == nullptr || startFrame >= frameCount) return;
+
+		size_t base = sampleData - file.data();
+		file.release(base + startFrame * format.frameSize, count * format.frameSize);
+	}
+};
@@ -0,0 +1,148 @@
+#include "pch.h"
+
+#include "includes/AudioStats.h"
+
+#include <chrono>
+
+namespace Banshee {
+
+	// Buckets per octave, as a power of two.
+	constexpr int LATENCY_SUB_BITS = 2;
+	constexpr int LATENCY_SUB_BUCKETS = 1 << LATENCY_SUB_BITS;
+
+	static inline double toMicroseconds(uint64_t nanoseconds) {
+		return nanoseconds * 0.001;
+	}
+
+	double LatencySnapshot::getMean() const {
+		return count > 0 ? toMicroseconds(totalNanoseconds) / count : 0.0;
+	}
+
+	double LatencySnapshot::getPercentile(double fraction) const {
+		if(count == 0) {
+			return 0.0;
+		}
+
+		uint64_t target = (uint64_t)(fraction * count);
+		target = target < 1 ? 1 : (target > count ? count : target);
+
+		uint64_t seen = 0;
+		for(int b = 0; b < LATENCY_BUCKETS; b++) {
+			seen += counts[b];
+			if(seen >= target) {
+				int edge = b + 1 < LATENCY_BUCKETS ? b + 1 : b;
+				return toMicroseconds(LatencyHistogram::bucketStart(edge));
+			}
+		}
+		return toMicroseconds(LatencyHistogram::bucketStart(LATENCY_BUCKETS - 1));
+	}
+
+	double LatencySnapshot::getMax() const {
+		return getPercentile(1.0);
+	}
+
+	LatencySnapshot LatencySnapshot::since(const LatencySnapshot& earlier) const {
+		LatencySnapshot interval;
+		for(int b = 0; b < LATENCY_BUCKETS; b++) {
+			// A bucket read a block ahead in earlier can not go negative.
+			interval.counts[b] = counts[b] > earlier.counts[b] ? counts[b] - earlier.counts[b] : 0;
+			interval.count += interval.counts[b];
+		}
+		interval.totalNanoseconds = totalNanoseconds > earlier.totalNanoseconds ? totalNanoseconds - earlier.totalNanoseconds : 0;
+		return interval;
+	}
+
+	LatencyHistogram::LatencyHistogram() {
+		for(int b = 0; b < LATENCY_BUCKETS; b++) {
+			counts[b].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	int LatencyHistogram::bucketFor(uint64_t nanoseconds) {
+		if(nanoseconds < LATENCY_SUB_BUCKETS) {
+			return (int)nanoseconds;
+		}
+
+		int octave = LATENCY_SUB_BITS;
+		while(octave < 63 && (nanoseconds >> (octave + 1)) != 0) {
+			octave++;
+		}
+
+		// The bits below the leading one pick the bucket inside the octave.
+		int sub = (int)((nanoseconds >> (octave - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+		int bucket = (octave - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS + sub;
+		return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+	}
+
+	uint64_t LatencyHistogram::bucketStart(int bucket) {
+		if(bucket < LATENCY_SUB_BUCKETS) {
+			return (uint64_t)bucket;
+		}
+
+		int octave = bucket / LATENCY_SUB_BUCKETS - 1 + LATENCY_SUB_BITS;
+		uint64_t sub = (uint64_t)(bucket % LATENCY_SUB_BUCKETS);
+		return (LATENCY_SUB_BUCKETS + sub) << (octave - LATENCY_SUB_BITS);
+	}
+
+	void LatencyHistogram::record(uint64_t nanoseconds) {
+		// One writer, so a load and a store are enough and readers never see a torn count.
+		std::atomic<uint64_t>& bucket = counts[bucketFor(nanoseconds)];
+		bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		totalNanoseconds.store(totalNanoseconds.load(std::memory_order_relaxed) + nanoseconds, std::memory_order_relaxed);
+	}
+
+	void LatencyHistogram::read(LatencySnapshot& snapshot) const {
+		snapshot.count = 0;
+		for(int b = 0; b < LATENCY_BUCKETS; b++) {
+			snapshot.counts[b] = counts[b].load(std::memory_order_relaxed);
+			snapshot.count += snapshot.counts[b];
+		}
+		snapshot.totalNanoseconds = totalNanoseconds.load(std::memory_order_relaxed);
+	}
+
+	AudioStatsSnapshot AudioStatsSnapshot::since(const AudioStatsSnapshot& earlier) const {
+		AudioStatsSnapshot interval = *this;
+		interval.blocks = blocks - earlier.blocks;
+		interval.underruns = underruns - earlier.underruns;
+		interval.commands = commands - earlier.commands;
+		interval.renderTime = renderTime.since(earlier.renderTime);
+		interval.commandLatency = commandLatency.since(earlier.commandLatency);
+		return interval;
+	}
+
+	AudioStats::AudioStats(int blockFrames, int sampleRate) {
+		blockNanoseconds = sampleRate > 0 ? (uint64_t)blockFrames * 1000000000ull / (uint64_t)sampleRate : 0;
+	}
+
+	void AudioStats::recordBlock(uint64_t renderNanoseconds, int real, int virtualCount) {
+		renderTime.record(renderNanoseconds);
+		if(renderNanoseconds > blockNanoseconds) {
+			underruns.store(underruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+		realVoices.store(real, std::memory_order_relaxed);
+		virtualVoices.store(virtualCount, std::memory_order_relaxed);
+		// Last, so a reader that sees the block count also sees the rest of the block.
+		blocks.store(blocks.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	void AudioStats::recordCommand(uint64_t postedAt, uint64_t appliedAt) {
+		commandLatency.record(appliedAt > postedAt ? appliedAt - postedAt : 0);
+		commands.store(commands.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	void AudioStats::read(AudioStatsSnapshot& snapshot) const {
+		snapshot.blocks = blocks.load(std::memory_order_acquire);
+		snapshot.underruns = underruns.load(std::memory_order_relaxed);
+		snapshot.commands = commands.load(std::memory_order_relaxed);
+		snapshot.realVoices = realVoices.load(std::memory_order_relaxed);
+		snapshot.virtualVoices = virtualVoices.load(std::memory_order_relaxed);
+		renderTime.read(snapshot.renderTime);
+		commandLatency.read(snapshot.commandLatency);
+		snapshot.blockMicroseconds = toMicroseconds(blockNanoseconds);
+	}
+
+	uint64_t AudioStats::now() {
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+};
@@ -0,0 +1,246 @@
+#include "pch.h"
+
+#include "includes/AudioStreamer.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "includes/Resampler.h"
+
+namespace Banshee {
+
+	void AudioStream::close() {
+		if(state.load(std::memory_order_acquire) != State::ACTIVE) return;
+
+		state.store(State::CLOSING, std::memory_order_release);
+		owner->wake.notify_one();
+	}
+
+	bool AudioStream::isPrimed() const {
+		if(state.load(std::memory_order_acquire) != State::ACTIVE) {
+			return false;
+		}
+
+		int64_t index = neededChunk.load(std::memory_order_acquire);
+		for(int i = 0; i < settings.bufferCount && index >= 0; i++) {
+			bool held = false;
+			for(int c = 0; c < settings.bufferCount; c++) {
+				held = held || chunks[c].index.load(std::memory_order_acquire) == index;
+			}
+			if(!held) {
+				return false;
+			}
+			index = nextChunk(index);
+		}
+		return true;
+	}
+
+	void AudioStream::setPosition(size_t frame) {
+		int64_t length = (int64_t)reader.getFrameCount();
+		int64_t earliest = (int64_t)frame - RESAMPLE_HISTORY;
+		if(earliest < 0) {
+			earliest = loop && length > 0 ? (earliest % length + length) % length : 0;
+		}
+
+		int64_t index = earliest / settings.chunkFrames;
+		if(neededChunk.exchange(index, std::memory_order_acq_rel) != index) {
+			// Like the reverb worker the lock is not taken, a missed wake up is covered by the timeout.
+			owner->wake.notify_one();
+		}
+	}
+
+	int AudioStream::readFloat(size_t frame, int count, float* dst) {
+		const AudioFormat& format = reader.getFormat();
+		int64_t index = (int64_t)frame / settings.chunkFrames;
+		size_t offset = (size_t)(frame - index * settings.chunkFrames);
+		int run = settings.chunkFrames - (int)offset < count ? settings.chunkFrames - (int)offset : count;
+
+		for(int c = 0; c < settings.bufferCount; c++) {
+			Chunk& chunk = chunks[c];
+			if(chunk.index.load(std::memory_order_acquire) != index) continue;
+
+			convertToFloat(dst, chunk.data.data() + offset * format.frameSize, format.sampleFormat, (size_t)run * format.channels);
+
+			// Still the same chunk afterwards, so the disk thread did not refill it mid copy.
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if(chunk.index.load(std::memory_order_relaxed) == index) {
+				return run;
+			}
+			break;
+		}
+
+		memset(dst, 0, (size_t)run * format.channels * sizeof(float));
+		underruns.fetch_add(1, std::memory_order_relaxed);
+		owner->underruns.fetch_add(1, std::memory_order_relaxed);
+		return run;
+	}
+
+	AudioStreamer::AudioStreamer(int maxStreams) {
+		for(int i = 0; i < maxStreams; i++) {
+			streams.emplace_back(new AudioStream());
+			streams.back()->owner = this;
+		}
+
+		running.store(true, std::memory_order_release);
+		thread = std::thread(&AudioStreamer::diskLoop, this);
+	}
+
+	AudioStreamer::~AudioStreamer() {
+		running.store(false, std::memory_order_release);
+		{
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			wake.notify_all();
+		}
+		thread.join();
+	}
+
+	AudioStream* AudioStreamer::open(const std::string& path, bool loop, const StreamSettings& settings) {
+		AudioStream* stream = nullptr;
+		for(std::unique_ptr<AudioStream>& candidate : streams) {
+			if(candidate->state.load(std::memory_order_acquire) == AudioStream::State::FREE) {
+				stream = candidate.get();
+				break;
+			}
+		}
+
+		if(stream == nullptr) {
+			std::cout << "AudioStreamer: every stream is in use, cannot open " << path << std::endl;
+			return nullptr;
+		}
+
+		if(!stream->reader.open(path)) {
+			return nullptr;
+		}
+		if(stream->reader.getFrameCount() == 0) {
+			std::cout << "AudioStreamer: " << path << " has no frames to stream" << std::endl;
+			stream->reader.close();
+			return nullptr;
+		}
+
+		StreamSettings& tuned = stream->settings;
+		tuned = settings;
+		tuned.chunkFrames = tuned.chunkFrames < MIN_STREAM_CHUNK_FRAMES ? MIN_STREAM_CHUNK_FRAMES : tuned.chunkFrames;
+		tuned.bufferCount = tuned.bufferCount < 2 ? 2 : (tuned.bufferCount > MAX_STREAM_BUFFERS ? MAX_STREAM_BUFFERS : tuned.bufferCount);
+		tuned.prefetchChunks = tuned.prefetchChunks < 0 ? 0 : tuned.prefetchChunks;
+
+		stream->loop = loop;
+		stream->chunkCount = ((int64_t)stream->reader.getFrameCount() + tuned.chunkFrames - 1) / tuned.chunkFrames;
+		stream->chunks.reset(new AudioStream::Chunk[tuned.bufferCount]);
+		for(int c = 0; c < tuned.bufferCount; c++) {
+			stream->chunks[c].data.resize((size_t)tuned.chunkFrames * stream->reader.getFormat().frameSize);
+		}
+		stream->underruns.store(0, std::memory_order_relaxed);
+		stream->hintedChunk = -1;
+		stream->setPosition(0);
+
+		stream->state.store(AudioStream::State::ACTIVE, std::memory_order_release);
+		wake.notify_one();
+		return stream;
+	}
+
+	int AudioStreamer::getOpenStreamCount() const {
+		int count = 0;
+		for(const std::unique_ptr<AudioStream>& stream : streams) {
+			if(stream->state.load(std::memory_order_relaxed) == AudioStream::State::ACTIVE) {
+				count++;
+			}
+		}
+		return count;
+	}
+
+	void AudioStreamer::diskLoop() {
+		while(running.load(std::memory_order_acquire)) {
+			bool loaded = false;
+
+			for(std::unique_ptr<AudioStream>& stream : streams) {
+				AudioStream::State state = stream->state.load(std::memory_order_acquire);
+				if(state == AudioStream::State::ACTIVE) {
+					loaded = service(*stream) || loaded;
+				}
+				else if(state == AudioStream::State::CLOSING) {
+					stream->reader.close();
+					stream->chunks.reset();
+					stream->state.store(AudioStream::State::FREE, std::memory_order_release);
+				}
+			}
+
+			// Go straight round again after a load, the streams may need more.
+			if(!loaded) {
+				std::unique_lock<std::mutex> lock(wakeMutex);
+				wake.wait_for(lock, std::chrono::milliseconds(2));
+			}
+		}
+	}
+
+	bool AudioStreamer::service(AudioStream& stream) {
+		const StreamSettings& settings = stream.settings;
+
+		// The chunks to keep, from the one being played onwards.
+		int64_t window[MAX_STREAM_BUFFERS];
+		int windowSize = 0;
+		int64_t index = stream.neededChunk.load(std::memory_order_acquire);
+		while(index >= 0 && windowSize < settings.bufferCount) {
+			// A looped clip shorter than the buffers comes round again.
+			bool repeated = false;
+			for(int w = 0; w < windowSize; w++) {
+				repeated = repeated || window[w] == index;
+			}
+			if(repeated) break;
+
+			window[windowSize++] = index;
+			index = stream.nextChunk(index);
+		}
+
+		for(int w = 0; w < windowSize; w++) {
+			AudioStream::Chunk* spare = nullptr;
+			bool held = false;
+			for(int c = 0; c < settings.bufferCount && !held; c++) {
+				AudioStream::Chunk& chunk = stream.chunks[c];
+				int64_t holding = chunk.index.load(std::memory_order_relaxed);
+				held = holding == window[w];
+
+				bool needed = false;
+				for(int n = 0; n < windowSize; n++) {
+					needed = needed || window[n] == holding;
+				}
+				if(!needed && spare == nullptr) {
+					spare = &chunk;
+				}
+			}
+
+			if(held || spare == nullptr) continue;
+
+			// One chunk at a time, nearest first, then the position is read again.
+			load(stream, *spare, window[w]);
+			return true;
+		}
+
+		// Everything buffered, ask the OS to start on the chunks after it.
+		if(settings.prefetchChunks > 0 && index >= 0 && index != stream.hintedChunk) {
+			stream.hintedChunk = index;
+			for(int p = 0; p < settings.prefetchChunks && index >= 0; p++) {
+				stream.reader.prefetchFrames((size_t)index * settings.chunkFrames, settings.chunkFrames);
+				index = stream.nextChunk(index);
+			}
+
+			// A clip that does not loop will not need the pages before the window again.
+			if(!stream.loop && window[0] > 0) {
+				stream.reader.releaseFrames(0, (size_t)window[0] * settings.chunkFrames);
+			}
+		}
+		return false;
+	}
+
+	void AudioStreamer::load(AudioStream& stream, AudioStream::Chunk& chunk, int64_t index) {
+		const int frameSize = stream.reader.getFormat().frameSize;
+		FrameView view = stream.reader.getFrames((size_t)index * stream.settings.chunkFrames, stream.settings.chunkFrames);
+
+		// Readers check the index again after copying, so clear it before touching the data.
+		chunk.index.store(-1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(chunk.data.data(), view.data, view.frameCount * frameSize);
+		chunk.index.store(index, std::memory_order_release);
+
+		chunksLoaded.fetch_add(1, std::memory_order_relaxed);
+	}
+};
@@ -0,0 +1,196 @@
+#include "pch.h"
+
+#include "includes/AudioWorkers.h"
+
+#include <chrono>
+
+#include "includes/ScratchArena.h"
+#include "Bitmaths.h"
+
+#ifdef BANSHEE_X86
+#include <immintrin.h>
+#endif
+
+namespace Banshee {
+
+	// Pause iterations a helper spins for after a run before it goes to sleep, roughly 100 us.
+	constexpr int HELPER_SPIN = 4000;
+
+	static inline void cpuRelax() {
+#ifdef BANSHEE_X86
+		_mm_pause();
+#else
+		std::this_thread::yield();
+#endif
+	}
+
+	TaskDeque::TaskDeque(size_t capacity) {
+		size_t size = 2;
+		while(size < capacity) {
+			size <<= 1;
+		}
+		tasks.reset(new std::atomic<uint32_t>[size]);
+		mask = (int64_t)size - 1;
+	}
+
+	bool TaskDeque::push(uint32_t task) {
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+		if(b - t > mask) {
+			return false;
+		}
+
+		tasks[b & mask].store(task, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	uint32_t TaskDeque::pop() {
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+
+		if(t > b) {
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return EMPTY;
+		}
+
+		uint32_t task = tasks[b & mask].load(std::memory_order_relaxed);
+		if(t == b) {
+			// Last task, race the thieves for it.
+			if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+				task = EMPTY;
+			}
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return task;
+	}
+
+	uint32_t TaskDeque::steal() {
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+		if(t >= b) {
+			return EMPTY;
+		}
+
+		uint32_t task = tasks[t & mask].load(std::memory_order_relaxed);
+		if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+			return EMPTY;
+		}
+		return task;
+	}
+
+	AudioWorkerPool::AudioWorkerPool(int helperThreads, int maxReadyTasks) {
+		if(helperThreads < 0) {
+			helperThreads = 0;
+		}
+
+		for(int i = 0; i <= helperThreads; i++) {
+			deques.emplace_back(new TaskDeque(maxReadyTasks));
+		}
+
+		running.store(true, std::memory_order_release);
+		for(int i = 1; i <= helperThreads; i++) {
+			helpers.emplace_back(&AudioWorkerPool::helperLoop, this, i);
+		}
+	}
+
+	AudioWorkerPool::~AudioWorkerPool() {
+		running.store(false, std::memory_order_release);
+		{
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			wake.notify_all();
+		}
+		for(std::thread& helper : helpers) {
+			helper.join();
+		}
+	}
+
+	void AudioWorkerPool::run(const uint32_t* ready, int readyCount, int taskCount, TaskCallback taskCallback, void* user) {
+		if(taskCount <= 0) return;
+
+		callback = taskCallback;
+		userData = user;
+		remaining.store(taskCount, std::memory_order_relaxed);
+
+		TaskDeque& own = *deques[0];
+		for(int i = 0; i < readyCount; i++) {
+			if(!own.push(ready[i])) {
+				execute(ready[i], 0);
+			}
+		}
+
+		if(!helpers.empty()) {
+			generation.fetch_add(1, std::memory_order_release);
+			// Like the reverb worker, the audio thread does not take the lock. A helper that
+			// misses the notification wakes from its timeout.
+			if(sleeping.load(std::memory_order_acquire) > 0) {
+				wake.notify_all();
+			}
+		}
+
+		work(0);
+	}
+
+	void AudioWorkerPool::push(int worker, uint32_t task) {
+		if(!deques[worker]->push(task)) {
+			execute(task, worker);
+		}
+	}
+
+	void AudioWorkerPool::execute(uint32_t task, int worker) {
+		callback(task, worker, userData);
+		remaining.fetch_sub(1, std::memory_order_acq_rel);
+	}
+
+	void AudioWorkerPool::work(int worker) {
+		const int workers = (int)deques.size();
+		int victim = worker;
+
+		while(remaining.load(std::memory_order_acquire) > 0) {
+			uint32_t task = deques[worker]->pop();
+
+			// Own deque is empty, try everyone else once starting after the last victim.
+			for(int i = 1; task == TaskDeque::EMPTY && i < workers; i++) {
+				victim = (victim + 1) % workers;
+				if(victim != worker) {
+					task = deques[victim]->steal();
+				}
+			}
+
+			if(task == TaskDeque::EMPTY) {
+				cpuRelax();
+				continue;
+			}
+
+			execute(task, worker);
+		}
+	}
+
+	void AudioWorkerPool::helperLoop(int worker) {
+		uint32_t seen = generation.load(std::memory_order_acquire);
+
+		while(running.load(std::memory_order_acquire)) {
+			int spins = 0;
+			while(generation.load(std::memory_order_acquire) == seen && running.load(std::memory_order_relaxed)) {
+				if(spins < HELPER_SPIN) {
+					spins++;
+					cpuRelax();
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lock(wakeMutex);
+				sleeping.fetch_add(1, std::memory_order_acq_rel);
+				wake.wait_for(lock, std::chrono::milliseconds(1));
+				sleeping.fetch_sub(1, std::memory_order_acq_rel);
+			}
+
+			seen = generation.load(std::memory_order_acquire);
+			AudioThreadScope scope;
+			work(worker);
+		}
+	}
+};
@@ -0,0 +1,184 @@
+#include "pch.h"
+
+#include "includes/BiquadBank.h"
+
+#include <cmath>
+#include <cstring>
+
+#include "Bitmaths.h"
+
+namespace Banshee {
+
+	// Coefficient and state rows of one lane group.
+	constexpr int COEFFICIENT_ROWS = 10;
+	constexpr int STATE_ROWS = 2;
+
+	// State below this (about -300 dB) is flushed to zero after every block. Left alone a silent
+	// filter decays into denormals, which are many times slower to compute on x86.
+	constexpr float DENORMAL_THRESHOLD = 1e-15f;
+
+	BiquadCoefficients BiquadCoefficients::design(FilterType type, float frequency, float q, float gainDb, int sampleRate) {
+		BiquadCoefficients result;
+		if(type == FilterType::NONE || sampleRate <= 0) {
+			return result;
+		}
+
+		double nyquist = sampleRate * 0.5;
+		double f = frequency < 1.0 ? 1.0 : (frequency > nyquist * 0.99 ? nyquist * 0.99 : (double)frequency);
+		double w0 = 2.0 * PI_d * f / sampleRate;
+		double cosw = cos(w0);
+		double alpha = sin(w0) / (2.0 * (q > 0.01f ? q : 0.01f));
+		double A = pow(10.0, gainDb / 40.0);
+
+		double b0 = 1.0, b1 = 0.0, b2 = 0.0;
+		double a0 = 1.0, a1 = 0.0, a2 = 0.0;
+
+		switch(type) {
+		case FilterType::LOW_PASS:
+			b0 = (1.0 - cosw) * 0.5;
+			b1 = 1.0 - cosw;
+			b2 = b0;
+			a0 = 1.0 + alpha;
+			a1 = -2.0 * cosw;
+			a2 = 1.0 - alpha;
+			break;
+		case FilterType::HIGH_PASS:
+			b0 = (1.0 + cosw) * 0.5;
+			b1 = -(1.0 + cosw);
+			b2 = b0;
+			a0 = 1.0 + alpha;
+			a1 = -2.0 * cosw;
+			a2 = 1.0 - alpha;
+			break;
+		case FilterType::BAND_PASS:
+			b0 = alpha;
+			b1 = 0.0;
+			b2 = -alpha;
+			a0 = 1.0 + alpha;
+			a1 = -2.0 * cosw;
+			a2 = 1.0 - alpha;
+			break;
+		case FilterType::PEAKING:
+			b0 = 1.0 + alpha * A;
+			b1 = -2.0 * cosw;
+			b2 = 1.0 - alpha * A;
+			a0 = 1.0 + alpha / A;
+			a1 = -2.0 * cosw;
+			a2 = 1.0 - alpha / A;
+			break;
+		case FilterType::LOW_SHELF: {
+			double root = 2.0 * sqrt(A) * alpha;
+			b0 = A * ((A + 1.0) - (A - 1.0) * cosw + root);
+			b1 = 2.0 * A * ((A - 1.0) - (A + 1.0) * cosw);
+			b2 = A * ((A + 1.0) - (A - 1.0) * cosw - root);
+			a0 = (A + 1.0) + (A - 1.0) * cosw + root;
+			a1 = -2.0 * ((A - 1.0) + (A + 1.0) * cosw);
+			a2 = (A + 1.0) + (A - 1.0) * cosw - root;
+			break;
+		}
+		case FilterType::HIGH_SHELF: {
+			double root = 2.0 * sqrt(A) * alpha;
+			b0 = A * ((A + 1.0) + (A - 1.0) * cosw + root);
+			b1 = -2.0 * A * ((A - 1.0) + (A + 1.0) * cosw);
+			b2 = A * ((A + 1.0) + (A - 1.0) * cosw - root);
+			a0 = (A + 1.0) - (A - 1.0) * cosw + root;
+			a1 = 2.0 * ((A - 1.0) - (A + 1.0) * cosw);
+			a2 = (A + 1.0) - (A - 1.0) * cosw - root;
+			break;
+		}
+		default:
+			return result;
+		}
+
+		result.b0 = (float)(b0 / a0);
+		result.b1 = (float)(b1 / a0);
+		result.b2 = (float)(b2 / a0);
+		result.a1 = (float)(a1 / a0);
+		result.a2 = (float)(a2 / a0);
+		return result;
+	}
+
+	BiquadBank::BiquadBank(int maxLanes, int frames) : frames(frames) {
+		int groups = (maxLanes + BIQUAD_LANES - 1) / BIQUAD_LANES;
+		this->maxLanes = groups * BIQUAD_LANES;
+
+		samples.resize((size_t)this->maxLanes * frames, 0.f);
+		spare.resize(frames, 0.f);
+		coefficients.resize((size_t)groups * COEFFICIENT_ROWS * BIQUAD_LANES, 0.f);
+		state.resize((size_t)groups * STATE_ROWS * BIQUAD_LANES, 0.f);
+	}
+
+	void BiquadBank::setLane(int lane, const BiquadCoefficients& from, const BiquadCoefficients& to, const BiquadState& laneState) {
+		const int L = BIQUAD_LANES;
+		float* c = &coefficients[(size_t)(lane / L) * COEFFICIENT_ROWS * L + lane % L];
+		float* z = &state[(size_t)(lane / L) * STATE_ROWS * L + lane % L];
+		const float scale = 1.f / frames;
+
+		// Frame i uses from + step * (i + 1), so the last frame lands on to.
+		c[0] = from.b0;
+		c[L] = from.b1;
+		c[L * 2] = from.b2;
+		c[L * 3] = from.a1;
+		c[L * 4] = from.a2;
+		c[L * 5] = (to.b0 - from.b0) * scale;
+		c[L * 6] = (to.b1 - from.b1) * scale;
+		c[L * 7] = (to.b2 - from.b2) * scale;
+		c[L * 8] = (to.a1 - from.a1) * scale;
+		c[L * 9] = (to.a2 - from.a2) * scale;
+
+		z[0] = laneState.z1;
+		z[L] = laneState.z2;
+	}
+
+	void BiquadBank::loadLane(int lane, const float* input) {
+		memcpy(&samples[(size_t)lane * frames], input, frames * sizeof(float));
+	}
+
+	BiquadState BiquadBank::storeLane(int lane, float* output) const {
+		memcpy(output, &samples[(size_t)lane * frames], frames * sizeof(float));
+
+		const float* z = &state[(size_t)(lane / BIQUAD_LANES) * STATE_ROWS * BIQUAD_LANES + lane % BIQUAD_LANES];
+		BiquadState result;
+		result.z1 = z[0];
+		result.z2 = z[BIQUAD_LANES];
+		return result;
+	}
+
+	void BiquadBank::process(int laneCount) {
+		if(laneCount > maxLanes) {
+			laneCount = maxLanes;
+		}
+
+		int groups = (laneCount + BIQUAD_LANES - 1) / BIQUAD_LANES;
+
+		// Unused lanes of the last group are still computed. They all share the spare buffer
+		// and get zero coefficients, so their output is silence that nobody reads.
+		for(int lane = laneCount; lane < groups * BIQUAD_LANES; lane++) {
+			float* c = &coefficients[(size_t)(lane / BIQUAD_LANES) * COEFFICIENT_ROWS * BIQUAD_LANES + lane % BIQUAD_LANES];
+			float* z = &state[(size_t)(lane / BIQUAD_LANES) * STATE_ROWS * BIQUAD_LANES + lane % BIQUAD_LANES];
+			for(int row = 0; row < COEFFICIENT_ROWS; row++) {
+				c[row * BIQUAD_LANES] = 0.f;
+			}
+			z[0] = 0.f;
+			z[BIQUAD_LANES] = 0.f;
+		}
+
+		const MixKernels& k = kernels();
+		float* channels[BIQUAD_LANES];
+		for(int g = 0; g < groups; g++) {
+			for(int l = 0; l < BIQUAD_LANES; l++) {
+				int lane = g * BIQUAD_LANES + l;
+				channels[l] = lane < laneCount ? &samples[(size_t)lane * frames] : spare.data();
+			}
+
+			float* z = &state[(size_t)g * STATE_ROWS * BIQUAD_LANES];
+			k.biquadLanes(channels, &coefficients[(size_t)g * COEFFICIENT_ROWS * BIQUAD_LANES], z, frames);
+
+			for(int i = 0; i < STATE_ROWS * BIQUAD_LANES; i++) {
+				if(fabsf(z[i]) < DENORMAL_THRESHOLD) {
+					z[i] = 0.f;
+				}
+			}
+		}
+	}
+};
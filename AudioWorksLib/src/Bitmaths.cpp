@@ -0,0 +1,1272 @@
+#include "pch.h"
+
+#include "Bitmaths.h"
+
+#include <cstring>
+
+#ifdef BANSHEE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace Banshee {
+
+	const int32_t ADPCM_STEP_TABLE[89] = {
+		7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+		50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+		337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+		2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+		15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+	};
+
+	const int32_t ADPCM_INDEX_TABLE[16] = {
+		-1, -1, -1, -1, 2, 4, 6, 8,
+		-1, -1, -1, -1, 2, 4, 6, 8
+	};
+
+	// Scalar reference kernels. Used on CPUs without SSE2 and for the tails of the SIMD loops.
+
+	static void mixGainScalar(float* BANSHEE_RESTRICT dst, const float* BANSHEE_RESTRICT src, float gain, size_t count) {
+		for(size_t i = 0; i < count; i++) {
+			dst[i] += src[i] * gain;
+		}
+	}
+
+	static void panMonoScalar(float* BANSHEE_RESTRICT dst, const float* BANSHEE_RESTRICT src, float gainL, float gainR, float stepL, float stepR, size_t frames) {
+		for(size_t i = 0; i < frames; i++) {
+			float n = (float)(i + 1);
+			dst[i * 2] += src[i] * (gainL + stepL * n);
+			dst[i * 2 + 1] += src[i] * (gainR + stepR * n);
+		}
+	}
+
+	static void panStereoScalar(float* BANSHEE_RESTRICT dst, const float* BANSHEE_RESTRICT left, const float* BANSHEE_RESTRICT right, float gainL, float gainR, float stepL, float stepR, size_t frames) {
+		for(size_t i = 0; i < frames; i++) {
+			float n = (float)(i + 1);
+			dst[i * 2] += left[i] * (gainL + stepL * n);
+			dst[i * 2 + 1] += right[i] * (gainR + stepR * n);
+		}
+	}
+
+	static void gainRampStereoScalar(float* buffer, float gain, float step, size_t frames) {
+		for(size_t i = 0; i < frames; i++) {
+			float g = gain + step * (float)(i + 1);
+			buffer[i * 2] *= g;
+			buffer[i * 2 + 1] *= g;
+		}
+	}
+
+	static void s16ToFloatScalar(float* BANSHEE_RESTRICT dst, const int16_t* BANSHEE_RESTRICT src, size_t count) {
+		for(size_t i = 0; i < count; i++) {
+			dst[i] = src[i] * (1.f / 32768.f);
+		}
+	}
+
+	static void s24ToFloatScalar(float* BANSHEE_RESTRICT dst, const uint8_t* BANSHEE_RESTRICT src, size_t count) {
+		for(size_t i = 0; i < count; i++) {
+			const uint8_t* p = src + i * 3;
+			// Place the 3 bytes at the top of an int so the shift sign extends.
+			int32_t s = (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24)) >> 8;
+			dst[i] = s * (1.f / 8388608.f);
+		}
+	}
+
+	static inline uint32_t xorshift32(uint32_t x) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		return x;
+	}
+
+	// Maps the top 23 bits of a random number to [0, 1).
+	static inline float unitFloat(uint32_t x) {
+		uint32_t bits = (x >> 9) | 0x3F800000;
+		float f;
+		memcpy(&f, &bits, 4);
+		return f - 1.f;
+	}
+
+	static void floatToS16DitherScalar(int16_t* BANSHEE_RESTRICT dst, const float* BANSHEE_RESTRICT src, size_t count, uint32_t* state) {
+		uint32_t seed = *state ? *state : 0x12345678u;
+
+		for(size_t i = 0; i < count; i++) {
+			seed = xorshift32(seed);
+			float r1 = unitFloat(seed);
+			seed = xorshift32(seed);
+			float r2 = unitFloat(seed);
+
+			// Difference of two uniform values gives triangular noise of +-1 LSB.
+			float v = src[i] * 32767.f + (r1 - r2);
+			v = v < -32768.f ? -32768.f : (v > 32767.f ? 32767.f : v);
+			dst[i] = (int16_t)(v < 0.f ? v - 0.5f : v + 0.5f);
+		}
+
+		*state = seed;
+	}
+
+	// Linear interpolation between the two table rows either side of the fractional position.
+	// A fraction just below 1 can round up to the last row, which has no row after it, so the
+	// index stops one short and interpolates all the way instead.
+	static inline const float* sincRow(const float* table, int phases, double frac, float& alpha) {
+		double row = frac * phases;
+		int index = (int)row;
+		if(index >= phases) {
+			index = phases - 1;
+			alpha = 1.f;
+		}
+		else {
+			alpha = (float)(row - (double)index);
+		}
+		return table + index * SINC_KERNEL_TAPS;
+	}
+
+	static void sincResampleScalar(float* BANSHEE_RESTRICT dst, const float* BANSHEE_RESTRICT src, const float* BANSHEE_RESTRICT table, int phases,
+		double position, double step, double stepDelta, size_t frames) {
+		for(size_t i = 0; i < frames; i++) {
+			size_t base = (size_t)position;
+			float alpha;
+			const float* a = sincRow(table, phases, position - (double)base, alpha);
+			const float* b = a + SINC_KERNEL_TAPS;
+			const float* s = src + base;
+
+			float sum = 0.f;
+			for(int k = 0; k < SINC_KERNEL_TAPS; k++) {
+				sum += s[k] * (a[k] + alpha * (b[k] - a[k]));
+			}
+			dst[i] = sum;
+
+			position += step + stepDelta * (double)(i + 1);
+		}
+	}
+
+	static void spectrumMacScalar(float* BANSHEE_RESTRICT accRe, float* BANSHEE_RESTRICT accIm, const float* BANSHEE_RESTRICT aRe, const float* BANSHEE_RESTRICT aIm,
+		const float* BANSHEE_RESTRICT bRe, const float* BANSHEE_RESTRICT bIm, size_t count) {
+		for(size_t i = 0; i < count; i++) {
+			accRe[i] += aRe[i] * bRe[i] - aIm[i] * bIm[i];
+			accIm[i] += aRe[i] * bIm[i] + aIm[i] * bRe[i];
+		}
+	}
+
+	static void fftRadix4Scalar(float* BANSHEE_RESTRICT re, float* BANSHEE_RESTRICT im, const float* BANSHEE_RESTRICT twiddles, size_t quarter, size_t size) {
+		const float* w1r = twiddles;
+		const float* w1i = twiddles + quarter;
+		const float* w2r = twiddles + quarter * 2;
+		const float* w2i = twiddles + quarter * 3;
+
+		for(size_t base = 0; base < size; base += quarter * 4) {
+			float* r0 = re + base;
+			float* r1 = r0 + quarter;
+			float* r2 = r1 + quarter;
+			float* r3 = r2 + quarter;
+			float* i0 = im + base;
+			float* i1 = i0 + quarter;
+			float* i2 = i1 + quarter;
+			float* i3 = i2 + quarter;
+
+			for(size_t k = 0; k < quarter; k++) {
+				// Two radix-2 butterflies of half the size.
+				float br = r1[k] * w1r[k] - i1[k] * w1i[k];
+				float bi = r1[k] * w1i[k] + i1[k] * w1r[k];
+				float dr = r3[k] * w1r[k] - i3[k] * w1i[k];
+				float di = r3[k] * w1i[k] + i3[k] * w1r[k];
+
+				float ar = r0[k] + br;
+				float ai = i0[k] + bi;
+				br = r0[k] - br;
+				bi = i0[k] - bi;
+				float cr = r2[k] + dr;
+				float ci = i2[k] + di;
+				dr = r2[k] - dr;
+				di = i2[k] - di;
+
+				// Combine them, the odd outputs use W(4 * quarter)^(k + quarter) = -i * W(4 * quarter)^k.
+				float tr = cr * w2r[k] - ci * w2i[k];
+				float ti = cr * w2i[k] + ci * w2r[k];
+				float ur = dr * w2r[k] - di * w2i[k];
+				float ui = dr * w2i[k] + di * w2r[k];
+
+				r0[k] = ar + tr;
+				i0[k] = ai + ti;
+				r2[k] = ar - tr;
+				i2[k] = ai - ti;
+				r1[k] = br + ui;
+				i1[k] = bi - ur;
+				r3[k] = br - ui;
+				i3[k] = bi + ur;
+			}
+		}
+	}
+
+	static void biquadLanesScalar(float* const* channels, const float* BANSHEE_RESTRICT coefficients, float* BANSHEE_RESTRICT state, size_t frames) {
+		const int L = BIQUAD_LANES;
+		for(int l = 0; l < L; l++) {
+			float* samples = channels[l];
+			float b0 = coefficients[l];
+			float b1 = coefficients[L + l];
+			float b2 = coefficients[L * 2 + l];
+			float a1 = coefficients[L * 3 + l];
+			float a2 = coefficients[L * 4 + l];
+			const float* step = coefficients + L * 5;
+			float z1 = state[l];
+			float z2 = state[L + l];
+
+			for(size_t i = 0; i < frames; i++) {
+				b0 += step[l];
+				b1 += step[L + l];
+				b2 += step[L * 2 + l];
+				a1 += step[L * 3 + l];
+				a2 += step[L * 4 + l];
+
+				float x = samples[i];
+				float y = b0 * x + z1;
+				z1 = b1 * x - a1 * y + z2;
+				z2 = b2 * x - a2 * y;
+				samples[i] = y;
+			}
+
+			state[l] = z1;
+			state[L + l] = z2;
+		}
+	}
+
+	static void adpcmDecodeScalar(float* BANSHEE_RESTRICT dst, const uint8_t* const* blocks, size_t count) {
+		for(size_t b = 0; b < count; b++) {
+			const uint8_t* block = blocks[b];
+			int predictor = (int16_t)(block[0] | (block[1] << 8));
+			int index = block[2] > 88 ? 88 : block[2];
+			float* out = dst + b * ADPCM_BLOCK_FRAMES;
+
+			for(int i = 0; i < ADPCM_BLOCK_FRAMES; i++) {
+				// Low nibble first.
+				int nibble = (block[4 + i / 2] >> ((i & 1) * 4)) & 15;
+				int step = ADPCM_STEP_TABLE[index];
+				int diff = step >> 3;
+				if(nibble & 4) diff += step;
+				if(nibble & 2) diff += step >> 1;
+				if(nibble & 1) diff += step >> 2;
+
+				predictor += nibble & 8 ? -diff : diff;
+				predictor = predictor > 32767 ? 32767 : (predictor < -32768 ? -32768 : predictor);
+				index += ADPCM_INDEX_TABLE[nibble];
+				index = index < 0 ? 0 : (index > 88 ? 88 : index);
+
+				out[i] = predictor * (1.f / 32768.f);
+			}
+		}
+	}
+
+	static const MixKernels scalarKernels = {
+		mixGainScalar,
+		panMonoScalar,
+		panStereoScalar,
+		gainRampStereoScalar,
+		s16ToFloatScalar,
+		s24ToFloatScalar,
+		floatToS16DitherScalar,
+		sincResampleScalar,
+		spectrumMacScalar,
+		fftRadix4Scalar,
+		biquadLanesScalar,
+		adpcmDecodeScalar
+	};
+
+#ifdef BANSHEE_X86
+
+	// SSE2 kernels, 4 lanes.
+
+	static void mixGainSSE2(float* BANSHEE_RESTRICT dst, const float* BANSHEE_RESTRICT src, float gain, size_t count) {
+		__m128 g = _mm_set1_ps(gain);
+		size_t i = 0;
+		for(; i + 8 <= count; i += 8) {
+			__m128 a = _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), g));
+			__m128 b = _mm_add_ps(_mm_loadu_ps(dst + i + 4), _mm_mul_ps(_mm_loadu_ps(src + i + 4), g));
+			_mm_storeu_ps(dst + i, a);
+			_mm_storeu_ps(dst + i + 4, b);
+		}
+		mixGainScalar(dst + i, src + i, gain, count - i);
+	}
+
+	static void panMonoSSE2(float* BANSHEE_RESTRICT dst, const float* BANSHEE_RESTRICT src, float gainL, float gainR, float stepL, float stepR, size_t frames) {
+		__m128 baseL = _mm_set1_ps(gainL);
+		__m128 baseR = _mm_set1_ps(gainR);
+		__m128 slopeL = _mm_set1_ps(stepL);
+		__m128 slopeR = _mm_set1_ps(stepR);
+		__m128 index = _mm_setr_ps(1.f, 2.f, 3.f, 4.f);
+		const __m128 four = _mm_set1_ps(4.f);
+
+		size_t i = 0;
+		for(; i + 4 <= frames; i += 4) {
+			__m128 s = _mm_loadu_ps(src + i);
+			__m128 gl = _mm_add_ps(baseL, _mm_mul_ps(slopeL, index));
+			__m128 gr = _mm_add_ps(baseR, _mm_mul_ps(slopeR, index));
+
+			// s0 s0 s1 s1 * gl0 gr0 gl1 gr1
+			__m128 lo = _mm_mul_ps(_mm_unpacklo_ps(s, s), _mm_unpacklo_ps(gl, gr));
+			__m128 hi = _mm_mul_ps(_mm_unpackhi_ps(s, s), _mm_unpackhi_ps(gl, gr));
+
+			_mm_storeu_ps(dst + i * 2, _mm_add_ps(_mm_loadu_ps(dst + i * 2), lo));
+			_mm_storeu_ps(dst + i * 2 + 4, _mm_add_ps(_mm_loadu_ps(dst + i * 2 + 4), hi));
+
+			index = _mm_add_ps(index, four);
+		}
+
+		float n = (float)i;
+		panMonoScalar(dst + i * 2, src + i, gainL + stepL * n, gainR + stepR * n, stepL, stepR, frames - i);
+	}
+
+	static void panStereoSSE2(float* BANSHEE_RESTRICT dst, const float* BANSHEE_RESTRICT left, const float* BANSHEE_RESTRICT right, float gainL, float gainR, float stepL, float stepR, size_t frames) {
+		__m128 baseL = _mm_set1_ps(gainL);
+		__m128 baseR = _mm_set1_ps(gainR);
+		__m128 slopeL = _mm_set1_ps(stepL);
+		__m128 slopeR = _mm_set1_ps(stepR);
+		__m128 index = _mm_setr_ps(1.f, 2.f, 3.f, 4.f);
+		const __m128 four = _mm_set1_ps(4.f);
+
+		size_t i = 0;
+		for(; i + 4 <= frames; i += 4) {
+			__m128 l = _mm_mul_ps(_mm_loadu_ps(left + i), _mm_add_ps(baseL, _mm_mul_ps(slopeL, index)));
+			__m128 r = _mm_mul_ps(_mm_loadu_ps(right + i), _mm_add_ps(baseR, _mm_mul_ps(slopeR, index)));
+
+			// Interleave back to l0 r0 l1 r1.
+			__m128 lo = _mm_unpacklo_ps(l, r);
+			__m128 hi = _mm_unpackhi_ps(l, r);
+
+			_mm_storeu_ps(dst + i * 2, _mm_add_ps(_mm_loadu_ps(dst + i * 2), lo));
+			_mm_storeu_ps(dst + i * 2 + 4, _mm_add_ps(_mm_loadu_ps(dst + i * 2 + 4), hi));
+
+			index = _mm_add_ps(index, four);
+		}
+
+		float n = (float)i;
+		panStereoScalar(dst + i * 2, left + i, right + i, gainL + stepL * n, gainR + stepR * n, stepL, stepR, frames - i);
+	}
+
+	static void gainRampStereoSSE2(float* buffer, float gain, float step, size_t frames) {
+		__m128 base = _mm_set1_ps(gain);
+		__m128 slope = _mm_set1_ps(step);
+		__m128 index = _mm_setr_ps(1.f, 1.f, 2.f, 2.f);
+		const __m128 two = _mm_set1_ps(2.f);
+
+		size_t i = 0;
+		for(; i + 2 <= frames; i += 2) {
+			__m128 g = _mm_add_ps(base, _mm_mul_ps(slope, index));
+			_mm_storeu_ps(buffer + i * 2, _mm_mul_ps(_mm_loadu_ps(buffer + i * 2), g));
+			index = _mm_add_ps(index, two);
+		}
+
+		gainRampStereoScalar(buffer + i * 2, gain + step * (float)i, step, frames - i);
+	}
+
+	static void s16ToFloatSSE2(float* BANSHEE_RESTRICT dst, const int16_t* BANSHEE_RESTRICT src, size_t count) {
+		const __m128 scale = _mm_set1_ps(1.f / 32768.f);
+
+		size_t i = 0;
+		for(; i + 8 <= count; i += 8) {
+			__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+			// Duplicating each value into both halves and shifting down sign extends to 32 bits.
+			__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+			__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+			_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+			_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+		}
+
+		s16ToFloatScalar(dst + i, src + i, count - i);
+	}
+
+	static inline int32_t loadU32(const uint8_t* p) {
+		int32_t v;
+		memcpy(&v, p, 4);
+		return v;
+	}
+
+	static void s24ToFloatSSE2(float* BANSHEE_RESTRICT dst, const uint8_t* BANSHEE_RESTRICT src, size_t count) {
+		const __m128 scale = _mm_set1_ps(1.f / 8388608.f);
+
+		// Each 4 byte load reads one byte past its sample, stop early enough to stay inside the buffer.
+		size_t i = 0;
+		for(; i + 5 <= count; i += 4) {
+			const uint8_t* p = src + i * 3;
+			__m128i v = _mm_setr_epi32(loadU32(p), loadU32(p + 3), loadU32(p + 6), loadU32(p + 9));
+			v = _mm_srai_epi32(_mm_slli_epi32(v, 8), 8);
+			_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+		}
+
+		s24ToFloatScalar(dst + i, src + i * 3, count - i);
+	}
+
+	// xorshift32 on every lane.
+	static inline __m128i xorshiftSSE2(__m128i x) {
+		x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+		x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+		x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+		return x;
+	}
+
+	static inline __m128 unitFloatSSE2(__m128i x) {
+		__m128i bits = _mm_or_si128(_mm_srli_epi32(x, 9), _mm_set1_epi32(0x3F800000));
+		return _mm_sub_ps(_mm_castsi128_ps(bits), _mm_set1_ps(1.f));
+	}
+
+	static void floatToS16DitherSSE2(int16_t* BANSHEE_RESTRICT dst, const float* BANSHEE_RESTRICT src, size_t count, uint32_t* state) {
+		uint32_t seed = *state ? *state : 0x12345678u;
+
+		// Every lane runs its own generator seeded from the shared state.
+		__m128i rng = _mm_xor_si128(_mm_set1_epi32((int)seed), _mm_setr_epi32(0, (int)0x9E3779B9, (int)0x3C6EF372, (int)0xDAA66D2B));
+		const __m128 scale = _mm_set1_ps(32767.f);
+		const __m128 low = _mm_set1_ps(-32768.f);
+		const __m128 high = _mm_set1_ps(32767.f);
+
+		size_t i = 0;
+		for(; i + 8 <= count; i += 8) {
+			__m128 v[2];
+			for(int k = 0; k < 2; k++) {
+				rng = xorshiftSSE2(rng);
+				__m128 r1 = unitFloatSSE2(rng);
+				rng = xorshiftSSE2(rng);
+				__m128 r2 = unitFloatSSE2(rng);
+
+				__m128 x = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src + i + k * 4), scale), _mm_sub_ps(r1, r2));
+				v[k] = _mm_min_ps(_mm_max_ps(x, low), high);
+			}
+
+			// Round to nearest and saturate to 16 bits.
+			__m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(v[0]), _mm_cvtps_epi32(v[1]));
+			_mm_storeu_si128((__m128i*)(dst + i), packed);
+		}
+
+		seed = (uint32_t)_mm_cvtsi128_si32(rng);
+		floatToS16DitherScalar(dst + i, src + i, count - i, &seed);
+		*state = seed;
+	}
+
+	static inline float horizontalSum(__m128 v) {
+		__m128 pair = _mm_add_ps(v, _mm_movehl_ps(v, v));
+		return _mm_cvtss_f32(_mm_add_ss(pair, _mm_shuffle_ps(pair, pair, 0x55)));
+	}
+
+	static void sincResampleSSE2(float* BANSHEE_RESTRICT dst, const float* BANSHEE_RESTRICT src, const float* BANSHEE_RESTRICT table, int phases,
+		double position, double step, double stepDelta, size_t frames) {
+		for(size_t i = 0; i < frames; i++) {
+			size_t base = (size_t)position;
+			float alpha;
+			const float* a = sincRow(table, phases, position - (double)base, alpha);
+			const float* b = a + SINC_KERNEL_TAPS;
+			const float* s = src + base;
+			__m128 w = _mm_set1_ps(alpha);
+
+			__m128 sum = _mm_setzero_ps();
+			for(int k = 0; k < SINC_KERNEL_TAPS; k += 4) {
+				__m128 ca = _mm_loadu_ps(a + k);
+				__m128 coef = _mm_add_ps(ca, _mm_mul_ps(w, _mm_sub_ps(_mm_loadu_ps(b + k), ca)));
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(s + k), coef));
+			}
+			dst[i] = horizontalSum(sum);
+
+			position += step + stepDelta * (double)(i + 1);
+		}
+	}
+
+	static void spectrumMacSSE2(float* BANSHEE_RESTRICT accRe, float* BANSHEE_RESTRICT accIm, const float* BANSHEE_RESTRICT aRe, const float* BANSHEE_RESTRICT aIm,
+		const float* BANSHEE_RESTRICT bRe, const float* BANSHEE_RESTRICT bIm, size_t count) {
+		size_t i = 0;
+		for(; i + 4 <= count; i += 4) {
+			__m128 ar = _mm_loadu_ps(aRe + i);
+			__m128 ai = _mm_loadu_ps(aIm + i);
+			__m128 br = _mm_loadu_ps(bRe + i);
+			__m128 bi = _mm_loadu_ps(bIm + i);
+			__m128 re = _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+			__m128 im = _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+			_mm_storeu_ps(accRe + i, _mm_add_ps(_mm_loadu_ps(accRe + i), re));
+			_mm_storeu_ps(accIm + i, _mm_add_ps(_mm_loadu_ps(accIm + i), im));
+		}
+		spectrumMacScalar(accRe + i, accIm + i, aRe + i, aIm + i, bRe + i, bIm + i, count - i);
+	}
+
+	static void fftRadix4SSE2(float* BANSHEE_RESTRICT re, float* BANSHEE_RESTRICT im, const float* BANSHEE_RESTRICT twiddles, size_t quarter, size_t size) {
+		if(quarter % 4 != 0) {
+			fftRadix4Scalar(re, im, twiddles, quarter, size);
+			return;
+		}
+
+		const float* w1r = twiddles;
+		const float* w1i = twiddles + quarter;
+		const float* w2r = twiddles + quarter * 2;
+		const float* w2i = twiddles + quarter * 3;
+
+		for(size_t base = 0; base < size; base += quarter * 4) {
+			float* r0 = re + base;
+			float* r1 = r0 + quarter;
+			float* r2 = r1 + quarter;
+			float* r3 = r2 + quarter;
+			float* i0 = im + base;
+			float* i1 = i0 + quarter;
+			float* i2 = i1 + quarter;
+			float* i3 = i2 + quarter;
+
+			for(size_t k = 0; k < quarter; k += 4) {
+				__m128 wr = _mm_loadu_ps(w1r + k);
+				__m128 wi = _mm_loadu_ps(w1i + k);
+				__m128 x1r = _mm_loadu_ps(r1 + k);
+				__m128 x1i = _mm_loadu_ps(i1 + k);
+				__m128 x3r = _mm_loadu_ps(r3 + k);
+				__m128 x3i = _mm_loadu_ps(i3 + k);
+
+				__m128 br = _mm_sub_ps(_mm_mul_ps(x1r, wr), _mm_mul_ps(x1i, wi));
+				__m128 bi = _mm_add_ps(_mm_mul_ps(x1r, wi), _mm_mul_ps(x1i, wr));
+				__m128 dr = _mm_sub_ps(_mm_mul_ps(x3r, wr), _mm_mul_ps(x3i, wi));
+				__m128 di = _mm_add_ps(_mm_mul_ps(x3r, wi), _mm_mul_ps(x3i, wr));
+
+				__m128 x0r = _mm_loadu_ps(r0 + k);
+				__m128 x0i = _mm_loadu_ps(i0 + k);
+				__m128 x2r = _mm_loadu_ps(r2 + k);
+				__m128 x2i = _mm_loadu_ps(i2 + k);
+
+				__m128 ar = _mm_add_ps(x0r, br);
+				__m128 ai = _mm_add_ps(x0i, bi);
+				br = _mm_sub_ps(x0r, br);
+				bi = _mm_sub_ps(x0i, bi);
+				__m128 cr = _mm_add_ps(x2r, dr);
+				__m128 ci = _mm_add_ps(x2i, di);
+				dr = _mm_sub_ps(x2r, dr);
+				di = _mm_sub_ps(x2i, di);
+
+				wr = _mm_loadu_ps(w2r + k);
+				wi = _mm_loadu_ps(w2i + k);
+				__m128 tr = _mm_sub_ps(_mm_mul_ps(cr, wr), _mm_mul_ps(ci, wi));
+				__m128 ti = _mm_add_ps(_mm_mul_ps(cr, wi), _mm_mul_ps(ci, wr));
+				__m128 ur = _mm_sub_ps(_mm_mul_ps(dr, wr), _mm_mul_ps(di, wi));
+				__m128 ui = _mm_add_ps(_mm_mul_ps(dr, wi), _mm_mul_ps(di, wr));
+
+				_mm_storeu_ps(r0 + k, _mm_add_ps(ar, tr));
+				_mm_storeu_ps(i0 + k, _mm_add_ps(ai, ti));
+				_mm_storeu_ps(r2 + k, _mm_sub_ps(ar, tr));
+				_mm_storeu_ps(i2 + k, _mm_sub_ps(ai, ti));
+				_mm_storeu_ps(r1 + k, _mm_add_ps(br, ui));
+				_mm_storeu_ps(i1 + k, _mm_sub_ps(bi, ur));
+				_mm_storeu_ps(r3 + k, _mm_sub_ps(br, ui));
+				_mm_storeu_ps(i3 + k, _mm_add_ps(bi, ur));
+			}
+		}
+	}
+
+	// Coefficients, steps and state of 4 biquad lanes.
+	struct BiquadSSE2 {
+		__m128 b0, b1, b2, a1, a2;
+		__m128 d0, d1, d2, e1, e2;
+		__m128 z1, z2;
+	};
+
+	static inline __m128 biquadStepSSE2(BiquadSSE2& f, __m128 x) {
+		f.b0 = _mm_add_ps(f.b0, f.d0);
+		f.b1 = _mm_add_ps(f.b1, f.d1);
+		f.b2 = _mm_add_ps(f.b2, f.d2);
+		f.a1 = _mm_add_ps(f.a1, f.e1);
+		f.a2 = _mm_add_ps(f.a2, f.e2);
+
+		__m128 y = _mm_add_ps(_mm_mul_ps(f.b0, x), f.z1);
+		f.z1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(f.b1, x), _mm_mul_ps(f.a1, y)), f.z2);
+		f.z2 = _mm_sub_ps(_mm_mul_ps(f.b2, x), _mm_mul_ps(f.a2, y));
+		return y;
+	}
+
+	static void biquadLanesSSE2(float* const* channels, const float* BANSHEE_RESTRICT coefficients, float* BANSHEE_RESTRICT state, size_t frames) {
+		const int L = BIQUAD_LANES;
+
+		// Two halves of 4 lanes, each its own dependency chain so they overlap in the pipeline.
+		BiquadSSE2 f[2];
+		for(int h = 0; h < 2; h++) {
+			const float* c = coefficients + h * 4;
+			f[h].b0 = _mm_loadu_ps(c);
+			f[h].b1 = _mm_loadu_ps(c + L);
+			f[h].b2 = _mm_loadu_ps(c + L * 2);
+			f[h].a1 = _mm_loadu_ps(c + L * 3);
+			f[h].a2 = _mm_loadu_ps(c + L * 4);
+			f[h].d0 = _mm_loadu_ps(c + L * 5);
+			f[h].d1 = _mm_loadu_ps(c + L * 6);
+			f[h].d2 = _mm_loadu_ps(c + L * 7);
+			f[h].e1 = _mm_loadu_ps(c + L * 8);
+			f[h].e2 = _mm_loadu_ps(c + L * 9);
+			f[h].z1 = _mm_loadu_ps(state + h * 4);
+			f[h].z2 = _mm_loadu_ps(state + L + h * 4);
+		}
+
+		// 4 frames of 4 lanes at a time, transposed in registers so every lane keeps its planar buffer.
+		size_t i = 0;
+		for(; i + 4 <= frames; i += 4) {
+			for(int h = 0; h < 2; h++) {
+				float* const* c = channels + h * 4;
+				__m128 r0 = _mm_loadu_ps(c[0] + i);
+				__m128 r1 = _mm_loadu_ps(c[1] + i);
+				__m128 r2 = _mm_loadu_ps(c[2] + i);
+				__m128 r3 = _mm_loadu_ps(c[3] + i);
+				_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+				r0 = biquadStepSSE2(f[h], r0);
+				r1 = biquadStepSSE2(f[h], r1);
+				r2 = biquadStepSSE2(f[h], r2);
+				r3 = biquadStepSSE2(f[h], r3);
+
+				_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+				_mm_storeu_ps(c[0] + i, r0);
+				_mm_storeu_ps(c[1] + i, r1);
+				_mm_storeu_ps(c[2] + i, r2);
+				_mm_storeu_ps(c[3] + i, r3);
+			}
+		}
+
+		for(; i < frames; i++) {
+			for(int h = 0; h < 2; h++) {
+				float* const* c = channels + h * 4;
+				float y[4];
+				_mm_storeu_ps(y, biquadStepSSE2(f[h], _mm_setr_ps(c[0][i], c[1][i], c[2][i], c[3][i])));
+				for(int l = 0; l < 4; l++) {
+					c[l][i] = y[l];
+				}
+			}
+		}
+
+		for(int h = 0; h < 2; h++) {
+			_mm_storeu_ps(state + h * 4, f[h].z1);
+			_mm_storeu_ps(state + L + h * 4, f[h].z2);
+		}
+	}
+
+	// All 0 bits or all 1 bits in every lane, whether bit is set in it.
+	static inline __m128i bitMaskSSE2(__m128i v, int bit) {
+		__m128i b = _mm_set1_epi32(bit);
+		return _mm_cmpeq_epi32(_mm_and_si128(v, b), b);
+	}
+
+	static void adpcmDecodeSSE2(float* BANSHEE_RESTRICT dst, const uint8_t* const* blocks, size_t count) {
+		const __m128i fifteen = _mm_set1_epi32(15);
+		const __m128i seven = _mm_set1_epi32(7);
+		const __m128i three = _mm_set1_epi32(3);
+		const __m128i minusOne = _mm_set1_epi32(-1);
+		const __m128i maxIndex = _mm_set1_epi32(88);
+		const __m128 scale = _mm_set1_ps(1.f / 32768.f);
+
+		size_t b = 0;
+		for(; b + 4 <= count; b += 4) {
+			const uint8_t* p[4] = { blocks[b], blocks[b + 1], blocks[b + 2], blocks[b + 3] };
+			__m128i predictor = _mm_setr_epi32((int16_t)(p[0][0] | (p[0][1] << 8)), (int16_t)(p[1][0] | (p[1][1] << 8)),
+				(int16_t)(p[2][0] | (p[2][1] << 8)), (int16_t)(p[3][0] | (p[3][1] << 8)));
+			__m128i index = _mm_setr_epi32(p[0][2], p[1][2], p[2][2], p[3][2]);
+			__m128i over = _mm_cmpgt_epi32(index, maxIndex);
+			index = _mm_or_si128(_mm_and_si128(over, maxIndex), _mm_andnot_si128(over, index));
+
+			// Sample i of every lane, transposed back to the blocks at the end.
+			__m128 samples[ADPCM_BLOCK_FRAMES];
+			alignas(16) int32_t lanes[4];
+
+			for(int w = 0; w < ADPCM_BLOCK_FRAMES / 8; w++) {
+				__m128i word = _mm_setr_epi32(loadU32(p[0] + 4 + w * 4), loadU32(p[1] + 4 + w * 4), loadU32(p[2] + 4 + w * 4), loadU32(p[3] + 4 + w * 4));
+
+				for(int j = 0; j < 8; j++) {
+					__m128i nibble = _mm_and_si128(word, fifteen);
+					word = _mm_srli_epi32(word, 4);
+
+					// No gather before AVX2.
+					_mm_store_si128((__m128i*)lanes, index);
+					__m128i step = _mm_setr_epi32(ADPCM_STEP_TABLE[lanes[0]], ADPCM_STEP_TABLE[lanes[1]], ADPCM_STEP_TABLE[lanes[2]], ADPCM_STEP_TABLE[lanes[3]]);
+
+					__m128i diff = _mm_srli_epi32(step, 3);
+					diff = _mm_add_epi32(diff, _mm_and_si128(bitMaskSSE2(nibble, 4), step));
+					diff = _mm_add_epi32(diff, _mm_and_si128(bitMaskSSE2(nibble, 2), _mm_srli_epi32(step, 1)));
+					diff = _mm_add_epi32(diff, _mm_and_si128(bitMaskSSE2(nibble, 1), _mm_srli_epi32(step, 2)));
+					__m128i sign = bitMaskSSE2(nibble, 8);
+					diff = _mm_sub_epi32(_mm_xor_si128(diff, sign), sign);
+
+					// Saturating pack to 16 bits then sign extend back, there is no 32-bit min/max in SSE2.
+					predictor = _mm_add_epi32(predictor, diff);
+					__m128i packed = _mm_packs_epi32(predictor, predictor);
+					predictor = _mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16);
+					samples[w * 8 + j] = _mm_mul_ps(_mm_cvtepi32_ps(predictor), scale);
+
+					// -1 for a low nibble under 4, otherwise 2, 4, 6 or 8.
+					__m128i low = _mm_and_si128(nibble, seven);
+					__m128i grow = _mm_cmpgt_epi32(low, three);
+					__m128i delta = _mm_or_si128(_mm_and_si128(grow, _mm_slli_epi32(_mm_sub_epi32(low, three), 1)), _mm_andnot_si128(grow, minusOne));
+					index = _mm_add_epi32(index, delta);
+					index = _mm_and_si128(index, _mm_cmpgt_epi32(index, minusOne));
+					over = _mm_cmpgt_epi32(index, maxIndex);
+					index = _mm_or_si128(_mm_and_si128(over, maxIndex), _mm_andnot_si128(over, index));
+				}
+			}
+
+			float* out = dst + b * ADPCM_BLOCK_FRAMES;
+			for(int i = 0; i < ADPCM_BLOCK_FRAMES; i += 4) {
+				__m128 r0 = samples[i];
+				__m128 r1 = samples[i + 1];
+				__m128 r2 = samples[i + 2];
+				__m128 r3 = samples[i + 3];
+				_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+				_mm_storeu_ps(out + i, r0);
+				_mm_storeu_ps(out + ADPCM_BLOCK_FRAMES + i, r1);
+				_mm_storeu_ps(out + ADPCM_BLOCK_FRAMES * 2 + i, r2);
+				_mm_storeu_ps(out + ADPCM_BLOCK_FRAMES * 3 + i, r3);
+			}
+		}
+
+		adpcmDecodeScalar(dst + b * ADPCM_BLOCK_FRAMES, blocks + b, count - b);
+	}
+
+	static const MixKernels sse2Kernels = {
+		mixGainSSE2,
+		panMonoSSE2,
+		panStereoSSE2,
+		gainRampStereoSSE2,
+		s16ToFloatSSE2,
+		s24ToFloatSSE2,
+		floatToS16DitherSSE2,
+		sincResampleSSE2,
+		spectrumMacSSE2,
+		fftRadix4SSE2,
+		biquadLanesSSE2,
+		adpcmDecodeSSE2
+	};
+
+	// AVX2 kernels, 8 lanes.
+
+	BANSHEE_TARGET_AVX2
+	static void mixGainAVX2(float* BANSHEE_RESTRICT dst, const float* BANSHEE_RESTRICT src, float gain, size_t count) {
+		__m256 g = _mm256_set1_ps(gain);
+		size_t i = 0;
+		for(; i + 16 <= count; i += 16) {
+			__m256 a = _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(_mm256_loadu_ps(src + i), g));
+			__m256 b = _mm256_add_ps(_mm256_loadu_ps(dst + i + 8), _mm256_mul_ps(_mm256_loadu_ps(src + i + 8), g));
+			_mm256_storeu_ps(dst + i, a);
+			_mm256_storeu_ps(dst + i + 8, b);
+		}
+		mixGainScalar(dst + i, src + i, gain, count - i);
+	}
+
+	BANSHEE_TARGET_AVX2
+	static void panMonoAVX2(float* BANSHEE_RESTRICT dst, const float* BANSHEE_RESTRICT src, float gainL, float gainR, float stepL, float stepR, size_t frames) {
+		__m256 baseL = _mm256_set1_ps(gainL);
+		__m256 baseR = _mm256_set1_ps(gainR);
+		__m256 slopeL = _mm256_set1_ps(stepL);
+		__m256 slopeR = _mm256_set1_ps(stepR);
+		__m256 index = _mm256_setr_ps(1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f, 8.f);
+		const __m256 eight = _mm256_set1_ps(8.f);
+
+		size_t i = 0;
+		for(; i + 8 <= frames; i += 8) {
+			__m256 s = _mm256_loadu_ps(src + i);
+			__m256 gl = _mm256_add_ps(baseL, _mm256_mul_ps(slopeL, index));
+			__m256 gr = _mm256_add_ps(baseR, _mm256_mul_ps(slopeR, index));
+
+			// Unpacks work per 128-bit lane so the halves have to be swapped back into frame order.
+			__m256 ssLo = _mm256_unpacklo_ps(s, s);
+			__m256 ssHi = _mm256_unpackhi_ps(s, s);
+			__m256 gLo = _mm256_unpacklo_ps(gl, gr);
+			__m256 gHi = _mm256_unpackhi_ps(gl, gr);
+
+			__m256 first = _mm256_mul_ps(_mm256_permute2f128_ps(ssLo, ssHi, 0x20), _mm256_permute2f128_ps(gLo, gHi, 0x20));
+			__m256 second = _mm256_mul_ps(_mm256_permute2f128_ps(ssLo, ssHi, 0x31), _mm256_permute2f128_ps(gLo, gHi, 0x31));
+
+			_mm256_storeu_ps(dst + i * 2, _mm256_add_ps(_mm256_loadu_ps(dst + i * 2), first));
+			_mm256_storeu_ps(dst + i * 2 + 8, _mm256_add_ps(_mm256_loadu_ps(dst + i * 2 + 8), second));
+
+			index = _mm256_add_ps(index, eight);
+		}
+
+		float n = (float)i;
+		panMonoScalar(dst + i * 2, src + i, gainL + stepL * n, gainR + stepR * n, stepL, stepR, frames - i);
+	}
+
+	BANSHEE_TARGET_AVX2
+	static void panStereoAVX2(float* BANSHEE_RESTRICT dst, const float* BANSHEE_RESTRICT left, const float* BANSHEE_RESTRICT right, float gainL, float gainR, float stepL, float stepR, size_t frames) {
+		__m256 baseL = _mm256_set1_ps(gainL);
+		__m256 baseR = _mm256_set1_ps(gainR);
+		__m256 slopeL = _mm256_set1_ps(stepL);
+		__m256 slopeR = _mm256_set1_ps(stepR);
+		__m256 index = _mm256_setr_ps(1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f, 8.f);
+		const __m256 eight = _mm256_set1_ps(8.f);
+
+		size_t i = 0;
+		for(; i + 8 <= frames; i += 8) {
+			__m256 l = _mm256_mul_ps(_mm256_loadu_ps(left + i), _mm256_add_ps(baseL, _mm256_mul_ps(slopeL, index)));
+			__m256 r = _mm256_mul_ps(_mm256_loadu_ps(right + i), _mm256_add_ps(baseR, _mm256_mul_ps(slopeR, index)));
+			__m256 lo = _mm256_unpacklo_ps(l, r);
+			__m256 hi = _mm256_unpackhi_ps(l, r);
+
+			__m256 first = _mm256_permute2f128_ps(lo, hi, 0x20);
+			__m256 second = _mm256_permute2f128_ps(lo, hi, 0x31);
+
+			_mm256_storeu_ps(dst + i * 2, _mm256_add_ps(_mm256_loadu_ps(dst + i * 2), first));
+			_mm256_storeu_ps(dst + i * 2 + 8, _mm256_add_ps(_mm256_loadu_ps(dst + i * 2 + 8), second));
+
+			index = _mm256_add_ps(index, eight);
+		}
+
+		float n = (float)i;
+		panStereoScalar(dst + i * 2, left + i, right + i, gainL + stepL * n, gainR + stepR * n, stepL, stepR, frames - i);
+	}
+
+	BANSHEE_TARGET_AVX2
+	static void gainRampStereoAVX2(float* buffer, float gain, float step, size_t frames) {
+		__m256 base = _mm256_set1_ps(gain);
+		__m256 slope = _mm256_set1_ps(step);
+		__m256 index = _mm256_setr_ps(1.f, 1.f, 2.f, 2.f, 3.f, 3.f, 4.f, 4.f);
+		const __m256 four = _mm256_set1_ps(4.f);
+
+		size_t i = 0;
+		for(; i + 4 <= frames; i += 4) {
+			__m256 g = _mm256_add_ps(base, _mm256_mul_ps(slope, index));
+			_mm256_storeu_ps(buffer + i * 2, _mm256_mul_ps(_mm256_loadu_ps(buffer + i * 2), g));
+			index = _mm256_add_ps(index, four);
+		}
+
+		gainRampStereoScalar(buffer + i * 2, gain + step * (float)i, step, frames - i);
+	}
+
+	BANSHEE_TARGET_AVX2
+	static void s16ToFloatAVX2(float* BANSHEE_RESTRICT dst, const int16_t* BANSHEE_RESTRICT src, size_t count) {
+		const __m256 scale = _mm256_set1_ps(1.f / 32768.f);
+
+		size_t i = 0;
+		for(; i + 16 <= count; i += 16) {
+			__m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+			__m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i + 8)));
+			_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+			_mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+		}
+
+		s16ToFloatScalar(dst + i, src + i, count - i);
+	}
+
+	BANSHEE_TARGET_AVX2
+	static void s24ToFloatAVX2(float* BANSHEE_RESTRICT dst, const uint8_t* BANSHEE_RESTRICT src, size_t count) {
+		const __m256 scale = _mm256_set1_ps(1.f / 8388608.f);
+		// Moves the 3 bytes of every sample into the top of a 32-bit lane.
+		const __m256i shuffle = _mm256_setr_epi8(
+			-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+			-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+
+		// The upper 16 byte load reads 4 bytes past the 8 samples.
+		size_t i = 0;
+		for(; i + 10 <= count; i += 8) {
+			const uint8_t* p = src + i * 3;
+			__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)p)),
+				_mm_loadu_si128((const __m128i*)(p + 12)), 1);
+			v = _mm256_srai_epi32(_mm256_shuffle_epi8(v, shuffle), 8);
+			_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+		}
+
+		s24ToFloatSSE2(dst + i, src + i * 3, count - i);
+	}
+
+	BANSHEE_TARGET_AVX2
+	static void floatToS16DitherAVX2(int16_t* BANSHEE_RESTRICT dst, const float* BANSHEE_RESTRICT src, size_t count, uint32_t* state) {
+		uint32_t seed = *state ? *state : 0x12345678u;
+
+		__m256i rng = _mm256_xor_si256(_mm256_set1_epi32((int)seed),
+			_mm256_setr_epi32(0, (int)0x9E3779B9, (int)0x3C6EF372, (int)0xDAA66D2B, (int)0x78DDE6E4, (int)0x1715609D, (int)0xB54CDA56, (int)0x5384540F));
+		const __m256 scale = _mm256_set1_ps(32767.f);
+		const __m256 low = _mm256_set1_ps(-32768.f);
+		const __m256 high = _mm256_set1_ps(32767.f);
+		const __m256i exponent = _mm256_set1_epi32(0x3F800000);
+		const __m256 one = _mm256_set1_ps(1.f);
+
+		size_t i = 0;
+		for(; i + 16 <= count; i += 16) {
+			__m256i v[2];
+			for(int k = 0; k < 2; k++) {
+				rng = _mm256_xor_si256(rng, _mm256_slli_epi32(rng, 13));
+				rng = _mm256_xor_si256(rng, _mm256_srli_epi32(rng, 17));
+				rng = _mm256_xor_si256(rng, _mm256_slli_epi32(rng, 5));
+				__m256 r1 = _mm256_sub_ps(_mm256_castsi256_ps(_mm256_or_si256(_mm256_srli_epi32(rng, 9), exponent)), one);
+
+				rng = _mm256_xor_si256(rng, _mm256_slli_epi32(rng, 13));
+				rng = _mm256_xor_si256(rng, _mm256_srli_epi32(rng, 17));
+				rng = _mm256_xor_si256(rng, _mm256_slli_epi32(rng, 5));
+				__m256 r2 = _mm256_sub_ps(_mm256_castsi256_ps(_mm256_or_si256(_mm256_srli_epi32(rng, 9), exponent)), one);
+
+				__m256 x = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i + k * 8), scale), _mm256_sub_ps(r1, r2));
+				v[k] = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(x, low), high));
+			}
+
+			// packs works per 128-bit lane, fix the order of the 64-bit quarters afterwards.
+			__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(v[0], v[1]), 0xD8);
+			_mm256_storeu_si256((__m256i*)(dst + i), packed);
+		}
+
+		seed = (uint32_t)_mm_cvtsi128_si32(_mm256_castsi256_si128(rng));
+		floatToS16DitherSSE2(dst + i, src + i, count - i, &seed);
+		*state = seed;
+	}
+
+	BANSHEE_TARGET_AVX2
+	static void sincResampleAVX2(float* BANSHEE_RESTRICT dst, const float* BANSHEE_RESTRICT src, const float* BANSHEE_RESTRICT table, int phases,
+		double position, double step, double stepDelta, size_t frames) {
+		for(size_t i = 0; i < frames; i++) {
+			size_t base = (size_t)position;
+			float alpha;
+			const float* a = sincRow(table, phases, position - (double)base, alpha);
+			const float* b = a + SINC_KERNEL_TAPS;
+			const float* s = src + base;
+			__m256 w = _mm256_set1_ps(alpha);
+
+			__m256 a0 = _mm256_loadu_ps(a);
+			__m256 a1 = _mm256_loadu_ps(a + 8);
+			__m256 c0 = _mm256_add_ps(a0, _mm256_mul_ps(w, _mm256_sub_ps(_mm256_loadu_ps(b), a0)));
+			__m256 c1 = _mm256_add_ps(a1, _mm256_mul_ps(w, _mm256_sub_ps(_mm256_loadu_ps(b + 8), a1)));
+
+			__m256 sum = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(s), c0), _mm256_mul_ps(_mm256_loadu_ps(s + 8), c1));
+			dst[i] = horizontalSum(_mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1)));
+
+			position += step + stepDelta * (double)(i + 1);
+		}
+	}
+
+	BANSHEE_TARGET_AVX2
+	static void spectrumMacAVX2(float* BANSHEE_RESTRICT accRe, float* BANSHEE_RESTRICT accIm, const float* BANSHEE_RESTRICT aRe, const float* BANSHEE_RESTRICT aIm,
+		const float* BANSHEE_RESTRICT bRe, const float* BANSHEE_RESTRICT bIm, size_t count) {
+		size_t i = 0;
+		for(; i + 8 <= count; i += 8) {
+			__m256 ar = _mm256_loadu_ps(aRe + i);
+			__m256 ai = _mm256_loadu_ps(aIm + i);
+			__m256 br = _mm256_loadu_ps(bRe + i);
+			__m256 bi = _mm256_loadu_ps(bIm + i);
+			__m256 re = _mm256_sub_ps(_mm256_mul_ps(ar, br), _mm256_mul_ps(ai, bi));
+			__m256 im = _mm256_add_ps(_mm256_mul_ps(ar, bi), _mm256_mul_ps(ai, br));
+			_mm256_storeu_ps(accRe + i, _mm256_add_ps(_mm256_loadu_ps(accRe + i), re));
+			_mm256_storeu_ps(accIm + i, _mm256_add_ps(_mm256_loadu_ps(accIm + i), im));
+		}
+		spectrumMacSSE2(accRe + i, accIm + i, aRe + i, aIm + i, bRe + i, bIm + i, count - i);
+	}
+
+	BANSHEE_TARGET_AVX2
+	static void fftRadix4AVX2(float* BANSHEE_RESTRICT re, float* BANSHEE_RESTRICT im, const float* BANSHEE_RESTRICT twiddles, size_t quarter, size_t size) {
+		if(quarter % 8 != 0) {
+			fftRadix4SSE2(re, im, twiddles, quarter, size);
+			return;
+		}
+
+		const float* w1r = twiddles;
+		const float* w1i = twiddles + quarter;
+		const float* w2r = twiddles + quarter * 2;
+		const float* w2i = twiddles + quarter * 3;
+
+		for(size_t base = 0; base < size; base += quarter * 4) {
+			float* r0 = re + base;
+			float* r1 = r0 + quarter;
+			float* r2 = r1 + quarter;
+			float* r3 = r2 + quarter;
+			float* i0 = im + base;
+			float* i1 = i0 + quarter;
+			float* i2 = i1 + quarter;
+			float* i3 = i2 + quarter;
+
+			for(size_t k = 0; k < quarter; k += 8) {
+				__m256 wr = _mm256_loadu_ps(w1r + k);
+				__m256 wi = _mm256_loadu_ps(w1i + k);
+				__m256 x1r = _mm256_loadu_ps(r1 + k);
+				__m256 x1i = _mm256_loadu_ps(i1 + k);
+				__m256 x3r = _mm256_loadu_ps(r3 + k);
+				__m256 x3i = _mm256_loadu_ps(i3 + k);
+
+				__m256 br = _mm256_sub_ps(_mm256_mul_ps(x1r, wr), _mm256_mul_ps(x1i, wi));
+				__m256 bi = _mm256_add_ps(_mm256_mul_ps(x1r, wi), _mm256_mul_ps(x1i, wr));
+				__m256 dr = _mm256_sub_ps(_mm256_mul_ps(x3r, wr), _mm256_mul_ps(x3i, wi));
+				__m256 di = _mm256_add_ps(_mm256_mul_ps(x3r, wi), _mm256_mul_ps(x3i, wr));
+
+				__m256 x0r = _mm256_loadu_ps(r0 + k);
+				__m256 x0i = _mm256_loadu_ps(i0 + k);
+				__m256 x2r = _mm256_loadu_ps(r2 + k);
+				__m256 x2i = _mm256_loadu_ps(i2 + k);
+
+				__m256 ar = _mm256_add_ps(x0r, br);
+				__m256 ai = _mm256_add_ps(x0i, bi);
+				br = _mm256_sub_ps(x0r, br);
+				bi = _mm256_sub_ps(x0i, bi);
+				__m256 cr = _mm256_add_ps(x2r, dr);
+				__m256 ci = _mm256_add_ps(x2i, di);
+				dr = _mm256_sub_ps(x2r, dr);
+				di = _mm256_sub_ps(x2i, di);
+
+				wr = _mm256_loadu_ps(w2r + k);
+				wi = _mm256_loadu_ps(w2i + k);
+				__m256 tr = _mm256_sub_ps(_mm256_mul_ps(cr, wr), _mm256_mul_ps(ci, wi));
+				__m256 ti = _mm256_add_ps(_mm256_mul_ps(cr, wi), _mm256_mul_ps(ci, wr));
+				__m256 ur = _mm256_sub_ps(_mm256_mul_ps(dr, wr), _mm256_mul_ps(di, wi));
+				__m256 ui = _mm256_add_ps(_mm256_mul_ps(dr, wi), _mm256_mul_ps(di, wr));
+
+				_mm256_storeu_ps(r0 + k, _mm256_add_ps(ar, tr));
+				_mm256_storeu_ps(i0 + k, _mm256_add_ps(ai, ti));
+				_mm256_storeu_ps(r2 + k, _mm256_sub_ps(ar, tr));
+				_mm256_storeu_ps(i2 + k, _mm256_sub_ps(ai, ti));
+				_mm256_storeu_ps(r1 + k, _mm256_add_ps(br, ui));
+				_mm256_storeu_ps(i1 + k, _mm256_sub_ps(bi, ur));
+				_mm256_storeu_ps(r3 + k, _mm256_sub_ps(br, ui));
+				_mm256_storeu_ps(i3 + k, _mm256_add_ps(bi, ur));
+			}
+		}
+	}
+
+	// Turns 8 rows of 8 into 8 columns, its own inverse.
+	BANSHEE_TARGET_AVX2
+	static inline void transpose8AVX2(__m256* r) {
+		__m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+		__m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+		__m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+		__m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+		__m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+		__m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+		__m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+		__m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+
+		__m256 s0 = _mm256_shuffle_ps(t0, t2, 0x44);
+		__m256 s1 = _mm256_shuffle_ps(t0, t2, 0xEE);
+		__m256 s2 = _mm256_shuffle_ps(t1, t3, 0x44);
+		__m256 s3 = _mm256_shuffle_ps(t1, t3, 0xEE);
+		__m256 s4 = _mm256_shuffle_ps(t4, t6, 0x44);
+		__m256 s5 = _mm256_shuffle_ps(t4, t6, 0xEE);
+		__m256 s6 = _mm256_shuffle_ps(t5, t7, 0x44);
+		__m256 s7 = _mm256_shuffle_ps(t5, t7, 0xEE);
+
+		r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+		r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+		r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+		r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+		r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+		r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+		r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+		r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+	}
+
+	BANSHEE_TARGET_AVX2
+	static void biquadLanesAVX2(float* const* channels, const float* BANSHEE_RESTRICT coefficients, float* BANSHEE_RESTRICT state, size_t frames) {
+		const int L = BIQUAD_LANES;
+		__m256 b0 = _mm256_loadu_ps(coefficients);
+		__m256 b1 = _mm256_loadu_ps(coefficients + L);
+		__m256 b2 = _mm256_loadu_ps(coefficients + L * 2);
+		__m256 a1 = _mm256_loadu_ps(coefficients + L * 3);
+		__m256 a2 = _mm256_loadu_ps(coefficients + L * 4);
+		__m256 d0 = _mm256_loadu_ps(coefficients + L * 5);
+		__m256 d1 = _mm256_loadu_ps(coefficients + L * 6);
+		__m256 d2 = _mm256_loadu_ps(coefficients + L * 7);
+		__m256 e1 = _mm256_loadu_ps(coefficients + L * 8);
+		__m256 e2 = _mm256_loadu_ps(coefficients + L * 9);
+		__m256 z1 = _mm256_loadu_ps(state);
+		__m256 z2 = _mm256_loadu_ps(state + L);
+
+		// 8 frames of every lane at a time, transposed in registers so every lane keeps its planar buffer.
+		__m256 r[8];
+		size_t i = 0;
+		for(; i < frames; i += 8) {
+			size_t count = frames - i < 8 ? frames - i : 8;
+			if(count == 8) {
+				for(int l = 0; l < L; l++) {
+					r[l] = _mm256_loadu_ps(channels[l] + i);
+				}
+				transpose8AVX2(r);
+			}
+			else {
+				for(size_t j = 0; j < count; j++) {
+					r[j] = _mm256_setr_ps(channels[0][i + j], channels[1][i + j], channels[2][i + j], channels[3][i + j],
+						channels[4][i + j], channels[5][i + j], channels[6][i + j], channels[7][i + j]);
+				}
+			}
+
+			for(size_t j = 0; j < count; j++) {
+				b0 = _mm256_add_ps(b0, d0);
+				b1 = _mm256_add_ps(b1, d1);
+				b2 = _mm256_add_ps(b2, d2);
+				a1 = _mm256_add_ps(a1, e1);
+				a2 = _mm256_add_ps(a2, e2);
+
+				__m256 x = r[j];
+				__m256 y = _mm256_add_ps(_mm256_mul_ps(b0, x), z1);
+				z1 = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(b1, x), _mm256_mul_ps(a1, y)), z2);
+				z2 = _mm256_sub_ps(_mm256_mul_ps(b2, x), _mm256_mul_ps(a2, y));
+				r[j] = y;
+			}
+
+			if(count == 8) {
+				transpose8AVX2(r);
+				for(int l = 0; l < L; l++) {
+					_mm256_storeu_ps(channels[l] + i, r[l]);
+				}
+			}
+			else {
+				for(size_t j = 0; j < count; j++) {
+					float y[8];
+					_mm256_storeu_ps(y, r[j]);
+					for(int l = 0; l < L; l++) {
+						channels[l][i + j] = y[l];
+					}
+				}
+			}
+		}
+
+		_mm256_storeu_ps(state, z1);
+		_mm256_storeu_ps(state + L, z2);
+	}
+
+	BANSHEE_TARGET_AVX2
+	static inline __m256i bitMaskAVX2(__m256i v, int bit) {
+		__m256i b = _mm256_set1_epi32(bit);
+		return _mm256_cmpeq_epi32(_mm256_and_si256(v, b), b);
+	}
+
+	BANSHEE_TARGET_AVX2
+	static void adpcmDecodeAVX2(float* BANSHEE_RESTRICT dst, const uint8_t* const* blocks, size_t count) {
+		const __m256i fifteen = _mm256_set1_epi32(15);
+		const __m256i seven = _mm256_set1_epi32(7);
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i maxIndex = _mm256_set1_epi32(88);
+		const __m256i minSample = _mm256_set1_epi32(-32768);
+		const __m256i maxSample = _mm256_set1_epi32(32767);
+		// Index change of the low 3 bits of a nibble, looked up with a lane permute.
+		const __m256i indexDeltas = _mm256_setr_epi32(-1, -1, -1, -1, 2, 4, 6, 8);
+		const __m256 scale = _mm256_set1_ps(1.f / 32768.f);
+
+		size_t b = 0;
+		for(; b + 8 <= count; b += 8) {
+			const uint8_t* const* p = blocks + b;
+			__m256i predictor = _mm256_setr_epi32((int16_t)(p[0][0] | (p[0][1] << 8)), (int16_t)(p[1][0] | (p[1][1] << 8)),
+				(int16_t)(p[2][0] | (p[2][1] << 8)), (int16_t)(p[3][0] | (p[3][1] << 8)), (int16_t)(p[4][0] | (p[4][1] << 8)),
+				(int16_t)(p[5][0] | (p[5][1] << 8)), (int16_t)(p[6][0] | (p[6][1] << 8)), (int16_t)(p[7][0] | (p[7][1] << 8)));
+			__m256i index = _mm256_min_epi32(_mm256_setr_epi32(p[0][2], p[1][2], p[2][2], p[3][2], p[4][2], p[5][2], p[6][2], p[7][2]), maxIndex);
+
+			__m256 samples[ADPCM_BLOCK_FRAMES];
+
+			for(int w = 0; w < ADPCM_BLOCK_FRAMES / 8; w++) {
+				const int o = 4 + w * 4;
+				__m256i word = _mm256_setr_epi32(loadU32(p[0] + o), loadU32(p[1] + o), loadU32(p[2] + o), loadU32(p[3] + o),
+					loadU32(p[4] + o), loadU32(p[5] + o), loadU32(p[6] + o), loadU32(p[7] + o));
+
+				for(int j = 0; j < 8; j++) {
+					__m256i nibble = _mm256_and_si256(word, fifteen);
+					word = _mm256_srli_epi32(word, 4);
+
+					__m256i step = _mm256_i32gather_epi32((const int*)ADPCM_STEP_TABLE, index, 4);
+					__m256i diff = _mm256_srli_epi32(step, 3);
+					diff = _mm256_add_epi32(diff, _mm256_and_si256(bitMaskAVX2(nibble, 4), step));
+					diff = _mm256_add_epi32(diff, _mm256_and_si256(bitMaskAVX2(nibble, 2), _mm256_srli_epi32(step, 1)));
+					diff = _mm256_add_epi32(diff, _mm256_and_si256(bitMaskAVX2(nibble, 1), _mm256_srli_epi32(step, 2)));
+					__m256i sign = bitMaskAVX2(nibble, 8);
+					diff = _mm256_sub_epi32(_mm256_xor_si256(diff, sign), sign);
+
+					predictor = _mm256_max_epi32(_mm256_min_epi32(_mm256_add_epi32(predictor, diff), maxSample), minSample);
+					samples[w * 8 + j] = _mm256_mul_ps(_mm256_cvtepi32_ps(predictor), scale);
+
+					index = _mm256_add_epi32(index, _mm256_permutevar8x32_epi32(indexDeltas, _mm256_and_si256(nibble, seven)));
+					index = _mm256_max_epi32(_mm256_min_epi32(index, maxIndex), zero);
+				}
+			}
+
+			float* out = dst + b * ADPCM_BLOCK_FRAMES;
+			for(int i = 0; i < ADPCM_BLOCK_FRAMES; i += 8) {
+				transpose8AVX2(samples + i);
+				for(int l = 0; l < 8; l++) {
+					_mm256_storeu_ps(out + l * ADPCM_BLOCK_FRAMES + i, samples[i + l]);
+				}
+			}
+		}
+
+		adpcmDecodeSSE2(dst + b * ADPCM_BLOCK_FRAMES, blocks + b, count - b);
+	}
+
+	static const MixKernels avx2Kernels = {
+		mixGainAVX2,
+		panMonoAVX2,
+		panStereoAVX2,
+		gainRampStereoAVX2,
+		s16ToFloatAVX2,
+		s24ToFloatAVX2,
+		floatToS16DitherAVX2,
+		sincResampleAVX2,
+		spectrumMacAVX2,
+		fftRadix4AVX2,
+		biquadLanesAVX2,
+		adpcmDecodeAVX2
+	};
+
+	static void cpuid(int leaf, int subLeaf, unsigned int regs[4]) {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuidex(info, leaf, subLeaf);
+		for(int i = 0; i < 4; i++) {
+			regs[i] = (unsigned int)info[i];
+		}
+#else
+		__cpuid_count(leaf, subLeaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	}
+
+	static uint64_t xgetbv0() {
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		uint32_t eax;
+		uint32_t edx;
+		__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return ((uint64_t)edx << 32) | eax;
+#endif
+	}
+
+#endif
+
+	SimdLevel detectSimdLevel() {
+#ifdef BANSHEE_X86
+		unsigned int regs[4];
+		cpuid(0, 0, regs);
+		unsigned int maxLeaf = regs[0];
+
+		cpuid(1, 0, regs);
+		bool sse2 = (regs[3] & (1u << 26)) != 0;
+		bool osxsave = (regs[2] & (1u << 27)) != 0;
+		bool avx = (regs[2] & (1u << 28)) != 0;
+
+		bool avx2 = false;
+		// The OS also has to save the YMM registers on context switches.
+		if(osxsave && avx && (xgetbv0() & 0x6) == 0x6 && maxLeaf >= 7) {
+			cpuid(7, 0, regs);
+			avx2 = (regs[1] & (1u << 5)) != 0;
+		}
+
+		if(avx2) return SimdLevel::AVX2;
+		if(sse2) return SimdLevel::SSE2;
+#endif
+		return SimdLevel::SCALAR;
+	}
+
+	const char* simdLevelName(SimdLevel level) {
+		switch(level) {
+		case SimdLevel::AVX2:
+			return "AVX2";
+		case SimdLevel::SSE2:
+			return "SSE2";
+		default:
+			return "Scalar";
+		}
+	}
+
+	const MixKernels& kernels() {
+		// Function local statics are initialised once even with several threads racing.
+		static const MixKernels* selected = kernelsFor(detectSimdLevel());
+		return *selected;
+	}
+
+	const MixKernels* kernelsFor(SimdLevel level) {
+		if(level == SimdLevel::SCALAR) {
+			return &scalarKernels;
+		}
+
+#ifdef BANSHEE_X86
+		if(level > detectSimdLevel()) {
+			return nullptr;
+		}
+
+		return level == SimdLevel::AVX2 ? &avx2Kernels : &sse2Kernels;
+#else
+		return nullptr;
+#endif
+	}
+};
@@ -1 +1,133 @@
 #pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "includes/Spatializer.h"
+
+// Architecture and compiler specific switches for the SIMD kernels.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BANSHEE_X86 1
+#endif
+
+#if defined(_MSC_VER)
+#define BANSHEE_TARGET_AVX2
+#define BANSHEE_RESTRICT __restrict
+#else
+#define BANSHEE_TARGET_AVX2 __attribute__((target("avx2")))
+#define BANSHEE_RESTRICT __restrict__
+#endif
+
+namespace Banshee {
+
+	// Taps per output sample of sincResample.
+	constexpr int SINC_KERNEL_TAPS = 16;
+	// Filters run side by side by biquadLanes, one AVX register or two SSE registers.
+	constexpr int BIQUAD_LANES = 8;
+	// IMA ADPCM samples per channel in one block, and bytes in the block: a 4 byte header
+	// with the 16-bit predictor and step index the block starts from, then a nibble per sample.
+	constexpr int ADPCM_BLOCK_FRAMES = 64;
+	constexpr int ADPCM_BLOCK_BYTES = 4 + ADPCM_BLOCK_FRAMES / 2;
+
+	// IMA ADPCM quantiser step sizes and the step index change of every nibble.
+	extern const int32_t ADPCM_STEP_TABLE[89];
+	extern const int32_t ADPCM_INDEX_TABLE[16];
+
+	constexpr float PI_f = 3.14159265f;
+	constexpr float TWO_PI_f = 6.28318531f;
+	constexpr float QUARTER_PI_f = 0.78539816f;
+	constexpr float DEG_TO_RAD_f = 0.017453293f;
+	constexpr double PI_d = 3.14159265358979323846;
+	constexpr double TWO_PI_d = 6.28318530717958647692;
+
+	inline float clampf(float value, float low, float high) {
+		return value < low ? low : (value > high ? high : value);
+	}
+
+	// Vector3 arithmetic shared by the spatial code.
+	inline Vector3 sub(const Vector3& a, const Vector3& b) {
+		return Vector3(a.x - b.x, a.y - b.y, a.z - b.z);
+	}
+
+	inline Vector3 cross(const Vector3& a, const Vector3& b) {
+		return Vector3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+	}
+
+	inline float dot(const Vector3& a, const Vector3& b) {
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	inline float distanceSquared(const Vector3& a, const Vector3& b) {
+		Vector3 d = sub(a, b);
+		return dot(d, d);
+	}
+
+	enum class SimdLevel {
+		SCALAR = 0,
+		SSE2 = 1,
+		AVX2 = 2
+	};
+
+	// Inner loop kernels of the mixer. Every field points at the implementation for one
+	// instruction set, the table for the running CPU is picked once on first use.
+	// Ramped gains follow gain(i) = gain + step * (i + 1) for frame i.
+	struct MixKernels {
+		// dst[i] += src[i] * gain
+		void (*mixGain)(float* dst, const float* src, float gain, size_t count);
+
+		// Accumulates a mono source into interleaved stereo with ramped left/right gains.
+		void (*panMono)(float* dst, const float* src, float gainL, float gainR, float stepL, float stepR, size_t frames);
+
+		// Accumulates a planar stereo source into interleaved stereo with ramped left/right gains.
+		void (*panStereo)(float* dst, const float* left, const float* right, float gainL, float gainR, float stepL, float stepR, size_t frames);
+
+		// Scales interleaved stereo in place by a ramped gain.
+		void (*gainRampStereo)(float* buffer, float gain, float step, size_t frames);
+
+		// Integer PCM to float in the range [-1, 1].
+		void (*s16ToFloat)(float* dst, const int16_t* src, size_t count);
+		void (*s24ToFloat)(float* dst, const uint8_t* src, size_t count);
+
+		// Float to 16-bit with triangular dither. Out of range values are clipped.
+		// state is the dither noise seed and is updated so consecutive calls continue the sequence.
+		void (*floatToS16Dither)(int16_t* dst, const float* src, size_t count, uint32_t* state);
+
+		// Polyphase FIR resampling of one channel. table holds phases + 1 rows of SINC_KERNEL_TAPS
+		// coefficients, neighbouring rows are interpolated by the fractional position.
+		// Output i reads src[floor(p) .. floor(p) + SINC_KERNEL_TAPS - 1] where p is its position,
+		// the first output is at position and output i + 1 is step + stepDelta * (i + 1) further on.
+		void (*sincResample)(float* dst, const float* src, const float* table, int phases,
+			double position, double step, double stepDelta, size_t frames);
+
+		// Complex multiply-accumulate on split real/imaginary spectra: acc[i] += a[i] * b[i].
+		void (*spectrumMac)(float* accRe, float* accIm, const float* aRe, const float* aIm,
+			const float* bRe, const float* bIm, size_t count);
+
+		// One radix-4 decimation in time stage of a forward complex FFT over size points in split
+		// arrays, combining sub-transforms of quarter points into ones of 4 * quarter points.
+		// twiddles holds quarter values each of W(2 * quarter)^k real and imaginary parts,
+		// then W(4 * quarter)^k real and imaginary parts.
+		void (*fftRadix4)(float* re, float* im, const float* twiddles, size_t quarter, size_t size);
+
+		// BIQUAD_LANES independent transposed direct form II biquads, one per channel, filtered in place.
+		// coefficients holds one row of BIQUAD_LANES values each for b0, b1, b2, a1, a2 and then
+		// their per frame steps, frame i uses coefficient + step * (i + 1).
+		// state holds the z1 row then the z2 row and is updated.
+		void (*biquadLanes)(float* const* channels, const float* coefficients, float* state, size_t frames);
+
+		// Decodes count independent IMA ADPCM channel blocks of ADPCM_BLOCK_BYTES each to floats,
+		// block b to dst + b * ADPCM_BLOCK_FRAMES. The blocks do not depend on each other so the
+		// SIMD versions decode one per lane.
+		void (*adpcmDecode)(float* dst, const uint8_t* const* blocks, size_t count);
+	};
+
+	// Highest instruction set supported by both the CPU and the OS.
+	SimdLevel detectSimdLevel();
+	const char* simdLevelName(SimdLevel level);
+
+	// Kernels for the detected instruction set. Selected once, safe to call from any thread.
+	const MixKernels& kernels();
+
+	// Kernels for a specific instruction set, or nullptr if this CPU or build cannot run it.
+	const MixKernels* kernelsFor(SimdLevel level);
+};
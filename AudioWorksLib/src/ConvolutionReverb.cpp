@@ -0,0 +1,287 @@
+#include "pch.h"
+
+#include "includes/ConvolutionReverb.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include "includes/FFT.h"
+#include "includes/Resampler.h"
+#include "Bitmaths.h"
+
+namespace Banshee {
+
+	static const FFT& reverbFft() {
+		return *FFT::get(REVERB_FFT_SIZE);
+	}
+
+	static void forwardTransform(const float* samples, Spectrum& spectrum) {
+		reverbFft().forward(samples, spectrum.re, spectrum.im);
+	}
+
+	// Writes the last REVERB_PARTITION samples of the inverse, the part overlap-save keeps.
+	// scratch holds REVERB_FFT_SIZE floats.
+	static void inverseTransform(const Spectrum& spectrum, float* samples, float* scratch) {
+		reverbFft().inverse(spectrum.re, spectrum.im, scratch);
+		memcpy(samples, scratch + REVERB_PARTITION, REVERB_PARTITION * sizeof(float));
+	}
+
+	static void clearSpectrum(Spectrum& spectrum) {
+		memset(spectrum.re, 0, sizeof(spectrum.re));
+		memset(spectrum.im, 0, sizeof(spectrum.im));
+	}
+
+	ConvolutionReverb::ConvolutionReverb()
+		: tailInputs(REVERB_HEAD_PARTITIONS * 2), tailOutputs(REVERB_HEAD_PARTITIONS * 2) {
+		inputHistory.resize(REVERB_FFT_SIZE, 0.f);
+		headDelayLine.resize(REVERB_HEAD_PARTITIONS);
+		// Builds the plan now rather than on the audio thread.
+		reverbFft();
+	}
+
+	ConvolutionReverb::~ConvolutionReverb() {
+		unload();
+	}
+
+	bool ConvolutionReverb::load(const AudioReader& impulse, int sampleRate) {
+		unload();
+
+		const AudioFormat& format = impulse.getFormat();
+		if(!impulse.isOpen() || impulse.getFrameCount() == 0 || sampleRate <= 0) {
+			std::cout << "Impulse response is not open or empty" << std::endl;
+			return false;
+		}
+
+		FrameView frames = impulse.getFrames(0, impulse.getFrameCount());
+		int sourceChannels = format.channels;
+		size_t sourceFrames = frames.frameCount;
+
+		std::vector<float> interleaved(sourceFrames * sourceChannels);
+		convertToFloat(interleaved.data(), frames.data, format.sampleFormat, interleaved.size());
+
+		// Anything past the front pair is ignored.
+		channels = sourceChannels >= 2 ? 2 : 1;
+		std::vector<float> planar[2];
+		for(int c = 0; c < channels; c++) {
+			planar[c].resize(sourceFrames);
+			for(size_t i = 0; i < sourceFrames; i++) {
+				planar[c][i] = interleaved[i * sourceChannels + c];
+			}
+		}
+
+		if(format.sampleRate != sampleRate) {
+			double step = (double)format.sampleRate / sampleRate;
+			int outputFrames = (int)ceil(sourceFrames / step);
+			int needed = Resampler::sourceFrames(0.0, step, step, outputFrames);
+
+			for(int c = 0; c < channels; c++) {
+				std::vector<float> padded(needed, 0.f);
+				memcpy(&padded[RESAMPLE_HISTORY], planar[c].data(), sourceFrames * sizeof(float));
+
+				planar[c].assign(outputFrames, 0.f);
+				Resampler::process(ResampleQuality::SINC, planar[c].data(), padded.data(), 0.0, step, step, outputFrames);
+			}
+		}
+
+		size_t length = planar[0].size();
+		partitionCount = (int)((length + REVERB_PARTITION - 1) / REVERB_PARTITION);
+
+		// Each partition is zero padded to the transform size, samples in the first half.
+		std::vector<float> padded(REVERB_FFT_SIZE);
+		for(int c = 0; c < channels; c++) {
+			irSpectra[c].resize(partitionCount);
+			for(int p = 0; p < partitionCount; p++) {
+				std::fill(padded.begin(), padded.end(), 0.f);
+				size_t offset = (size_t)p * REVERB_PARTITION;
+				size_t count = length - offset < (size_t)REVERB_PARTITION ? length - offset : REVERB_PARTITION;
+				memcpy(padded.data(), &planar[c][offset], count * sizeof(float));
+
+				forwardTransform(padded.data(), irSpectra[c][p]);
+			}
+		}
+
+		std::fill(inputHistory.begin(), inputHistory.end(), 0.f);
+		for(Spectrum& spectrum : headDelayLine) {
+			clearSpectrum(spectrum);
+		}
+		headPosition = 0;
+		block = 0;
+		hasPendingTail = false;
+		lateTails = 0;
+
+		if(partitionCount > REVERB_HEAD_PARTITIONS) {
+			startWorker();
+		}
+
+		return true;
+	}
+
+	void ConvolutionReverb::unload() {
+		stopWorker();
+
+		partitionCount = 0;
+		channels = 0;
+		irSpectra[0].clear();
+		irSpectra[1].clear();
+	}
+
+	void ConvolutionReverb::startWorker() {
+		workerRunning.store(true, std::memory_order_release);
+		worker = std::thread(&ConvolutionReverb::workerLoop, this);
+	}
+
+	void ConvolutionReverb::stopWorker() {
+		if(!worker.joinable()) return;
+
+		workerRunning.store(false, std::memory_order_release);
+		wake.notify_one();
+		worker.join();
+
+		// Neither side is running, so both ends of the rings can be drained from here.
+		TailInput input;
+		while(tailInputs.pop(input)) {
+		}
+		TailOutput output;
+		while(tailOutputs.pop(output)) {
+		}
+	}
+
+	void ConvolutionReverb::process(const float* input, float* out, ScratchArena& scratch) {
+		if(partitionCount == 0) return;
+
+		const MixKernels& k = kernels();
+
+		size_t mark = scratch.getUsed();
+		Spectrum* accumulator = scratch.allocate<Spectrum>(1);
+		float* fftScratch = scratch.allocate<float>(REVERB_FFT_SIZE);
+		float* wetScratch = scratch.allocate<float>(REVERB_PARTITION * 2);
+		if(wetScratch == nullptr) {
+			scratch.rewind(mark);
+			return;
+		}
+
+		// Slide the overlap-save window along by one block.
+		memmove(inputHistory.data(), inputHistory.data() + REVERB_PARTITION, REVERB_PARTITION * sizeof(float));
+		float* fresh = inputHistory.data() + REVERB_PARTITION;
+		for(int i = 0; i < REVERB_PARTITION; i++) {
+			fresh[i] = (input[i * 2] + input[i * 2 + 1]) * 0.5f;
+		}
+
+		Spectrum& newest = headDelayLine[headPosition];
+		forwardTransform(inputHistory.data(), newest);
+
+		if(worker.joinable()) {
+			TailInput tail;
+			tail.block = block;
+			tail.spectrum = newest;
+			if(tailInputs.push(tail)) {
+				wake.notify_one();
+			}
+		}
+
+		int headCount = partitionCount < REVERB_HEAD_PARTITIONS ? partitionCount : REVERB_HEAD_PARTITIONS;
+		for(int c = 0; c < channels; c++) {
+			clearSpectrum(*accumulator);
+			for(int p = 0; p < headCount; p++) {
+				const Spectrum& x = headDelayLine[(headPosition - p + REVERB_HEAD_PARTITIONS) % REVERB_HEAD_PARTITIONS];
+				const Spectrum& h = irSpectra[c][p];
+				k.spectrumMac(accumulator->re, accumulator->im, x.re, x.im, h.re, h.im, REVERB_BINS);
+			}
+			inverseTransform(*accumulator, &wetScratch[c * REVERB_PARTITION], fftScratch);
+		}
+		if(channels == 1) {
+			memcpy(&wetScratch[REVERB_PARTITION], wetScratch, REVERB_PARTITION * sizeof(float));
+		}
+
+		// Pick up the tail for this block, dropping any the worker finished too late.
+		if(worker.joinable() && block >= (uint64_t)REVERB_HEAD_PARTITIONS) {
+			bool found = false;
+			while(true) {
+				if(!hasPendingTail) {
+					if(!tailOutputs.pop(pendingTail)) break;
+					hasPendingTail = true;
+				}
+				if(pendingTail.block < block) {
+					hasPendingTail = false;
+					continue;
+				}
+				if(pendingTail.block == block) {
+					found = true;
+					hasPendingTail = false;
+				}
+				break;
+			}
+
+			if(found) {
+				int tailChannel = channels == 1 ? 0 : 1;
+				for(int i = 0; i < REVERB_PARTITION; i++) {
+					wetScratch[i] += pendingTail.samples[0][i];
+					wetScratch[REVERB_PARTITION + i] += pendingTail.samples[tailChannel][i];
+				}
+			}
+			else {
+				lateTails.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		const float* left = wetScratch;
+		const float* right = left + REVERB_PARTITION;
+		k.panStereo(out, left, right, wetGain, wetGain, 0.f, 0.f, REVERB_PARTITION);
+
+		headPosition = (headPosition + 1) % REVERB_HEAD_PARTITIONS;
+		block++;
+		scratch.rewind(mark);
+	}
+
+	void ConvolutionReverb::workerLoop() {
+		const MixKernels& k = kernels();
+		const int tailCount = partitionCount - REVERB_HEAD_PARTITIONS;
+
+		std::vector<Spectrum> delayLine(tailCount);
+		for(Spectrum& spectrum : delayLine) {
+			clearSpectrum(spectrum);
+		}
+		int position = 0;
+		uint64_t expected = 0;
+
+		std::vector<float> scratch(REVERB_FFT_SIZE);
+		TailInput input;
+		TailOutput output;
+		Spectrum sum;
+
+		while(workerRunning.load(std::memory_order_acquire)) {
+			if(!tailInputs.pop(input)) {
+				std::unique_lock<std::mutex> lock(wakeMutex);
+				// The audio thread never takes the lock, so a wake up can be missed. The timeout covers it.
+				wake.wait_for(lock, std::chrono::milliseconds(2));
+				continue;
+			}
+
+			// Blocks dropped because the ring was full count as silence.
+			for(uint64_t gap = expected; gap < input.block && gap < expected + (uint64_t)tailCount; gap++) {
+				position = (position + 1) % tailCount;
+				clearSpectrum(delayLine[position]);
+			}
+			expected = input.block + 1;
+
+			position = (position + 1) % tailCount;
+			delayLine[position] = input.spectrum;
+
+			// Partition REVERB_HEAD_PARTITIONS + q against the input from q blocks ago
+			// is heard REVERB_HEAD_PARTITIONS blocks from now.
+			for(int c = 0; c < channels; c++) {
+				clearSpectrum(sum);
+				for(int q = 0; q < tailCount; q++) {
+					const Spectrum& x = delayLine[(position - q + tailCount) % tailCount];
+					const Spectrum& h = irSpectra[c][REVERB_HEAD_PARTITIONS + q];
+					k.spectrumMac(sum.re, sum.im, x.re, x.im, h.re, h.im, REVERB_BINS);
+				}
+				inverseTransform(sum, output.samples[c], scratch.data());
+			}
+
+			output.block = input.block + REVERB_HEAD_PARTITIONS;
+			tailOutputs.push(output);
+		}
+	}
+};
@@ -0,0 +1,197 @@
+#include "pch.h"
+
+#include "includes/DspGraph.h"
+
+#include <cstring>
+
+namespace Banshee {
+
+	void FilterEffect::process(float* buffer, int frames, ScratchArena&) {
+		const BiquadCoefficients& c = coefficients;
+		for(int ch = 0; ch < 2; ch++) {
+			float z1 = state[ch].z1;
+			float z2 = state[ch].z2;
+			for(int i = 0; i < frames; i++) {
+				float x = buffer[i * 2 + ch];
+				float y = c.b0 * x + z1;
+				z1 = c.b1 * x - c.a1 * y + z2;
+				z2 = c.b2 * x - c.a2 * y;
+				buffer[i * 2 + ch] = y;
+			}
+			state[ch].z1 = z1;
+			state[ch].z2 = z2;
+		}
+	}
+
+	void ReverbEffect::process(float* buffer, int frames, ScratchArena& scratch) {
+		if(reverb == nullptr || frames != REVERB_PARTITION) return;
+
+		float* input = scratch.allocate<float>(REVERB_PARTITION * 2);
+		if(input == nullptr) return;
+
+		memcpy(input, buffer, REVERB_PARTITION * 2 * sizeof(float));
+		memset(buffer, 0, REVERB_PARTITION * 2 * sizeof(float));
+		reverb->process(input, buffer, scratch);
+	}
+
+	void DspSchedule::reset() {
+		for(size_t i = 0; i < nodes.size(); i++) {
+			pending[i].store((int)nodes[i].inputCount, std::memory_order_relaxed);
+		}
+	}
+
+	DspGraph::DspGraph() {
+		buses.resize(1);
+	}
+
+	BusId DspGraph::addBus(BusId parent, float gain) {
+		if(buses.size() >= MAX_BUSES || parent >= buses.size()) {
+			return INVALID_BUS;
+		}
+
+		Bus bus;
+		bus.parent = parent;
+		bus.gain = gain;
+		buses.push_back(bus);
+		return (BusId)(buses.size() - 1);
+	}
+
+	bool DspGraph::setGain(BusId bus, float gain) {
+		if(bus >= buses.size()) return false;
+
+		buses[bus].gain = gain;
+		return true;
+	}
+
+	bool DspGraph::addEffect(BusId bus, AudioEffect* effect) {
+		if(bus >= buses.size() || effect == nullptr) return false;
+
+		buses[bus].effects.push_back(effect);
+		return true;
+	}
+
+	bool DspGraph::addSend(BusId from, BusId to, float gain) {
+		if(from >= buses.size() || to >= buses.size() || from == to) return false;
+
+		Send send;
+		send.from = from;
+		send.to = to;
+		send.gain = gain;
+		sends.push_back(send);
+		return true;
+	}
+
+	DspSchedule* DspGraph::compile(int frames) const {
+		const size_t count = buses.size();
+
+		// Edges between buses: every bus feeds its parent, sends feed their target.
+		struct Edge {
+			BusId from;
+			BusId to;
+			float gain;
+		};
+		std::vector<Edge> edges;
+		for(size_t b = 1; b < count; b++) {
+			Edge edge;
+			edge.from = (BusId)b;
+			edge.to = buses[b].parent;
+			edge.gain = buses[b].gain;
+			edges.push_back(edge);
+		}
+		for(const Send& send : sends) {
+			Edge edge;
+			edge.from = send.from;
+			edge.to = send.to;
+			edge.gain = buses[send.from].gain * send.gain;
+			edges.push_back(edge);
+		}
+
+		// Kahn's algorithm, each bus is placed once all of its inputs have been.
+		std::vector<int> inputCount(count, 0);
+		for(const Edge& edge : edges) {
+			inputCount[edge.to]++;
+		}
+
+		std::vector<int> remaining = inputCount;
+		std::vector<int> level(count, 0);
+		std::vector<BusId> order;
+		order.reserve(count);
+		for(size_t b = 0; b < count; b++) {
+			if(remaining[b] == 0) {
+				order.push_back((BusId)b);
+			}
+		}
+		for(size_t i = 0; i < order.size(); i++) {
+			BusId bus = order[i];
+			for(const Edge& edge : edges) {
+				if(edge.from != bus) continue;
+
+				level[edge.to] = level[edge.to] > level[bus] + 1 ? level[edge.to] : level[bus] + 1;
+				if(--remaining[edge.to] == 0) {
+					order.push_back(edge.to);
+				}
+			}
+		}
+
+		if(order.size() != count) {
+			std::cout << "DspGraph: the sends form a cycle, graph not compiled" << std::endl;
+			return nullptr;
+		}
+
+		DspSchedule* schedule = new DspSchedule();
+		schedule->frames = frames;
+		schedule->busNodes.assign(MAX_BUSES, 0);
+		for(size_t n = 0; n < count; n++) {
+			schedule->busNodes[order[n]] = (uint16_t)n;
+		}
+		schedule->masterNode = schedule->busNodes[MASTER_BUS];
+		schedule->masterBusGain = buses[MASTER_BUS].gain;
+		for(size_t b = count; b < MAX_BUSES; b++) {
+			schedule->busNodes[b] = (uint16_t)schedule->masterNode;
+		}
+
+		schedule->nodes.resize(count);
+		for(size_t n = 0; n < count; n++) {
+			BusId bus = order[n];
+			DspSchedule::Node& node = schedule->nodes[n];
+			node.bus = bus;
+
+			node.firstInput = (uint32_t)schedule->inputs.size();
+			for(const Edge& edge : edges) {
+				if(edge.to != bus) continue;
+
+				DspSchedule::Input input;
+				input.node = schedule->busNodes[edge.from];
+				input.gain = edge.gain;
+				schedule->inputs.push_back(input);
+			}
+			node.inputCount = (uint32_t)schedule->inputs.size() - node.firstInput;
+
+			node.firstEffect = (uint32_t)schedule->effects.size();
+			schedule->effects.insert(schedule->effects.end(), buses[bus].effects.begin(), buses[bus].effects.end());
+			node.effectCount = (uint32_t)buses[bus].effects.size();
+
+			node.firstConsumer = (uint32_t)schedule->consumers.size();
+			for(const Edge& edge : edges) {
+				if(edge.from == bus) {
+					schedule->consumers.push_back(schedule->busNodes[edge.to]);
+				}
+			}
+			node.consumerCount = (uint32_t)schedule->consumers.size() - node.firstConsumer;
+
+			if(node.inputCount == 0) {
+				schedule->sources.push_back((uint32_t)n);
+			}
+		}
+
+		std::vector<int> perLevel(count, 0);
+		for(size_t b = 0; b < count; b++) {
+			perLevel[level[b]]++;
+			schedule->width = schedule->width > perLevel[level[b]] ? schedule->width : perLevel[level[b]];
+		}
+
+		schedule->pending.reset(new std::atomic<int>[count]);
+		schedule->reset();
+		return schedule;
+	}
+};
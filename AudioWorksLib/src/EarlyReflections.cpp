@@ -0,0 +1,211 @@
+#include "pch.h"
+
+#include "includes/EarlyReflections.h"
+
+#include <cmath>
+
+#include "Bitmaths.h"
+
+namespace Banshee {
+
+	// Turning the listener further than about 2.5 degrees moves the pans enough to recompute.
+	constexpr float TURN_COSINE = 0.999f;
+
+	// Reflection index along x, y and z of every image source. 1 is the image in the positive wall,
+	// 2 the image of that in the negative wall, and so on. First order images come first.
+	static const int8_t IMAGE_LATTICE[MAX_REFLECTION_TAPS][3] = {
+		{-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1},
+		{-2, 0, 0}, {2, 0, 0}, {0, -2, 0}, {0, 2, 0}, {0, 0, -2}, {0, 0, 2},
+		{-1, -1, 0}, {-1, 1, 0}, {1, -1, 0}, {1, 1, 0},
+		{-1, 0, -1}, {-1, 0, 1}, {1, 0, -1}, {1, 0, 1},
+		{0, -1, -1}, {0, -1, 1}, {0, 1, -1}, {0, 1, 1}
+	};
+
+	int computeImageSources(const ReflectionRoom& room, const Listener& listener, const Vector3& emitter,
+		int order, float speedOfSound, ReflectionTap* taps) {
+		const int count = order >= 2 ? MAX_REFLECTION_TAPS : ROOM_WALLS;
+
+		const float centre[3] = { room.centre.x, room.centre.y, room.centre.z };
+		const float size[3] = { fabsf(room.size.x), fabsf(room.size.y), fabsf(room.size.z) };
+		const float source[3] = { emitter.x, emitter.y, emitter.z };
+		const float ear[3] = { listener.position.x, listener.position.y, listener.position.z };
+
+		bool inside = true;
+		float low[3], high[3];
+		for(int axis = 0; axis < 3; axis++) {
+			low[axis] = centre[axis] - size[axis] * 0.5f;
+			high[axis] = centre[axis] + size[axis] * 0.5f;
+			inside = inside && source[axis] >= low[axis] && source[axis] <= high[axis]
+				&& ear[axis] >= low[axis] && ear[axis] <= high[axis];
+		}
+
+		const float direct = sqrtf(distanceSquared(listener.position, emitter));
+		// The direct sound is at full level inside one unit, so the reflections are measured against that too.
+		const float reference = direct > 1.f ? direct : 1.f;
+
+		for(int t = 0; t < count; t++) {
+			float image[3];
+			float gain = 1.f;
+			int bounces = 0;
+			for(int axis = 0; axis < 3; axis++) {
+				const float lowWall = room.reflectivity[axis * 2];
+				const float highWall = room.reflectivity[axis * 2 + 1];
+				const int n = IMAGE_LATTICE[t][axis];
+				switch(n) {
+				case 1:
+					image[axis] = 2.f * high[axis] - source[axis];
+					gain *= highWall;
+					break;
+				case -1:
+					image[axis] = 2.f * low[axis] - source[axis];
+					gain *= lowWall;
+					break;
+				case 2:
+					image[axis] = source[axis] + 2.f * size[axis];
+					gain *= lowWall * highWall;
+					break;
+				case -2:
+					image[axis] = source[axis] - 2.f * size[axis];
+					gain *= lowWall * highWall;
+					break;
+				default:
+					image[axis] = source[axis];
+					break;
+				}
+				bounces += n < 0 ? -n : n;
+			}
+
+			float ox = image[0] - ear[0];
+			float oy = image[1] - ear[1];
+			float oz = image[2] - ear[2];
+			float distance = sqrtf(ox * ox + oy * oy + oz * oz);
+			float delay = (distance - direct) / speedOfSound;
+
+			ReflectionTap& tap = taps[t];
+			tap.order = bounces;
+			tap.delay = clampf(delay, 0.f, MAX_REFLECTION_DELAY);
+			tap.pan = clampf((ox * listener.right.x + oy * listener.right.y + oz * listener.right.z) / (distance > 1e-6f ? distance : 1e-6f), -1.f, 1.f);
+			tap.gain = inside && delay <= MAX_REFLECTION_DELAY ? gain * reference / (distance > 1.f ? distance : 1.f) : 0.f;
+		}
+		return count;
+	}
+
+	EarlyReflections::EarlyReflections(int sampleRate, int blockFrames)
+		: sampleRate(sampleRate), blockFrames(blockFrames), updates(4), bank(MAX_REFLECTION_TAPS, blockFrames) {
+		// Longest delay plus the block being written, and a sample for the interpolation.
+		size_t length = 1;
+		while(length < (size_t)(MAX_REFLECTION_DELAY * sampleRate) + blockFrames + 2) {
+			length <<= 1;
+		}
+		delayLine.assign(length, 0.f);
+		delayMask = (uint32_t)length - 1;
+	}
+
+	void EarlyReflections::setRoom(const ReflectionRoom& value) {
+		room = value;
+		changed = true;
+	}
+
+	void EarlyReflections::setOrder(int value) {
+		order = value >= 2 ? 2 : 1;
+		changed = true;
+	}
+
+	bool EarlyReflections::needsRecompute(const Listener& listener, const Vector3& emitter) const {
+		const float threshold = moveThreshold * moveThreshold;
+		// Pans only depend on the right vector.
+		float turn = listener.right.x * lastListener.right.x + listener.right.y * lastListener.right.y + listener.right.z * lastListener.right.z;
+		return changed || distanceSquared(listener.position, lastListener.position) > threshold
+			|| distanceSquared(emitter, lastEmitter) > threshold || turn < TURN_COSINE;
+	}
+
+	void EarlyReflections::update(const Listener& listener, const Vector3& emitter) {
+		if(!needsRecompute(listener, emitter)) return;
+
+		tapCount = computeImageSources(room, listener, emitter, order, speedOfSound, taps);
+
+		TapSet set;
+		set.count = tapCount;
+		for(int t = 0; t < tapCount; t++) {
+			TapTarget& target = set.taps[t];
+			target.delaySamples = taps[t].delay * sampleRate;
+			// The constant power law the mixer uses for mono voices.
+			float angle = (taps[t].pan + 1.f) * QUARTER_PI_f;
+			target.gainL = cosf(angle) * taps[t].gain;
+			target.gainR = sinf(angle) * taps[t].gain;
+			target.filter = BiquadCoefficients::design(FilterType::LOW_PASS, room.wallCutoff / taps[t].order, BUTTERWORTH_Q, 0.f, sampleRate);
+		}
+
+		// With the ring full the audio thread is not running, try again next tick.
+		if(!updates.push(set)) return;
+
+		lastListener = listener;
+		lastEmitter = emitter;
+		changed = false;
+		recomputes++;
+	}
+
+	void EarlyReflections::process(float* buffer, int frames, ScratchArena& scratch) {
+		if(frames != blockFrames) return;
+
+		// Only the newest set matters.
+		while(updates.pop(target)) {}
+
+		const uint32_t start = writePosition;
+		for(int i = 0; i < frames; i++) {
+			delayLine[(start + i) & delayMask] = 0.5f * (buffer[i * 2] + buffer[i * 2 + 1]);
+		}
+		writePosition += frames;
+
+		size_t mark = scratch.getUsed();
+		float* input = scratch.allocate<float>(frames);
+		float* output = scratch.allocate<float>(frames);
+		if(input == nullptr || output == nullptr) {
+			scratch.rewind(mark);
+			return;
+		}
+		const float* line = delayLine.data();
+		const float rampStep = 1.f / frames;
+
+		int laneTaps[MAX_REFLECTION_TAPS];
+		int lanes = 0;
+		const int count = current.count > target.count ? current.count : target.count;
+		for(int t = 0; t < count; t++) {
+			const TapTarget& from = current.taps[t];
+			const TapTarget& to = target.taps[t];
+			if(from.gainL == 0.f && from.gainR == 0.f && to.gainL == 0.f && to.gainR == 0.f) {
+				filterState[t] = BiquadState();
+				continue;
+			}
+
+			// The delay glides with the rest of the tap, read between samples.
+			float delayStep = (to.delaySamples - from.delaySamples) * rampStep;
+			for(int i = 0; i < frames; i++) {
+				float delay = from.delaySamples + delayStep * (i + 1);
+				int whole = (int)delay;
+				float fraction = delay - whole;
+				uint32_t index = start + i - whole;
+				input[i] = line[index & delayMask] + (line[(index - 1) & delayMask] - line[index & delayMask]) * fraction;
+			}
+
+			bank.setLane(lanes, from.filter, to.filter, filterState[t]);
+			bank.loadLane(lanes, input);
+			laneTaps[lanes++] = t;
+		}
+
+		bank.process(lanes);
+
+		const MixKernels& k = kernels();
+		for(int lane = 0; lane < lanes; lane++) {
+			const int t = laneTaps[lane];
+			filterState[t] = bank.storeLane(lane, output);
+
+			const TapTarget& from = current.taps[t];
+			const TapTarget& to = target.taps[t];
+			k.panMono(buffer, output, from.gainL, from.gainR, (to.gainL - from.gainL) * rampStep, (to.gainR - from.gainR) * rampStep, frames);
+		}
+
+		current = target;
+		scratch.rewind(mark);
+	}
+};
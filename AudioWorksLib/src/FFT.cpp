@@ -0,0 +1,258 @@
+#include "pch.h"
+
+#include "includes/FFT.h"
+
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "Bitmaths.h"
+
+namespace Banshee {
+
+	// Builds the swaps that apply dst[i] = src[from(i)] in place, one cycle of the permutation at a time.
+	template<typename From>
+	static std::vector<uint32_t> permutationSwaps(uint32_t count, From from) {
+		std::vector<uint32_t> swaps;
+		std::vector<bool> visited(count, false);
+
+		for(uint32_t start = 0; start < count; start++) {
+			if(visited[start]) continue;
+
+			uint32_t i = start;
+			visited[i] = true;
+			while(from(i) != start) {
+				uint32_t next = from(i);
+				swaps.push_back(i);
+				swaps.push_back(next);
+				visited[next] = true;
+				i = next;
+			}
+		}
+		return swaps;
+	}
+
+	const FFT* FFT::get(int size) {
+		if(size < 4 || size > MAX_FFT_SIZE || (size & (size - 1)) != 0) {
+			return nullptr;
+		}
+
+		static std::mutex lock;
+		static std::map<int, std::unique_ptr<FFT>> plans;
+
+		std::lock_guard<std::mutex> guard(lock);
+		std::unique_ptr<FFT>& plan = plans[size];
+		if(!plan) {
+			plan.reset(new FFT(size));
+		}
+		return plan.get();
+	}
+
+	FFT::FFT(int size) : size(size), half(size / 2) {
+		int bits = 0;
+		while((1 << bits) < half) {
+			bits++;
+		}
+
+		bitReverse.resize(half);
+		for(int i = 0; i < half; i++) {
+			uint32_t reversed = 0;
+			for(int b = 0; b < bits; b++) {
+				reversed |= (uint32_t)((i >> b) & 1) << (bits - 1 - b);
+			}
+			bitReverse[i] = reversed;
+		}
+
+		// Even samples become the real parts and odd samples the imaginary parts, both bit reversed.
+		const uint32_t m = (uint32_t)half;
+		const std::vector<uint32_t>& reverse = bitReverse;
+		packSwaps = permutationSwaps((uint32_t)size, [m, &reverse](uint32_t i) {
+			return i < m ? reverse[i] * 2 : reverse[i - m] * 2 + 1;
+		});
+		unpackSwaps = permutationSwaps((uint32_t)size, [m](uint32_t i) {
+			return (i & 1) ? m + i / 2 : i / 2;
+		});
+
+		// An odd number of radix-2 stages leaves one radix-2 stage before the radix-4 ones.
+		radix2First = (bits & 1) != 0;
+		size_t quarter = radix2First ? 2 : 1;
+		for(; quarter * 4 <= (size_t)half; quarter *= 4) {
+			Stage stage;
+			stage.quarter = quarter;
+			stage.offset = stageTwiddles.size();
+			stages.push_back(stage);
+
+			stageTwiddles.resize(stage.offset + quarter * 4);
+			float* w = &stageTwiddles[stage.offset];
+			for(size_t k = 0; k < quarter; k++) {
+				double a1 = -TWO_PI_d * (double)k / (double)(quarter * 2);
+				double a2 = -TWO_PI_d * (double)k / (double)(quarter * 4);
+				w[k] = (float)cos(a1);
+				w[quarter + k] = (float)sin(a1);
+				w[quarter * 2 + k] = (float)cos(a2);
+				w[quarter * 3 + k] = (float)sin(a2);
+			}
+		}
+
+		splitCos.resize(half / 2 + 1);
+		splitSin.resize(half / 2 + 1);
+		for(int k = 0; k <= half / 2; k++) {
+			splitCos[k] = (float)cos(TWO_PI_d * k / size);
+			splitSin[k] = (float)sin(TWO_PI_d * k / size);
+		}
+	}
+
+	void FFT::applySwaps(float* data, const std::vector<uint32_t>& swaps) {
+		for(size_t i = 0; i < swaps.size(); i += 2) {
+			float t = data[swaps[i]];
+			data[swaps[i]] = data[swaps[i + 1]];
+			data[swaps[i + 1]] = t;
+		}
+	}
+
+	void FFT::transform(float* re, float* im) const {
+		if(radix2First) {
+			for(int i = 0; i < half; i += 2) {
+				float r = re[i + 1];
+				float m = im[i + 1];
+				re[i + 1] = re[i] - r;
+				im[i + 1] = im[i] - m;
+				re[i] += r;
+				im[i] += m;
+			}
+		}
+
+		const MixKernels& k = kernels();
+		for(const Stage& stage : stages) {
+			k.fftRadix4(re, im, &stageTwiddles[stage.offset], stage.quarter, (size_t)half);
+		}
+	}
+
+	float FFT::splitSpectrum(float* re, float* im) const {
+		float nyquist = re[0] - im[0];
+		re[0] = re[0] + im[0];
+		im[0] = 0.f;
+
+		// Bins k and half - k come from the same two complex values, so they are done together.
+		for(int k = 1; k <= half / 2; k++) {
+			int j = half - k;
+			float zkr = re[k];
+			float zki = im[k];
+			float zjr = re[j];
+			float zji = im[j];
+
+			// Spectra of the even and odd samples.
+			float er = 0.5f * (zkr + zjr);
+			float ei = 0.5f * (zki - zji);
+			float orr = 0.5f * (zki + zji);
+			float oi = -0.5f * (zkr - zjr);
+
+			// W(N)^k * odd, with W(N)^k = cos - i sin.
+			float wr = splitCos[k];
+			float wi = -splitSin[k];
+			float tr = wr * orr - wi * oi;
+			float ti = wr * oi + wi * orr;
+
+			re[k] = er + tr;
+			im[k] = ei + ti;
+			re[j] = er - tr;
+			im[j] = -(ei - ti);
+		}
+
+		return nyquist;
+	}
+
+	void FFT::mergeSpectrum(const float* srcRe, const float* srcIm, float nyquist, float* dstRe, float* dstIm, bool bitReversed) const {
+		float dc = srcRe[0];
+		dstRe[0] = 0.5f * (dc + nyquist);
+		dstIm[0] = 0.5f * (dc - nyquist);
+
+		for(int k = 1; k <= half / 2; k++) {
+			int j = half - k;
+			float xkr = srcRe[k];
+			float xki = srcIm[k];
+			float xjr = srcRe[j];
+			float xji = srcIm[j];
+
+			float er = 0.5f * (xkr + xjr);
+			float ei = 0.5f * (xki - xji);
+			float dr = 0.5f * (xkr - xjr);
+			float di = 0.5f * (xki + xji);
+
+			// odd = difference * W(N)^-k, with W(N)^-k = cos + i sin.
+			float wr = splitCos[k];
+			float wi = splitSin[k];
+			float orr = dr * wr - di * wi;
+			float oi = dr * wi + di * wr;
+
+			// Z[k] = even + i * odd, Z[j] = conj(even) + i * conj(odd).
+			int dk = bitReversed ? (int)bitReverse[k] : k;
+			int dj = bitReversed ? (int)bitReverse[j] : j;
+			dstRe[dk] = er - oi;
+			dstIm[dk] = ei + orr;
+			dstRe[dj] = er + oi;
+			dstIm[dj] = orr - ei;
+		}
+	}
+
+	void FFT::forward(const float* input, float* re, float* im) const {
+		for(int i = 0; i < half; i++) {
+			uint32_t source = bitReverse[i] * 2;
+			re[i] = input[source];
+			im[i] = input[source + 1];
+		}
+
+		transform(re, im);
+		re[half] = splitSpectrum(re, im);
+		im[half] = 0.f;
+	}
+
+	void FFT::inverse(const float* re, const float* im, float* output) const {
+		// output doubles as the split work arrays.
+		float* workRe = output;
+		float* workIm = output + half;
+		mergeSpectrum(re, im, re[half], workRe, workIm, true);
+
+		// Swapping the real and imaginary parts turns the forward transform into an inverse.
+		transform(workIm, workRe);
+		applySwaps(output, unpackSwaps);
+
+		const float scale = 1.f / half;
+		for(int i = 0; i < size; i++) {
+			output[i] *= scale;
+		}
+	}
+
+	void FFT::forwardInPlace(float* data) const {
+		applySwaps(data, packSwaps);
+		transform(data, data + half);
+		data[half] = splitSpectrum(data, data + half);
+	}
+
+	void FFT::inverseInPlace(float* data) const {
+		float* re = data;
+		float* im = data + half;
+		mergeSpectrum(re, im, im[0], re, im, false);
+
+		for(int i = 0; i < half; i++) {
+			uint32_t j = bitReverse[i];
+			if(j > (uint32_t)i) {
+				float t = re[i];
+				re[i] = re[j];
+				re[j] = t;
+				t = im[i];
+				im[i] = im[j];
+				im[j] = t;
+			}
+		}
+
+		transform(im, re);
+		applySwaps(data, unpackSwaps);
+
+		const float scale = 1.f / half;
+		for(int i = 0; i < size; i++) {
+			data[i] *= scale;
+		}
+	}
+};
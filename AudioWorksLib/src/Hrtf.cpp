@@ -0,0 +1,358 @@
+#include "pch.h"
+
+#include "includes/Hrtf.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "includes/AudioReader.h"
+#include "includes/Resampler.h"
+#include "Bitmaths.h"
+
+namespace Banshee {
+
+	static const char HRIR_MAGIC[4] = { 'H', 'R', 'I', 'R' };
+
+	constexpr float RAD_TO_DEG_f = 57.29577951f;
+	// An impulse response starts at its first sample within 20 dB of its peak.
+	constexpr float ONSET_THRESHOLD = 0.1f;
+	// Samples kept ahead of the onset for the ringing of a band limited attack.
+	constexpr int ONSET_MARGIN = 4;
+	// Measurements blended into every grid point.
+	constexpr int GRID_NEIGHBOURS = 3;
+	// A measurement closer than this to a grid point, in radians, is used on its own.
+	constexpr float GRID_EXACT_ANGLE = 0.005f;
+
+	// Unit vector of a direction in degrees, in listener axes.
+	static void measurementDirection(float azimuth, float elevation, float* direction) {
+		float a = azimuth * DEG_TO_RAD_f;
+		float e = elevation * DEG_TO_RAD_f;
+		direction[0] = -sinf(a) * cosf(e);
+		direction[1] = sinf(e);
+		direction[2] = cosf(a) * cosf(e);
+	}
+
+	static int findOnset(const std::vector<float>& response) {
+		float peak = 0.f;
+		for(float sample : response) {
+			peak = fabsf(sample) > peak ? fabsf(sample) : peak;
+		}
+
+		int onset = 0;
+		while(onset < (int)response.size() && fabsf(response[onset]) < peak * ONSET_THRESHOLD) {
+			onset++;
+		}
+		return onset > ONSET_MARGIN ? onset - ONSET_MARGIN : 0;
+	}
+
+	bool HrtfSet::load(const std::string& path, int rate) {
+		unload();
+
+		MappedFile file;
+		if(!file.open(path)) {
+			std::cout << "Could not map HRIR set: " << path << std::endl;
+			return false;
+		}
+
+		const HrirHeader* header = (const HrirHeader*)file.data();
+		bool valid = file.size() >= sizeof(HrirHeader) && memcmp(header->magic, HRIR_MAGIC, sizeof(HRIR_MAGIC)) == 0;
+		if(valid && header->version != HRIR_VERSION) {
+			std::cout << "HRIR set version " << header->version << " is not supported: " << path << std::endl;
+			return false;
+		}
+
+		const uint64_t measurementBytes = valid ? (uint64_t)header->measurementCount * sizeof(HrtfMeasurement) : 0;
+		const uint64_t sampleBytes = valid ? (uint64_t)header->measurementCount * 2 * header->length * sizeof(float) : 0;
+		valid = valid && header->measurementCount > 0 && header->length > 0 && header->sampleRate > 0
+			&& sizeof(HrirHeader) + measurementBytes + sampleBytes == file.size();
+		if(!valid) {
+			std::cout << "Corrupt HRIR set: " << path << std::endl;
+			return false;
+		}
+
+		const HrtfMeasurement* measurements = (const HrtfMeasurement*)(file.data() + sizeof(HrirHeader));
+		const float* samples = (const float*)(file.data() + sizeof(HrirHeader) + measurementBytes);
+		return build(measurements, (int)header->measurementCount, samples, (int)header->length, (int)header->sampleRate, rate);
+	}
+
+	bool HrtfSet::build(const HrtfMeasurement* measurements, int count, const float* samples, int length, int sourceRate, int rate) {
+		unload();
+
+		if(count <= 0 || length <= 0 || sourceRate <= 0 || rate <= 0) {
+			std::cout << "HRIR set is empty" << std::endl;
+			return false;
+		}
+
+		// Every response at the mixer rate, left and right of each measurement.
+		std::vector<std::vector<float>> responses(count * 2);
+		for(int r = 0; r < count * 2; r++) {
+			const float* source = samples + (size_t)r * length;
+			if(sourceRate == rate) {
+				responses[r].assign(source, source + length);
+				continue;
+			}
+
+			double step = (double)sourceRate / rate;
+			int outputFrames = (int)ceil(length / step);
+			int needed = Resampler::sourceFrames(0.0, step, step, outputFrames);
+			std::vector<float> padded(needed, 0.f);
+			memcpy(&padded[RESAMPLE_HISTORY], source, length * sizeof(float));
+
+			responses[r].assign(outputFrames, 0.f);
+			Resampler::process(ResampleQuality::SINC, responses[r].data(), padded.data(), 0.0, step, step, outputFrames);
+		}
+
+		// The set's common onset is only the distance it was measured at, the rest is the
+		// interaural delay and stays in the ear delays.
+		std::vector<int> onsets(count * 2);
+		int firstOnset = 0x7FFFFFFF;
+		int longest = 0;
+		for(int r = 0; r < count * 2; r++) {
+			onsets[r] = findOnset(responses[r]);
+			firstOnset = onsets[r] < firstOnset ? onsets[r] : firstOnset;
+			int kept = (int)responses[r].size() - onsets[r];
+			longest = kept > longest ? kept : longest;
+		}
+		longest = longest < HRTF_MAX_LENGTH ? longest : HRTF_MAX_LENGTH;
+		partitions = (longest + REVERB_PARTITION - 1) / REVERB_PARTITION;
+		const int taps = partitions * REVERB_PARTITION;
+
+		// Aligned responses, taps each.
+		std::vector<float> aligned((size_t)count * 2 * taps, 0.f);
+		std::vector<float> delays(count * 2);
+		double energy = 0.0;
+		for(int r = 0; r < count * 2; r++) {
+			int kept = (int)responses[r].size() - onsets[r];
+			kept = kept < taps ? kept : taps;
+			memcpy(&aligned[(size_t)r * taps], &responses[r][onsets[r]], kept * sizeof(float));
+			delays[r] = (float)(onsets[r] - firstOnset < HRTF_MAX_DELAY ? onsets[r] - firstOnset : HRTF_MAX_DELAY);
+			for(int i = 0; i < kept; i++) {
+				energy += (double)responses[r][onsets[r] + i] * responses[r][onsets[r] + i];
+			}
+		}
+		const float scale = energy > 0.0 ? (float)sqrt(count * 2 / energy) : 1.f;
+
+		std::vector<float> directions(count * 3);
+		for(int m = 0; m < count; m++) {
+			measurementDirection(measurements[m].azimuth, measurements[m].elevation, &directions[m * 3]);
+		}
+
+		fft = FFT::get(REVERB_FFT_SIZE);
+		const int points = HRTF_GRID_AZIMUTHS * HRTF_GRID_ELEVATIONS;
+		grid.resize((size_t)points * 2 * partitions);
+		gridDelays.resize(points * 2);
+
+		std::vector<float> blended(taps);
+		std::vector<float> padded(REVERB_FFT_SIZE);
+		for(int e = 0; e < HRTF_GRID_ELEVATIONS; e++) {
+			for(int a = 0; a < HRTF_GRID_AZIMUTHS; a++) {
+				const int point = e * HRTF_GRID_AZIMUTHS + a;
+				float direction[3];
+				measurementDirection((float)(a * HRTF_GRID_STEP), (float)(e * HRTF_GRID_STEP - 90), direction);
+
+				// Nearest measurements, closest first.
+				int nearest[GRID_NEIGHBOURS];
+				float closeness[GRID_NEIGHBOURS];
+				int found = 0;
+				for(int m = 0; m < count; m++) {
+					const float* d = &directions[m * 3];
+					float dot = d[0] * direction[0] + d[1] * direction[1] + d[2] * direction[2];
+					int slot = found < GRID_NEIGHBOURS ? found++ : GRID_NEIGHBOURS;
+					while(slot > 0 && closeness[slot - 1] < dot) {
+						if(slot < GRID_NEIGHBOURS) {
+							nearest[slot] = nearest[slot - 1];
+							closeness[slot] = closeness[slot - 1];
+						}
+						slot--;
+					}
+					if(slot < GRID_NEIGHBOURS) {
+						nearest[slot] = m;
+						closeness[slot] = dot;
+					}
+				}
+
+				// Inverse angle weights, unless a measurement is right on the point.
+				const bool exact = acosf(clampf(closeness[0], -1.f, 1.f)) < GRID_EXACT_ANGLE;
+				float weights[GRID_NEIGHBOURS];
+				float total = 0.f;
+				for(int n = 0; n < found; n++) {
+					weights[n] = exact ? (n == 0 ? 1.f : 0.f) : 1.f / acosf(clampf(closeness[n], -1.f, 1.f));
+					total += weights[n];
+				}
+
+				for(int ear = 0; ear < 2; ear++) {
+					std::fill(blended.begin(), blended.end(), 0.f);
+					float delay = 0.f;
+					for(int n = 0; n < found; n++) {
+						const int r = nearest[n] * 2 + ear;
+						const float weight = weights[n] / total;
+						for(int i = 0; i < taps; i++) {
+							blended[i] += aligned[(size_t)r * taps + i] * weight * scale;
+						}
+						delay += delays[r] * weight;
+					}
+					gridDelays[point * 2 + ear] = delay;
+
+					// Samples in the first half of each transform, as overlap-save expects.
+					for(int p = 0; p < partitions; p++) {
+						std::fill(padded.begin(), padded.end(), 0.f);
+						memcpy(padded.data(), &blended[p * REVERB_PARTITION], REVERB_PARTITION * sizeof(float));
+						Spectrum& spectrum = grid[((size_t)point * 2 + ear) * partitions + p];
+						fft->forward(padded.data(), spectrum.re, spectrum.im);
+					}
+				}
+			}
+		}
+
+		sampleRate = rate;
+		measurementCount = count;
+		return true;
+	}
+
+	void HrtfSet::unload() {
+		partitions = 0;
+		measurementCount = 0;
+		grid.clear();
+		gridDelays.clear();
+	}
+
+	void HrtfSet::interpolate(float x, float y, float z, HrtfFilter& filter) const {
+		const MixKernels& k = kernels();
+
+		float azimuth = atan2f(-x, z) * RAD_TO_DEG_f;
+		azimuth = azimuth < 0.f ? azimuth + 360.f : azimuth;
+		float elevation = asinf(clampf(y, -1.f, 1.f)) * RAD_TO_DEG_f;
+
+		float column = azimuth / HRTF_GRID_STEP;
+		int a0 = (int)column;
+		float ta = column - a0;
+		a0 = a0 % HRTF_GRID_AZIMUTHS;
+		int a1 = (a0 + 1) % HRTF_GRID_AZIMUTHS;
+
+		float row = clampf((elevation + 90.f) / HRTF_GRID_STEP, 0.f, (float)(HRTF_GRID_ELEVATIONS - 1));
+		int e0 = (int)row < HRTF_GRID_ELEVATIONS - 1 ? (int)row : HRTF_GRID_ELEVATIONS - 2;
+		float te = row - e0;
+
+		const int corners[4] = {
+			e0 * HRTF_GRID_AZIMUTHS + a0,
+			e0 * HRTF_GRID_AZIMUTHS + a1,
+			(e0 + 1) * HRTF_GRID_AZIMUTHS + a0,
+			(e0 + 1) * HRTF_GRID_AZIMUTHS + a1
+		};
+		const float weights[4] = {
+			(1.f - ta) * (1.f - te),
+			ta * (1.f - te),
+			(1.f - ta) * te,
+			ta * te
+		};
+
+		for(int ear = 0; ear < 2; ear++) {
+			filter.delay[ear] = 0.f;
+			for(int p = 0; p < partitions; p++) {
+				memset(filter.ears[ear][p].re, 0, sizeof(filter.ears[ear][p].re));
+				memset(filter.ears[ear][p].im, 0, sizeof(filter.ears[ear][p].im));
+			}
+
+			for(int c = 0; c < 4; c++) {
+				if(weights[c] <= 0.f) continue;
+				filter.delay[ear] += gridDelays[corners[c] * 2 + ear] * weights[c];
+				const Spectrum* spectra = &grid[((size_t)corners[c] * 2 + ear) * partitions];
+				for(int p = 0; p < partitions; p++) {
+					k.mixGain(filter.ears[ear][p].re, spectra[p].re, weights[c], REVERB_BINS);
+					k.mixGain(filter.ears[ear][p].im, spectra[p].im, weights[c], REVERB_BINS);
+				}
+			}
+		}
+	}
+
+	void HrtfConvolver::reset() {
+		memset(inputHistory, 0, sizeof(inputHistory));
+		for(Spectrum& spectrum : inputs) {
+			memset(spectrum.re, 0, sizeof(spectrum.re));
+			memset(spectrum.im, 0, sizeof(spectrum.im));
+		}
+		memset(earHistory, 0, sizeof(earHistory));
+		position = 0;
+		current = 0;
+		primed = false;
+	}
+
+	void HrtfConvolver::process(const HrtfSet& set, const float* input, int frames, const float* target,
+		float gainFrom, float gainTo, float* out, ScratchArena& scratch) {
+		const MixKernels& k = kernels();
+		const FFT& fft = *set.getFft();
+		const int partitions = set.getPartitionCount();
+		const int history = HRTF_MAX_DELAY + 1;
+
+		size_t mark = scratch.getUsed();
+		Spectrum* accumulator = scratch.allocate<Spectrum>(1);
+		float* fftScratch = scratch.allocate<float>(REVERB_FFT_SIZE);
+		float* wet = scratch.allocate<float>(REVERB_PARTITION * 2);
+		float* fading = scratch.allocate<float>(REVERB_PARTITION * 2);
+		float* line = scratch.allocate<float>(history + REVERB_PARTITION);
+		if(line == nullptr) {
+			scratch.rewind(mark);
+			return;
+		}
+
+		// A new voice starts on its filter, later moves crossfade to it.
+		const bool moved = !primed || target[0] != direction[0] || target[1] != direction[1] || target[2] != direction[2];
+		const bool crossfade = moved && primed;
+		if(moved) {
+			current ^= crossfade ? 1 : 0;
+			set.interpolate(target[0], target[1], target[2], filters[current]);
+			memcpy(direction, target, sizeof(direction));
+		}
+		primed = true;
+		const HrtfFilter& filter = filters[current];
+		const HrtfFilter& previous = filters[crossfade ? current ^ 1 : current];
+
+		// Slide the overlap-save window along by one block, a voice that ended early is padded.
+		memmove(inputHistory, inputHistory + REVERB_PARTITION, REVERB_PARTITION * sizeof(float));
+		memcpy(inputHistory + REVERB_PARTITION, input, frames * sizeof(float));
+		memset(inputHistory + REVERB_PARTITION + frames, 0, (REVERB_PARTITION - frames) * sizeof(float));
+		position = (position + 1) % partitions;
+		fft.forward(inputHistory, inputs[position].re, inputs[position].im);
+
+		for(int ear = 0; ear < 2; ear++) {
+			float* block = wet + ear * REVERB_PARTITION;
+			for(int pass = 0; pass < (crossfade ? 2 : 1); pass++) {
+				const Spectrum* spectra = pass == 0 ? filter.ears[ear] : previous.ears[ear];
+				memset(accumulator->re, 0, sizeof(accumulator->re));
+				memset(accumulator->im, 0, sizeof(accumulator->im));
+				for(int p = 0; p < partitions; p++) {
+					const Spectrum& x = inputs[(position - p + partitions) % partitions];
+					k.spectrumMac(accumulator->re, accumulator->im, x.re, x.im, spectra[p].re, spectra[p].im, REVERB_BINS);
+				}
+				fft.inverse(accumulator->re, accumulator->im, fftScratch);
+				memcpy(pass == 0 ? block : fading + ear * REVERB_PARTITION, fftScratch + REVERB_PARTITION, REVERB_PARTITION * sizeof(float));
+			}
+
+			if(crossfade) {
+				const float* old = fading + ear * REVERB_PARTITION;
+				for(int i = 0; i < REVERB_PARTITION; i++) {
+					block[i] = old[i] + (block[i] - old[i]) * (i + 1) * (1.f / REVERB_PARTITION);
+				}
+			}
+
+			// Ear delay, gliding to the new one over the block with linear interpolation.
+			memcpy(line, earHistory[ear], history * sizeof(float));
+			memcpy(line + history, block, REVERB_PARTITION * sizeof(float));
+			const float from = previous.delay[ear];
+			const float step = (filter.delay[ear] - from) * (1.f / REVERB_PARTITION);
+			for(int i = 0; i < REVERB_PARTITION; i++) {
+				float delay = from + step * (i + 1);
+				int whole = (int)delay;
+				float fraction = delay - whole;
+				const float* tap = line + history + i - whole;
+				block[i] = tap[0] + (tap[-1] - tap[0]) * fraction;
+			}
+			memcpy(earHistory[ear], line + REVERB_PARTITION, history * sizeof(float));
+		}
+
+		const float step = (gainTo - gainFrom) * (1.f / REVERB_PARTITION);
+		k.panStereo(out, wet, wet + REVERB_PARTITION, gainFrom, gainFrom, step, step, frames);
+		scratch.rewind(mark);
+	}
+};
@@ -0,0 +1,1159 @@
+#include "pch.h"
+
+#include "includes/Mixer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "includes/Adpcm.h"
+#include "Bitmaths.h"
+
+namespace Banshee {
+
+	// Mono sources use a constant power pan law, stereo sources are balanced linearly.
+	static void panGains(float pan, float gain, int channels, float& left, float& right) {
+		pan = clampf(pan, -1.f, 1.f);
+
+		if(channels == 1) {
+			float angle = (pan + 1.f) * QUARTER_PI_f;
+			left = cosf(angle) * gain;
+			right = sinf(angle) * gain;
+			return;
+		}
+
+		left = (pan > 0.f ? 1.f - pan : 1.f) * gain;
+		right = (pan < 0.f ? 1.f + pan : 1.f) * gain;
+	}
+
+	// Voices that were mixed last block count as this much louder when picking the real voices,
+	// so two voices of similar loudness do not keep swapping places.
+	constexpr float REAL_VOICE_HYSTERESIS = 1.25f;
+
+	// Fraction of the remaining distance to the doppler target covered per block.
+	// About 12 ms to settle at 48 kHz, shorter than a 60 Hz game tick.
+	constexpr float DOPPLER_SMOOTHING = 0.35f;
+
+	// Arena space of every worker: its scratch buffers plus room for one effect or HRTF convolution.
+	static const size_t CONTEXT_SCRATCH_BYTES =
+		ScratchArena::alignedSize(SOURCE_SCRATCH_FRAMES * MAX_SOURCE_CHANNELS * sizeof(float)) +
+		ScratchArena::alignedSize(SOURCE_SCRATCH_FRAMES * 2 * sizeof(float)) +
+		ScratchArena::alignedSize(BLOCK_FRAMES * 2 * sizeof(float)) +
+		ScratchArena::alignedSize(BLOCK_FRAMES * OUTPUT_CHANNELS * sizeof(float)) +
+		ScratchArena::alignedSize(BLOCK_FRAMES * MAX_AMBISONIC_CHANNELS * sizeof(float)) +
+		(EFFECT_SCRATCH_BYTES > HRTF_SCRATCH_BYTES ? EFFECT_SCRATCH_BYTES : HRTF_SCRATCH_BYTES);
+
+	// Extra arena space of the audio thread: the outputs of the largest graph, the reverb bus
+	// input and the reverb work areas, then the summed soundfield and the Ambisonics decode.
+	static const size_t AUDIO_THREAD_SCRATCH_BYTES =
+		ScratchArena::alignedSize(MAX_BUSES * BLOCK_FRAMES * OUTPUT_CHANNELS * sizeof(float)) +
+		ScratchArena::alignedSize(BLOCK_FRAMES * OUTPUT_CHANNELS * sizeof(float)) +
+		REVERB_SCRATCH_BYTES +
+		ScratchArena::alignedSize(BLOCK_FRAMES * MAX_AMBISONIC_CHANNELS * sizeof(float)) +
+		AMBISONIC_SCRATCH_BYTES;
+
+	Mixer::MixContext::MixContext(size_t extraBytes)
+		: arena(CONTEXT_SCRATCH_BYTES + extraBytes), filterBank(FILTER_BANK_LANES, BLOCK_FRAMES) {
+		filteredVoices.reserve(FILTER_BANK_LANES);
+	}
+
+	void Mixer::MixContext::beginBlock(int ambisonicPlanes) {
+		arena.reset();
+		sourceScratch = arena.allocate<float>(SOURCE_SCRATCH_FRAMES * MAX_SOURCE_CHANNELS);
+		planarScratch = arena.allocate<float>(SOURCE_SCRATCH_FRAMES * 2);
+		voiceScratch = arena.allocate<float>(BLOCK_FRAMES * 2);
+		reverbSend = arena.allocate<float>(BLOCK_FRAMES * OUTPUT_CHANNELS);
+		memset(reverbSend, 0, BLOCK_FRAMES * OUTPUT_CHANNELS * sizeof(float));
+		ambisonicSend = arena.allocate<float>(BLOCK_FRAMES * MAX_AMBISONIC_CHANNELS);
+		memset(ambisonicSend, 0, ambisonicPlanes * BLOCK_FRAMES * 2 * sizeof(float));
+	}
+
+	Mixer::Mixer(int maxVoices, int maxRealVoices, int sampleRate, int commandCapacity, int maxSincVoices)
+		: commands(commandCapacity), events(maxVoices > 0xFFFF ? 0xFFFF : maxVoices), retiredSchedules(4),
+		maxRealVoices(maxRealVoices), maxSincVoices(maxSincVoices), sampleRate(sampleRate), stats(BLOCK_FRAMES, sampleRate) {
+		if(maxVoices > 0xFFFF) {
+			maxVoices = 0xFFFF;
+		}
+
+		// Everything render() touches is allocated up front.
+		voices.resize(maxVoices);
+		contexts.emplace_back(new MixContext(AUDIO_THREAD_SCRATCH_BYTES));
+		schedule = DspGraph().compile(BLOCK_FRAMES);
+		mixEntries.reserve(maxVoices);
+		nodeEntries.resize(maxVoices);
+		nodeEntryStart.resize(MAX_BUSES + 1);
+		Resampler::initTables();
+		activeVoices.reserve(maxVoices);
+
+		slotGenerations.resize(maxVoices, 0);
+		slotInUse.resize(maxVoices, false);
+		slotBuffers.resize(maxVoices);
+		slotStreams.resize(maxVoices, nullptr);
+		freeSlots.reserve(maxVoices);
+		for(int i = maxVoices - 1; i >= 0; i--) {
+			freeSlots.push_back((uint16_t)i);
+		}
+	}
+
+	Mixer::~Mixer() {
+		// Stop the helpers before the schedule they might still be reading goes away.
+		pool.reset();
+		collectSchedules();
+		delete pendingSchedule.exchange(nullptr);
+		delete schedule;
+	}
+
+	VoiceHandle Mixer::play(const AudioReader& clip, float gain, float pan, bool loop, int priority) {
+		if(!clip.isOpen()) {
+			return INVALID_VOICE;
+		}
+
+		return playFrames(clip.getFrames(0, clip.getFrameCount()), nullptr, gain, pan, loop, priority);
+	}
+
+	VoiceHandle Mixer::play(const SampleBuffer& buffer, float gain, float pan, bool loop, int priority) {
+		VoiceHandle voice = playFrames(buffer.getFrames(), nullptr, gain, pan, loop, priority);
+		if(voice != INVALID_VOICE) {
+			slotBuffers[voice & 0xFFFF] = buffer;
+		}
+		return voice;
+	}
+
+	VoiceHandle Mixer::play(AudioStream* stream, float gain, float pan, int priority) {
+		if(stream == nullptr) {
+			return INVALID_VOICE;
+		}
+
+		FrameView frames;
+		frames.frameCount = stream->getFrameCount();
+		frames.format = stream->getFormat();
+
+		VoiceHandle voice = playFrames(frames, stream, gain, pan, stream->isLooping(), priority);
+		if(voice != INVALID_VOICE) {
+			slotStreams[voice & 0xFFFF] = stream;
+		}
+		return voice;
+	}
+
+	VoiceHandle Mixer::play(const FrameView& frames, float gain, float pan, bool loop, int priority) {
+		return playFrames(frames, nullptr, gain, pan, loop, priority);
+	}
+
+	VoiceHandle Mixer::playFrames(const FrameView& frames, AudioStream* stream, float gain, float pan, bool loop, int priority) {
+		if(frames.empty() || frames.format.channels > MAX_SOURCE_CHANNELS) {
+			return INVALID_VOICE;
+		}
+
+		if(freeSlots.empty()) {
+			return INVALID_VOICE;
+		}
+
+		uint16_t slot = freeSlots.back();
+
+		AudioCommand command;
+		command.type = CommandType::PLAY;
+		command.voice = ((VoiceHandle)(uint16_t)(slotGenerations[slot] + 1) << 16) | slot;
+		command.source = frames;
+		command.stream = stream;
+		command.gain = gain;
+		command.pan = pan;
+		command.loop = loop;
+		command.priority = priority;
+
+		if(!postCommand(command)) {
+			return INVALID_VOICE;
+		}
+
+		freeSlots.pop_back();
+		slotGenerations[slot]++;
+		slotInUse[slot] = true;
+
+		return command.voice;
+	}
+
+	void Mixer::stop(VoiceHandle voice) {
+		if(!isPlaying(voice)) return;
+
+		AudioCommand command;
+		command.type = CommandType::STOP;
+		command.voice = voice;
+		postCommand(command);
+	}
+
+	void Mixer::setGain(VoiceHandle voice, float gain) {
+		if(!isPlaying(voice)) return;
+
+		AudioCommand command;
+		command.type = CommandType::SET_GAIN;
+		command.voice = voice;
+		command.gain = gain;
+		postCommand(command);
+	}
+
+	void Mixer::setPan(VoiceHandle voice, float pan) {
+		if(!isPlaying(voice)) return;
+
+		AudioCommand command;
+		command.type = CommandType::SET_PAN;
+		command.voice = voice;
+		command.pan = pan;
+		postCommand(command);
+	}
+
+	void Mixer::setPriority(VoiceHandle voice, int priority) {
+		if(!isPlaying(voice)) return;
+
+		AudioCommand command;
+		command.type = CommandType::SET_PRIORITY;
+		command.voice = voice;
+		command.priority = priority;
+		postCommand(command);
+	}
+
+	void Mixer::setSpatial(VoiceHandle voice, float gain, float pan, float doppler) {
+		if(!isPlaying(voice)) return;
+
+		AudioCommand command;
+		command.type = CommandType::SET_SPATIAL;
+		command.voice = voice;
+		command.gain = gain;
+		command.pan = pan;
+		command.pitch = doppler;
+		postCommand(command);
+	}
+
+	void Mixer::setReverbSend(VoiceHandle voice, float send) {
+		if(!isPlaying(voice)) return;
+
+		AudioCommand command;
+		command.type = CommandType::SET_REVERB_SEND;
+		command.voice = voice;
+		command.gain = send;
+		postCommand(command);
+	}
+
+	void Mixer::setPitch(VoiceHandle voice, float pitch) {
+		if(!isPlaying(voice)) return;
+
+		AudioCommand command;
+		command.type = CommandType::SET_PITCH;
+		command.voice = voice;
+		command.pitch = pitch;
+		postCommand(command);
+	}
+
+	void Mixer::setResampleQuality(VoiceHandle voice, ResampleQuality quality) {
+		if(!isPlaying(voice)) return;
+
+		AudioCommand command;
+		command.type = CommandType::SET_QUALITY;
+		command.voice = voice;
+		command.quality = quality;
+		postCommand(command);
+	}
+
+	void Mixer::setFilter(VoiceHandle voice, FilterType type, float frequency, float q, float gainDb) {
+		if(!isPlaying(voice)) return;
+
+		AudioCommand command;
+		command.type = CommandType::SET_FILTER;
+		command.voice = voice;
+		command.filter = BiquadCoefficients::design(type, frequency, q, gainDb, sampleRate);
+		postCommand(command);
+	}
+
+	void Mixer::setMasterGain(float gain) {
+		AudioCommand command;
+		command.type = CommandType::SET_MASTER_GAIN;
+		command.gain = gain;
+		postCommand(command);
+	}
+
+	void Mixer::setBus(VoiceHandle voice, BusId bus) {
+		if(!isPlaying(voice)) return;
+
+		AudioCommand command;
+		command.type = CommandType::SET_BUS;
+		command.voice = voice;
+		command.bus = bus;
+		postCommand(command);
+	}
+
+	void Mixer::setDirection(VoiceHandle voice, float x, float y, float z) {
+		if(!isPlaying(voice)) return;
+
+		AudioCommand command;
+		command.type = CommandType::SET_DIRECTION;
+		command.voice = voice;
+		command.direction[0] = x;
+		command.direction[1] = y;
+		command.direction[2] = z;
+		postCommand(command);
+	}
+
+	void Mixer::setHrtfDirection(VoiceHandle voice, float x, float y, float z) {
+		if(!isPlaying(voice)) return;
+
+		AudioCommand command;
+		command.type = CommandType::SET_HRTF;
+		command.voice = voice;
+		command.direction[0] = x;
+		command.direction[1] = y;
+		command.direction[2] = z;
+		postCommand(command);
+	}
+
+	void Mixer::clearHrtf(VoiceHandle voice) {
+		if(!isPlaying(voice)) return;
+
+		AudioCommand command;
+		command.type = CommandType::SET_HRTF;
+		command.voice = voice;
+		postCommand(command);
+	}
+
+	bool Mixer::setHrtf(HrtfSet* set, int maxVoices) {
+		if(set != nullptr && set->isLoaded() && set->getSampleRate() != sampleRate) {
+			std::cout << "HRTF set is built at " << set->getSampleRate() << " Hz, the mixer runs at " << sampleRate << " Hz" << std::endl;
+			return false;
+		}
+
+		hrtfSet = set != nullptr && set->isLoaded() ? set : nullptr;
+		maxHrtfVoices = hrtfSet != nullptr && maxVoices > 0 ? maxVoices : 0;
+
+		// Every convolver render() can hand out is made here.
+		hrtfConvolvers.clear();
+		hrtfConvolvers.resize(maxHrtfVoices * 2);
+		freeHrtfConvolvers.clear();
+		freeHrtfConvolvers.reserve(hrtfConvolvers.size());
+		for(int i = (int)hrtfConvolvers.size() - 1; i >= 0; i--) {
+			freeHrtfConvolvers.push_back(i);
+		}
+		for(Voice& voice : voices) {
+			voice.hrtfSlot = -1;
+			voice.hrtfActive = false;
+			voice.hrtfHeld = false;
+		}
+		return true;
+	}
+
+	bool Mixer::setGraph(const DspGraph& graph) {
+		DspSchedule* compiled = graph.compile(BLOCK_FRAMES);
+		if(compiled == nullptr) {
+			return false;
+		}
+
+		// The audio thread retires at most one schedule per setGraph(), so collecting here first
+		// keeps it from ever finding the retired ring full.
+		collectSchedules();
+
+		// A schedule the audio thread has not picked up yet is simply replaced.
+		delete pendingSchedule.exchange(compiled, std::memory_order_acq_rel);
+		return true;
+	}
+
+	void Mixer::startWorkers(int helperThreads) {
+		// Helpers without a core of their own only take time away from the audio thread.
+		int spareCores = (int)std::thread::hardware_concurrency() - 1;
+		if(helperThreads > spareCores) {
+			helperThreads = spareCores;
+		}
+		if(helperThreads <= 0) return;
+
+		pool.reset(new AudioWorkerPool(helperThreads, MAX_BUSES));
+		while((int)contexts.size() < pool->getWorkerCount()) {
+			contexts.emplace_back(new MixContext(0));
+		}
+	}
+
+	void Mixer::collectSchedules() {
+		DspSchedule* retired;
+		while(retiredSchedules.pop(retired)) {
+			delete retired;
+		}
+	}
+
+	void Mixer::update() {
+		collectSchedules();
+
+		VoiceEvent event;
+		while(events.pop(event)) {
+			if(event.type != VoiceEventType::FINISHED) continue;
+
+			uint16_t slot = (uint16_t)(event.voice & 0xFFFF);
+			slotInUse[slot] = false;
+			slotBuffers[slot].reset();
+			if(slotStreams[slot] != nullptr) {
+				slotStreams[slot]->close();
+				slotStreams[slot] = nullptr;
+			}
+			freeSlots.push_back(slot);
+
+			if(finishedCallback != nullptr) {
+				finishedCallback(event.voice, finishedUserData);
+			}
+		}
+	}
+
+	void Mixer::setVoiceFinishedCallback(VoiceFinishedCallback callback, void* userData) {
+		finishedCallback = callback;
+		finishedUserData = userData;
+	}
+
+	bool Mixer::isPlaying(VoiceHandle voice) const {
+		size_t slot = voice & 0xFFFF;
+		if(voice == INVALID_VOICE || slot >= slotInUse.size()) {
+			return false;
+		}
+
+		return slotInUse[slot] && slotGenerations[slot] == (uint16_t)(voice >> 16);
+	}
+
+	int Mixer::getActiveVoiceCount() const {
+		return (int)(slotInUse.size() - freeSlots.size());
+	}
+
+	bool Mixer::postCommand(const AudioCommand& command) {
+		AudioCommand stamped = command;
+		stamped.postedAt = AudioStats::now();
+		if(!commands.push(stamped)) {
+			droppedCommands++;
+			return false;
+		}
+		return true;
+	}
+
+	void Mixer::render(float* out) {
+		const uint64_t blockStart = AudioStats::now();
+		processCommands(blockStart);
+
+		DspSchedule* next = pendingSchedule.exchange(nullptr, std::memory_order_acq_rel);
+		if(next != nullptr) {
+			retiredSchedules.push(schedule);
+			schedule = next;
+		}
+
+		const int ambisonicPlanes = ambisonics != nullptr ? ambisonics->getPlaneCount() : 0;
+		for(std::unique_ptr<MixContext>& context : contexts) {
+			context->beginBlock(ambisonicPlanes);
+		}
+		ScratchArena& scratch = contexts[0]->arena;
+		schedule->setBuffers(scratch.allocate<float>(schedule->getBufferFloats()));
+
+		memset(out, 0, BLOCK_FRAMES * OUTPUT_CHANNELS * sizeof(float));
+
+		int realCount = selectRealVoices();
+		int activeCount = (int)activeVoices.size();
+		int hrtfCount = 0;
+		mixEntries.clear();
+
+		for(int i = 0; i < activeCount; i++) {
+			Voice& voice = voices[activeVoices[i]];
+			bool makeReal = i < realCount;
+
+			bool justStarted = voice.justStarted;
+			voice.justStarted = false;
+
+			voice.doppler += (voice.dopplerTarget - voice.doppler) * DOPPLER_SMOOTHING;
+
+			if(!makeReal && !voice.real) {
+				releaseHrtf(voice);
+				advanceVirtualVoice(voice);
+				continue;
+			}
+
+			// Coming back from virtual, fade in from silence.
+			if(makeReal && !voice.real && !justStarted) {
+				voice.lastGainL = 0.f;
+				voice.lastGainR = 0.f;
+				memset(voice.lastEncode, 0, sizeof(voice.lastEncode));
+				voice.lastHrtfGain = 0.f;
+				voice.filterState[0] = BiquadState();
+				voice.filterState[1] = BiquadState();
+			}
+
+			// Voices are given HRTF in order of importance until the budget runs out. A voice changing
+			// over mid clip runs its new convolver silently for a block, which would otherwise start
+			// from an empty history, and then crossfades into it from its other path.
+			voice.hrtfActive = false;
+			voice.hrtfHeld = false;
+			if(makeReal && voice.hrtf && hrtfCount < maxHrtfVoices) {
+				bool warming = false;
+				if(voice.hrtfSlot < 0 && !freeHrtfConvolvers.empty()) {
+					voice.hrtfSlot = freeHrtfConvolvers.back();
+					freeHrtfConvolvers.pop_back();
+					hrtfConvolvers[voice.hrtfSlot].reset();
+					warming = !justStarted;
+				}
+				voice.hrtfHeld = voice.hrtfSlot >= 0;
+				voice.hrtfActive = voice.hrtfHeld && !warming;
+				hrtfCount += voice.hrtfHeld ? 1 : 0;
+			}
+
+			// A new voice starts on HRTF instead of crossfading from its pan.
+			if(justStarted && voice.hrtfActive) {
+				voice.lastDry = 0.f;
+				memset(voice.lastEncode, 0, sizeof(voice.lastEncode));
+				voice.lastHrtfGain = voice.gain * voice.spatialGain;
+			}
+
+			// Only the most important real voices can afford the sinc filter.
+			ResampleQuality quality = voice.quality;
+			if(i >= maxSincVoices && quality > ResampleQuality::CUBIC) {
+				quality = ResampleQuality::CUBIC;
+			}
+
+			// A voice that just lost its slot is mixed once more while it fades out.
+			MixEntry entry;
+			entry.index = activeVoices[i];
+			entry.quality = quality;
+			entry.fadeOut = !makeReal;
+			entry.ended = false;
+			mixEntries.push_back(entry);
+			voice.real = makeReal;
+		}
+
+		groupByNode();
+
+		int nodeCount = schedule->getNodeCount();
+		if(pool != nullptr && schedule->getWidth() > 1) {
+			const std::vector<uint32_t>& sources = schedule->getSources();
+			schedule->reset();
+			pool->run(sources.data(), (int)sources.size(), nodeCount, &Mixer::nodeTask, this);
+		}
+		else {
+			// Schedule order is topological, so running it in order satisfies every input.
+			for(int n = 0; n < nodeCount; n++) {
+				renderNode((uint32_t)n, 0);
+			}
+		}
+
+		// Finished here rather than on the workers, the event ring only takes one producer.
+		// Convolvers of voices that have faded out of HRTF are free for the next block.
+		for(size_t e = 0; e < mixEntries.size(); e++) {
+			Voice& voice = voices[nodeEntries[e].index];
+			if(nodeEntries[e].ended) {
+				finishVoice(voice);
+			}
+			else if(!voice.hrtfHeld) {
+				releaseHrtf(voice);
+			}
+		}
+
+		kernels().mixGain(out, schedule->getBuffer(schedule->getMasterNode()), schedule->getMasterBusGain(),
+			BLOCK_FRAMES * OUTPUT_CHANNELS);
+
+		if(reverb != nullptr) {
+			float* reverbBus = scratch.allocate<float>(BLOCK_FRAMES * OUTPUT_CHANNELS);
+			memcpy(reverbBus, contexts[0]->reverbSend, BLOCK_FRAMES * OUTPUT_CHANNELS * sizeof(float));
+			for(size_t c = 1; c < contexts.size(); c++) {
+				kernels().mixGain(reverbBus, contexts[c]->reverbSend, 1.f, BLOCK_FRAMES * OUTPUT_CHANNELS);
+			}
+			reverb->process(reverbBus, out, scratch);
+		}
+
+		if(ambisonics != nullptr) {
+			const int floats = ambisonicPlanes * BLOCK_FRAMES * 2;
+			float* soundfield = scratch.allocate<float>(floats);
+			memcpy(soundfield, contexts[0]->ambisonicSend, floats * sizeof(float));
+			for(size_t c = 1; c < contexts.size(); c++) {
+				kernels().mixGain(soundfield, contexts[c]->ambisonicSend, 1.f, floats);
+			}
+			ambisonics->process(soundfield, BLOCK_FRAMES, out, scratch);
+		}
+
+		// Master bus.
+		kernels().gainRampStereo(out, lastMasterGain, (masterGain - lastMasterGain) / BLOCK_FRAMES, BLOCK_FRAMES);
+		lastMasterGain = masterGain;
+
+		stats.recordBlock(AudioStats::now() - blockStart, realCount, activeCount - realCount);
+	}
+
+	void Mixer::groupByNode() {
+		// Counting sort, the voices of one node stay in importance order.
+		int nodeCount = schedule->getNodeCount();
+		std::fill(nodeEntryStart.begin(), nodeEntryStart.begin() + nodeCount + 1, 0);
+		for(const MixEntry& entry : mixEntries) {
+			nodeEntryStart[schedule->nodeForBus(voices[entry.index].bus) + 1]++;
+		}
+		for(int n = 0; n < nodeCount; n++) {
+			nodeEntryStart[n + 1] += nodeEntryStart[n];
+		}
+
+		// Uses the starts as cursors, which leaves each one at the next node's start, then shifts them back.
+		for(const MixEntry& entry : mixEntries) {
+			nodeEntries[nodeEntryStart[schedule->nodeForBus(voices[entry.index].bus)]++] = entry;
+		}
+		for(int n = nodeCount; n > 0; n--) {
+			nodeEntryStart[n] = nodeEntryStart[n - 1];
+		}
+		nodeEntryStart[0] = 0;
+	}
+
+	void Mixer::renderNode(uint32_t node, int worker) {
+		MixContext& context = *contexts[worker];
+		const DspSchedule::Node& info = schedule->getNode(node);
+		float* buffer = schedule->getBuffer(node);
+		memset(buffer, 0, BLOCK_FRAMES * OUTPUT_CHANNELS * sizeof(float));
+
+		for(uint32_t e = nodeEntryStart[node]; e < nodeEntryStart[node + 1]; e++) {
+			MixEntry& entry = nodeEntries[e];
+			Voice& voice = voices[entry.index];
+
+			// A full bank is emptied before readVoice(), mixing it reuses voiceScratch.
+			bool filtered = !voice.filter.isIdentity() || !voice.lastFilter.isIdentity();
+			int planes = voice.source.format.channels == 1 ? 1 : 2;
+			if(filtered && context.filterLanes + planes > context.filterBank.getMaxLanes()) {
+				mixFilteredVoices(context, buffer);
+			}
+
+			int frames = readVoice(context, voice, entry.quality);
+
+			if(filtered) {
+				queueFilteredVoice(context, entry.index, frames, entry.fadeOut, &entry.ended);
+				continue;
+			}
+
+			mixVoice(context, voice, frames, buffer, entry.fadeOut);
+			entry.ended = voice.stopping || frames < BLOCK_FRAMES;
+		}
+
+		if(!context.filteredVoices.empty()) {
+			mixFilteredVoices(context, buffer);
+		}
+
+		for(uint32_t i = 0; i < info.inputCount; i++) {
+			const DspSchedule::Input& input = schedule->getInput(info.firstInput + i);
+			kernels().mixGain(buffer, schedule->getBuffer(input.node), input.gain, BLOCK_FRAMES * OUTPUT_CHANNELS);
+		}
+
+		for(uint32_t i = 0; i < info.effectCount; i++) {
+			size_t mark = context.arena.getUsed();
+			schedule->getEffect(info.firstEffect + i)->process(buffer, BLOCK_FRAMES, context.arena);
+			context.arena.rewind(mark);
+		}
+	}
+
+	void Mixer::nodeTask(uint32_t task, int worker, void* userData) {
+		Mixer* mixer = (Mixer*)userData;
+		mixer->renderNode(task, worker);
+
+		DspSchedule& schedule = *mixer->schedule;
+		const DspSchedule::Node& info = schedule.getNode(task);
+		for(uint32_t i = 0; i < info.consumerCount; i++) {
+			uint32_t consumer = schedule.getConsumer(info.firstConsumer + i);
+			if(schedule.inputDone(consumer)) {
+				mixer->pool->push(worker, consumer);
+			}
+		}
+	}
+
+	// Stereo frames to a device's channel layout.
+	static void copyToDevice(float* out, int channels, const float* stereo, int frames) {
+		if(channels == OUTPUT_CHANNELS) {
+			memcpy(out, stereo, (size_t)frames * OUTPUT_CHANNELS * sizeof(float));
+			return;
+		}
+		for(int i = 0; i < frames; i++) {
+			const float left = stereo[i * 2];
+			const float right = stereo[i * 2 + 1];
+			float* frame = out + (size_t)i * channels;
+			if(channels == 1) {
+				frame[0] = 0.5f * (left + right);
+				continue;
+			}
+			frame[0] = left;
+			frame[1] = right;
+			for(int c = 2; c < channels; c++) {
+				frame[c] = 0.f;
+			}
+		}
+	}
+
+	void Mixer::renderCallback(float* out, int frames, int channels, void* userData) {
+		Mixer* mixer = (Mixer*)userData;
+		int written = 0;
+		while(written < frames) {
+			if(mixer->pendingFrames == 0) {
+				// Whole stereo blocks are rendered straight into the device buffer.
+				if(channels == OUTPUT_CHANNELS && frames - written >= BLOCK_FRAMES) {
+					mixer->render(out + (size_t)written * OUTPUT_CHANNELS);
+					written += BLOCK_FRAMES;
+					continue;
+				}
+				mixer->render(mixer->pending);
+				mixer->pendingFrames = BLOCK_FRAMES;
+			}
+
+			const int count = mixer->pendingFrames < frames - written ? mixer->pendingFrames : frames - written;
+			const float* from = mixer->pending + (size_t)(BLOCK_FRAMES - mixer->pendingFrames) * OUTPUT_CHANNELS;
+			copyToDevice(out + (size_t)written * channels, channels, from, count);
+			mixer->pendingFrames -= count;
+			written += count;
+		}
+	}
+
+	void Mixer::processCommands(uint64_t blockStart) {
+		AudioCommand command;
+		while(commands.pop(command)) {
+			stats.recordCommand(command.postedAt, blockStart);
+			applyCommand(command);
+		}
+	}
+
+	void Mixer::applyCommand(const AudioCommand& command) {
+		if(command.type == CommandType::SET_MASTER_GAIN) {
+			masterGain = command.gain;
+			return;
+		}
+
+		if(command.type == CommandType::PLAY) {
+			Voice& voice = voices[command.voice & 0xFFFF];
+			voice.source = command.source;
+			voice.stream = command.stream;
+			voice.position = 0;
+			voice.phase = 0.0;
+			voice.pitch = command.pitch;
+			voice.quality = command.quality;
+			voice.gain = command.gain;
+			voice.pan = command.pan;
+			voice.spatialGain = 1.f;
+			voice.doppler = 1.f;
+			voice.dopplerTarget = 1.f;
+			voice.reverbSend = 0.f;
+			voice.lastReverbSend = 0.f;
+			voice.ambisonic = false;
+			voice.lastDry = 1.f;
+			memset(voice.lastEncode, 0, sizeof(voice.lastEncode));
+			voice.hrtf = false;
+			voice.lastHrtfGain = 0.f;
+			releaseHrtf(voice);
+			voice.filter = BiquadCoefficients();
+			voice.lastFilter = BiquadCoefficients();
+			voice.filterState[0] = BiquadState();
+			voice.filterState[1] = BiquadState();
+			voice.loop = command.loop;
+			voice.priority = command.priority;
+			voice.handle = command.voice;
+			voice.stopping = false;
+			voice.active = true;
+			voice.real = false;
+			voice.justStarted = true;
+			voice.bus = MASTER_BUS;
+
+			// Start from the target gains, ramping up from silence would soften transients.
+			panGains(voice.pan, voice.gain, voice.source.format.channels, voice.lastGainL, voice.lastGainR);
+			voice.lastStep = voiceStep(voice);
+			return;
+		}
+
+		Voice* voice = findVoice(command.voice);
+		if(voice == nullptr) return;
+
+		switch(command.type) {
+		case CommandType::STOP:
+			voice->stopping = true;
+			break;
+		case CommandType::SET_GAIN:
+			voice->gain = command.gain;
+			break;
+		case CommandType::SET_PAN:
+			voice->pan = command.pan;
+			break;
+		case CommandType::SET_PRIORITY:
+			voice->priority = command.priority;
+			break;
+		case CommandType::SET_SPATIAL:
+			voice->spatialGain = command.gain;
+			voice->pan = command.pan;
+			voice->dopplerTarget = command.pitch;
+			// A new voice starts at the right pitch instead of gliding into it.
+			if(voice->justStarted) {
+				voice->doppler = command.pitch;
+				voice->lastStep = voiceStep(*voice);
+			}
+			break;
+		case CommandType::SET_REVERB_SEND:
+			voice->reverbSend = command.gain;
+			break;
+		case CommandType::SET_FILTER:
+			voice->filter = command.filter;
+			// A new voice starts filtered instead of sweeping in from unfiltered.
+			if(voice->justStarted) {
+				voice->lastFilter = command.filter;
+			}
+			break;
+		case CommandType::SET_BUS:
+			voice->bus = command.bus;
+			break;
+		case CommandType::SET_DIRECTION:
+			memcpy(voice->direction, command.direction, sizeof(voice->direction));
+			// A new voice starts encoded instead of crossfading from its pan.
+			if(voice->justStarted && ambisonics != nullptr) {
+				encodeAmbisonics(voice->direction[0], voice->direction[1], voice->direction[2], ambisonics->getOrder(), voice->lastEncode);
+				for(int c = 0; c < ambisonics->getChannelCount(); c++) {
+					voice->lastEncode[c] *= voice->gain * voice->spatialGain;
+				}
+				voice->lastDry = 0.f;
+			}
+			voice->ambisonic = true;
+			break;
+		case CommandType::SET_HRTF:
+			voice->hrtf = command.direction[0] != 0.f || command.direction[1] != 0.f || command.direction[2] != 0.f;
+			// A voice fading out of HRTF keeps its last direction.
+			if(voice->hrtf) {
+				memcpy(voice->hrtfDirection, command.direction, sizeof(voice->hrtfDirection));
+			}
+			break;
+		case CommandType::SET_PITCH:
+			voice->pitch = command.pitch;
+			break;
+		case CommandType::SET_QUALITY:
+			voice->quality = command.quality;
+			break;
+		default:
+			break;
+		}
+	}
+
+	Mixer::Voice* Mixer::findVoice(VoiceHandle handle) {
+		size_t index = handle & 0xFFFF;
+		if(handle == INVALID_VOICE || index >= voices.size()) {
+			return nullptr;
+		}
+
+		Voice& voice = voices[index];
+		if(!voice.active || voice.handle != handle) {
+			return nullptr;
+		}
+
+		return &voice;
+	}
+
+	void Mixer::finishVoice(Voice& voice) {
+		voice.active = false;
+		releaseHrtf(voice);
+
+		// Cannot fail, a slot is only reused once the game thread has seen its event.
+		VoiceEvent event;
+		event.type = VoiceEventType::FINISHED;
+		event.voice = voice.handle;
+		events.push(event);
+	}
+
+	void Mixer::releaseHrtf(Voice& voice) {
+		if(voice.hrtfSlot < 0) return;
+		freeHrtfConvolvers.push_back(voice.hrtfSlot);
+		voice.hrtfSlot = -1;
+		voice.hrtfActive = false;
+		voice.hrtfHeld = false;
+	}
+
+	int Mixer::selectRealVoices() {
+		activeVoices.clear();
+		for(size_t i = 0; i < voices.size(); i++) {
+			Voice& voice = voices[i];
+			if(!voice.active) continue;
+
+			voice.audibility = fabsf(voice.gain * voice.spatialGain) * (voice.real ? REAL_VOICE_HYSTERESIS : 1.f);
+			activeVoices.push_back((uint16_t)i);
+		}
+
+		int count = (int)activeVoices.size();
+		int realCount = count < maxRealVoices ? count : maxRealVoices;
+		const std::vector<Voice>& all = voices;
+		auto compare = [&all](uint16_t a, uint16_t b) {
+			const Voice& va = all[a];
+			const Voice& vb = all[b];
+			if(va.priority != vb.priority) {
+				return va.priority > vb.priority;
+			}
+			return va.audibility > vb.audibility;
+		};
+
+		// Partial sorts, only the splits between real and virtual and between sinc and cubic matter.
+		if(count > realCount) {
+			std::nth_element(activeVoices.begin(), activeVoices.begin() + realCount, activeVoices.end(), compare);
+		}
+		if(realCount > maxSincVoices && maxSincVoices >= 0) {
+			std::nth_element(activeVoices.begin(), activeVoices.begin() + maxSincVoices, activeVoices.begin() + realCount, compare);
+		}
+
+		return realCount;
+	}
+
+	double Mixer::voiceStep(const Voice& voice) const {
+		double step = (double)voice.source.format.sampleRate / sampleRate * voice.pitch * voice.doppler;
+		return step < MIN_RESAMPLE_STEP ? MIN_RESAMPLE_STEP : (step > MAX_RESAMPLE_STEP ? MAX_RESAMPLE_STEP : step);
+	}
+
+	void Mixer::advanceVoice(Voice& voice, double endStep) {
+		double moved = voice.phase + Resampler::advance(voice.lastStep, endStep, BLOCK_FRAMES);
+		size_t whole = (size_t)moved;
+
+		voice.position += whole;
+		voice.phase = moved - (double)whole;
+		voice.lastStep = endStep;
+	}
+
+	void Mixer::advanceVirtualVoice(Voice& voice) {
+		// Nothing would be heard while fading out anyway.
+		if(voice.stopping) {
+			finishVoice(voice);
+			return;
+		}
+
+		advanceVoice(voice, voiceStep(voice));
+		if(voice.position >= voice.source.frameCount) {
+			if(!voice.loop) {
+				finishVoice(voice);
+				return;
+			}
+			voice.position %= voice.source.frameCount;
+		}
+
+		// Streams keep reading ahead of virtual voices so they can become real without a gap.
+		if(voice.stream != nullptr) {
+			voice.stream->setPosition(voice.position);
+		}
+	}
+
+	void Mixer::fetchSource(MixContext& context, const Voice& voice, int64_t start, int count) {
+		const FrameView& source = voice.source;
+		const int64_t length = (int64_t)source.frameCount;
+		int channels = source.format.channels;
+
+		float* left = context.planarScratch;
+		float* right = left + SOURCE_SCRATCH_FRAMES;
+
+		int done = 0;
+		while(done < count) {
+			int64_t frame = start + done;
+			if(voice.loop) {
+				frame %= length;
+				if(frame < 0) frame += length;
+			}
+
+			// Outside a clip that does not loop.
+			if(frame < 0 || frame >= length) {
+				int run = frame < 0 && -frame < count - done ? (int)-frame : count - done;
+				memset(left + done, 0, run * sizeof(float));
+				memset(right + done, 0, run * sizeof(float));
+				done += run;
+				continue;
+			}
+
+			int run = length - frame < count - done ? (int)(length - frame) : count - done;
+			float* converted = context.sourceScratch;
+			if(voice.stream != nullptr) {
+				run = voice.stream->readFloat((size_t)frame, run, converted);
+			}
+			else if(source.format.sampleFormat == SampleFormat::IMA_ADPCM) {
+				decodeAdpcm(converted, source.data, channels, (size_t)frame, run);
+			}
+			else {
+				convertToFloat(converted, source.frame((size_t)frame), source.format.sampleFormat, (size_t)run * channels);
+			}
+
+			if(channels == 1) {
+				memcpy(left + done, converted, run * sizeof(float));
+			}
+			else {
+				for(int i = 0; i < run; i++) {
+					left[done + i] = converted[i * channels];
+					right[done + i] = converted[i * channels + 1];
+				}
+			}
+			done += run;
+		}
+	}
+
+	int Mixer::readVoice(MixContext& context, Voice& voice, ResampleQuality quality) {
+		const FrameView& source = voice.source;
+		int planes = source.format.channels == 1 ? 1 : 2;
+		double startStep = voice.lastStep;
+		double endStep = voiceStep(voice);
+
+		// Count the outputs read before the end of a clip that does not loop.
+		int frames = BLOCK_FRAMES;
+		if(!voice.loop) {
+			double remaining = (double)(source.frameCount - voice.position) - voice.phase;
+			double stepDelta = (endStep - startStep) / BLOCK_FRAMES;
+			double offset = 0.0;
+			frames = 0;
+			while(frames < BLOCK_FRAMES && offset < remaining) {
+				frames++;
+				offset += startStep + stepDelta * frames;
+			}
+		}
+
+		float* left = context.planarScratch;
+		float* out = context.voiceScratch;
+
+		if(startStep == 1.0 && endStep == 1.0 && voice.phase == 0.0) {
+			// Same rate and no pitch, copy the source as is.
+			fetchSource(context, voice, (int64_t)voice.position, BLOCK_FRAMES);
+			for(int c = 0; c < planes; c++) {
+				memcpy(out + c * BLOCK_FRAMES, left + c * SOURCE_SCRATCH_FRAMES, BLOCK_FRAMES * sizeof(float));
+			}
+		}
+		else {
+			int count = Resampler::sourceFrames(voice.phase, startStep, endStep, BLOCK_FRAMES);
+			fetchSource(context, voice, (int64_t)voice.position - RESAMPLE_HISTORY, count);
+			for(int c = 0; c < planes; c++) {
+				Resampler::process(quality, out + c * BLOCK_FRAMES, left + c * SOURCE_SCRATCH_FRAMES,
+					voice.phase, startStep, endStep, BLOCK_FRAMES);
+			}
+		}
+
+		advanceVoice(voice, endStep);
+		if(voice.loop) {
+			voice.position %= source.frameCount;
+		}
+		if(voice.stream != nullptr) {
+			voice.stream->setPosition(voice.position);
+		}
+
+		return frames;
+	}
+
+	void Mixer::mixVoice(MixContext& context, Voice& voice, int frames, float* out, bool fadeOut) {
+		int channels = voice.source.format.channels;
+		const float level = voice.stopping || fadeOut ? 0.f : voice.gain * voice.spatialGain;
+		const bool hrtf = voice.hrtfActive;
+		const bool encode = !hrtf && voice.ambisonic && ambisonics != nullptr;
+		const float dry = hrtf || encode ? 0.f : 1.f;
+
+		float gainL;
+		float gainR;
+		panGains(voice.pan, level, channels, gainL, gainR);
+
+		// Ramp over the whole block even if the voice ends early so the slope stays the same.
+		float fromL = voice.lastGainL * voice.lastDry;
+		float fromR = voice.lastGainR * voice.lastDry;
+		float stepL = (gainL * dry - fromL) / BLOCK_FRAMES;
+		float stepR = (gainR * dry - fromR) / BLOCK_FRAMES;
+
+		const float* left = context.voiceScratch;
+		const float* right = left + BLOCK_FRAMES;
+
+		// Only the front pair of multichannel clips is used.
+		if(dry > 0.f || voice.lastDry > 0.f) {
+			if(channels == 1) {
+				kernels().panMono(out, left, fromL, fromR, stepL, stepR, frames);
+			}
+			else {
+				kernels().panStereo(out, left, right, fromL, fromR, stepL, stepR, frames);
+			}
+		}
+		voice.lastDry = dry;
+
+		// The send follows the dry gains so it fades and pans with the voice.
+		float send = voice.stopping || fadeOut ? 0.f : voice.reverbSend;
+		if(reverb != nullptr && (send > 0.f || voice.lastReverbSend > 0.f)) {
+			float fromL = voice.lastGainL * voice.lastReverbSend;
+			float fromR = voice.lastGainR * voice.lastReverbSend;
+			float sendStepL = (gainL * send - fromL) / BLOCK_FRAMES;
+			float sendStepR = (gainR * send - fromR) / BLOCK_FRAMES;
+
+			if(channels == 1) {
+				kernels().panMono(context.reverbSend, left, fromL, fromR, sendStepL, sendStepR, frames);
+			}
+			else {
+				kernels().panStereo(context.reverbSend, left, right, fromL, fromR, sendStepL, sendStepR, frames);
+			}
+		}
+		voice.lastReverbSend = send;
+
+		voice.lastGainL = gainL;
+		voice.lastGainR = gainR;
+
+		// Also run the path the voice is fading out of, if it has just changed over.
+		const bool encoded = ambisonics != nullptr && (encode || voice.lastEncode[0] != 0.f);
+		if(!encoded && voice.hrtfSlot < 0) return;
+
+		// Stereo clips are summed to mono, a point source has no width.
+		float* mono = context.voiceScratch;
+		if(channels > 1) {
+			for(int i = 0; i < frames; i++) {
+				mono[i] = 0.5f * (mono[i] + right[i]);
+			}
+		}
+
+		if(encoded) {
+			encodeVoice(context, voice, frames, encode ? level : 0.f);
+		}
+		if(voice.hrtfSlot >= 0) {
+			const float hrtfGain = hrtf ? level : 0.f;
+			hrtfConvolvers[voice.hrtfSlot].process(*hrtfSet, mono, frames, voice.hrtfDirection, voice.lastHrtfGain, hrtfGain, out, context.arena);
+			voice.lastHrtfGain = hrtfGain;
+		}
+	}
+
+	void Mixer::encodeVoice(MixContext& context, Voice& voice, int frames, float level) {
+		const int channels = ambisonics->getChannelCount();
+		float gains[MAX_AMBISONIC_CHANNELS + 1];
+		encodeAmbisonics(voice.direction[0], voice.direction[1], voice.direction[2], ambisonics->getOrder(), gains);
+		for(int c = 0; c < channels; c++) {
+			gains[c] *= level;
+		}
+		// The unused half of the last pair with an odd channel count, its lastEncode stays 0 too.
+		gains[channels] = 0.f;
+
+		const float* mono = context.voiceScratch;
+		for(int p = 0; p < ambisonics->getPlaneCount(); p++) {
+			const int a = p * 2;
+			const int b = a + 1;
+			kernels().panMono(context.ambisonicSend + (size_t)p * BLOCK_FRAMES * 2, mono, voice.lastEncode[a], voice.lastEncode[b],
+				(gains[a] - voice.lastEncode[a]) / BLOCK_FRAMES, (gains[b] - voice.lastEncode[b]) / BLOCK_FRAMES, frames);
+		}
+		memcpy(voice.lastEncode, gains, channels * sizeof(float));
+	}
+
+	void Mixer::queueFilteredVoice(MixContext& context, uint16_t index, int frames, bool fadeOut, bool* ended) {
+		Voice& voice = voices[index];
+		int planes = voice.source.format.channels == 1 ? 1 : 2;
+		int lane = context.filterLanes;
+
+		for(int c = 0; c < planes; c++) {
+			context.filterBank.setLane(lane + c, voice.lastFilter, voice.filter, voice.filterState[c]);
+			context.filterBank.loadLane(lane + c, &context.voiceScratch[c * BLOCK_FRAMES]);
+		}
+
+		FilteredVoice queued;
+		queued.index = index;
+		queued.frames = frames;
+		queued.fadeOut = fadeOut;
+		queued.lane = lane;
+		queued.ended = ended;
+		context.filteredVoices.push_back(queued);
+
+		context.filterLanes += planes;
+	}
+
+	void Mixer::mixFilteredVoices(MixContext& context, float* out) {
+		context.filterBank.process(context.filterLanes);
+
+		for(const FilteredVoice& queued : context.filteredVoices) {
+			Voice& voice = voices[queued.index];
+			int planes = voice.source.format.channels == 1 ? 1 : 2;
+
+			for(int c = 0; c < planes; c++) {
+				voice.filterState[c] = context.filterBank.storeLane(queued.lane + c, &context.voiceScratch[c * BLOCK_FRAMES]);
+			}
+			voice.lastFilter = voice.filter;
+
+			// Once a removed filter has ramped back to a pass through its state is no longer needed.
+			if(voice.filter.isIdentity()) {
+				voice.filterState[0] = BiquadState();
+				voice.filterState[1] = BiquadState();
+			}
+
+			mixVoice(context, voice, queued.frames, out, queued.fadeOut);
+			*queued.ended = voice.stopping || queued.frames < BLOCK_FRAMES;
+		}
+
+		context.filteredVoices.clear();
+		context.filterLanes = 0;
+	}
+};
@@ -0,0 +1,342 @@
+#include "pch.h"
+
+#include "includes/Occlusion.h"
+
+#include <cmath>
+
+#include "Bitmaths.h"
+
+namespace Banshee {
+
+	// World to local transform of a box, false if the box is flat and can not be inverted.
+	static bool invertTransform(const float (&m)[3][4], float* inverse) {
+		float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+		float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+		float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+		float det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+		if(fabsf(det) < 1e-12f) {
+			return false;
+		}
+
+		float inv = 1.f / det;
+		float r[9] = {
+			c00 * inv, (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv, (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv,
+			c01 * inv, (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv, (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv,
+			c02 * inv, (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv, (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv
+		};
+
+		for(int row = 0; row < 3; row++) {
+			inverse[row * 4 + 0] = r[row * 3 + 0];
+			inverse[row * 4 + 1] = r[row * 3 + 1];
+			inverse[row * 4 + 2] = r[row * 3 + 2];
+			inverse[row * 4 + 3] = -(r[row * 3 + 0] * m[0][3] + r[row * 3 + 1] * m[1][3] + r[row * 3 + 2] * m[2][3]);
+		}
+		return true;
+	}
+
+	// Slab test of the segment origin + t * direction, t from 0 to 1, against the unit box.
+	// A segment that starts or ends inside the box hits it.
+	static inline bool segmentHitsUnitBox(const float* origin, const float* direction) {
+		float enter = 0.f;
+		float leave = 1.f;
+		for(int axis = 0; axis < 3; axis++) {
+			float o = origin[axis];
+			float d = direction[axis];
+			if(fabsf(d) < 1e-12f) {
+				// Parallel to the slab, so inside it all along or never.
+				if(o < -0.5f || o > 0.5f) return false;
+				continue;
+			}
+
+			float inv = 1.f / d;
+			float t0 = (-0.5f - o) * inv;
+			float t1 = (0.5f - o) * inv;
+			if(t0 > t1) {
+				float swap = t0;
+				t0 = t1;
+				t1 = swap;
+			}
+			enter = t0 > enter ? t0 : enter;
+			leave = t1 < leave ? t1 : leave;
+			if(enter > leave) return false;
+		}
+		return true;
+	}
+
+	OcclusionQueries::OcclusionQueries(const OcclusionSettings& value) : settings(value) {
+		settings.raysPerQuery = settings.raysPerQuery < 1 ? 1 : (settings.raysPerQuery > MAX_OCCLUSION_RAYS ? MAX_OCCLUSION_RAYS : settings.raysPerQuery);
+		settings.raysPerTick = settings.raysPerTick > settings.raysPerQuery ? settings.raysPerTick : settings.raysPerQuery;
+		settings.occludedCutoff = clampf(settings.occludedCutoff, 20.f, OCCLUSION_OPEN_CUTOFF);
+		queries.reserve(settings.raysPerTick / settings.raysPerQuery);
+
+		running.store(true, std::memory_order_release);
+		for(int i = 0; i < settings.workerThreads; i++) {
+			workers.push_back(std::thread(&OcclusionQueries::workerLoop, this));
+		}
+	}
+
+	OcclusionQueries::~OcclusionQueries() {
+		running.store(false, std::memory_order_release);
+		{
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			wake.notify_all();
+		}
+		for(std::thread& worker : workers) {
+			worker.join();
+		}
+	}
+
+	OccluderId OcclusionQueries::addOccluder(const OccluderBox& box) {
+		OccluderId id;
+		if(freeBoxes.empty()) {
+			id = (OccluderId)boxes.size();
+			boxes.push_back(box);
+			boxUsed.push_back(true);
+		}
+		else {
+			id = freeBoxes.back();
+			freeBoxes.pop_back();
+			boxes[id] = box;
+			boxUsed[id] = true;
+		}
+		boxesChanged = true;
+		return id;
+	}
+
+	void OcclusionQueries::removeOccluder(OccluderId occluder) {
+		if(!isValid(occluder)) return;
+		boxUsed[occluder] = false;
+		freeBoxes.push_back(occluder);
+		boxesChanged = true;
+	}
+
+	void OcclusionQueries::setOccluder(OccluderId occluder, const OccluderBox& box) {
+		if(!isValid(occluder)) return;
+		boxes[occluder] = box;
+		boxesChanged = true;
+	}
+
+	bool OcclusionQueries::isValid(OccluderId occluder) const {
+		return occluder < boxes.size() && boxUsed[occluder];
+	}
+
+	void OcclusionQueries::update(Spatializer& spatializer) {
+		if(batchPending) {
+			if(!batchDone.load(std::memory_order_acquire)) {
+				// The workers are behind, skipping a tick keeps the budget.
+				busyTicks++;
+				return;
+			}
+			applyResults(spatializer);
+			batchPending = false;
+		}
+
+		if(!gatherQueries(spatializer)) return;
+
+		if(boxesChanged) {
+			snapshotOccluders();
+		}
+
+		batchListener = spatializer.getListener().position;
+		batchRays = settings.raysPerQuery;
+		batchRadius = settings.sourceRadius;
+
+		int boxCount = (int)batchTransmission.size();
+		localListener.resize(boxCount * 3);
+		for(int b = 0; b < boxCount; b++) {
+			const float* m = batchInverse.data() + b * 12;
+			for(int row = 0; row < 3; row++) {
+				localListener[b * 3 + row] = m[row * 4 + 0] * batchListener.x + m[row * 4 + 1] * batchListener.y + m[row * 4 + 2] * batchListener.z + m[row * 4 + 3];
+			}
+		}
+		raysTraced += queries.size() * batchRays;
+
+		if(workers.empty()) {
+			for(Query& query : queries) {
+				traceQuery(query);
+			}
+			applyResults(spatializer);
+			return;
+		}
+
+		chunkCount = ((int)queries.size() + QUERY_CHUNK - 1) / QUERY_CHUNK;
+		chunksLeft.store(chunkCount, std::memory_order_relaxed);
+		batchDone.store(false, std::memory_order_relaxed);
+		batchPending = true;
+		{
+			// The workers read the batch after taking the lock, which makes it visible to them.
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			generation++;
+			nextChunk.store((uint64_t)generation << 32, std::memory_order_relaxed);
+		}
+		wake.notify_all();
+	}
+
+	void OcclusionQueries::snapshotOccluders() {
+		batchInverse.clear();
+		batchTransmission.clear();
+
+		float inverse[12];
+		for(size_t i = 0; i < boxes.size(); i++) {
+			if(!boxUsed[i] || boxes[i].transmission >= 1.f || !invertTransform(boxes[i].transform, inverse)) continue;
+			batchInverse.insert(batchInverse.end(), inverse, inverse + 12);
+			batchTransmission.push_back(clampf(boxes[i].transmission, 0.f, 1.f));
+		}
+		boxesChanged = false;
+	}
+
+	bool OcclusionQueries::gatherQueries(Spatializer& spatializer) {
+		queries.clear();
+
+		const int count = spatializer.getEmitterCount();
+		const int budget = settings.raysPerTick / settings.raysPerQuery;
+		const Vector3 listener = spatializer.getListener().position;
+		const float maxDistanceSquared = settings.maxDistance * settings.maxDistance;
+
+		// Round robin over the emitters, starting after the last one traced.
+		for(int n = 0; n < count && (int)queries.size() < budget; n++) {
+			if(cursor >= count) {
+				cursor = 0;
+			}
+			EmitterId emitter = spatializer.getEmitter(cursor++);
+			if(spatializer.getVoice(emitter) == INVALID_VOICE) continue;
+
+			Vector3 position = spatializer.getPosition(emitter);
+			float dx = position.x - listener.x;
+			float dy = position.y - listener.y;
+			float dz = position.z - listener.z;
+			if(dx * dx + dy * dy + dz * dz > maxDistanceSquared) {
+				spatializer.setOcclusion(emitter, 1.f, OCCLUSION_OPEN_CUTOFF);
+				continue;
+			}
+
+			Query query;
+			query.emitter = emitter;
+			query.x = position.x;
+			query.y = position.y;
+			query.z = position.z;
+			queries.push_back(query);
+		}
+		return !queries.empty();
+	}
+
+	void OcclusionQueries::applyResults(Spatializer& spatializer) {
+		const float range = OCCLUSION_OPEN_CUTOFF / settings.occludedCutoff;
+		for(const Query& query : queries) {
+			// Rises by equal steps in octaves as more of the rays get through.
+			float cutoff = query.clear >= 1.f ? OCCLUSION_OPEN_CUTOFF : settings.occludedCutoff * powf(range, query.clear);
+			spatializer.setOcclusion(query.emitter, query.gain, cutoff);
+		}
+	}
+
+	void OcclusionQueries::workerLoop() {
+		uint32_t seen = 0;
+		while(true) {
+			int batchChunks;
+			{
+				std::unique_lock<std::mutex> lock(wakeMutex);
+				wake.wait(lock, [&] { return !running.load(std::memory_order_acquire) || generation != seen; });
+				if(!running.load(std::memory_order_acquire)) return;
+				seen = generation;
+				batchChunks = chunkCount;
+			}
+			traceChunks(seen, batchChunks);
+		}
+	}
+
+	void OcclusionQueries::traceChunks(uint32_t batch, int batchChunks) {
+		uint64_t claim = nextChunk.load(std::memory_order_relaxed);
+		while(true) {
+			if((uint32_t)(claim >> 32) != batch || (uint32_t)claim >= (uint32_t)batchChunks) return;
+			// A failed exchange reloads claim and checks again.
+			if(!nextChunk.compare_exchange_weak(claim, claim + 1, std::memory_order_relaxed)) continue;
+
+			int first = (int)(uint32_t)claim * QUERY_CHUNK;
+			int last = first + QUERY_CHUNK < (int)queries.size() ? first + QUERY_CHUNK : (int)queries.size();
+			for(int i = first; i < last; i++) {
+				traceQuery(queries[i]);
+			}
+
+			if(chunksLeft.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				batchDone.store(true, std::memory_order_release);
+			}
+			claim = nextChunk.load(std::memory_order_relaxed);
+		}
+	}
+
+	void OcclusionQueries::traceQuery(Query& query) const {
+		const Vector3& listener = batchListener;
+		float targets[MAX_OCCLUSION_RAYS][3];
+		targets[0][0] = query.x;
+		targets[0][1] = query.y;
+		targets[0][2] = query.z;
+
+		if(batchRays > 1) {
+			// Two directions across the path, so the extra rays fan out around the emitter.
+			float px = query.x - listener.x;
+			float py = query.y - listener.y;
+			float pz = query.z - listener.z;
+			// Cross with the world axis least in line with the path.
+			float ax = fabsf(px), ay = fabsf(py), az = fabsf(pz);
+			float ux, uy, uz;
+			if(ax <= ay && ax <= az) {
+				ux = 0.f; uy = pz; uz = -py;
+			}
+			else if(ay <= az) {
+				ux = -pz; uy = 0.f; uz = px;
+			}
+			else {
+				ux = py; uy = -px; uz = 0.f;
+			}
+			float ul = sqrtf(ux * ux + uy * uy + uz * uz);
+			float us = ul > 1e-6f ? batchRadius / ul : 0.f;
+			ux *= us; uy *= us; uz *= us;
+
+			float vx = py * uz - pz * uy;
+			float vy = pz * ux - px * uz;
+			float vz = px * uy - py * ux;
+			float vl = sqrtf(vx * vx + vy * vy + vz * vz);
+			float vs = vl > 1e-6f ? batchRadius / vl : 0.f;
+			vx *= vs; vy *= vs; vz *= vs;
+
+			const float offsets[MAX_OCCLUSION_RAYS - 1][3] = {
+				{ux, uy, uz}, {-ux, -uy, -uz}, {vx, vy, vz}, {-vx, -vy, -vz}
+			};
+			for(int r = 1; r < batchRays; r++) {
+				targets[r][0] = query.x + offsets[r - 1][0];
+				targets[r][1] = query.y + offsets[r - 1][1];
+				targets[r][2] = query.z + offsets[r - 1][2];
+			}
+		}
+
+		const int boxCount = (int)batchTransmission.size();
+		float total = 0.f;
+		int clear = 0;
+		for(int r = 0; r < batchRays; r++) {
+			float rx = targets[r][0] - listener.x;
+			float ry = targets[r][1] - listener.y;
+			float rz = targets[r][2] - listener.z;
+
+			float through = 1.f;
+			bool hit = false;
+			for(int b = 0; b < boxCount; b++) {
+				// Only the direction needs transforming, the listener was moved into the box once per batch.
+				const float* m = batchInverse.data() + b * 12;
+				float direction[3] = {
+					m[0] * rx + m[1] * ry + m[2] * rz,
+					m[4] * rx + m[5] * ry + m[6] * rz,
+					m[8] * rx + m[9] * ry + m[10] * rz
+				};
+				if(segmentHitsUnitBox(localListener.data() + b * 3, direction)) {
+					through *= batchTransmission[b];
+					hit = true;
+				}
+			}
+			total += through;
+			clear += hit ? 0 : 1;
+		}
+
+		query.gain = total / batchRays;
+		query.clear = (float)clear / batchRays;
+	}
+};
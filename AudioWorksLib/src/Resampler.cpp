@@ -0,0 +1,132 @@
+#include "pch.h"
+
+#include "includes/Resampler.h"
+
+#include <cmath>
+#include <vector>
+
+#include "Bitmaths.h"
+
+namespace Banshee {
+
+	static_assert(RESAMPLE_HISTORY == SINC_KERNEL_TAPS / 2 - 1, "sinc taps must be centred on the read position");
+	static_assert(RESAMPLE_LOOKAHEAD == SINC_KERNEL_TAPS / 2, "sinc taps must be centred on the read position");
+
+	// Steps the sinc tables are designed for. A block uses the first band at or above its
+	// largest step so the cutoff always sits below the output Nyquist frequency.
+	static const double SINC_BANDS[] = {1.0, 1.25, 1.5, 2.0, 3.0, 4.0, 6.0, 8.0};
+	constexpr int SINC_BAND_COUNT = sizeof(SINC_BANDS) / sizeof(SINC_BANDS[0]);
+
+	// Fraction of the Nyquist frequency kept at a step of one, the rest is transition band.
+	constexpr double SINC_CUTOFF = 0.9;
+	constexpr double KAISER_BETA = 7.0;
+
+	// Zeroth order modified Bessel function of the first kind.
+	static double besselI0(double x) {
+		double sum = 1.0;
+		double term = 1.0;
+		for(int k = 1; k < 32; k++) {
+			term *= (x / (2.0 * k)) * (x / (2.0 * k));
+			sum += term;
+			if(term < sum * 1e-12) break;
+		}
+		return sum;
+	}
+
+	struct SincTables {
+		std::vector<float> bands[SINC_BAND_COUNT];
+
+		SincTables() {
+			const double halfWidth = SINC_KERNEL_TAPS / 2;
+			const double norm = besselI0(KAISER_BETA);
+
+			for(int band = 0; band < SINC_BAND_COUNT; band++) {
+				double cutoff = SINC_CUTOFF / SINC_BANDS[band];
+				std::vector<float>& table = bands[band];
+				table.resize((SINC_PHASES + 1) * SINC_KERNEL_TAPS);
+
+				for(int phase = 0; phase <= SINC_PHASES; phase++) {
+					double frac = (double)phase / SINC_PHASES;
+					double taps[SINC_KERNEL_TAPS];
+					double sum = 0.0;
+
+					for(int k = 0; k < SINC_KERNEL_TAPS; k++) {
+						// Distance from the read position to the source frame under this tap.
+						double x = (double)(k - RESAMPLE_HISTORY) - frac;
+						double t = x * cutoff;
+						double sinc = fabs(t) < 1e-9 ? 1.0 : sin(PI_d * t) / (PI_d * t);
+
+						double w = x / halfWidth;
+						double window = fabs(w) >= 1.0 ? 0.0 : besselI0(KAISER_BETA * sqrt(1.0 - w * w)) / norm;
+
+						taps[k] = cutoff * sinc * window;
+						sum += taps[k];
+					}
+
+					// Unity gain at DC for every phase, otherwise the phases modulate the level.
+					for(int k = 0; k < SINC_KERNEL_TAPS; k++) {
+						table[phase * SINC_KERNEL_TAPS + k] = (float)(taps[k] / sum);
+					}
+				}
+			}
+		}
+	};
+
+	static const SincTables& sincTables() {
+		static const SincTables tables;
+		return tables;
+	}
+
+	void Resampler::initTables() {
+		sincTables();
+	}
+
+	double Resampler::advance(double startStep, double endStep, int frames) {
+		return frames * startStep + (endStep - startStep) * (frames + 1) * 0.5;
+	}
+
+	int Resampler::sourceFrames(double phase, double startStep, double endStep, int frames) {
+		double end = phase + advance(startStep, endStep, frames);
+		return RESAMPLE_HISTORY + (int)end + RESAMPLE_LOOKAHEAD + 1;
+	}
+
+	void Resampler::process(ResampleQuality quality, float* dst, const float* src, double phase,
+		double startStep, double endStep, int frames) {
+		double stepDelta = frames > 0 ? (endStep - startStep) / frames : 0.0;
+
+		if(quality == ResampleQuality::SINC) {
+			double largest = startStep > endStep ? startStep : endStep;
+			int band = 0;
+			while(band < SINC_BAND_COUNT - 1 && SINC_BANDS[band] < largest) {
+				band++;
+			}
+
+			kernels().sincResample(dst, src, sincTables().bands[band].data(), SINC_PHASES, phase, startStep, stepDelta, frames);
+			return;
+		}
+
+		const float* origin = src + RESAMPLE_HISTORY;
+		double position = phase;
+
+		if(quality == ResampleQuality::LINEAR) {
+			for(int i = 0; i < frames; i++) {
+				int base = (int)position;
+				float t = (float)(position - base);
+				dst[i] = origin[base] + t * (origin[base + 1] - origin[base]);
+				position += startStep + stepDelta * (i + 1);
+			}
+			return;
+		}
+
+		for(int i = 0; i < frames; i++) {
+			int base = (int)position;
+			float t = (float)(position - base);
+			float p0 = origin[base - 1];
+			float p1 = origin[base];
+			float p2 = origin[base + 1];
+			float p3 = origin[base + 2];
+			dst[i] = p1 + 0.5f * t * (p2 - p0 + t * (2.f * p0 - 5.f * p1 + 4.f * p2 - p3 + t * (3.f * (p1 - p2) + p3 - p0)));
+			position += startStep + stepDelta * (i + 1);
+		}
+	}
+};
@@ -0,0 +1,114 @@
+#include "pch.h"
+
+#include "includes/SampleBuffer.h"
+
+#include <cassert>
+#include <cstring>
+
+#include "includes/Adpcm.h"
+#include "includes/ScratchArena.h"
+
+namespace Banshee {
+
+	SampleBuffer::~SampleBuffer() {
+		reset();
+	}
+
+	SampleBuffer::SampleBuffer(const SampleBuffer& other) : storage(other.storage) {
+		if(storage != nullptr) {
+			storage->references.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	SampleBuffer::SampleBuffer(SampleBuffer&& other) : storage(other.storage) {
+		other.storage = nullptr;
+	}
+
+	SampleBuffer& SampleBuffer::operator=(const SampleBuffer& other) {
+		if(storage != other.storage) {
+			// Take the new reference first in case other is only kept alive by this handle.
+			if(other.storage != nullptr) {
+				other.storage->references.fetch_add(1, std::memory_order_relaxed);
+			}
+			reset();
+			storage = other.storage;
+		}
+		return *this;
+	}
+
+	SampleBuffer& SampleBuffer::operator=(SampleBuffer&& other) {
+		if(this != &other) {
+			reset();
+			storage = other.storage;
+			other.storage = nullptr;
+		}
+		return *this;
+	}
+
+	SampleBuffer SampleBuffer::fromReader(const AudioReader& reader) {
+		if(!reader.isOpen() || reader.getFrameCount() == 0) {
+			return SampleBuffer();
+		}
+
+		FrameView frames = reader.getFrames(0, reader.getFrameCount());
+
+		Storage* storage = new Storage();
+		storage->format = frames.format;
+		storage->frameCount = frames.frameCount;
+		storage->data.assign(frames.data, frames.data + frames.frameCount * frames.format.frameSize);
+		return SampleBuffer(storage);
+	}
+
+	SampleBuffer SampleBuffer::fromFloat(const float* samples, size_t frameCount, int channels, int sampleRate) {
+		if(samples == nullptr || frameCount == 0 || channels <= 0 || sampleRate <= 0) {
+			return SampleBuffer();
+		}
+
+		Storage* storage = new Storage();
+		storage->format.sampleFormat = SampleFormat::FLOAT32;
+		storage->format.channels = channels;
+		storage->format.sampleRate = sampleRate;
+		storage->format.frameSize = channels * (int)sizeof(float);
+		storage->frameCount = frameCount;
+		storage->data.resize(frameCount * storage->format.frameSize);
+		memcpy(storage->data.data(), samples, storage->data.size());
+		return SampleBuffer(storage);
+	}
+
+	SampleBuffer SampleBuffer::compressed(const FrameView& frames) {
+		std::vector<uint8_t> encoded;
+		AudioFormat format = encodeAdpcm(frames, encoded);
+		if(format.sampleFormat == SampleFormat::UNKNOWN) {
+			return SampleBuffer();
+		}
+
+		Storage* storage = new Storage();
+		storage->format = format;
+		storage->frameCount = frames.frameCount;
+		storage->data = std::move(encoded);
+		return SampleBuffer(storage);
+	}
+
+	void SampleBuffer::reset() {
+		if(storage == nullptr) return;
+
+		// acq_rel so every read made through other handles happens before the free.
+		if(storage->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			assert(!AudioThreadScope::isAudioThread() && "sample buffers must not be freed on the audio thread");
+			delete storage;
+		}
+		storage = nullptr;
+	}
+
+	FrameView SampleBuffer::getFrames() const {
+		FrameView view;
+		if(storage == nullptr) {
+			return view;
+		}
+
+		view.data = storage->data.data();
+		view.frameCount = storage->frameCount;
+		view.format = storage->format;
+		return view;
+	}
+};
@@ -0,0 +1,115 @@
+#include "pch.h"
+
+#include "includes/ScratchArena.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <new>
+
+#if BANSHEE_CHECK_AUDIO_ALLOCATIONS && defined(_MSC_VER)
+#include <crtdbg.h>
+#endif
+
+namespace Banshee {
+
+	ScratchArena::ScratchArena(size_t bytes) {
+		capacity = alignedSize(bytes);
+		storage.resize(capacity + SCRATCH_ALIGNMENT);
+
+		uintptr_t address = (uintptr_t)storage.data();
+		base = storage.data() + (SCRATCH_ALIGNMENT - address % SCRATCH_ALIGNMENT) % SCRATCH_ALIGNMENT;
+	}
+
+	void* ScratchArena::allocateBytes(size_t bytes) {
+		size_t size = alignedSize(bytes);
+		if(size > capacity - used) {
+			assert(!"ScratchArena is out of space");
+			return nullptr;
+		}
+
+		void* memory = base + used;
+		used += size;
+		highWater = used > highWater ? used : highWater;
+		return memory;
+	}
+
+#if BANSHEE_CHECK_AUDIO_ALLOCATIONS
+	static thread_local int audioThreadDepth = 0;
+
+	// Clears the scope first so whatever the assert allocates does not trip the check again.
+	static void reportAudioAllocation() {
+		audioThreadDepth = 0;
+		assert(!"heap allocation on the audio thread");
+	}
+
+#if defined(_MSC_VER)
+	static _CRT_ALLOC_HOOK previousHook = nullptr;
+
+	static int allocationHook(int allocType, void* userData, size_t size, int blockType, long requestNumber,
+		const unsigned char* fileName, int lineNumber) {
+		if(audioThreadDepth > 0 && (allocType == _HOOK_ALLOC || allocType == _HOOK_REALLOC)) {
+			reportAudioAllocation();
+		}
+
+		if(previousHook != nullptr) {
+			return previousHook(allocType, userData, size, blockType, requestNumber, fileName, lineNumber);
+		}
+		return 1;
+	}
+
+	static bool installAllocationHook() {
+		previousHook = _CrtSetAllocHook(allocationHook);
+		return true;
+	}
+#endif
+
+	AudioThreadScope::AudioThreadScope() {
+#if defined(_MSC_VER)
+		static bool installed = installAllocationHook();
+		(void)installed;
+#endif
+		audioThreadDepth++;
+	}
+
+	AudioThreadScope::~AudioThreadScope() {
+		if(audioThreadDepth > 0) {
+			audioThreadDepth--;
+		}
+	}
+
+	bool AudioThreadScope::isAudioThread() {
+		return audioThreadDepth > 0;
+	}
+#else
+	bool AudioThreadScope::isAudioThread() {
+		return false;
+	}
+#endif
+};
+
+#if BANSHEE_CHECK_AUDIO_ALLOCATIONS && !defined(_MSC_VER)
+// Without a CRT hook the check sits in the global operator new, which every container uses.
+void* operator new(std::size_t size) {
+	if(Banshee::AudioThreadScope::isAudioThread()) {
+		Banshee::reportAudioAllocation();
+	}
+
+	void* memory = std::malloc(size ? size : 1);
+	if(memory == nullptr) {
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void* operator new[](std::size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* memory) noexcept {
+	std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+	std::free(memory);
+}
+#endif
@@ -0,0 +1,291 @@
+#include "pch.h"
+
+#include "includes/SoundBank.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "includes/Adpcm.h"
+#include "Bitmaths.h"
+
+namespace Banshee {
+
+	static const char BANK_MAGIC[4] = { 'B', 'A', 'N', 'K' };
+
+	static inline uint64_t alignBank(uint64_t offset) {
+		return (offset + BANK_DATA_ALIGNMENT - 1) & ~(uint64_t)(BANK_DATA_ALIGNMENT - 1);
+	}
+
+	uint64_t SoundBank::hashName(const char* name, size_t length) {
+		uint64_t hash = 14695981039346656037ull;
+		for(size_t i = 0; i < length; i++) {
+			hash ^= (uint8_t)name[i];
+			hash *= 1099511628211ull;
+		}
+		// 0 marks an empty slot.
+		return hash != 0 ? hash : 1;
+	}
+
+	bool SoundBank::open(const std::string& path) {
+		close();
+
+		if(!file.open(path)) {
+			std::cout << "Could not map sound bank: " << path << std::endl;
+			return false;
+		}
+
+		const uint8_t* base = file.data();
+		const uint64_t size = file.size();
+		const BankHeader* candidate = (const BankHeader*)base;
+
+		bool valid = size >= sizeof(BankHeader) && memcmp(candidate->magic, BANK_MAGIC, sizeof(BANK_MAGIC)) == 0;
+		if(valid && candidate->version != BANK_VERSION) {
+			std::cout << "Sound bank version " << candidate->version << " is not supported: " << path << std::endl;
+			close();
+			return false;
+		}
+
+		// Check every range once here so lookups never need to. The offsets are ordered and bounded
+		// by size first, then every check subtracts from a bound rather than adding to an offset,
+		// so a corrupt header cannot wrap them.
+		valid = valid && candidate->fileSize == size
+			&& candidate->slotCount > 0 && (candidate->slotCount & (candidate->slotCount - 1)) == 0
+			&& candidate->clipCount < candidate->slotCount
+			&& candidate->entriesOffset % alignof(BankEntry) == 0
+			&& candidate->slotsOffset % alignof(BankSlot) == 0
+			&& candidate->entriesOffset <= candidate->slotsOffset && candidate->slotsOffset <= candidate->namesOffset
+			&& candidate->namesOffset <= candidate->dataOffset && candidate->dataOffset <= size
+			&& candidate->clipCount <= (candidate->slotsOffset - candidate->entriesOffset) / sizeof(BankEntry)
+			&& candidate->slotCount <= (candidate->namesOffset - candidate->slotsOffset) / sizeof(BankSlot);
+
+		if(valid) {
+			const BankEntry* entryTable = (const BankEntry*)(base + candidate->entriesOffset);
+			const uint64_t namesSize = candidate->dataOffset - candidate->namesOffset;
+			for(uint32_t i = 0; i < candidate->clipCount && valid; i++) {
+				const BankEntry& entry = entryTable[i];
+				FrameView clip = view(base, entry);
+				bool known = bytesPerSample(clip.format.sampleFormat) > 0
+					|| (clip.format.sampleFormat == SampleFormat::IMA_ADPCM && entry.channels <= ADPCM_MAX_CHANNELS);
+				valid = known && entry.channels > 0 && entry.sampleRate > 0
+					&& entry.dataOffset % BANK_DATA_ALIGNMENT == 0 && entry.dataOffset >= candidate->dataOffset
+					&& entry.dataOffset <= size
+					&& entry.nameOffset <= namesSize && entry.nameLength <= namesSize - entry.nameOffset;
+
+				// Count the data in whole units before multiplying it out: frames, or blocks of ADPCM.
+				const bool adpcm = clip.format.sampleFormat == SampleFormat::IMA_ADPCM;
+				const uint64_t unitFrames = adpcm ? ADPCM_BLOCK_FRAMES : 1;
+				const uint64_t unitBytes = adpcm ? (uint64_t)ADPCM_BLOCK_BYTES * entry.channels : (uint64_t)clip.format.frameSize;
+				const uint64_t units = entry.frameCount / unitFrames + (entry.frameCount % unitFrames != 0 ? 1 : 0);
+				valid = valid && unitBytes > 0 && units <= (size - entry.dataOffset) / unitBytes;
+			}
+
+			// Lookups probe until an empty slot, so a table without one would never end a miss.
+			const BankSlot* slotTable = (const BankSlot*)(base + candidate->slotsOffset);
+			bool anyEmpty = false;
+			for(uint32_t i = 0; i < candidate->slotCount && valid; i++) {
+				anyEmpty = anyEmpty || slotTable[i].hash == 0;
+				valid = slotTable[i].hash == 0 || slotTable[i].entry < candidate->clipCount;
+			}
+			valid = valid && anyEmpty;
+		}
+
+		if(!valid) {
+			std::cout << "Corrupt sound bank: " << path << std::endl;
+			close();
+			return false;
+		}
+
+		filePath = path;
+		header = candidate;
+		entries = (const BankEntry*)(base + header->entriesOffset);
+		slots = (const BankSlot*)(base + header->slotsOffset);
+		names = (const char*)(base + header->namesOffset);
+		return true;
+	}
+
+	void SoundBank::close() {
+		file.close();
+		filePath.clear();
+		header = nullptr;
+		entries = nullptr;
+		slots = nullptr;
+		names = nullptr;
+	}
+
+	FrameView SoundBank::find(const std::string& name) const {
+		return find(hashName(name.data(), name.size()), name.data(), name.size());
+	}
+
+	FrameView SoundBank::find(uint64_t hash, const char* name, size_t length) const {
+		const BankEntry* entry = lookup(hash, name, length);
+		return entry != nullptr ? view(file.data(), *entry) : FrameView();
+	}
+
+	std::string SoundBank::getClipName(int index) const {
+		if(index < 0 || index >= getClipCount()) {
+			return std::string();
+		}
+		return std::string(names + entries[index].nameOffset, entries[index].nameLength);
+	}
+
+	FrameView SoundBank::getClip(int index) const {
+		if(index < 0 || index >= getClipCount()) {
+			return FrameView();
+		}
+		return view(file.data(), entries[index]);
+	}
+
+	const BankEntry* SoundBank::lookup(uint64_t hash, const char* name, size_t length) const {
+		if(header == nullptr) {
+			return nullptr;
+		}
+
+		const uint32_t mask = header->slotCount - 1;
+		for(uint32_t slot = (uint32_t)hash & mask; slots[slot].hash != 0; slot = (slot + 1) & mask) {
+			if(slots[slot].hash != hash) continue;
+
+			// Hashes can collide, the name decides.
+			const BankEntry& entry = entries[slots[slot].entry];
+			if(entry.nameLength == length && memcmp(names + entry.nameOffset, name, length) == 0) {
+				return &entry;
+			}
+		}
+		return nullptr;
+	}
+
+	FrameView SoundBank::view(const uint8_t* base, const BankEntry& entry) {
+		FrameView frames;
+		frames.data = base + entry.dataOffset;
+		frames.frameCount = (size_t)entry.frameCount;
+		frames.format.sampleFormat = (SampleFormat)entry.sampleFormat;
+		frames.format.channels = entry.channels;
+		frames.format.sampleRate = (int)entry.sampleRate;
+		frames.format.frameSize = bytesPerSample(frames.format.sampleFormat) * entry.channels;
+		return frames;
+	}
+
+	bool SoundBankWriter::addClip(const std::string& name, const FrameView& frames, bool compress) {
+		if(name.empty() || name.size() > UINT16_MAX) {
+			std::cout << "Sound bank clip names must be 1 to " << UINT16_MAX << " characters long" << std::endl;
+			return false;
+		}
+
+		bool adpcm = frames.format.sampleFormat == SampleFormat::IMA_ADPCM;
+		if(frames.empty() || (bytesPerSample(frames.format.sampleFormat) == 0 && !adpcm) || frames.format.channels <= 0
+			|| frames.format.channels > (adpcm || compress ? ADPCM_MAX_CHANNELS : UINT8_MAX) || frames.format.sampleRate <= 0) {
+			std::cout << "Unsupported clip for sound bank: " << name << std::endl;
+			return false;
+		}
+
+		for(const Clip& clip : clips) {
+			if(clip.name == name) {
+				std::cout << "Sound bank already has a clip named " << name << std::endl;
+				return false;
+			}
+		}
+
+		Clip clip;
+		clip.name = name;
+		clip.frameCount = frames.frameCount;
+		if(compress && !adpcm) {
+			clip.format = encodeAdpcm(frames, clip.data);
+		}
+		else {
+			clip.format = frames.format;
+			clip.data.assign(frames.data, frames.data + frameBytes(frames.format, frames.frameCount));
+		}
+		clips.push_back(std::move(clip));
+		return true;
+	}
+
+	bool SoundBankWriter::addFile(const std::string& name, const std::string& path, bool compress) {
+		AudioReader reader;
+		if(!reader.open(path)) {
+			return false;
+		}
+		return addClip(name, reader.getFrames(0, reader.getFrameCount()), compress);
+	}
+
+	bool SoundBankWriter::write(const std::string& path) const {
+		std::vector<const Clip*> order;
+		for(const Clip& clip : clips) {
+			order.push_back(&clip);
+		}
+		std::sort(order.begin(), order.end(), [](const Clip* a, const Clip* b) { return a->name < b->name; });
+
+		uint32_t slotCount = 16;
+		while(slotCount < order.size() * 2) {
+			slotCount <<= 1;
+		}
+
+		BankHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, BANK_MAGIC, sizeof(BANK_MAGIC));
+		header.version = BANK_VERSION;
+		header.clipCount = (uint32_t)order.size();
+		header.slotCount = slotCount;
+		header.entriesOffset = sizeof(BankHeader);
+		header.slotsOffset = header.entriesOffset + order.size() * sizeof(BankEntry);
+		header.namesOffset = header.slotsOffset + (uint64_t)slotCount * sizeof(BankSlot);
+
+		std::vector<BankEntry> entries(order.size());
+		std::vector<BankSlot> slots(slotCount);
+		memset(entries.data(), 0, entries.size() * sizeof(BankEntry));
+		memset(slots.data(), 0, slots.size() * sizeof(BankSlot));
+
+		std::string names;
+		for(size_t i = 0; i < order.size(); i++) {
+			entries[i].nameOffset = (uint32_t)names.size();
+			entries[i].nameLength = (uint16_t)order[i]->name.size();
+			names += order[i]->name;
+		}
+
+		uint64_t offset = alignBank(header.namesOffset + names.size());
+		header.dataOffset = offset;
+		for(size_t i = 0; i < order.size(); i++) {
+			const Clip& clip = *order[i];
+			BankEntry& entry = entries[i];
+			entry.dataOffset = offset;
+			entry.frameCount = clip.frameCount;
+			entry.sampleFormat = (uint8_t)clip.format.sampleFormat;
+			entry.channels = (uint8_t)clip.format.channels;
+			entry.sampleRate = (uint32_t)clip.format.sampleRate;
+			offset = alignBank(offset + clip.data.size());
+
+			uint64_t hash = SoundBank::hashName(clip.name.data(), clip.name.size());
+			uint32_t slot = (uint32_t)hash & (slotCount - 1);
+			while(slots[slot].hash != 0) {
+				slot = (slot + 1) & (slotCount - 1);
+			}
+			slots[slot].hash = hash;
+			slots[slot].entry = (uint32_t)i;
+		}
+		header.fileSize = offset;
+
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		if(!out) {
+			std::cout << "Could not create sound bank: " << path << std::endl;
+			return false;
+		}
+
+		static const char padding[BANK_DATA_ALIGNMENT] = {};
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)entries.data(), entries.size() * sizeof(BankEntry));
+		out.write((const char*)slots.data(), slots.size() * sizeof(BankSlot));
+		out.write(names.data(), names.size());
+		uint64_t written = header.namesOffset + names.size();
+		for(size_t i = 0; i < order.size(); i++) {
+			out.write(padding, (std::streamsize)(entries[i].dataOffset - written));
+			out.write((const char*)order[i]->data.data(), order[i]->data.size());
+			written = entries[i].dataOffset + order[i]->data.size();
+		}
+		out.write(padding, (std::streamsize)(header.fileSize - written));
+
+		if(!out) {
+			std::cout << "Could not write sound bank: " << path << std::endl;
+			return false;
+		}
+		return true;
+	}
+};
@@ -0,0 +1,454 @@
+#include "pch.h"
+
+#include "includes/Spatializer.h"
+
+#include <cmath>
+
+#include "includes/Mixer.h"
+#include "Bitmaths.h"
+
+namespace Banshee {
+
+	// Changes smaller than this are not worth a mixer command.
+	constexpr float RESEND_THRESHOLD = 1e-4f;
+	// Fraction of the way to its occlusion target an emitter moves every update.
+	constexpr float OCCLUSION_GLIDE = 0.2f;
+	// Cutoff changes smaller than this ratio keep the filter the voice has.
+	constexpr float CUTOFF_RESEND_RATIO = 1.02f;
+	// Directions closer than about half a degree are not resent.
+	constexpr float DIRECTION_RESEND_COS = 0.99996f;
+	// Voices keep HRTF until this much further out than they got it, so one on the edge does not
+	// keep changing over.
+	constexpr float HRTF_LOD_HYSTERESIS = 1.1f;
+
+	EmitterId Spatializer::createEmitter(const EmitterSettings& settings) {
+		EmitterId id;
+		if(freeIds.empty()) {
+			id = (EmitterId)idToIndex.size();
+			idToIndex.push_back(0);
+		}
+		else {
+			id = freeIds.back();
+			freeIds.pop_back();
+		}
+
+		idToIndex[id] = (uint32_t)indexToId.size();
+		indexToId.push_back(id);
+
+		posX.push_back(0.f);
+		posY.push_back(0.f);
+		posZ.push_back(0.f);
+		dirX.push_back(0.f);
+		dirY.push_back(0.f);
+		dirZ.push_back(-1.f);
+		velX.push_back(0.f);
+		velY.push_back(0.f);
+		velZ.push_back(0.f);
+		dopplerScale.push_back(1.f);
+		minDistance.push_back(1.f);
+		maxDistance.push_back(1.f);
+		rolloff.push_back(1.f);
+		model.push_back(DistanceModel::NONE);
+		coneOuterCos.push_back(-3.f);
+		coneScale.push_back(1.f);
+		coneOuterGain.push_back(1.f);
+		voice.push_back(INVALID_VOICE);
+		occlusionTarget.push_back(1.f);
+		cutoffTarget.push_back(OCCLUSION_OPEN_CUTOFF);
+		occlusion.push_back(1.f);
+		cutoff.push_back(OCCLUSION_OPEN_CUTOFF);
+		gain.push_back(1.f);
+		pan.push_back(0.f);
+		pitch.push_back(1.f);
+		sentGain.push_back(-1.f);
+		sentPan.push_back(0.f);
+		sentPitch.push_back(1.f);
+		sentCutoff.push_back(OCCLUSION_OPEN_CUTOFF);
+		sentDirX.push_back(0.f);
+		sentDirY.push_back(0.f);
+		sentDirZ.push_back(0.f);
+		sentHrtfX.push_back(0.f);
+		sentHrtfY.push_back(0.f);
+		sentHrtfZ.push_back(0.f);
+
+		setSettings(id, settings);
+		return id;
+	}
+
+	void Spatializer::destroyEmitter(EmitterId emitter) {
+		if(!isValid(emitter)) return;
+
+		uint32_t index = idToIndex[emitter];
+		uint32_t last = (uint32_t)indexToId.size() - 1;
+
+		// Move the last emitter into the hole.
+		if(index != last) {
+			posX[index] = posX[last];
+			posY[index] = posY[last];
+			posZ[index] = posZ[last];
+			dirX[index] = dirX[last];
+			dirY[index] = dirY[last];
+			dirZ[index] = dirZ[last];
+			velX[index] = velX[last];
+			velY[index] = velY[last];
+			velZ[index] = velZ[last];
+			dopplerScale[index] = dopplerScale[last];
+			minDistance[index] = minDistance[last];
+			maxDistance[index] = maxDistance[last];
+			rolloff[index] = rolloff[last];
+			model[index] = model[last];
+			coneOuterCos[index] = coneOuterCos[last];
+			coneScale[index] = coneScale[last];
+			coneOuterGain[index] = coneOuterGain[last];
+			voice[index] = voice[last];
+			occlusionTarget[index] = occlusionTarget[last];
+			cutoffTarget[index] = cutoffTarget[last];
+			occlusion[index] = occlusion[last];
+			cutoff[index] = cutoff[last];
+			gain[index] = gain[last];
+			pan[index] = pan[last];
+			pitch[index] = pitch[last];
+			sentGain[index] = sentGain[last];
+			sentPan[index] = sentPan[last];
+			sentPitch[index] = sentPitch[last];
+			sentCutoff[index] = sentCutoff[last];
+			sentDirX[index] = sentDirX[last];
+			sentDirY[index] = sentDirY[last];
+			sentDirZ[index] = sentDirZ[last];
+			sentHrtfX[index] = sentHrtfX[last];
+			sentHrtfY[index] = sentHrtfY[last];
+			sentHrtfZ[index] = sentHrtfZ[last];
+
+			indexToId[index] = indexToId[last];
+			idToIndex[indexToId[index]] = index;
+		}
+
+		posX.pop_back();
+		posY.pop_back();
+		posZ.pop_back();
+		dirX.pop_back();
+		dirY.pop_back();
+		dirZ.pop_back();
+		velX.pop_back();
+		velY.pop_back();
+		velZ.pop_back();
+		dopplerScale.pop_back();
+		minDistance.pop_back();
+		maxDistance.pop_back();
+		rolloff.pop_back();
+		model.pop_back();
+		coneOuterCos.pop_back();
+		coneScale.pop_back();
+		coneOuterGain.pop_back();
+		voice.pop_back();
+		occlusionTarget.pop_back();
+		cutoffTarget.pop_back();
+		occlusion.pop_back();
+		cutoff.pop_back();
+		gain.pop_back();
+		pan.pop_back();
+		pitch.pop_back();
+		sentGain.pop_back();
+		sentPan.pop_back();
+		sentPitch.pop_back();
+		sentCutoff.pop_back();
+		sentDirX.pop_back();
+		sentDirY.pop_back();
+		sentDirZ.pop_back();
+		sentHrtfX.pop_back();
+		sentHrtfY.pop_back();
+		sentHrtfZ.pop_back();
+		indexToId.pop_back();
+
+		idToIndex[emitter] = INVALID_EMITTER;
+		freeIds.push_back(emitter);
+	}
+
+	void Spatializer::setSettings(EmitterId emitter, const EmitterSettings& settings) {
+		if(!isValid(emitter)) return;
+		uint32_t i = idToIndex[emitter];
+
+		model[i] = settings.model;
+		minDistance[i] = settings.minDistance > 1e-3f ? settings.minDistance : 1e-3f;
+		maxDistance[i] = settings.maxDistance > minDistance[i] ? settings.maxDistance : minDistance[i];
+		rolloff[i] = settings.rolloff;
+		dopplerScale[i] = settings.dopplerScale;
+
+		if(settings.coneOuterAngle >= 360.f) {
+			// Every angle lands above the inner cone.
+			coneOuterCos[i] = -3.f;
+			coneScale[i] = 1.f;
+			coneOuterGain[i] = 1.f;
+			return;
+		}
+
+		float innerCos = cosf(clampf(settings.coneInnerAngle, 0.f, 360.f) * 0.5f * DEG_TO_RAD_f);
+		float outerCos = cosf(clampf(settings.coneOuterAngle, 0.f, 360.f) * 0.5f * DEG_TO_RAD_f);
+		float width = innerCos - outerCos;
+
+		coneOuterCos[i] = outerCos;
+		coneScale[i] = width > 1e-4f ? 1.f / width : 1e4f;
+		coneOuterGain[i] = settings.coneOuterGain;
+	}
+
+	void Spatializer::setPosition(EmitterId emitter, const Vector3& position) {
+		if(!isValid(emitter)) return;
+		uint32_t i = idToIndex[emitter];
+		posX[i] = position.x;
+		posY[i] = position.y;
+		posZ[i] = position.z;
+	}
+
+	void Spatializer::setDirection(EmitterId emitter, const Vector3& direction) {
+		if(!isValid(emitter)) return;
+		uint32_t i = idToIndex[emitter];
+
+		float length = sqrtf(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+		float scale = length > 1e-6f ? 1.f / length : 0.f;
+		dirX[i] = direction.x * scale;
+		dirY[i] = direction.y * scale;
+		dirZ[i] = direction.z * scale;
+	}
+
+	void Spatializer::setVelocity(EmitterId emitter, const Vector3& velocity) {
+		if(!isValid(emitter)) return;
+		uint32_t i = idToIndex[emitter];
+		velX[i] = velocity.x;
+		velY[i] = velocity.y;
+		velZ[i] = velocity.z;
+	}
+
+	void Spatializer::setVoice(EmitterId emitter, VoiceHandle handle) {
+		if(!isValid(emitter)) return;
+		uint32_t i = idToIndex[emitter];
+		voice[i] = handle;
+		// Force the next update to send the values for the new voice, which starts without a filter.
+		sentGain[i] = -1.f;
+		sentCutoff[i] = OCCLUSION_OPEN_CUTOFF;
+		sentDirX[i] = 0.f;
+		sentDirY[i] = 0.f;
+		sentDirZ[i] = 0.f;
+		sentHrtfX[i] = 0.f;
+		sentHrtfY[i] = 0.f;
+		sentHrtfZ[i] = 0.f;
+	}
+
+	void Spatializer::setOcclusion(EmitterId emitter, float gainValue, float cutoffFrequency) {
+		if(!isValid(emitter)) return;
+		uint32_t i = idToIndex[emitter];
+		occlusionTarget[i] = clampf(gainValue, 0.f, 1.f);
+		cutoffTarget[i] = clampf(cutoffFrequency, 20.f, OCCLUSION_OPEN_CUTOFF);
+	}
+
+	float Spatializer::getGain(EmitterId emitter) const {
+		return isValid(emitter) ? gain[idToIndex[emitter]] : 0.f;
+	}
+
+	float Spatializer::getPan(EmitterId emitter) const {
+		return isValid(emitter) ? pan[idToIndex[emitter]] : 0.f;
+	}
+
+	float Spatializer::getDopplerRatio(EmitterId emitter) const {
+		return isValid(emitter) ? pitch[idToIndex[emitter]] : 1.f;
+	}
+
+	float Spatializer::getOcclusionCutoff(EmitterId emitter) const {
+		return isValid(emitter) ? cutoff[idToIndex[emitter]] : OCCLUSION_OPEN_CUTOFF;
+	}
+
+	Vector3 Spatializer::getPosition(EmitterId emitter) const {
+		if(!isValid(emitter)) return Vector3();
+		uint32_t i = idToIndex[emitter];
+		return Vector3(posX[i], posY[i], posZ[i]);
+	}
+
+	VoiceHandle Spatializer::getVoice(EmitterId emitter) const {
+		return isValid(emitter) ? voice[idToIndex[emitter]] : INVALID_VOICE;
+	}
+
+	bool Spatializer::isValid(EmitterId emitter) const {
+		return emitter < idToIndex.size() && idToIndex[emitter] != INVALID_EMITTER;
+	}
+
+	void Spatializer::update(Mixer& mixer) {
+		int count = (int)indexToId.size();
+		for(int first = 0; first < count; first += BATCH) {
+			computeBatch(first, count - first < BATCH ? count - first : BATCH);
+		}
+
+		// Occlusion results come in every few ticks, gliding hides the steps between them.
+		// The cutoff moves in octaves so it sweeps evenly to the ear.
+		for(int i = 0; i < count; i++) {
+			occlusion[i] += (occlusionTarget[i] - occlusion[i]) * OCCLUSION_GLIDE;
+			if(cutoff[i] != cutoffTarget[i]) {
+				cutoff[i] *= powf(cutoffTarget[i] / cutoff[i], OCCLUSION_GLIDE);
+				if(fabsf(cutoff[i] - cutoffTarget[i]) < 1.f) {
+					cutoff[i] = cutoffTarget[i];
+				}
+			}
+			gain[i] *= occlusion[i];
+		}
+
+		for(int i = 0; i < count; i++) {
+			if(voice[i] == INVALID_VOICE) continue;
+
+			bool open = cutoff[i] >= OCCLUSION_OPEN_CUTOFF;
+			bool wasOpen = sentCutoff[i] >= OCCLUSION_OPEN_CUTOFF;
+			if(open != wasOpen || (!open && (cutoff[i] > sentCutoff[i] * CUTOFF_RESEND_RATIO || cutoff[i] * CUTOFF_RESEND_RATIO < sentCutoff[i]))) {
+				mixer.setFilter(voice[i], open ? FilterType::NONE : FilterType::LOW_PASS, cutoff[i]);
+				sentCutoff[i] = cutoff[i];
+			}
+
+			if(fabsf(gain[i] - sentGain[i]) >= RESEND_THRESHOLD || fabsf(pan[i] - sentPan[i]) >= RESEND_THRESHOLD ||
+				fabsf(pitch[i] - sentPitch[i]) >= RESEND_THRESHOLD) {
+				mixer.setSpatial(voice[i], gain[i], pan[i], pitch[i]);
+				sentGain[i] = gain[i];
+				sentPan[i] = pan[i];
+				sentPitch[i] = pitch[i];
+			}
+
+			const bool held = sentHrtfX[i] != 0.f || sentHrtfY[i] != 0.f || sentHrtfZ[i] != 0.f;
+			if(!ambisonic && !hrtf && !held) continue;
+
+			float x = posX[i] - listener.position.x;
+			float y = posY[i] - listener.position.y;
+			float z = posZ[i] - listener.position.z;
+			float length = sqrtf(x * x + y * y + z * z);
+			// On top of the listener the direction is meaningless, straight ahead will do.
+			if(length > 1e-6f) {
+				x /= length;
+				y /= length;
+				z /= length;
+			}
+			else {
+				x = listener.forward.x;
+				y = listener.forward.y;
+				z = listener.forward.z;
+			}
+
+			if(ambisonic && x * sentDirX[i] + y * sentDirY[i] + z * sentDirZ[i] < DIRECTION_RESEND_COS) {
+				mixer.setDirection(voice[i], x, y, z);
+				sentDirX[i] = x;
+				sentDirY[i] = y;
+				sentDirZ[i] = z;
+			}
+
+			// Only voices within hrtfDistance are worth HRTF, further out they fall back.
+			if(hrtf && length < hrtfDistance * (held ? HRTF_LOD_HYSTERESIS : 1.f)) {
+				const Vector3& r = listener.right;
+				const Vector3& u = listener.up;
+				const Vector3& f = listener.forward;
+				float hx = x * r.x + y * r.y + z * r.z;
+				float hy = x * u.x + y * u.y + z * u.z;
+				float hz = x * f.x + y * f.y + z * f.z;
+				if(hx * sentHrtfX[i] + hy * sentHrtfY[i] + hz * sentHrtfZ[i] < DIRECTION_RESEND_COS) {
+					mixer.setHrtfDirection(voice[i], hx, hy, hz);
+					sentHrtfX[i] = hx;
+					sentHrtfY[i] = hy;
+					sentHrtfZ[i] = hz;
+				}
+			}
+			else if(held) {
+				mixer.clearHrtf(voice[i]);
+				sentHrtfX[i] = 0.f;
+				sentHrtfY[i] = 0.f;
+				sentHrtfZ[i] = 0.f;
+			}
+		}
+	}
+
+	void Spatializer::computeBatch(int first, int count) {
+		const float* BANSHEE_RESTRICT px = posX.data() + first;
+		const float* BANSHEE_RESTRICT py = posY.data() + first;
+		const float* BANSHEE_RESTRICT pz = posZ.data() + first;
+		const float* BANSHEE_RESTRICT dx = dirX.data() + first;
+		const float* BANSHEE_RESTRICT dy = dirY.data() + first;
+		const float* BANSHEE_RESTRICT dz = dirZ.data() + first;
+		const float* BANSHEE_RESTRICT vx = velX.data() + first;
+		const float* BANSHEE_RESTRICT vy = velY.data() + first;
+		const float* BANSHEE_RESTRICT vz = velZ.data() + first;
+
+		const float lx = listener.position.x;
+		const float ly = listener.position.y;
+		const float lz = listener.position.z;
+		const float rx = listener.right.x;
+		const float ry = listener.right.y;
+		const float rz = listener.right.z;
+		const float lvx = listener.velocity.x;
+		const float lvy = listener.velocity.y;
+		const float lvz = listener.velocity.z;
+
+		// Geometry. Straight line float maths over the arrays so the compiler can vectorise it.
+		for(int i = 0; i < count; i++) {
+			float ox = px[i] - lx;
+			float oy = py[i] - ly;
+			float oz = pz[i] - lz;
+			float d = sqrtf(ox * ox + oy * oy + oz * oz);
+			float inv = 1.f / (d > 1e-6f ? d : 1e-6f);
+
+			distance[i] = d;
+			// Sine of the azimuth, positive to the right.
+			localX[i] = (ox * rx + oy * ry + oz * rz) * inv;
+			// Cosine between the emitter direction and the direction to the listener.
+			facing[i] = -(ox * dx[i] + oy * dy[i] + oz * dz[i]) * inv;
+
+			listenerApproach[i] = (ox * lvx + oy * lvy + oz * lvz) * inv;
+			emitterApproach[i] = -(ox * vx[i] + oy * vy[i] + oz * vz[i]) * inv;
+		}
+
+		const float* BANSHEE_RESTRICT minD = minDistance.data() + first;
+		const float* BANSHEE_RESTRICT maxD = maxDistance.data() + first;
+		const float* BANSHEE_RESTRICT roll = rolloff.data() + first;
+		const float* BANSHEE_RESTRICT outerCos = coneOuterCos.data() + first;
+		const float* BANSHEE_RESTRICT scale = coneScale.data() + first;
+		const float* BANSHEE_RESTRICT outerGain = coneOuterGain.data() + first;
+		float* BANSHEE_RESTRICT outGain = gain.data() + first;
+		float* BANSHEE_RESTRICT outPan = pan.data() + first;
+		float* BANSHEE_RESTRICT outPitch = pitch.data() + first;
+		const float* BANSHEE_RESTRICT shift = dopplerScale.data() + first;
+
+		// Doppler ratio (c + listener approach) / (c - emitter approach).
+		// Approach speeds are capped below c so the ratio stays finite.
+		const float c = speedOfSound;
+		const float maxApproach = c * 0.9f;
+		for(int i = 0; i < count; i++) {
+			float scale = dopplerFactor * shift[i];
+			float towardsEmitter = clampf(listenerApproach[i] * scale, -maxApproach, maxApproach);
+			float towardsListener = clampf(emitterApproach[i] * scale, -maxApproach, maxApproach);
+			outPitch[i] = clampf((c + towardsEmitter) / (c - towardsListener), MIN_DOPPLER_RATIO, MAX_DOPPLER_RATIO);
+		}
+
+		// Cone and pan.
+		for(int i = 0; i < count; i++) {
+			float t = clampf((facing[i] - outerCos[i]) * scale[i], 0.f, 1.f);
+			outGain[i] = outerGain[i] + (1.f - outerGain[i]) * t;
+
+			// Narrow the image inside minDistance so an emitter on top of the listener is centred.
+			float spread = clampf(distance[i] / minD[i], 0.f, 1.f);
+			outPan[i] = clampf(localX[i], -1.f, 1.f) * spread;
+		}
+
+		// Distance curves differ per emitter, so this pass branches.
+		const DistanceModel* curve = model.data() + first;
+		for(int i = 0; i < count; i++) {
+			float d = clampf(distance[i], minD[i], maxD[i]);
+			float attenuation = 1.f;
+
+			switch(curve[i]) {
+			case DistanceModel::INVERSE:
+				attenuation = minD[i] / (minD[i] + roll[i] * (d - minD[i]));
+				break;
+			case DistanceModel::LINEAR:
+				attenuation = clampf(1.f - roll[i] * (d - minD[i]) / (maxD[i] - minD[i] + 1e-6f), 0.f, 1.f);
+				break;
+			case DistanceModel::EXPONENTIAL:
+				attenuation = powf(d / minD[i], -roll[i]);
+				break;
+			default:
+				break;
+			}
+
+			outGain[i] *= attenuation;
+		}
+	}
+};
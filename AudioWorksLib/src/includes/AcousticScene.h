@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Spatializer.h"
+
+namespace Banshee {
+
+	// Leaves with this many triangles or fewer are never split.
+	constexpr int BVH_LEAF_TRIANGLES = 4;
+
+	// How a surface treats sound that hits it.
+	struct AcousticMaterial {
+		// Fraction of the energy a hit takes away.
+		float absorption = 0.1f;
+		// Fraction of the reflected energy that scatters in a random direction instead of like a mirror.
+		float scattering = 0.2f;
+	};
+
+	struct RayHit {
+		float distance = 0.f;
+		// Unit normal of the triangle, facing back along the ray.
+		Vector3 normal;
+		uint32_t triangle = 0;
+		uint16_t material = 0;
+	};
+
+	// Triangles of every model in world space with a bounding volume hierarchy over them, for tracing sound.
+	//
+	// Meshes are added with their model transform and baked into one list. build() sorts the list
+	// into a BVH split by the surface area heuristic, evaluated over a few bins per axis so a build
+	// is a handful of linear passes per level. Nodes are 32 bytes, the two children of a node are
+	// next to each other and every leaf's triangles are contiguous, so a ray walks memory mostly forwards.
+	//
+	// Queries only read the scene and can run on any number of threads at once. Adding meshes or
+	// building must not overlap them.
+	class AcousticScene {
+	private:
+		// Precomputed for the Moller-Trumbore test.
+		struct Triangle {
+			Vector3 v0;
+			Vector3 edge1;
+			Vector3 edge2;
+		};
+
+		// An inner node when count is 0, then first is its left child and first + 1 its right.
+		// A leaf holds triangles first to first + count - 1.
+		struct Node {
+			float min[3];
+			uint32_t first;
+			float max[3];
+			uint32_t count;
+		};
+
+		std::vector<Triangle> triangles;
+		std::vector<uint16_t> triangleMaterials;
+		std::vector<AcousticMaterial> materials;
+		std::vector<Node> nodes;
+
+	public:
+		AcousticScene();
+		~AcousticScene() {};
+
+		// Returns the index meshes refer to it by. Material 0 always exists.
+		uint16_t addMaterial(const AcousticMaterial& material);
+
+		// Adds indexCount / 3 triangles. Vertex i starts at vertices[i * stride] with its x, y and z,
+		// so interleaved vertex buffers like a Cube's can be passed as they are. The transform is
+		// row major, local to world, with the translation in the fourth column.
+		void addMesh(const float* vertices, size_t vertexCount, size_t stride, const uint32_t* indices, size_t indexCount,
+			const float (&transform)[3][4], uint16_t material = 0);
+		// Drops every triangle and the BVH, the materials stay.
+		void clear();
+		// Builds the BVH over the triangles added so far.
+		void build();
+
+		// Nearest triangle along origin + t * direction for t between 0 and maxDistance.
+		// direction must be unit length. Returns false if nothing is hit, or the scene is not built.
+		bool intersect(const Vector3& origin, const Vector3& direction, float maxDistance, RayHit& hit) const;
+
+		inline bool isBuilt() const {
+			return !nodes.empty();
+		};
+		inline int getTriangleCount() const {
+			return (int)triangles.size();
+		};
+		inline int getNodeCount() const {
+			return (int)nodes.size();
+		};
+		inline const AcousticMaterial& getMaterial(uint16_t material) const {
+			return materials[material < materials.size() ? material : 0];
+		};
+
+		// Positions and triangles of a Wavefront OBJ file, 3 floats per vertex. Faces with more than
+		// three corners are split into fans. Normals, texture coordinates and groups are skipped.
+		static bool loadObj(const std::string& path, std::vector<float>& vertices, std::vector<uint32_t>& indices);
+	};
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "AcousticScene.h"
+#include "AudioWorkers.h"
+
+namespace Banshee {
+
+	typedef uint32_t TraceSourceId;
+	constexpr TraceSourceId INVALID_TRACE_SOURCE = 0xFFFFFFFF;
+
+	// Rays one task of a round traces.
+	constexpr int RAYS_PER_TASK = 256;
+
+	struct AcousticTracerSettings {
+		// Threads tracing a round, the round thread included. 0 uses every core.
+		int threads = 0;
+		// Rays per round, shared between the sources.
+		int raysPerRound = 32768;
+		int maxBounces = 32;
+		// Rays are stopped once they carry less than this fraction of their energy.
+		float minEnergy = 1e-4f;
+		// The listener is a sphere rays are counted through. Larger converges faster but blurs the timing.
+		float listenerRadius = 0.5f;
+		// Width and number of the histogram bins, 2ms by 1024 covers about two seconds.
+		float binSeconds = 0.002f;
+		int bins = 1024;
+		float speedOfSound = SPEED_OF_SOUND;
+		// Distance a source or the listener has to move before its old paths start to fade.
+		float moveThreshold = 0.5f;
+		// Share of the energy collected before a move that is kept.
+		float history = 0.25f;
+	};
+
+	// Geometric acoustics by stochastic ray tracing against an AcousticScene.
+	//
+	// Every source sends rays in random directions that bounce around the scene, losing energy to
+	// each surface they hit and scattering by its material. Wherever a ray passes through the listener
+	// sphere its energy is added to the source's energy histogram at its arrival time, which over many
+	// rays converges on the energy envelope of the impulse response from the source to the listener.
+	//
+	// The histograms are built up over several rounds. update() on the game thread collects the
+	// round that has finished and starts the next, which the round thread traces on an
+	// AudioWorkerPool: the rays are cut into tasks of RAYS_PER_TASK that idle cores steal, and each task
+	// writes a histogram of its own so no two threads share one. The game thread never waits for a
+	// round. A source that moves keeps only a share of what it had collected, so its response follows
+	// the move within a few rounds.
+	//
+	// The scene must stay built and unchanged while the tracer exists.
+	class AcousticTracer {
+	private:
+		struct Source {
+			bool used = false;
+			// Bumped when the slot is reused, so a round traced for a removed source is dropped.
+			uint32_t version = 0;
+			Vector3 position;
+			// Position the histogram was last faded at.
+			Vector3 anchor;
+			// Energy summed over every ray so far and the rays it came from.
+			std::vector<float> energy;
+			double rays = 0.0;
+			// energy normalised by the rays, what getEnergyResponse() returns.
+			std::vector<float> response;
+		};
+
+		struct Task {
+			TraceSourceId source;
+			uint32_t version;
+			Vector3 origin;
+			uint32_t seed;
+			uint32_t rays;
+		};
+
+		const AcousticScene& scene;
+		AcousticTracerSettings settings;
+
+		std::vector<Source> sources;
+		std::vector<TraceSourceId> freeSources;
+		Vector3 listener;
+		Vector3 listenerAnchor;
+		// Source the next round starts from, when the sources do not all fit in one.
+		uint32_t cursor = 0;
+		uint32_t round = 0;
+
+		// The round. Written by the game thread while none runs, read by the round thread and the pool.
+		std::vector<Task> tasks;
+		std::vector<uint32_t> ready;
+		// bins floats per task.
+		std::vector<float> taskEnergy;
+		Vector3 roundListener;
+
+		std::unique_ptr<AudioWorkerPool> pool;
+		std::thread thread;
+		std::atomic<bool> running{false};
+		std::atomic<bool> roundDone{true};
+		bool roundPending = false;
+		uint32_t generation = 0;
+		std::mutex wakeMutex;
+		std::condition_variable wake;
+
+		uint64_t raysTraced = 0;
+		uint64_t rounds = 0;
+
+	public:
+		AcousticTracer(const AcousticScene& scene, const AcousticTracerSettings& settings = AcousticTracerSettings());
+		~AcousticTracer();
+
+		AcousticTracer(const AcousticTracer&) = delete;
+		AcousticTracer& operator=(const AcousticTracer&) = delete;
+
+		// Game thread.
+
+		TraceSourceId addSource(const Vector3& position);
+		void removeSource(TraceSourceId source);
+		void setSourcePosition(TraceSourceId source, const Vector3& position);
+		void setListener(const Vector3& position);
+
+		// Collects the finished round into the histograms and starts the next one. Call once per tick.
+		void update();
+		// Waits for the running round and collects it, for tools and benchmarks.
+		void finish();
+
+		// Energy reaching the listener in each bin, settings.binSeconds wide, as a fraction of the energy
+		// the direct sound would have at one unit from the source. Empty for an unknown source.
+		const std::vector<float>& getEnergyResponse(TraceSourceId source) const;
+		// Rays the response of the source is averaged over, after fading for moves.
+		double getRayCount(TraceSourceId source) const;
+
+		inline const AcousticTracerSettings& getSettings() const {
+			return settings;
+		};
+		inline int getThreadCount() const {
+			return pool->getWorkerCount();
+		};
+		inline uint64_t getRaysTraced() const {
+			return raysTraced;
+		};
+		inline uint64_t getRoundCount() const {
+			return rounds;
+		};
+		inline bool isTracing() const {
+			return roundPending;
+		};
+
+	private:
+		bool isValid(TraceSourceId source) const;
+		void collect();
+		void startRound();
+
+		void roundLoop();
+		// TaskCallback of the pool, userData is the tracer.
+		static void traceTask(uint32_t task, int worker, void* userData);
+		void trace(const Task& task, float* energy) const;
+	};
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "AudioReader.h"
+
+namespace Banshee {
+
+	// Most channels an IMA ADPCM clip can have, as many as the mixer plays.
+	constexpr int ADPCM_MAX_CHANNELS = 8;
+
+	// Compresses frames of any PCM format to 4-bit IMA ADPCM, a little under a quarter of the
+	// size of 16-bit PCM. Every 64 frames start a new block for each channel that carries its own
+	// decoder state, so playback can start at any block and blocks decode side by side.
+	// Replaces the contents of out. Returns the format of the encoded frames, UNKNOWN on failure.
+	AudioFormat encodeAdpcm(const FrameView& frames, std::vector<uint8_t>& out);
+
+	// Decodes count frames from startFrame of an IMA ADPCM clip starting at data to interleaved floats.
+	// Starts at the beginning of the block holding startFrame, doing no work that needs allocating.
+	void decodeAdpcm(float* dst, const uint8_t* data, int channels, size_t startFrame, size_t count);
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "BiquadBank.h"
+#include "ScratchArena.h"
+#include "Spatializer.h"
+#include "SpscQueue.h"
+
+namespace Banshee {
+
+	constexpr int MAX_AMBISONIC_ORDER = 3;
+	// (order + 1)^2 spherical harmonics at third order.
+	constexpr int MAX_AMBISONIC_CHANNELS = 16;
+	// Virtual speakers of the decoder, twice the channels of the order.
+	constexpr int MAX_AMBISONIC_SPEAKERS = 32;
+	// Longest block an AmbisonicBus can be rendered in.
+	constexpr int AMBISONIC_MAX_FRAMES = 256;
+	// Longest interaural delay of the binaural decode, in samples. About 0.66 ms at 96 kHz.
+	constexpr int MAX_EAR_DELAY = 64;
+	// Arena space AmbisonicBus::process() needs: the planar soundfield, the speaker feeds and
+	// a delay line and output for one ear.
+	constexpr size_t AMBISONIC_SCRATCH_BYTES =
+		(MAX_AMBISONIC_CHANNELS + MAX_AMBISONIC_SPEAKERS + 2) * AMBISONIC_MAX_FRAMES * sizeof(float) +
+		MAX_EAR_DELAY * sizeof(float) + 4 * SCRATCH_ALIGNMENT;
+
+	inline int ambisonicChannels(int order) {
+		return (order + 1) * (order + 1);
+	};
+
+	// Real spherical harmonics of a unit direction up to order, in ACN channel order with SN3D
+	// normalisation (AmbiX), so channel 0 is always 1. The axes are whatever the direction is given
+	// in, the AmbisonicBus rotation takes world axes to the listener's.
+	void encodeAmbisonics(float x, float y, float z, int order, float* coefficients);
+
+	enum class AmbisonicDecode : uint8_t {
+		// Virtual speakers folded down to two channels by the mixer's pan law.
+		STEREO = 0,
+		// Virtual speakers heard through a spherical head model: every speaker reaches each ear
+		// after its interaural delay and through a head shadow filter for its angle to that ear.
+		BINAURAL
+	};
+
+	// Ambisonics submix. Voices routed to it with Mixer::setDirection() are encoded into a shared
+	// soundfield instead of being panned, so the cost per voice is the same whatever direction it
+	// comes from and however many voices overlap, and the spatial work happens once for all of them.
+	//
+	// Voices are encoded in world axes. Once per block the soundfield is rotated into the listener's
+	// axes and decoded with a single matrix, the rotation times the decoder, which is glided to over
+	// the block. Turning the head never touches the voices.
+	//
+	// The decoder is a mode matching decode to a spherical layout of virtual speakers with max rE
+	// weights. The rotation of each order is found by evaluating the harmonics at a fixed set of points
+	// turned by the listener and solving against the unturned ones, which is exact for a rotation and
+	// does not depend on the sign conventions of the harmonics.
+	//
+	// B-format buffers keep the channels in interleaved pairs: channels 2p and 2p + 1 share a plane
+	// of frames * 2 floats, plane after plane, so encoding a voice is one stereo pan per pair. With an
+	// odd channel count the second half of the last plane is unused.
+	class AmbisonicBus {
+	private:
+		// Points the rotation is solved on.
+		static constexpr int ROTATION_POINTS = 16;
+
+		// Listener axes as rows, world to front, left and up.
+		struct Orientation {
+			float matrix[3][3];
+		};
+
+		int order = 1;
+		int channels = 4;
+		AmbisonicDecode decode = AmbisonicDecode::STEREO;
+		int sampleRate = 48000;
+		int blockFrames = 256;
+		int speakers = 8;
+
+		// Decode of the unrotated soundfield, one row per output: left and right for STEREO,
+		// every virtual speaker for BINAURAL.
+		float decoder[MAX_AMBISONIC_SPEAKERS][MAX_AMBISONIC_CHANNELS];
+		int outputs = 2;
+		float rotationPoints[ROTATION_POINTS][3];
+		// For each order, the inverse of the harmonics of that order at the rotation points, in the
+		// columns of its channels.
+		float rotationInverse[ROTATION_POINTS][MAX_AMBISONIC_CHANNELS];
+
+		// BINAURAL. Delay and head shadow from every speaker to the left and right ear.
+		int earDelay[MAX_AMBISONIC_SPEAKERS][2];
+		BiquadCoefficients earFilter[MAX_AMBISONIC_SPEAKERS][2];
+
+		// Game thread.
+		SpscQueue<Orientation> orientations;
+
+		// Audio thread.
+		Orientation orientation;
+		bool turned = true;
+		// Rotated decode of the last block and the one to glide to.
+		float current[MAX_AMBISONIC_SPEAKERS][MAX_AMBISONIC_CHANNELS];
+		float target[MAX_AMBISONIC_SPEAKERS][MAX_AMBISONIC_CHANNELS];
+		BiquadState earState[MAX_AMBISONIC_SPEAKERS][2];
+		// Last MAX_EAR_DELAY samples of every speaker feed.
+		std::vector<float> history;
+		BiquadBank bank;
+
+	public:
+		// order is clamped to 1 to MAX_AMBISONIC_ORDER and blockFrames to 1 to AMBISONIC_MAX_FRAMES.
+		// The bus must be rendered in blocks of the clamped blockFrames.
+		AmbisonicBus(int order, AmbisonicDecode decode, int sampleRate, int blockFrames);
+		~AmbisonicBus() {};
+
+		AmbisonicBus(const AmbisonicBus&) = delete;
+		AmbisonicBus& operator=(const AmbisonicBus&) = delete;
+
+		// Game thread. Only the orientation of the listener is used, the voice directions already
+		// come from its position. Call once per tick with the Spatializer's listener.
+		void setListener(const Listener& listener);
+
+		inline int getOrder() const {
+			return order;
+		};
+		inline int getChannelCount() const {
+			return channels;
+		};
+		// Interleaved pairs a B-format buffer of one block holds.
+		inline int getPlaneCount() const {
+			return (channels + 1) / 2;
+		};
+		inline AmbisonicDecode getDecode() const {
+			return decode;
+		};
+		inline int getSpeakerCount() const {
+			return speakers;
+		};
+
+		// Audio thread. Rotates and decodes one block of the soundfield, getPlaneCount() planes of
+		// interleaved pairs, and adds the result to out, interleaved stereo.
+		void process(const float* soundfield, int frames, float* out, ScratchArena& scratch);
+
+	private:
+		// Rotation of the soundfield for the current orientation, times the decoder, into target.
+		void updateTarget();
+	};
+};
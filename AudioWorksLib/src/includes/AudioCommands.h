@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+
+#include "AudioReader.h"
+#include "BiquadBank.h"
+#include "DspGraph.h"
+#include "Resampler.h"
+
+namespace Banshee {
+
+	class AudioStream;
+
+	// Slot index in the low 16 bits, generation in the high 16 bits so stale handles are ignored.
+	typedef uint32_t VoiceHandle;
+	constexpr VoiceHandle INVALID_VOICE = 0xFFFFFFFF;
+
+	enum class CommandType : uint8_t {
+		NONE = 0,
+		PLAY,
+		STOP,
+		SET_GAIN,
+		SET_PAN,
+		SET_PRIORITY,
+		SET_PITCH,
+		SET_QUALITY,
+		SET_SPATIAL,
+		SET_REVERB_SEND,
+		SET_FILTER,
+		SET_BUS,
+		SET_DIRECTION,
+		SET_HRTF,
+		SET_MASTER_GAIN
+	};
+
+	// Fixed-size message from the game thread to the audio thread.
+	// Plain data only so it can be copied through the command ring.
+	struct AudioCommand {
+		CommandType type = CommandType::NONE;
+		VoiceHandle voice = INVALID_VOICE;
+
+		// PLAY: the frames to play. Must stay valid until the voice has finished.
+		FrameView source;
+		// PLAY: streamed voices read through the stream, source then only gives the format and length.
+		AudioStream* stream = nullptr;
+		bool loop = false;
+
+		// PLAY, SET_GAIN, SET_SPATIAL, SET_REVERB_SEND and SET_MASTER_GAIN.
+		float gain = 1.f;
+		// PLAY, SET_PAN and SET_SPATIAL.
+		float pan = 0.f;
+		// PLAY and SET_PRIORITY.
+		int priority = 0;
+		// PLAY, SET_PITCH and SET_SPATIAL (doppler), a playback rate multiplier.
+		float pitch = 1.f;
+		// PLAY and SET_QUALITY, the best resampler the voice may use.
+		ResampleQuality quality = ResampleQuality::SINC;
+		// SET_FILTER, designed on the game thread at the mixer rate.
+		BiquadCoefficients filter;
+		// SET_BUS.
+		BusId bus = MASTER_BUS;
+		// SET_DIRECTION, unit vector from the listener to the voice in world axes.
+		// SET_HRTF, the same in the listener's axes, x right, y up and z forward, or 0 to stop.
+		float direction[3] = {0.f, 0.f, 0.f};
+		// AudioStats::now() when the command was posted, for the latency histogram.
+		uint64_t postedAt = 0;
+	};
+
+	enum class VoiceEventType : uint8_t {
+		// The voice reached the end of its clip or was stopped. Its handle is no longer valid.
+		FINISHED = 0
+	};
+
+	// Message from the audio thread back to the game thread.
+	struct VoiceEvent {
+		VoiceEventType type = VoiceEventType::FINISHED;
+		VoiceHandle voice = INVALID_VOICE;
+	};
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+namespace Banshee {
+
+	// Fills frames interleaved frames of channels samples into out. Called on the device's own thread.
+	typedef void (*RenderCallback)(float* out, int frames, int channels, void* userData);
+
+	struct DeviceConfig {
+		int sampleRate = 48000;
+		int channels = 2;
+		// Frames requested per callback. The mixer takes any size, a multiple of BLOCK_FRAMES saves a copy.
+		int blockFrames = 256;
+	};
+
+	struct DeviceStats {
+		uint64_t blocksRendered = 0;
+		uint64_t framesRendered = 0;
+		// Time spent inside the render callback.
+		double busySeconds = 0.0;
+		// Blocks that started after their deadline (real time devices only).
+		uint64_t lateBlocks = 0;
+
+		// Seconds of audio produced per second of callback time. Above 1 means faster than real time.
+		double realtimeFactor(int sampleRate) const {
+			return busySeconds > 0.0 ? ((double)framesRendered / sampleRate) / busySeconds : 0.0;
+		};
+	};
+
+	// Output backend. Every backend drives the same render callback from its own thread,
+	// so the mixer runs exactly the same code no matter where the samples end up.
+	class AudioDevice {
+	protected:
+		DeviceConfig config;
+		RenderCallback callback = nullptr;
+		void* userData = nullptr;
+
+		std::thread thread;
+		std::atomic<bool> running{false};
+
+		std::atomic<uint64_t> blocksRendered{0};
+		std::atomic<uint64_t> busyNanoseconds{0};
+		std::atomic<uint64_t> lateBlocks{0};
+
+	public:
+		AudioDevice() {};
+		virtual ~AudioDevice() {};
+
+		AudioDevice(const AudioDevice&) = delete;
+		AudioDevice& operator=(const AudioDevice&) = delete;
+
+		virtual bool open(const DeviceConfig& config, RenderCallback callback, void* userData);
+		virtual bool start();
+		virtual void stop();
+		virtual void close();
+		virtual const char* getName() const = 0;
+
+		inline bool isRunning() const {
+			return running.load(std::memory_order_acquire);
+		};
+		inline const DeviceConfig& getConfig() const {
+			return config;
+		};
+		DeviceStats getStats() const;
+
+	protected:
+		// Body of the device thread, returns when running is cleared or the device is done.
+		virtual void run() = 0;
+		// Calls the render callback for one block and records how long it took.
+		void renderBlock(float* out);
+	};
+
+	// Discards the output but pulls blocks at the real time rate using a high resolution timer.
+	// For soak tests and machines without a sound card.
+	class NullDevice : public AudioDevice {
+	public:
+		NullDevice() {};
+		~NullDevice();
+
+		const char* getName() const override {
+			return "Null";
+		};
+
+	protected:
+		void run() override;
+	};
+
+	// Renders as fast as possible into a WAV file. Used to measure mixer throughput
+	// and to capture the output of headless runs.
+	class FileDevice : public AudioDevice {
+	private:
+		std::string path;
+		double durationSeconds = 0.0;
+		bool writeFloat = false;
+		std::atomic<bool> finished{false};
+
+	public:
+		// durationSeconds of 0 keeps rendering until stop() is called.
+		// 16-bit output is dithered, float output is written as is.
+		FileDevice(const std::string& path, double durationSeconds, bool writeFloat = false);
+		~FileDevice();
+
+		bool open(const DeviceConfig& config, RenderCallback callback, void* userData) override;
+
+		// Blocks until the requested duration has been written.
+		void waitUntilFinished();
+
+		inline bool isFinished() const {
+			return finished.load(std::memory_order_acquire);
+		};
+		const char* getName() const override {
+			return "File";
+		};
+
+	protected:
+		void run() override;
+	};
+};
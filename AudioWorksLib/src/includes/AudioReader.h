@@ -1,10 +1,162 @@
 #pragma once
 
-class TesterLib {
-public:
-	void helpme();
-};
+#include <cstddef>
+#include <cstdint>
+#include <string>
 
 namespace Banshee {
-	void printMessage();
-};
\ No newline at end of file
+
+	enum class SampleFormat {
+		UNKNOWN = 0,
+		PCM_U8,
+		PCM_S16,
+		PCM_S24,
+		PCM_S32,
+		FLOAT32,
+		// Compressed in blocks, see Adpcm.h. Frames have no size of their own so FrameView::frame()
+		// cannot be used, only the mixer and decodeAdpcm() read it.
+		IMA_ADPCM
+	};
+
+	// Size in bytes of a single sample of the given format (0 if unknown or compressed).
+	int bytesPerSample(SampleFormat format);
+
+	struct AudioFormat {
+		SampleFormat sampleFormat = SampleFormat::UNKNOWN;
+		int channels = 0;
+		int sampleRate = 0;
+		// Bytes per frame (one sample for every channel).
+		int frameSize = 0;
+	};
+
+	// Bytes taken by frameCount frames of the format, whole blocks for IMA_ADPCM.
+	size_t frameBytes(const AudioFormat& format, size_t frameCount);
+
+	// Non-owning view of interleaved frames inside a mapped file.
+	// Only valid while the reader that produced it stays open.
+	struct FrameView {
+		const uint8_t* data = nullptr;
+		size_t frameCount = 0;
+		AudioFormat format;
+
+		inline bool empty() const {
+			return frameCount == 0;
+		};
+		inline const uint8_t* frame(size_t index) const {
+			return data + index * format.frameSize;
+		};
+	};
+
+	// Read-only memory mapping of an entire file.
+	// Mapping is cheap, the OS only reads pages from disk once they are touched.
+	class MappedFile {
+	private:
+		const uint8_t* m_Data = nullptr;
+		size_t m_Size = 0;
+#ifdef _WIN32
+		void* m_FileHandle = nullptr;
+		void* m_MappingHandle = nullptr;
+#else
+		int m_FileDescriptor = -1;
+#endif
+
+	public:
+		MappedFile() {};
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		bool open(const std::string& path);
+		void close();
+
+		// Asks the OS to start reading the byte range in the background.
+		void prefetch(size_t offset, size_t length) const;
+		// Tells the OS the byte range will not be needed again soon so the pages can be dropped.
+		void release(size_t offset, size_t length) const;
+		// Hint that the file will mostly be read front to back.
+		void adviseSequential() const;
+
+		inline bool isOpen() const {
+			return m_Data != nullptr;
+		};
+		inline const uint8_t* data() const {
+			return m_Data;
+		};
+		inline size_t size() const {
+			return m_Size;
+		};
+	};
+
+	// Converts interleaved samples of any supported format into floats in the range [-1, 1].
+	void convertToFloat(float* dst, const uint8_t* src, SampleFormat format, size_t sampleCount);
+
+	// Memory maps RIFF/WAVE files and hands out zero-copy views of the sample frames.
+	// Supports 8/16/24/32-bit integer PCM and 32-bit float, including WAVE_FORMAT_EXTENSIBLE.
+	// Long files can be streamed block by block with readBlock(), which prefetches the next
+	// block and drops the pages of the blocks already consumed.
+	class AudioReader {
+	private:
+		MappedFile file;
+		std::string filePath;
+		AudioFormat format;
+
+		const uint8_t* sampleData = nullptr;
+		size_t frameCount = 0;
+
+		// Streaming state.
+		size_t cursor = 0;
+		size_t blockFrames = 4096;
+		size_t releasedFrames = 0;
+		bool streaming = false;
+
+	public:
+		AudioReader() {};
+		~AudioReader();
+
+		AudioReader(const AudioReader&) = delete;
+		AudioReader& operator=(const AudioReader&) = delete;
+
+		// Maps the file and parses the header. Sample data is not touched.
+		bool open(const std::string& path);
+		void close();
+
+		// Returns a view of up to count frames starting at startFrame.
+		FrameView getFrames(size_t startFrame, size_t count) const;
+
+		// Enables block streaming. Blocks are blockSize frames long.
+		void setStreaming(bool enable, size_t blockSize = 4096);
+		// Returns the next block and advances the cursor. The view is empty at the end of the data.
+		FrameView readBlock();
+		// Moves the streaming cursor to the given frame.
+		void seek(size_t frame);
+
+		// Asks the OS to start reading count frames from startFrame in the background.
+		void prefetchFrames(size_t startFrame, size_t count) const;
+		// Lets the OS drop the pages of count frames from startFrame, they are read again if touched.
+		void releaseFrames(size_t startFrame, size_t count) const;
+
+		inline bool isOpen() const {
+			return sampleData != nullptr;
+		};
+		inline const AudioFormat& getFormat() const {
+			return format;
+		};
+		inline size_t getFrameCount() const {
+			return frameCount;
+		};
+		inline size_t tell() const {
+			return cursor;
+		};
+		inline const std::string& getPath() const {
+			return filePath;
+		};
+		// Length of the clip in seconds.
+		inline double getDuration() const {
+			return format.sampleRate > 0 ? (double)frameCount / format.sampleRate : 0.0;
+		};
+
+	private:
+		bool parseHeader();
+	};
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace Banshee {
+
+	// Buckets of a LatencyHistogram. Each is a quarter of an octave wide, durations under 4ns get
+	// a bucket each and everything over half an hour shares the last one.
+	constexpr int LATENCY_BUCKETS = 160;
+
+	// Counts of a LatencyHistogram at one moment, owned by the reader.
+	struct LatencySnapshot {
+		uint64_t counts[LATENCY_BUCKETS] = {};
+		uint64_t count = 0;
+		uint64_t totalNanoseconds = 0;
+
+		// Durations in microseconds. Percentiles are the upper edge of the bucket holding them,
+		// at most a quarter over the real value. 0 when nothing was recorded.
+		double getMean() const;
+		double getPercentile(double fraction) const;
+		double getMax() const;
+
+		// What was recorded between earlier and this snapshot, both from the same histogram.
+		LatencySnapshot since(const LatencySnapshot& earlier) const;
+	};
+
+	// Histogram of durations with logarithmic buckets, written by one thread and read by any.
+	//
+	// The writer only does relaxed loads and stores, no read-modify-write, so recording is a handful of
+	// plain instructions even on the audio thread. Readers take a snapshot, which may be a block behind
+	// on some buckets, and subtract an earlier one for the figures of an interval.
+	class LatencyHistogram {
+	private:
+		std::atomic<uint64_t> counts[LATENCY_BUCKETS];
+		std::atomic<uint64_t> totalNanoseconds{0};
+
+	public:
+		LatencyHistogram();
+
+		LatencyHistogram(const LatencyHistogram&) = delete;
+		LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+		// Writer thread only.
+		void record(uint64_t nanoseconds);
+		// Any thread.
+		void read(LatencySnapshot& snapshot) const;
+
+		static int bucketFor(uint64_t nanoseconds);
+		// Lowest duration counted by the bucket, the upper edge is the next bucket's.
+		static uint64_t bucketStart(int bucket);
+	};
+
+	struct AudioStatsSnapshot {
+		uint64_t blocks = 0;
+		// Blocks that took longer to render than they last to play, a glitch on a real time device.
+		uint64_t underruns = 0;
+		uint64_t commands = 0;
+		// Voices in the last block.
+		int realVoices = 0;
+		int virtualVoices = 0;
+		// Time to render a block.
+		LatencySnapshot renderTime;
+		// Time from a command being posted on the game thread to the audio thread applying it.
+		LatencySnapshot commandLatency;
+		// Duration of one block, the render deadline.
+		double blockMicroseconds = 0.0;
+
+		// Render time as a percentage of the deadline, on average and for the slowest block.
+		inline double getLoad() const {
+			return blockMicroseconds > 0.0 ? renderTime.getMean() / blockMicroseconds * 100.0 : 0.0;
+		};
+		inline double getPeakLoad() const {
+			return blockMicroseconds > 0.0 ? renderTime.getMax() / blockMicroseconds * 100.0 : 0.0;
+		};
+
+		// Counters and histograms between earlier and this snapshot, the voice counts are this one's.
+		AudioStatsSnapshot since(const AudioStatsSnapshot& earlier) const;
+	};
+
+	// Performance counters of the mixer. The audio thread records every block, the game thread
+	// reads a snapshot whenever it likes without ever blocking the audio thread.
+	class AudioStats {
+	private:
+		std::atomic<uint64_t> blocks{0};
+		std::atomic<uint64_t> underruns{0};
+		std::atomic<uint64_t> commands{0};
+		std::atomic<int> realVoices{0};
+		std::atomic<int> virtualVoices{0};
+		LatencyHistogram renderTime;
+		LatencyHistogram commandLatency;
+		uint64_t blockNanoseconds = 0;
+
+	public:
+		AudioStats(int blockFrames, int sampleRate);
+
+		AudioStats(const AudioStats&) = delete;
+		AudioStats& operator=(const AudioStats&) = delete;
+
+		// Audio thread.
+		void recordBlock(uint64_t renderNanoseconds, int real, int virtualCount);
+		// postedAt is the now() of the game thread when it posted the command.
+		void recordCommand(uint64_t postedAt, uint64_t appliedAt);
+
+		// Any thread.
+		void read(AudioStatsSnapshot& snapshot) const;
+
+		inline int getRealVoices() const {
+			return realVoices.load(std::memory_order_relaxed);
+		};
+		inline int getVirtualVoices() const {
+			return virtualVoices.load(std::memory_order_relaxed);
+		};
+
+		// Monotonic clock in nanoseconds shared by every thread.
+		static uint64_t now();
+	};
+};
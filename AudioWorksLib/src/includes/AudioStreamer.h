@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AudioReader.h"
+
+namespace Banshee {
+
+	// Smallest chunk a stream may use, more than one block reads at the highest pitch.
+	constexpr int MIN_STREAM_CHUNK_FRAMES = 4096;
+	// Most chunks a stream can keep in memory.
+	constexpr int MAX_STREAM_BUFFERS = 8;
+
+	// Read ahead of one streamed clip.
+	struct StreamSettings {
+		// Frames per chunk, the unit the disk thread reads. At least MIN_STREAM_CHUNK_FRAMES.
+		int chunkFrames = 16384;
+		// Chunks kept in memory: the one being played and bufferCount - 1 ahead of it.
+		// 2 is double buffering, use 3 or more for slow storage or high pitches.
+		int bufferCount = 3;
+		// Chunks past the buffered ones the OS is asked to start reading, 0 for none.
+		int prefetchChunks = 2;
+	};
+
+	class AudioStreamer;
+
+	// A long clip played straight from disk through a few fixed chunks of memory.
+	//
+	// The disk thread of the owning AudioStreamer keeps the chunks filled ahead of the play position,
+	// which the mixer publishes after every block. The mixer reads the chunks on the audio thread
+	// without locking and never waits: a chunk that is not loaded yet plays as silence and counts
+	// as an underrun. Every chunk carries the index of the clip chunk it holds, which the disk thread
+	// clears before refilling it, so a reader can tell when a chunk changed under it (a seqlock).
+	class AudioStream {
+	private:
+		friend class AudioStreamer;
+
+		enum class State : int {
+			FREE = 0,
+			ACTIVE,
+			// Closed by the game thread, waiting for the disk thread to release it.
+			CLOSING
+		};
+
+		struct Chunk {
+			// Clip chunk held, -1 while empty or being refilled.
+			std::atomic<int64_t> index{-1};
+			std::vector<uint8_t> data;
+		};
+
+		AudioStreamer* owner = nullptr;
+		std::atomic<State> state{State::FREE};
+
+		// Set up on the game thread before the stream becomes ACTIVE, read only afterwards.
+		AudioReader reader;
+		StreamSettings settings;
+		bool loop = false;
+		int64_t chunkCount = 0;
+		std::unique_ptr<Chunk[]> chunks;
+
+		// First clip chunk the audio thread still needs, published by setPosition().
+		std::atomic<int64_t> neededChunk{0};
+		std::atomic<uint64_t> underruns{0};
+		// Disk thread. First chunk after the buffered ones when the OS was last asked to prefetch.
+		int64_t hintedChunk = -1;
+
+	public:
+		AudioStream() {};
+		~AudioStream() {};
+
+		AudioStream(const AudioStream&) = delete;
+		AudioStream& operator=(const AudioStream&) = delete;
+
+		// Game thread.
+
+		// Hands the stream back to the streamer. The mixer does this when a streamed voice finishes,
+		// only call it for a stream that is not playing.
+		void close();
+		// True once every chunk the start of playback needs has been loaded.
+		bool isPrimed() const;
+
+		inline bool isLooping() const {
+			return loop;
+		};
+		inline const AudioFormat& getFormat() const {
+			return reader.getFormat();
+		};
+		inline size_t getFrameCount() const {
+			return reader.getFrameCount();
+		};
+		inline const StreamSettings& getSettings() const {
+			return settings;
+		};
+		// Reads that found their chunk missing and played silence instead.
+		inline uint64_t getUnderruns() const {
+			return underruns.load(std::memory_order_relaxed);
+		};
+
+		// Audio thread.
+
+		// Publishes the next frame to be played so the disk thread can read ahead of it.
+		void setPosition(size_t frame);
+		// Converts up to count frames starting at frame to floats, stopping at the end of its chunk.
+		// Writes silence for a chunk that is not loaded. Returns the frames written, at least one.
+		int readFloat(size_t frame, int count, float* dst);
+
+	private:
+		// Clip chunk after index, -1 past the end of a clip that does not loop.
+		inline int64_t nextChunk(int64_t index) const {
+			return index + 1 < chunkCount ? index + 1 : (loop ? 0 : -1);
+		};
+	};
+
+	// Owns the streams and the disk thread that fills them.
+	//
+	// Streams come from a pool allocated up front, open() and close() only change their state.
+	// The disk thread wakes every couple of milliseconds, or when a stream moves into a new chunk,
+	// and refills the chunks each stream needs next, nearest first. Copying the chunk out of the
+	// mapped file is what pulls its pages in from disk, so page faults and slow storage only ever
+	// stall the disk thread.
+	class AudioStreamer {
+	private:
+		friend class AudioStream;
+
+		std::vector<std::unique_ptr<AudioStream>> streams;
+
+		std::thread thread;
+		std::atomic<bool> running{false};
+		std::mutex wakeMutex;
+		std::condition_variable wake;
+
+		std::atomic<uint64_t> underruns{0};
+		std::atomic<uint64_t> chunksLoaded{0};
+
+	public:
+		explicit AudioStreamer(int maxStreams = 32);
+		~AudioStreamer();
+
+		AudioStreamer(const AudioStreamer&) = delete;
+		AudioStreamer& operator=(const AudioStreamer&) = delete;
+
+		// Game thread. Opens a clip for streaming and starts loading its first chunks.
+		// Returns nullptr if the file cannot be read or every stream is in use.
+		AudioStream* open(const std::string& path, bool loop = false, const StreamSettings& settings = StreamSettings());
+
+		// Underruns of every stream so far.
+		inline uint64_t getUnderruns() const {
+			return underruns.load(std::memory_order_relaxed);
+		};
+		inline uint64_t getChunksLoaded() const {
+			return chunksLoaded.load(std::memory_order_relaxed);
+		};
+		int getOpenStreamCount() const;
+
+	private:
+		void diskLoop();
+		// Loads the chunks the stream needs next. Returns true if it loaded any.
+		bool service(AudioStream& stream);
+		void load(AudioStream& stream, AudioStream::Chunk& chunk, int64_t index);
+	};
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Banshee {
+
+	// Bounded work stealing deque of task indices (Chase-Lev).
+	// The owning thread pushes and pops at the bottom, any other thread steals from the top.
+	// Indices only ever grow so a thief that was preempted mid steal cannot take a slot twice.
+	class TaskDeque {
+	private:
+		static constexpr size_t CACHE_LINE = 64;
+
+		std::unique_ptr<std::atomic<uint32_t>[]> tasks;
+		int64_t mask = 0;
+
+		char pad0[CACHE_LINE];
+		std::atomic<int64_t> top{0};
+		char pad1[CACHE_LINE];
+		std::atomic<int64_t> bottom{0};
+		char pad2[CACHE_LINE];
+
+	public:
+		static constexpr uint32_t EMPTY = 0xFFFFFFFF;
+
+		// Capacity is rounded up to a power of two.
+		explicit TaskDeque(size_t capacity);
+
+		TaskDeque(const TaskDeque&) = delete;
+		TaskDeque& operator=(const TaskDeque&) = delete;
+
+		// Owner only. Returns false if the deque is full.
+		bool push(uint32_t task);
+		// Owner only. Newest task first, EMPTY if there is none.
+		uint32_t pop();
+		// Any thread. Oldest task first, EMPTY if there is none or another thread won the race.
+		uint32_t steal();
+	};
+
+	// Runs one task, called on whichever worker took it.
+	typedef void (*TaskCallback)(uint32_t task, int worker, void* userData);
+
+	// Small pool of helper threads that render alongside the audio thread.
+	//
+	// run() is called from the audio thread, which takes part as worker 0. Ready tasks start
+	// in its deque and idle helpers steal them, a task that makes others ready pushes them to the
+	// deque of the worker running it, so dependent work tends to stay on the same core.
+	// Helpers spin for a short while after a run before sleeping so back to back blocks do not
+	// pay for a wake up.
+	class AudioWorkerPool {
+	private:
+		std::vector<std::unique_ptr<TaskDeque>> deques;
+		std::vector<std::thread> helpers;
+
+		TaskCallback callback = nullptr;
+		void* userData = nullptr;
+
+		// Bumped for every run(), helpers wait for it to change.
+		std::atomic<uint32_t> generation{0};
+		// Tasks of the current run that have not finished yet.
+		std::atomic<int> remaining{0};
+		std::atomic<bool> running{false};
+		std::atomic<int> sleeping{0};
+		std::mutex wakeMutex;
+		std::condition_variable wake;
+
+	public:
+		// helperThreads may be 0, then run() does everything on the calling thread.
+		// maxReadyTasks bounds how many tasks can be queued on one worker at a time.
+		AudioWorkerPool(int helperThreads, int maxReadyTasks);
+		~AudioWorkerPool();
+
+		AudioWorkerPool(const AudioWorkerPool&) = delete;
+		AudioWorkerPool& operator=(const AudioWorkerPool&) = delete;
+
+		// Helpers plus the calling thread.
+		inline int getWorkerCount() const {
+			return (int)deques.size();
+		};
+
+		// Runs taskCount tasks in total, starting from the readyCount tasks in ready. The others
+		// must be pushed by the tasks they depend on. Returns once every task has finished.
+		// Audio thread only, never allocates or locks.
+		void run(const uint32_t* ready, int readyCount, int taskCount, TaskCallback taskCallback, void* user);
+
+		// From inside a task: queues a task that has just become ready on the calling worker.
+		void push(int worker, uint32_t task);
+
+	private:
+		void helperLoop(int worker);
+		// Takes and runs tasks until the current run is complete.
+		void work(int worker);
+		void execute(uint32_t task, int worker);
+	};
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Banshee {
+
+	enum class FilterType : uint8_t {
+		// Passes everything unchanged.
+		NONE = 0,
+		LOW_PASS,
+		HIGH_PASS,
+		// Constant 0 dB peak gain at the centre frequency.
+		BAND_PASS,
+		// Boosts or cuts gainDb around the centre frequency.
+		PEAKING,
+		// Boosts or cuts gainDb below or above the corner frequency.
+		LOW_SHELF,
+		HIGH_SHELF
+	};
+
+	// Q of a second order Butterworth response, no resonant peak.
+	constexpr float BUTTERWORTH_Q = 0.70710678f;
+
+	// Biquad coefficients normalised so a0 is 1.
+	struct BiquadCoefficients {
+		float b0 = 1.f;
+		float b1 = 0.f;
+		float b2 = 0.f;
+		float a1 = 0.f;
+		float a2 = 0.f;
+
+		// Designs from the RBJ audio EQ cookbook. frequency is clamped below Nyquist,
+		// gainDb is only used by PEAKING and the shelves.
+		static BiquadCoefficients design(FilterType type, float frequency, float q, float gainDb, int sampleRate);
+
+		inline bool isIdentity() const {
+			return b0 == 1.f && b1 == 0.f && b2 == 0.f && a1 == 0.f && a2 == 0.f;
+		};
+	};
+
+	// Delay elements of one transposed direct form II biquad.
+	struct BiquadState {
+		float z1 = 0.f;
+		float z2 = 0.f;
+	};
+
+	// Runs many independent biquads at once, one per lane.
+	//
+	// A single IIR filter cannot be vectorised over time because every output feeds the next one,
+	// so instead BIQUAD_LANES lanes are filtered together with one lane per SIMD element, SSE2 or
+	// AVX2. Each lane keeps its samples planar, the kernel transposes tiles of them in registers.
+	// Coefficients, their ramps and the filter state are kept as structure of arrays in lane order.
+	//
+	// Lanes do not own anything between blocks: each block the caller sets up the lanes it needs,
+	// loads their input, calls process() and stores the output and state back. Coefficients
+	// ramp linearly across the block, which keeps every frame stable since the stable region of
+	// (a1, a2) is convex.
+	class BiquadBank {
+	private:
+		int maxLanes = 0;
+		int frames = 0;
+
+		// frames samples per lane.
+		std::vector<float> samples;
+		// Stands in for the unused lanes of the last group.
+		std::vector<float> spare;
+		// Per group of BIQUAD_LANES lanes: 10 coefficient rows and 2 state rows.
+		std::vector<float> coefficients;
+		std::vector<float> state;
+
+	public:
+		// maxLanes is rounded up to a multiple of BIQUAD_LANES. frames is the block length,
+		// every process() call filters and ramps over exactly that many frames.
+		BiquadBank(int maxLanes, int frames);
+		~BiquadBank() {};
+
+		inline int getMaxLanes() const {
+			return maxLanes;
+		};
+		inline int getFrames() const {
+			return frames;
+		};
+
+		// Ramps the lane from one filter to another over the next process().
+		void setLane(int lane, const BiquadCoefficients& from, const BiquadCoefficients& to, const BiquadState& laneState);
+		// Copies frames samples into the lane.
+		void loadLane(int lane, const float* input);
+		// Copies the filtered lane to output and returns its state at the end of the block.
+		BiquadState storeLane(int lane, float* output) const;
+
+		// Filters lanes 0 to laneCount - 1.
+		void process(int laneCount);
+	};
+};
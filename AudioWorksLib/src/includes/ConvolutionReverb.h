@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "AudioReader.h"
+#include "ScratchArena.h"
+#include "SpscQueue.h"
+
+namespace Banshee {
+
+	// Samples per impulse response partition, one mixer block.
+	constexpr int REVERB_PARTITION = 256;
+	// Overlap-save transforms are two partitions long.
+	constexpr int REVERB_FFT_SIZE = REVERB_PARTITION * 2;
+	// Bins of a real spectrum of REVERB_FFT_SIZE samples.
+	constexpr int REVERB_BINS = REVERB_FFT_SIZE / 2 + 1;
+	// Partitions convolved on the audio thread. The rest of the tail is convolved on the
+	// worker thread, which has this many blocks to deliver each result.
+	constexpr int REVERB_HEAD_PARTITIONS = 8;
+	// Arena space ConvolutionReverb::process() needs for its work areas.
+	constexpr size_t REVERB_SCRATCH_BYTES = 16 * 1024;
+
+	// Spectrum split into real and imaginary parts so the complex maths vectorises.
+	struct Spectrum {
+		float re[REVERB_BINS];
+		float im[REVERB_BINS];
+	};
+
+	// Stereo convolution reverb bus using uniformly partitioned overlap-save convolution.
+	//
+	// The impulse response is cut into REVERB_PARTITION sized pieces and transformed once on load.
+	// Every block the input is transformed once and multiplied against each partition through a
+	// frequency domain delay line, so the cost per block grows with the IR length divided by the
+	// block size instead of the IR length times the block size.
+	//
+	// The first REVERB_HEAD_PARTITIONS partitions are done in process() so the reverb has no latency.
+	// Later partitions only affect output REVERB_HEAD_PARTITIONS blocks in the future, so their input
+	// spectra are sent to a worker thread and the finished tail blocks come back through a ring.
+	class ConvolutionReverb {
+	private:
+		// Input spectrum of one block, sent to the tail worker.
+		struct TailInput {
+			uint64_t block = 0;
+			Spectrum spectrum;
+		};
+
+		// Tail output for one block, sent back to the audio thread.
+		struct TailOutput {
+			uint64_t block = 0;
+			float samples[2][REVERB_PARTITION];
+		};
+
+		int channels = 0;
+		int partitionCount = 0;
+		// IR partition spectra, partitionCount per channel.
+		std::vector<Spectrum> irSpectra[2];
+
+		// Audio thread state.
+		std::vector<float> inputHistory;
+		std::vector<Spectrum> headDelayLine;
+		int headPosition = 0;
+		uint64_t block = 0;
+		TailOutput pendingTail;
+		bool hasPendingTail = false;
+		float wetGain = 1.f;
+
+		// Tail worker.
+		SpscQueue<TailInput> tailInputs;
+		SpscQueue<TailOutput> tailOutputs;
+		std::thread worker;
+		std::atomic<bool> workerRunning{false};
+		std::mutex wakeMutex;
+		std::condition_variable wake;
+
+		std::atomic<uint64_t> lateTails{0};
+
+	public:
+		ConvolutionReverb();
+		~ConvolutionReverb();
+
+		ConvolutionReverb(const ConvolutionReverb&) = delete;
+		ConvolutionReverb& operator=(const ConvolutionReverb&) = delete;
+
+		// Loads a mono or stereo impulse response, resampled to sampleRate if needed.
+		// Must not be called while process() can run.
+		bool load(const AudioReader& impulse, int sampleRate);
+		void unload();
+
+		inline bool isLoaded() const {
+			return partitionCount > 0;
+		};
+		inline int getPartitionCount() const {
+			return partitionCount;
+		};
+		inline void setWetGain(float gain) {
+			wetGain = gain;
+		};
+		// Blocks whose tail was not ready in time and was left out.
+		inline uint64_t getLateTails() const {
+			return lateTails.load(std::memory_order_relaxed);
+		};
+
+		// Audio thread. Convolves REVERB_PARTITION interleaved stereo frames of input,
+		// downmixed to mono, and adds the wet stereo result to out.
+		// The work areas come from scratch, which is left as it was found.
+		void process(const float* input, float* out, ScratchArena& scratch);
+
+	private:
+		void startWorker();
+		void stopWorker();
+		void workerLoop();
+	};
+};
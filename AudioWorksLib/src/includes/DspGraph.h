@@ -0,0 +1,205 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "BiquadBank.h"
+#include "ConvolutionReverb.h"
+#include "ScratchArena.h"
+
+namespace Banshee {
+
+	// Index of a bus in a DspGraph, stable for the life of the graph.
+	typedef uint16_t BusId;
+	constexpr BusId MASTER_BUS = 0;
+	constexpr BusId INVALID_BUS = 0xFFFF;
+	// Buses one graph can hold, the master included.
+	constexpr int MAX_BUSES = 256;
+	// Arena space an effect can take during one process() call.
+	constexpr size_t EFFECT_SCRATCH_BYTES = 32 * 1024;
+
+	// Processing inserted on a bus. process() runs on an audio worker thread and must not
+	// allocate, lock or block. An effect may only be used by one bus at a time and must
+	// outlive every schedule that uses it.
+	class AudioEffect {
+	public:
+		virtual ~AudioEffect() {};
+
+		// buffer holds frames interleaved stereo frames and is processed in place.
+		// Temporary buffers come from scratch, up to EFFECT_SCRATCH_BYTES, and are released
+		// by the caller afterwards.
+		virtual void process(float* buffer, int frames, ScratchArena& scratch) = 0;
+	};
+
+	// Stereo biquad insert.
+	class FilterEffect : public AudioEffect {
+	private:
+		BiquadCoefficients coefficients;
+		BiquadState state[2];
+
+	public:
+		explicit FilterEffect(const BiquadCoefficients& coefficients) : coefficients(coefficients) {};
+
+		void process(float* buffer, int frames, ScratchArena& scratch) override;
+	};
+
+	// Replaces the bus signal with the wet output of a convolution reverb, for reverb send buses.
+	// The bus must be rendered in blocks of REVERB_PARTITION frames.
+	class ReverbEffect : public AudioEffect {
+	private:
+		ConvolutionReverb* reverb;
+
+	public:
+		explicit ReverbEffect(ConvolutionReverb* reverb) : reverb(reverb) {};
+
+		void process(float* buffer, int frames, ScratchArena& scratch) override;
+	};
+
+	class DspGraph;
+
+	// DspGraph flattened into topological order for one render. Built on the game thread by
+	// DspGraph::compile() and only read by the audio thread, apart from the dependency counters.
+	class DspSchedule {
+	public:
+		struct Input {
+			uint32_t node;
+			// Bus gain of the input, times the send level for sends.
+			float gain;
+		};
+
+		struct Node {
+			BusId bus;
+			uint32_t firstInput;
+			uint32_t inputCount;
+			uint32_t firstEffect;
+			uint32_t effectCount;
+			// Nodes that take this one as an input.
+			uint32_t firstConsumer;
+			uint32_t consumerCount;
+		};
+
+	private:
+		friend class DspGraph;
+
+		int frames = 0;
+		std::vector<Node> nodes;
+		std::vector<Input> inputs;
+		std::vector<AudioEffect*> effects;
+		std::vector<uint32_t> consumers;
+		// Nodes without inputs, runnable as soon as the block starts.
+		std::vector<uint32_t> sources;
+		// Node of every bus id, MAX_BUSES entries. Unknown buses go to the master.
+		std::vector<uint16_t> busNodes;
+		uint32_t masterNode = 0;
+		float masterBusGain = 1.f;
+		// Most nodes that can run at the same time, 1 means the graph is a chain.
+		int width = 1;
+
+		// Interleaved stereo output of every node, set for each block by setBuffers().
+		float* buffers = nullptr;
+		// Inputs still running in the current block, reset by reset().
+		std::unique_ptr<std::atomic<int>[]> pending;
+
+		DspSchedule() {};
+
+	public:
+		DspSchedule(const DspSchedule&) = delete;
+		DspSchedule& operator=(const DspSchedule&) = delete;
+
+		inline int getNodeCount() const {
+			return (int)nodes.size();
+		};
+		inline const Node& getNode(uint32_t node) const {
+			return nodes[node];
+		};
+		inline const Input& getInput(uint32_t index) const {
+			return inputs[index];
+		};
+		inline AudioEffect* getEffect(uint32_t index) const {
+			return effects[index];
+		};
+		inline uint32_t getConsumer(uint32_t index) const {
+			return consumers[index];
+		};
+		inline const std::vector<uint32_t>& getSources() const {
+			return sources;
+		};
+		inline uint32_t getMasterNode() const {
+			return masterNode;
+		};
+		inline float getMasterBusGain() const {
+			return masterBusGain;
+		};
+		inline int getWidth() const {
+			return width;
+		};
+		inline uint32_t nodeForBus(BusId bus) const {
+			return bus < busNodes.size() ? busNodes[bus] : masterNode;
+		};
+		inline float* getBuffer(uint32_t node) {
+			return buffers + (size_t)node * frames * 2;
+		};
+		// Floats setBuffers() needs, the outputs of every node.
+		inline size_t getBufferFloats() const {
+			return nodes.size() * frames * 2;
+		};
+
+		// Audio thread. Points the node outputs at memory for the current block, usually arena scratch.
+		inline void setBuffers(float* memory) {
+			buffers = memory;
+		};
+		// Audio thread. Rearms the dependency counters before a block.
+		void reset();
+		// Audio thread. Called when an input of node has finished, true if node is now ready.
+		inline bool inputDone(uint32_t node) {
+			return pending[node].fetch_sub(1, std::memory_order_acq_rel) == 1;
+		};
+	};
+
+	// Description of the mix: a tree of submix buses under the master bus, each with a gain and a
+	// chain of effects, plus sends that feed one bus into another. Voices are routed to buses
+	// with Mixer::setBus().
+	//
+	// Game thread only. Changes take effect when the graph is handed to Mixer::setGraph(),
+	// which compiles it into a DspSchedule and swaps it in between two blocks.
+	class DspGraph {
+	private:
+		struct Bus {
+			BusId parent = INVALID_BUS;
+			float gain = 1.f;
+			std::vector<AudioEffect*> effects;
+		};
+
+		struct Send {
+			BusId from;
+			BusId to;
+			float gain;
+		};
+
+		std::vector<Bus> buses;
+		std::vector<Send> sends;
+
+	public:
+		// Starts with only the master bus.
+		DspGraph();
+		~DspGraph() {};
+
+		// Returns INVALID_BUS when the graph is full or the parent does not exist.
+		BusId addBus(BusId parent = MASTER_BUS, float gain = 1.f);
+		bool setGain(BusId bus, float gain);
+		// Effects run in the order they were added, after the inputs are summed.
+		bool addEffect(BusId bus, AudioEffect* effect);
+		// Feeds the output of from into to as well as into its parent. Post fader.
+		bool addSend(BusId from, BusId to, float gain);
+
+		inline int getBusCount() const {
+			return (int)buses.size();
+		};
+
+		// Flattens the graph for blocks of frames frames.
+		// Returns nullptr and prints why if the sends make a cycle.
+		DspSchedule* compile(int frames) const;
+	};
+};
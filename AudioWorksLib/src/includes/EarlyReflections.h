@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "BiquadBank.h"
+#include "DspGraph.h"
+#include "Spatializer.h"
+#include "SpscQueue.h"
+
+namespace Banshee {
+
+	constexpr int ROOM_WALLS = 6;
+	// Image sources up to second order in a box, 6 first order and 18 second order.
+	constexpr int MAX_REFLECTION_TAPS = 24;
+	// Reflections arriving later than this after the direct sound are left out, in seconds.
+	constexpr float MAX_REFLECTION_DELAY = 0.2f;
+
+	// Axis aligned box room given like a Cube: the centre is its position and size its scale, so the
+	// walls are half the size either side of the centre.
+	struct ReflectionRoom {
+		Vector3 centre;
+		Vector3 size = {10.f, 4.f, 10.f};
+		// Amplitude kept by a bounce off each wall, in the order -x, +x, -y, +y, -z, +z.
+		float reflectivity[ROOM_WALLS] = {0.7f, 0.7f, 0.5f, 0.7f, 0.7f, 0.7f};
+		// Low-pass cutoff of a single bounce. Each further bounce divides it again.
+		float wallCutoff = 6000.f;
+	};
+
+	// One image source, relative to the direct sound.
+	struct ReflectionTap {
+		// Time after the direct sound, in seconds.
+		float delay = 0.f;
+		// Wall losses times the inverse distance law against the direct path, 0 for a tap that is left out.
+		float gain = 0.f;
+		// -1 to 1, from the direction of the image source around the listener.
+		float pan = 0.f;
+		// Walls the path bounces off, 1 or 2.
+		int order = 0;
+	};
+
+	// Writes the image sources of the emitter, first order first, and returns how many: 6 for order 1
+	// and MAX_REFLECTION_TAPS for order 2. Tap i is always the same image so a moving emitter or
+	// listener changes each tap smoothly. Every tap is silent when either one is outside the room.
+	int computeImageSources(const ReflectionRoom& room, const Listener& listener, const Vector3& emitter,
+		int order, float speedOfSound, ReflectionTap* taps);
+
+	// Early reflections of one emitter in a box room, inserted on the bus its voice plays through.
+	//
+	// update() runs on the game thread and only recomputes the image sources when the listener or
+	// emitter has moved more than the move threshold, or the listener has turned, since the last time.
+	// The new taps reach the audio thread through a ring. process() downmixes the bus to mono into a
+	// delay line, reads every tap at its delay, filters the taps side by side in a BiquadBank with
+	// one lane each and pans them back into the bus. A new set of taps is glided to over one block.
+	// The bus must be rendered in blocks of the blockFrames given to the constructor.
+	class EarlyReflections : public AudioEffect {
+	private:
+		// Everything process() needs for one tap, worked out on the game thread.
+		struct TapTarget {
+			float delaySamples = 0.f;
+			float gainL = 0.f;
+			float gainR = 0.f;
+			BiquadCoefficients filter;
+		};
+
+		struct TapSet {
+			int count = 0;
+			TapTarget taps[MAX_REFLECTION_TAPS];
+		};
+
+		int sampleRate = 48000;
+		int blockFrames = 256;
+
+		// Game thread.
+		ReflectionRoom room;
+		int order = 2;
+		float moveThreshold = 0.25f;
+		float speedOfSound = SPEED_OF_SOUND;
+		bool changed = true;
+		Listener lastListener;
+		Vector3 lastEmitter;
+		ReflectionTap taps[MAX_REFLECTION_TAPS];
+		int tapCount = 0;
+		uint64_t recomputes = 0;
+
+		SpscQueue<TapSet> updates;
+
+		// Audio thread. The taps the last block ended on and the ones to glide to.
+		TapSet current;
+		TapSet target;
+		BiquadState filterState[MAX_REFLECTION_TAPS];
+		BiquadBank bank;
+		// Mono input, a power of two long.
+		std::vector<float> delayLine;
+		uint32_t delayMask = 0;
+		uint32_t writePosition = 0;
+
+	public:
+		EarlyReflections(int sampleRate, int blockFrames);
+		~EarlyReflections() {};
+
+		EarlyReflections(const EarlyReflections&) = delete;
+		EarlyReflections& operator=(const EarlyReflections&) = delete;
+
+		// Game thread.
+
+		void setRoom(const ReflectionRoom& value);
+		// 1 for first order reflections only, 2 adds the second order ones.
+		void setOrder(int value);
+		// World units the listener or emitter has to move before the image sources are recomputed.
+		inline void setMoveThreshold(float value) {
+			moveThreshold = value;
+		};
+		inline void setSpeedOfSound(float value) {
+			speedOfSound = value;
+			changed = true;
+		};
+
+		// Call once per tick with the same listener as the Spatializer and the emitter's position.
+		void update(const Listener& listener, const Vector3& emitter);
+
+		inline const ReflectionRoom& getRoom() const {
+			return room;
+		};
+		// Image sources from the last recompute.
+		inline int getTapCount() const {
+			return tapCount;
+		};
+		inline const ReflectionTap& getTap(int index) const {
+			return taps[index];
+		};
+		// Times the image sources have been recomputed.
+		inline uint64_t getRecomputeCount() const {
+			return recomputes;
+		};
+
+		// Audio thread.
+		void process(float* buffer, int frames, ScratchArena& scratch) override;
+
+	private:
+		bool needsRecompute(const Listener& listener, const Vector3& emitter) const;
+	};
+};
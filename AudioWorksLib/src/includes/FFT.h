@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Banshee {
+
+	// Largest transform FFT::get() will plan.
+	constexpr int MAX_FFT_SIZE = 1 << 20;
+
+	// Real FFT of a power of two size.
+	//
+	// A real input of N samples is transformed as an N / 2 point complex FFT of its even and odd
+	// samples, built from radix-4 stages (plus one radix-2 stage when log2(N / 2) is odd) that run
+	// on the SSE2/AVX2 butterflies in Bitmaths, followed by a split into the N / 2 + 1 real bins.
+	//
+	// Spectra are stored as separate real and imaginary arrays. forward() is unscaled and
+	// inverse() divides by N, so inverse(forward(x)) == x.
+	//
+	// A plan only holds read-only tables, one plan can be used by any number of threads at once.
+	class FFT {
+	private:
+		int size = 0;
+		int half = 0;
+
+		// Bit reversal of the N / 2 point complex transform.
+		std::vector<uint32_t> bitReverse;
+		// Index pairs to swap, in order, to permute in place between interleaved real samples
+		// and bit reversed split complex arrays.
+		std::vector<uint32_t> packSwaps;
+		std::vector<uint32_t> unpackSwaps;
+
+		// Radix-4 stages, quarter is the size of the sub-transforms each stage combines.
+		struct Stage {
+			size_t quarter;
+			size_t offset;
+		};
+		std::vector<Stage> stages;
+		std::vector<float> stageTwiddles;
+		bool radix2First = false;
+
+		// W(N)^k for k up to N / 4, used to split the complex result into real bins.
+		std::vector<float> splitCos;
+		std::vector<float> splitSin;
+
+	public:
+		// Cached plan for size, or nullptr if size is not a power of two from 4 to MAX_FFT_SIZE.
+		// Takes a lock the first time a size is requested, so fetch plans before the audio thread needs them.
+		static const FFT* get(int size);
+
+		FFT(const FFT&) = delete;
+		FFT& operator=(const FFT&) = delete;
+
+		inline int getSize() const {
+			return size;
+		};
+		// Bins in a spectrum, size / 2 + 1.
+		inline int getBins() const {
+			return half + 1;
+		};
+
+		// size samples in, getBins() values out in re and im. Out of place, input is not modified.
+		void forward(const float* input, float* re, float* im) const;
+		// getBins() values in, size samples out. Out of place, re and im are not modified.
+		void inverse(const float* re, const float* im, float* output) const;
+
+		// In place on size floats. The spectrum is packed as size / 2 real parts followed by
+		// size / 2 imaginary parts, with the Nyquist bin (which is real) stored where the
+		// imaginary part of the DC bin would be.
+		void forwardInPlace(float* data) const;
+		void inverseInPlace(float* data) const;
+
+	private:
+		explicit FFT(int size);
+
+		// Forward complex FFT of half points on bit reversed split arrays.
+		void transform(float* re, float* im) const;
+		// Turns the complex FFT of the packed samples into bins 0 to half - 1 in place.
+		// Returns the real Nyquist bin.
+		float splitSpectrum(float* re, float* im) const;
+		// Inverse of splitSpectrum(). dst may alias src, except when bitReversed is set.
+		void mergeSpectrum(const float* srcRe, const float* srcIm, float nyquist, float* dstRe, float* dstIm, bool bitReversed) const;
+
+		static void applySwaps(float* data, const std::vector<uint32_t>& swaps);
+	};
+};
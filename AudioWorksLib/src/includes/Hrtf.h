@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ConvolutionReverb.h"
+#include "FFT.h"
+#include "ScratchArena.h"
+
+namespace Banshee {
+
+	constexpr uint32_t HRIR_VERSION = 1;
+	// Taps of every impulse response kept after its onset, longer ones are cut.
+	constexpr int HRTF_MAX_LENGTH = 512;
+	// Filters are partitioned like the reverb, one mixer block per partition.
+	constexpr int HRTF_MAX_PARTITIONS = HRTF_MAX_LENGTH / REVERB_PARTITION;
+	// Longest onset delay of an ear, in samples. About 1.3 ms at 96 kHz.
+	constexpr int HRTF_MAX_DELAY = 128;
+	// Spacing of the filter grid in degrees, 36 azimuths by 19 elevations pole to pole.
+	constexpr int HRTF_GRID_STEP = 10;
+	constexpr int HRTF_GRID_AZIMUTHS = 360 / HRTF_GRID_STEP;
+	constexpr int HRTF_GRID_ELEVATIONS = 180 / HRTF_GRID_STEP + 1;
+	// Arena space HrtfConvolver::process() needs for its work areas.
+	constexpr size_t HRTF_SCRATCH_BYTES =
+		sizeof(Spectrum) + (REVERB_FFT_SIZE + 5 * REVERB_PARTITION + HRTF_MAX_DELAY + 1) * sizeof(float) + 6 * SCRATCH_ALIGNMENT;
+
+	// On disk layout of a .hrir file, little endian: HrirHeader, measurementCount HrtfMeasurements
+	// and then the impulse responses as 32-bit floats, the left and then the right ear of every
+	// measurement in order, length samples each.
+	struct HrirHeader {
+		char magic[4];
+		uint32_t version;
+		uint32_t sampleRate;
+		uint32_t length;
+		uint32_t measurementCount;
+		uint32_t reserved;
+	};
+
+	// Direction of one measured pair of impulse responses in degrees, as in SOFA files: azimuth
+	// turns anticlockwise seen from above so 90 is to the left, elevation 90 is straight up.
+	struct HrtfMeasurement {
+		float azimuth;
+		float elevation;
+	};
+
+	// Filters of one direction, both ears. The spectra are the impulse responses without their
+	// onset, which is given separately as a delay in samples.
+	struct HrtfFilter {
+		Spectrum ears[2][HRTF_MAX_PARTITIONS];
+		float delay[2];
+	};
+
+	// Head related transfer functions of a measured HRIR set, cached on a regular grid.
+	//
+	// The measurements rarely lie on a grid and are often sparse, so on load the onset of every
+	// impulse response is cut off and kept as a delay, the aligned responses around each grid point
+	// are blended from the nearest measurements and the result is transformed into partitions once.
+	// Looking up a direction then blends the spectra and delays of the four grid points around it.
+	// Blending aligned responses keeps the interaural delay out of the spectra, where interpolating
+	// it would comb filter.
+	//
+	// The set is scaled so an ear hears unity energy on average over the measurements, about the
+	// level of a centred voice on the mixer's pan law.
+	//
+	// Read only once loaded, any number of threads can look up filters at once.
+	class HrtfSet {
+	private:
+		int sampleRate = 0;
+		int partitions = 0;
+		int measurementCount = 0;
+		const FFT* fft = nullptr;
+		// Partitions of both ears of every grid point, elevation major.
+		std::vector<Spectrum> grid;
+		// Delays of both ears of every grid point.
+		std::vector<float> gridDelays;
+
+	public:
+		HrtfSet() {};
+		~HrtfSet() {};
+
+		HrtfSet(const HrtfSet&) = delete;
+		HrtfSet& operator=(const HrtfSet&) = delete;
+
+		// Reads a .hrir file and builds the grid at sampleRate, resampling if the file differs.
+		// Must not be called while a mixer uses the set.
+		bool load(const std::string& path, int sampleRate);
+		// Same from impulse responses in memory, laid out as in the file.
+		bool build(const HrtfMeasurement* measurements, int count, const float* samples, int length, int sourceRate, int sampleRate);
+		void unload();
+
+		inline bool isLoaded() const {
+			return partitions > 0;
+		};
+		inline int getSampleRate() const {
+			return sampleRate;
+		};
+		inline int getPartitionCount() const {
+			return partitions;
+		};
+		inline int getMeasurementCount() const {
+			return measurementCount;
+		};
+		// Plan the filters were transformed with, fetched on load so the audio thread never plans.
+		inline const FFT* getFft() const {
+			return fft;
+		};
+
+		// Filter for a unit direction from the listener in its own axes, x right, y up and z forward.
+		// Only the set's partitions are written.
+		void interpolate(float x, float y, float z, HrtfFilter& filter) const;
+	};
+
+	// Binaural convolution of one voice with an HrtfSet, uniformly partitioned overlap-save like
+	// ConvolutionReverb's head: one transform of the input and one inverse per ear each block.
+	//
+	// When the direction changes the block is convolved with the old and the new filter and
+	// crossfaded from one to the other, and the ear delays glide to their new length, so moving
+	// voices neither click nor comb. That doubles the inverse transforms, which only happens in
+	// blocks the direction actually changes in.
+	class HrtfConvolver {
+	private:
+		float inputHistory[REVERB_FFT_SIZE];
+		// Input spectra of the last partitions blocks.
+		Spectrum inputs[HRTF_MAX_PARTITIONS];
+		int position = 0;
+		// The filter in use and the one crossfaded from.
+		HrtfFilter filters[2];
+		int current = 0;
+		float direction[3];
+		bool primed = false;
+		// Last HRTF_MAX_DELAY + 1 samples of each ear before its delay.
+		float earHistory[2][HRTF_MAX_DELAY + 1];
+
+	public:
+		HrtfConvolver() {
+			reset();
+		};
+
+		// Clears the history for a new voice.
+		void reset();
+
+		// Audio thread. Convolves a block of mono input, REVERB_PARTITION samples of which frames are
+		// valid, with the filter for direction (listener axes, see HrtfSet::interpolate()) and adds
+		// frames of the result to out, interleaved stereo, with its gain ramping from gainFrom to gainTo.
+		// The work areas come from scratch, which is left as it was found.
+		void process(const HrtfSet& set, const float* input, int frames, const float* direction,
+			float gainFrom, float gainTo, float* out, ScratchArena& scratch);
+	};
+};
@@ -0,0 +1,404 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Ambisonics.h"
+#include "AudioCommands.h"
+#include "AudioReader.h"
+#include "AudioStats.h"
+#include "AudioStreamer.h"
+#include "AudioWorkers.h"
+#include "BiquadBank.h"
+#include "ConvolutionReverb.h"
+#include "DspGraph.h"
+#include "Hrtf.h"
+#include "Resampler.h"
+#include "SampleBuffer.h"
+#include "ScratchArena.h"
+#include "SpscQueue.h"
+
+namespace Banshee {
+
+	// Frames rendered by every call to Mixer::render().
+	constexpr int BLOCK_FRAMES = 256;
+	// The mix is always rendered as interleaved stereo.
+	constexpr int OUTPUT_CHANNELS = 2;
+	// Clips with more channels than this are rejected.
+	constexpr int MAX_SOURCE_CHANNELS = 8;
+	// Source frames one block can read at the largest resampling step.
+	constexpr int SOURCE_SCRATCH_FRAMES = (int)(MAX_RESAMPLE_STEP * BLOCK_FRAMES) + RESAMPLE_HISTORY + RESAMPLE_LOOKAHEAD + 2;
+	// Filter bank lanes per worker, two per stereo voice. A full bank is run and mixed early.
+	constexpr int FILTER_BANK_LANES = 64;
+
+	// Called on the game thread from update() for every voice that has finished.
+	typedef void (*VoiceFinishedCallback)(VoiceHandle voice, void* userData);
+
+	// Mixes clips into an interleaved float buffer one fixed block at a time.
+	// render() never allocates, locks or touches the file system. Its temporary buffers come from
+	// a ScratchArena per worker that is sized up front and reset at the start of every block.
+	//
+	// Up to maxVoices clips can play at once but only the maxRealVoices most important ones are
+	// mixed. The rest are virtual: their play position keeps moving but they cost next to nothing,
+	// so the price of a block follows maxRealVoices rather than the number of emitters.
+	// Importance is the voice priority first and its audibility (current gain) second.
+	//
+	// Voices can have a biquad filter. Their blocks are collected and filtered side by side in a
+	// BiquadBank before they are mixed, instead of one voice at a time.
+	//
+	// Voices are mixed into the buses of a DspGraph, set with setGraph() and setBus(). The graph
+	// is compiled into a DspSchedule on the game thread and swapped in between two blocks.
+	// Every bus is one task: it mixes its voices, sums its inputs and runs its effects. Once all
+	// inputs of a bus are done it becomes ready, so with startWorkers() independent buses render
+	// in parallel on a small pool of helper threads. Without helpers, or for a graph that is a
+	// single chain, the buses simply run in order on the audio thread.
+	//
+	// Voices given a direction with setDirection() leave their bus and are encoded into the
+	// AmbisonicBus instead. Like the reverb sends, every worker encodes into a soundfield of its own
+	// and the sum is rotated and decoded once after the graph has run.
+	//
+	// Voices given a head relative direction with setHrtfDirection() are convolved with the filters
+	// of an HrtfSet and stay in their bus. HRTF is the dearest way to place a voice, so only the
+	// maxHrtfVoices most important of them get it and the rest fall back to the Ambisonics bus or
+	// panning, crossfading over a block whenever a voice changes over.
+	//
+	// Clips are resampled from their own rate to the mixer rate, times the voice pitch.
+	// The maxSincVoices most important real voices get the windowed sinc resampler,
+	// the others drop to cubic interpolation.
+	//
+	// The control methods belong to the game thread and only post commands to a wait-free ring,
+	// render() belongs to the audio thread and applies them at the start of the next block.
+	// Finished voices travel back through a second ring and are collected by update().
+	class Mixer {
+	private:
+		// Audio thread state of a voice.
+		struct Voice {
+			FrameView source;
+			// Streamed voices read their frames through this instead of source.data.
+			AudioStream* stream = nullptr;
+			size_t position = 0;
+			// Fractional part of the read position, in [0, 1).
+			double phase = 0.0;
+			float pitch = 1.f;
+			// Doppler ratio from the Spatializer. Arrives once per game tick, so the value used
+			// by the resampler glides towards the target block by block.
+			float doppler = 1.f;
+			float dopplerTarget = 1.f;
+			// Resampling step at the end of the last block, the next block ramps from it.
+			double lastStep = 1.0;
+			ResampleQuality quality = ResampleQuality::SINC;
+
+			float gain = 1.f;
+			float pan = 0.f;
+			// Distance and cone attenuation from the Spatializer, on top of gain.
+			float spatialGain = 1.f;
+			// Channel gains used at the end of the last block. The next block ramps from these
+			// to the new targets so gain and pan changes do not click.
+			float lastGainL = 0.f;
+			float lastGainR = 0.f;
+			// Level sent to the reverb bus, relative to the dry level.
+			float reverbSend = 0.f;
+			float lastReverbSend = 0.f;
+			// Encoded into the Ambisonics bus from direction instead of panned. The dry pan fades
+			// from lastDry, the encoding gains of the last block ramp to the new ones.
+			bool ambisonic = false;
+			float direction[3];
+			float lastDry = 1.f;
+			float lastEncode[MAX_AMBISONIC_CHANNELS];
+			// Asked for HRTF from hrtfDirection, and is heard through it this block. hrtfSlot is its
+			// convolver, taken a block before it is heard so its history is filled and kept a block
+			// after to fade out. hrtfHeld keeps it past this block.
+			bool hrtf = false;
+			float hrtfDirection[3];
+			bool hrtfActive = false;
+			bool hrtfHeld = false;
+			int hrtfSlot = -1;
+			float lastHrtfGain = 0.f;
+			// Filter coefficients to reach and the ones used at the end of the last block.
+			BiquadCoefficients filter;
+			BiquadCoefficients lastFilter;
+			BiquadState filterState[2];
+
+			// Higher priorities are never made virtual in favour of lower ones.
+			int priority = 0;
+			// Sort key within one priority, roughly how loud the voice is.
+			float audibility = 0.f;
+
+			VoiceHandle handle = INVALID_VOICE;
+			bool loop = false;
+			bool active = false;
+			// Fades out over one block and then frees the slot.
+			bool stopping = false;
+			// Was mixed in the last block.
+			bool real = false;
+			// Has not been rendered yet, so there is nothing to fade in from.
+			bool justStarted = false;
+			BusId bus = MASTER_BUS;
+		};
+
+		// Game thread state.
+		std::vector<uint16_t> slotGenerations;
+		std::vector<bool> slotInUse;
+		// Keeps the buffer of every voice played from a SampleBuffer alive until update() sees it finish.
+		std::vector<SampleBuffer> slotBuffers;
+		// Streams of streamed voices, closed once update() sees the voice finish.
+		std::vector<AudioStream*> slotStreams;
+		std::vector<uint16_t> freeSlots;
+		VoiceFinishedCallback finishedCallback = nullptr;
+		void* finishedUserData = nullptr;
+		unsigned int droppedCommands = 0;
+
+		SpscQueue<AudioCommand> commands;
+		SpscQueue<VoiceEvent> events;
+
+		// Swapped in by the audio thread at the start of the next block.
+		std::atomic<DspSchedule*> pendingSchedule{nullptr};
+		// Schedules the audio thread has replaced, deleted on the game thread.
+		SpscQueue<DspSchedule*> retiredSchedules;
+
+		// A voice whose block waits in the filter bank before it is mixed.
+		struct FilteredVoice {
+			uint16_t index;
+			int frames;
+			bool fadeOut;
+			int lane;
+			bool* ended;
+		};
+
+		// Scratch of one worker, everything needed to mix voices independently of the others.
+		struct MixContext {
+			// Backs the buffers below and any other temporaries of the block.
+			ScratchArena arena;
+			// Converted interleaved source samples, SOURCE_SCRATCH_FRAMES frames.
+			float* sourceScratch = nullptr;
+			// Front left and right source channels, SOURCE_SCRATCH_FRAMES frames each.
+			float* planarScratch = nullptr;
+			// One resampled block of the voice being mixed, left then right.
+			float* voiceScratch = nullptr;
+			// This worker's part of the reverb bus input, summed after the graph has run.
+			float* reverbSend = nullptr;
+			// This worker's part of the Ambisonics soundfield, in the bus's interleaved pairs.
+			float* ambisonicSend = nullptr;
+			// Filters the filtered voices of a bus together.
+			BiquadBank filterBank;
+			std::vector<FilteredVoice> filteredVoices;
+			int filterLanes = 0;
+
+			// extraBytes is arena space on top of what every worker needs.
+			explicit MixContext(size_t extraBytes);
+
+			// Resets the arena and takes this block's buffers from it. ambisonicPlanes of the
+			// soundfield are cleared, 0 without an Ambisonics bus.
+			void beginBlock(int ambisonicPlanes);
+		};
+
+		// A voice to mix this block.
+		struct MixEntry {
+			uint16_t index;
+			ResampleQuality quality;
+			// Mixed once more while it fades out of its real slot.
+			bool fadeOut;
+			// Set by the worker that mixed it, finished by the audio thread afterwards.
+			bool ended;
+		};
+
+		// Audio thread state.
+		std::vector<Voice> voices;
+		std::vector<std::unique_ptr<MixContext>> contexts;
+		std::unique_ptr<AudioWorkerPool> pool;
+		DspSchedule* schedule = nullptr;
+		// Voices to mix in activeVoices order, then grouped by schedule node.
+		std::vector<MixEntry> mixEntries;
+		std::vector<MixEntry> nodeEntries;
+		// First entry of every node in nodeEntries, one more than the node count.
+		std::vector<uint32_t> nodeEntryStart;
+		ConvolutionReverb* reverb = nullptr;
+		AmbisonicBus* ambisonics = nullptr;
+		HrtfSet* hrtfSet = nullptr;
+		int maxHrtfVoices = 0;
+		// Twice maxHrtfVoices, so every voice fading out of HRTF can be replaced straight away.
+		std::vector<HrtfConvolver> hrtfConvolvers;
+		std::vector<int> freeHrtfConvolvers;
+		// Indices of the playing voices, the ones mixed this block first.
+		std::vector<uint16_t> activeVoices;
+		int maxRealVoices = 64;
+		int maxSincVoices = 32;
+
+		float masterGain = 1.f;
+		float lastMasterGain = 1.f;
+		int sampleRate = 48000;
+
+		// Rest of the last block rendered for the device, its final pendingFrames frames not yet taken.
+		float pending[BLOCK_FRAMES * OUTPUT_CHANNELS];
+		int pendingFrames = 0;
+
+		// Written by the audio thread, read by anyone.
+		AudioStats stats;
+
+	public:
+		// maxRealVoices is the number of voices mixed per block.
+		// commandCapacity is the number of commands that can be queued between two blocks.
+		Mixer(int maxVoices, int maxRealVoices = 64, int sampleRate = 48000, int commandCapacity = 1024, int maxSincVoices = 32);
+		~Mixer();
+
+		Mixer(const Mixer&) = delete;
+		Mixer& operator=(const Mixer&) = delete;
+
+		// Game thread.
+
+		// Starts playing the clip. The reader must stay open until the voice has finished.
+		// Returns INVALID_VOICE when every voice is in use or the command ring is full.
+		VoiceHandle play(const AudioReader& clip, float gain = 1.f, float pan = 0.f, bool loop = false, int priority = 0);
+		// Plays a shared buffer without copying it. The mixer holds a reference until the voice has
+		// finished, so the caller may drop its handle straight away.
+		VoiceHandle play(const SampleBuffer& buffer, float gain = 1.f, float pan = 0.f, bool loop = false, int priority = 0);
+		// Plays a stream from an AudioStreamer, looping if it was opened to loop. The mixer closes the
+		// stream when the voice finishes. Wait for isPrimed() first or the start may underrun.
+		VoiceHandle play(AudioStream* stream, float gain = 1.f, float pan = 0.f, int priority = 0);
+		// Plays frames owned by someone else, like a clip from a SoundBank. The memory must stay
+		// valid until the voice has finished.
+		VoiceHandle play(const FrameView& frames, float gain = 1.f, float pan = 0.f, bool loop = false, int priority = 0);
+		void stop(VoiceHandle voice);
+
+		void setGain(VoiceHandle voice, float gain);
+		// -1 is hard left, 0 is centre and 1 is hard right.
+		void setPan(VoiceHandle voice, float pan);
+		void setPriority(VoiceHandle voice, int priority);
+		// Attenuation, pan and doppler ratio of a 3D voice, sent by the Spatializer.
+		// The pan replaces setPan(), the doppler ratio multiplies the pitch.
+		void setSpatial(VoiceHandle voice, float gain, float pan, float doppler = 1.f);
+		// How much of the voice goes to the reverb bus, 0 is dry only.
+		void setReverbSend(VoiceHandle voice, float send);
+		// Playback rate, 2 is an octave up. Limited so the step stays within MAX_RESAMPLE_STEP.
+		void setPitch(VoiceHandle voice, float pitch);
+		// Caps the resampler of a voice, for sounds that do not need the sinc filter.
+		void setResampleQuality(VoiceHandle voice, ResampleQuality quality);
+		// Low-pass, high-pass or EQ on the voice, FilterType::NONE removes it.
+		// Changes glide over one block. Large jumps, like switching a filter on, can ring briefly,
+		// so move the frequency in steps when sweeping.
+		void setFilter(VoiceHandle voice, FilterType type, float frequency, float q = BUTTERWORTH_Q, float gainDb = 0.f);
+		void setMasterGain(float gain);
+		// Routes the voice to a bus of the current graph. Buses the graph does not have go to the master.
+		void setBus(VoiceHandle voice, BusId bus);
+		// Encodes the voice into the Ambisonics bus from this direction instead of panning it, a unit
+		// vector from the listener in world axes. Sent by the Spatializer. Without a bus it is ignored.
+		void setDirection(VoiceHandle voice, float x, float y, float z);
+		// Renders the voice through the HRTF set from this direction, a unit vector from the listener in
+		// its own axes, x right, y up and z forward. Sent by the Spatializer. Takes over from setDirection().
+		void setHrtfDirection(VoiceHandle voice, float x, float y, float z);
+		// Back to the Ambisonics bus or panning, for voices too far away to be worth HRTF.
+		void clearHrtf(VoiceHandle voice);
+
+		// Replaces the bus graph from the next block. Effects of the old graph that are not in the
+		// new one must stay alive until update() has been called after that block.
+		// Returns false if the graph has a cycle.
+		bool setGraph(const DspGraph& graph);
+		// Starts helper threads that render independent buses alongside the audio thread.
+		// Call before the device starts.
+		void startWorkers(int helperThreads);
+
+		// Collects the events sent back by the audio thread and recycles finished voices,
+		// releasing their sample buffers. Call once per game tick.
+		void update();
+		void setVoiceFinishedCallback(VoiceFinishedCallback callback, void* userData);
+
+		// Reverb bus fed by the voice sends, or nullptr for none. Set it before the device starts,
+		// the mixer does not own it.
+		inline void setReverb(ConvolutionReverb* bus) {
+			reverb = bus;
+		};
+		// Ambisonics bus voices with a direction are encoded into, or nullptr for none. Set it before
+		// the device starts, the mixer does not own it. It must be rendered in blocks of BLOCK_FRAMES.
+		inline void setAmbisonics(AmbisonicBus* bus) {
+			ambisonics = bus;
+		};
+		// HRIR set voices with an HRTF direction are convolved with, or nullptr for none, and how many
+		// of them may be convolved per block. Set it before the device starts, the mixer does not own
+		// it. Returns false and keeps the current set if the set is not built at the mixer rate.
+		bool setHrtf(HrtfSet* set, int maxHrtfVoices);
+
+		// True until update() has seen the voice finish.
+		bool isPlaying(VoiceHandle voice) const;
+		int getActiveVoiceCount() const;
+		// Voices mixed and voices virtualised in the last rendered block.
+		inline int getRealVoiceCount() const {
+			return stats.getRealVoices();
+		};
+		inline int getVirtualVoiceCount() const {
+			return stats.getVirtualVoices();
+		};
+		// Render time, load, voice counts and command latency, see AudioStats.
+		inline const AudioStats& getStats() const {
+			return stats;
+		};
+		// Commands lost because the ring was full.
+		inline unsigned int getDroppedCommands() const {
+			return droppedCommands;
+		};
+
+		// Audio thread.
+
+		// Mixes the next BLOCK_FRAMES frames into out, which must hold BLOCK_FRAMES * OUTPUT_CHANNELS floats.
+		void render(float* out);
+
+		// RenderCallback for an AudioDevice, userData is the mixer. Any frame count works, blocks are
+		// split across calls when it is not a multiple of BLOCK_FRAMES. Mono devices get the average of
+		// both channels, devices with more channels get left and right first and silence in the rest.
+		static void renderCallback(float* out, int frames, int channels, void* userData);
+
+		inline int getSampleRate() const {
+			return sampleRate;
+		};
+		inline int getMaxVoices() const {
+			return (int)voices.size();
+		};
+
+	private:
+		VoiceHandle playFrames(const FrameView& frames, AudioStream* stream, float gain, float pan, bool loop, int priority);
+		bool postCommand(const AudioCommand& command);
+
+		// blockStart is when render() began, the latency of every command is measured up to it.
+		void processCommands(uint64_t blockStart);
+		void applyCommand(const AudioCommand& command);
+		Voice* findVoice(VoiceHandle handle);
+		void finishVoice(Voice& voice);
+		// Gives the voice's convolver back.
+		void releaseHrtf(Voice& voice);
+
+		// Orders activeVoices so the voices to mix come first, most important of them first.
+		// Returns how many to mix.
+		int selectRealVoices();
+		// Source frames per output frame for the current pitch.
+		double voiceStep(const Voice& voice) const;
+		// Moves the read position over one block.
+		void advanceVoice(Voice& voice, double endStep);
+		// Moves a virtual voice forward by one block without reading any samples.
+		void advanceVirtualVoice(Voice& voice);
+
+		// Sorts mixEntries into nodeEntries by the schedule node of their bus.
+		void groupByNode();
+		// Mixes the voices of a node, sums its inputs and runs its effects. Runs on any worker.
+		void renderNode(uint32_t node, int worker);
+		// TaskCallback of the worker pool, userData is the mixer.
+		static void nodeTask(uint32_t task, int worker, void* userData);
+
+		// Converts count source frames starting at frame start into planarScratch, wrapping looped
+		// clips and padding others with silence. Only the front two channels are kept.
+		void fetchSource(MixContext& context, const Voice& voice, int64_t start, int count);
+		// Resamples the next block of the voice into voiceScratch. Returns the frames produced.
+		int readVoice(MixContext& context, Voice& voice, ResampleQuality quality);
+		// fadeOut ramps the voice to silence, used for the block after it lost its real slot.
+		void mixVoice(MixContext& context, Voice& voice, int frames, float* out, bool fadeOut);
+		// Adds the voice to this worker's soundfield, level is its gain after distance and fades.
+		// voiceScratch must hold the voice as mono.
+		void encodeVoice(MixContext& context, Voice& voice, int frames, float level);
+		// Copies voiceScratch into the filter bank, which must have room for the voice.
+		void queueFilteredVoice(MixContext& context, uint16_t index, int frames, bool fadeOut, bool* ended);
+		// Runs the filter bank and mixes the voices queued in it.
+		void mixFilteredVoices(MixContext& context, float* out);
+		// Deletes the schedules sent back by the audio thread.
+		void collectSchedules();
+	};
+};
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Spatializer.h"
+
+namespace Banshee {
+
+	typedef uint32_t OccluderId;
+	constexpr OccluderId INVALID_OCCLUDER = 0xFFFFFFFF;
+
+	// Most rays one emitter is tested with.
+	constexpr int MAX_OCCLUSION_RAYS = 5;
+
+	// A box that sound has to pass through. The box is the unit cube from -0.5 to 0.5 on every axis,
+	// the same as the Cube primitive, placed in the world by a local to world transform.
+	struct OccluderBox {
+		// Row major, the fourth column is the translation.
+		float transform[3][4] = {
+			{1.f, 0.f, 0.f, 0.f},
+			{0.f, 1.f, 0.f, 0.f},
+			{0.f, 0.f, 1.f, 0.f}
+		};
+		// Fraction of the sound that gets through, multiplied for every box on a path.
+		float transmission = 0.3f;
+	};
+
+	struct OcclusionSettings {
+		// Threads that trace the rays. With 0 they are traced on the game thread inside update().
+		int workerThreads = 2;
+		// Rays traced per tick at most. Emitters take turns, so with n playing emitters each one is
+		// refreshed about every n * raysPerQuery / raysPerTick ticks.
+		int raysPerTick = 500;
+		// Rays per emitter, 1 to MAX_OCCLUSION_RAYS. The first follows the direct path, the others go to
+		// points sourceRadius around the emitter so an edge that hides part of it only obstructs it.
+		int raysPerQuery = 5;
+		float sourceRadius = 0.5f;
+		// Emitters further away are not traced and count as unoccluded.
+		float maxDistance = 100.f;
+		// Low-pass cutoff when every ray is blocked. It rises towards OCCLUSION_OPEN_CUTOFF with the
+		// fraction of rays that are clear.
+		float occludedCutoff = 800.f;
+	};
+
+	// Occlusion and obstruction of the Spatializer's emitters by box geometry.
+	//
+	// Every tick update() picks the next few emitters with a voice, up to the ray budget, and hands
+	// them to the worker threads as one batch traced against a snapshot of the occluders. The game
+	// thread never waits for it: the results are collected by the first update() after the batch
+	// finishes and sent to the Spatializer as a gain and a low-pass cutoff, and while a batch is
+	// still running no new one starts. A tick costs the same however many emitters there are,
+	// more emitters only make each one refresh less often.
+	class OcclusionQueries {
+	private:
+		struct Query {
+			EmitterId emitter = INVALID_EMITTER;
+			float x = 0.f, y = 0.f, z = 0.f;
+			// Results. Mean transmission of the rays and the fraction that hit nothing.
+			float gain = 1.f;
+			float clear = 1.f;
+		};
+
+		// Queries a worker takes at a time.
+		static constexpr int QUERY_CHUNK = 8;
+
+		OcclusionSettings settings;
+
+		// Game thread copy of the occluders, with stable ids.
+		std::vector<OccluderBox> boxes;
+		std::vector<bool> boxUsed;
+		std::vector<OccluderId> freeBoxes;
+		bool boxesChanged = false;
+
+		// The batch. Written by the game thread while no batch runs, only read by the workers.
+		// Occluders are kept as world to local transforms, 12 floats each, and their transmission.
+		std::vector<float> batchInverse;
+		std::vector<float> batchTransmission;
+		std::vector<Query> queries;
+		Vector3 batchListener;
+		int batchRays = 1;
+		float batchRadius = 0.f;
+		// The listener in the space of every occluder, the same for every ray of a batch.
+		std::vector<float> localListener;
+
+		// Generation of the batch in the top 32 bits and the next chunk to trace in the bottom ones,
+		// so a worker that is late for one batch can never claim a chunk of the next.
+		std::atomic<uint64_t> nextChunk{0};
+		std::atomic<int> chunksLeft{0};
+		int chunkCount = 0;
+		std::atomic<bool> batchDone{true};
+		bool batchPending = false;
+		// Dense emitter index the next batch starts from.
+		int cursor = 0;
+
+		std::vector<std::thread> workers;
+		std::atomic<bool> running{false};
+		uint32_t generation = 0;
+		std::mutex wakeMutex;
+		std::condition_variable wake;
+
+		uint64_t raysTraced = 0;
+		uint64_t busyTicks = 0;
+
+	public:
+		explicit OcclusionQueries(const OcclusionSettings& settings = OcclusionSettings());
+		~OcclusionQueries();
+
+		OcclusionQueries(const OcclusionQueries&) = delete;
+		OcclusionQueries& operator=(const OcclusionQueries&) = delete;
+
+		// Game thread. Occluder changes are picked up by the next batch.
+		OccluderId addOccluder(const OccluderBox& box);
+		void removeOccluder(OccluderId occluder);
+		void setOccluder(OccluderId occluder, const OccluderBox& box);
+
+		// Sends the results of the last finished batch to the spatializer and starts the next one
+		// from its listener and emitters. Call once per tick, before Spatializer::update().
+		void update(Spatializer& spatializer);
+
+		inline const OcclusionSettings& getSettings() const {
+			return settings;
+		};
+		inline int getOccluderCount() const {
+			return (int)(boxes.size() - freeBoxes.size());
+		};
+		// Rays handed to the workers so far.
+		inline uint64_t getRaysTraced() const {
+			return raysTraced;
+		};
+		// Ticks that could not start a batch because the last one was still running.
+		inline uint64_t getBusyTicks() const {
+			return busyTicks;
+		};
+
+	private:
+		bool isValid(OccluderId occluder) const;
+		void snapshotOccluders();
+		void applyResults(Spatializer& spatializer);
+		// Picks the queries of the next batch, returns false if there are none.
+		bool gatherQueries(Spatializer& spatializer);
+
+		void workerLoop();
+		// Takes and traces chunks of the batch until none are left.
+		void traceChunks(uint32_t batch, int batchChunks);
+		void traceQuery(Query& query) const;
+	};
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+
+namespace Banshee {
+
+	enum class ResampleQuality : uint8_t {
+		// Two point interpolation. Cheapest, audible aliasing and high frequency loss.
+		LINEAR = 0,
+		// Four point Catmull-Rom spline.
+		CUBIC,
+		// 16 tap polyphase windowed sinc with an anti-aliasing cutoff that follows the step.
+		SINC
+	};
+
+	// Source frames needed before the frame at the read position.
+	constexpr int RESAMPLE_HISTORY = 7;
+	// Source frames needed after the last frame a block reaches.
+	constexpr int RESAMPLE_LOOKAHEAD = 8;
+	// Fractional positions stored per sinc table, positions in between are interpolated.
+	constexpr int SINC_PHASES = 256;
+	// Largest ratio of source frames to output frames, also bounds the pitch.
+	constexpr double MAX_RESAMPLE_STEP = 8.0;
+	constexpr double MIN_RESAMPLE_STEP = 1.0 / 64.0;
+
+	// Converts one channel between sample rates with a step (source frames per output frame)
+	// that may ramp linearly across the block, which is how pitch changes stay click free.
+	//
+	// The source passed to process() is laid out so that src[RESAMPLE_HISTORY] is the frame
+	// at the integer part of the read position, with RESAMPLE_HISTORY frames before it and
+	// sourceFrames() frames in total.
+	class Resampler {
+	public:
+		// Builds the filter tables. They are also built on first use, calling this up front
+		// keeps the work off the audio thread.
+		static void initTables();
+
+		// How far the read position moves over frames outputs when the step ramps from
+		// startStep to endStep. Output i uses startStep + (endStep - startStep) * (i + 1) / frames.
+		static double advance(double startStep, double endStep, int frames);
+
+		// Source frames process() reads for frames outputs starting at the fractional phase.
+		static int sourceFrames(double phase, double startStep, double endStep, int frames);
+
+		// Writes frames outputs to dst. phase is the fractional part of the read position, in [0, 1).
+		static void process(ResampleQuality quality, float* dst, const float* src, double phase,
+			double startStep, double endStep, int frames);
+	};
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "AudioReader.h"
+
+namespace Banshee {
+
+	// Shared handle to an immutable block of interleaved sample frames.
+	//
+	// Copying a handle only bumps an atomic reference count, every copy views the same memory,
+	// so any number of voices can play one clip without a copy of their own. The samples are
+	// kept in the format they were loaded in, the mixer converts them as it reads.
+	//
+	// The memory is freed when the last handle goes away. The mixer keeps the handle of every
+	// playing voice in its game thread slot table and only passes a FrameView to the audio thread,
+	// so the last release never happens there. Debug builds assert if it does.
+	class SampleBuffer {
+	private:
+		struct Storage {
+			std::atomic<int> references{1};
+			AudioFormat format;
+			size_t frameCount = 0;
+			std::vector<uint8_t> data;
+		};
+
+		Storage* storage = nullptr;
+
+		explicit SampleBuffer(Storage* storage) : storage(storage) {};
+
+	public:
+		SampleBuffer() {};
+		~SampleBuffer();
+
+		SampleBuffer(const SampleBuffer& other);
+		SampleBuffer(SampleBuffer&& other);
+		SampleBuffer& operator=(const SampleBuffer& other);
+		SampleBuffer& operator=(SampleBuffer&& other);
+
+		// Copies every frame of an open reader once, the reader can be closed afterwards.
+		// Returns an empty handle if the reader is not open or has no frames.
+		static SampleBuffer fromReader(const AudioReader& reader);
+		// Copies frameCount interleaved float frames.
+		static SampleBuffer fromFloat(const float* samples, size_t frameCount, int channels, int sampleRate);
+		// Compresses the frames to IMA ADPCM, which the mixer decodes as it plays. Takes a little over
+		// a quarter of the memory of 16-bit PCM, good for short sounds that stay loaded.
+		static SampleBuffer compressed(const FrameView& frames);
+
+		// Drops this handle's reference.
+		void reset();
+
+		inline bool isValid() const {
+			return storage != nullptr;
+		};
+		// Empty view for an empty handle. Valid for as long as any handle to the buffer exists.
+		FrameView getFrames() const;
+		inline size_t getFrameCount() const {
+			return storage != nullptr ? storage->frameCount : 0;
+		};
+		inline AudioFormat getFormat() const {
+			return storage != nullptr ? storage->format : AudioFormat();
+		};
+		// Bytes of sample data, shared by every handle.
+		inline size_t getSizeBytes() const {
+			return storage != nullptr ? storage->data.size() : 0;
+		};
+		// Handles to the buffer, 0 for an empty handle. Only a snapshot when other threads hold handles.
+		inline int getUseCount() const {
+			return storage != nullptr ? storage->references.load(std::memory_order_relaxed) : 0;
+		};
+	};
+};
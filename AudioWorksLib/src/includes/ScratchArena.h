@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Debug builds assert when the heap is used from a thread inside an AudioThreadScope.
+// Define it to 0 or 1 to override.
+#if !defined(BANSHEE_CHECK_AUDIO_ALLOCATIONS)
+#if defined(_DEBUG)
+#define BANSHEE_CHECK_AUDIO_ALLOCATIONS 1
+#else
+#define BANSHEE_CHECK_AUDIO_ALLOCATIONS 0
+#endif
+#endif
+
+namespace Banshee {
+
+	// Every allocation starts on a cache line, which also covers AVX loads.
+	constexpr size_t SCRATCH_ALIGNMENT = 64;
+
+	// Bump pointer allocator for the temporary buffers of one block.
+	//
+	// The memory is allocated once up front. allocate() only moves an offset forward and reset()
+	// moves it back to the start, so the render path gets its buffers without touching the heap.
+	// Nothing is freed individually, a nested user can take getUsed() as a mark and rewind() to it.
+	// An arena belongs to one thread at a time.
+	class ScratchArena {
+	private:
+		std::vector<uint8_t> storage;
+		uint8_t* base = nullptr;
+		size_t capacity = 0;
+		size_t used = 0;
+		size_t highWater = 0;
+
+	public:
+		explicit ScratchArena(size_t bytes);
+		~ScratchArena() {};
+
+		ScratchArena(const ScratchArena&) = delete;
+		ScratchArena& operator=(const ScratchArena&) = delete;
+
+		// Returns nullptr, and asserts in debug builds, when the arena is out of space.
+		// The memory is not cleared.
+		void* allocateBytes(size_t bytes);
+
+		template<typename T>
+		inline T* allocate(size_t count) {
+			return (T*)allocateBytes(count * sizeof(T));
+		};
+
+		inline void reset() {
+			used = 0;
+		};
+		inline void rewind(size_t mark) {
+			used = mark < used ? mark : used;
+		};
+
+		inline size_t getUsed() const {
+			return used;
+		};
+		inline size_t getCapacity() const {
+			return capacity;
+		};
+		// Most bytes ever in use at once, for sizing the arena.
+		inline size_t getHighWater() const {
+			return highWater;
+		};
+
+		// Bytes allocateBytes() takes for a request of bytes.
+		static inline size_t alignedSize(size_t bytes) {
+			return (bytes + SCRATCH_ALIGNMENT - 1) & ~(SCRATCH_ALIGNMENT - 1);
+		};
+	};
+
+	// Marks the current thread as an audio thread for its lifetime. Scopes can nest.
+	// With BANSHEE_CHECK_AUDIO_ALLOCATIONS any heap allocation made inside one asserts: through the
+	// debug CRT allocation hook on MSVC, which sees every malloc, and through operator new elsewhere.
+	class AudioThreadScope {
+	public:
+#if BANSHEE_CHECK_AUDIO_ALLOCATIONS
+		AudioThreadScope();
+		~AudioThreadScope();
+#else
+		AudioThreadScope() {};
+		~AudioThreadScope() {};
+#endif
+
+		AudioThreadScope(const AudioThreadScope&) = delete;
+		AudioThreadScope& operator=(const AudioThreadScope&) = delete;
+
+		// True inside a scope. Always false when the check is compiled out.
+		static bool isAudioThread();
+	};
+};
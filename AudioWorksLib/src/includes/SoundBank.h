@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "AudioReader.h"
+
+namespace Banshee {
+
+	// Start of every clip's samples in a bank, so kernels can load them aligned.
+	constexpr size_t BANK_DATA_ALIGNMENT = 64;
+	constexpr uint32_t BANK_VERSION = 1;
+
+	// On disk layout of a .bank file, little endian:
+	// BankHeader, the BankEntry of every clip in name order, slotCount BankSlots, the clip names
+	// and then the sample data. The slots are an open addressed hash table of the entries keyed by
+	// the FNV-1a hash of the name with linear probing, at most half full so probes stay short.
+	struct BankHeader {
+		char magic[4];
+		uint32_t version;
+		uint32_t clipCount;
+		// Power of two.
+		uint32_t slotCount;
+		uint64_t entriesOffset;
+		uint64_t slotsOffset;
+		uint64_t namesOffset;
+		uint64_t dataOffset;
+		uint64_t fileSize;
+	};
+
+	struct BankEntry {
+		// From the start of the file, a multiple of BANK_DATA_ALIGNMENT.
+		uint64_t dataOffset;
+		uint64_t frameCount;
+		// From namesOffset, not null terminated.
+		uint32_t nameOffset;
+		uint16_t nameLength;
+		// SampleFormat value.
+		uint8_t sampleFormat;
+		uint8_t channels;
+		uint32_t sampleRate;
+		uint32_t reserved;
+	};
+
+	struct BankSlot {
+		// 0 for an empty slot.
+		uint64_t hash;
+		uint32_t entry;
+		uint32_t reserved;
+	};
+
+	// Many clips packed into one file, mapped once and looked up by name in constant time.
+	//
+	// Opening a bank maps the file and checks the table, no sample data is read until a clip plays.
+	// Clips are handed out as FrameViews straight into the mapping, so they play without a copy
+	// and stay valid until the bank is closed. Build banks with SoundBankWriter or the BankPacker tool.
+	class SoundBank {
+	private:
+		MappedFile file;
+		std::string filePath;
+		const BankHeader* header = nullptr;
+		const BankEntry* entries = nullptr;
+		const BankSlot* slots = nullptr;
+		const char* names = nullptr;
+
+	public:
+		SoundBank() {};
+		~SoundBank() {};
+
+		SoundBank(const SoundBank&) = delete;
+		SoundBank& operator=(const SoundBank&) = delete;
+
+		bool open(const std::string& path);
+		void close();
+
+		// Empty view if the bank has no clip of that name.
+		FrameView find(const std::string& name) const;
+		// Same lookup with the hash worked out ahead of time, see hashName().
+		FrameView find(uint64_t hash, const char* name, size_t length) const;
+
+		// Clips by index, in name order, for listing the bank.
+		std::string getClipName(int index) const;
+		FrameView getClip(int index) const;
+
+		inline bool isOpen() const {
+			return header != nullptr;
+		};
+		inline int getClipCount() const {
+			return header != nullptr ? (int)header->clipCount : 0;
+		};
+		inline const std::string& getPath() const {
+			return filePath;
+		};
+
+		// 64-bit FNV-1a, never 0.
+		static uint64_t hashName(const char* name, size_t length);
+
+	private:
+		const BankEntry* lookup(uint64_t hash, const char* name, size_t length) const;
+		static FrameView view(const uint8_t* base, const BankEntry& entry);
+	};
+
+	// Builds a .bank file from clips held in memory.
+	class SoundBankWriter {
+	private:
+		struct Clip {
+			std::string name;
+			AudioFormat format;
+			size_t frameCount = 0;
+			std::vector<uint8_t> data;
+		};
+
+		std::vector<Clip> clips;
+
+	public:
+		SoundBankWriter() {};
+		~SoundBankWriter() {};
+
+		// Copies the frames, compressed to IMA ADPCM if compress is set.
+		// Fails for an empty or duplicate name or an unsupported format.
+		bool addClip(const std::string& name, const FrameView& frames, bool compress = false);
+		// Adds a WAV file under name.
+		bool addFile(const std::string& name, const std::string& path, bool compress = false);
+
+		inline int getClipCount() const {
+			return (int)clips.size();
+		};
+
+		// Writes every clip added so far. Clips are stored in name order so sounds that share a
+		// prefix, like impact_wood_01 and impact_wood_02, end up next to each other on disk.
+		bool write(const std::string& path) const;
+	};
+};
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "AudioCommands.h"
+
+namespace Banshee {
+
+	class Mixer;
+
+	struct Vector3 {
+		float x = 0.f;
+		float y = 0.f;
+		float z = 0.f;
+
+		Vector3() {};
+		Vector3(float x, float y, float z) : x(x), y(y), z(z) {};
+	};
+
+	// Position and orthonormal basis of the listener in world space.
+	struct Listener {
+		Vector3 position;
+		Vector3 right = {1.f, 0.f, 0.f};
+		Vector3 up = {0.f, 1.f, 0.f};
+		// Direction the listener is facing.
+		Vector3 forward = {0.f, 0.f, -1.f};
+		// World units per second, used for doppler.
+		Vector3 velocity;
+	};
+
+	// How gain falls off between an emitter's min and max distance.
+	enum class DistanceModel : uint8_t {
+		// No distance attenuation.
+		NONE = 0,
+		// minDistance / (minDistance + rolloff * (d - minDistance))
+		INVERSE,
+		// Falls linearly to zero at maxDistance, rolloff scales the slope.
+		LINEAR,
+		// (d / minDistance) ^ -rolloff
+		EXPONENTIAL
+	};
+
+	struct EmitterSettings {
+		DistanceModel model = DistanceModel::INVERSE;
+		// Full volume inside minDistance, the curve stops falling at maxDistance.
+		float minDistance = 1.f;
+		float maxDistance = 100.f;
+		float rolloff = 1.f;
+
+		// Sound cone around the emitter direction, full angles in degrees. Inside the inner
+		// angle the gain is 1, outside the outer angle it is coneOuterGain.
+		// An outer angle of 360 makes the emitter omnidirectional.
+		float coneInnerAngle = 360.f;
+		float coneOuterAngle = 360.f;
+		float coneOuterGain = 0.f;
+
+		// Multiplies the doppler shift of this emitter, 0 turns it off.
+		float dopplerScale = 1.f;
+	};
+
+	typedef uint32_t EmitterId;
+	constexpr EmitterId INVALID_EMITTER = 0xFFFFFFFF;
+
+	// In world units per second, the Simulator uses metres.
+	constexpr float SPEED_OF_SOUND = 343.f;
+	// Doppler pitch ratios are clamped to this range, an octave either way.
+	constexpr float MIN_DOPPLER_RATIO = 0.5f;
+	constexpr float MAX_DOPPLER_RATIO = 2.f;
+	// Low-pass cutoff of an emitter with nothing in the way, its voice has no filter at or above it.
+	constexpr float OCCLUSION_OPEN_CUTOFF = 20000.f;
+
+	// Game thread side of 3D audio. Emitters are kept as structure of arrays and updated in
+	// batches once per tick against a single listener snapshot, the results are sent to the
+	// mixer as per-voice gain, pan and doppler pitch so nothing spatial is computed on the audio thread.
+	//
+	// With setAmbisonic() on, every voice is also sent its direction from the listener in world axes,
+	// so the mixer encodes it into its AmbisonicBus and the pan goes unused. With setHrtf() on, voices
+	// close to the listener are sent their direction in the listener's axes for the mixer's HRTF, and
+	// the rest keep to the cheaper rendering.
+	//
+	// Occlusion from OcclusionQueries arrives a few emitters at a time. Each emitter glides towards
+	// its latest result over a few ticks, which scales its gain and sets a low-pass filter on its voice.
+	class Spatializer {
+	private:
+		// Emitters processed together, small enough for the working set to stay in L1.
+		static constexpr int BATCH = 64;
+
+		Listener listener;
+		float speedOfSound = SPEED_OF_SOUND;
+		float dopplerFactor = 1.f;
+		bool ambisonic = false;
+		bool hrtf = false;
+		float hrtfDistance = 0.f;
+
+		// Dense emitter data, index i is one emitter.
+		std::vector<float> posX, posY, posZ;
+		std::vector<float> dirX, dirY, dirZ;
+		std::vector<float> velX, velY, velZ;
+		std::vector<float> dopplerScale;
+		std::vector<float> minDistance, maxDistance, rolloff;
+		std::vector<DistanceModel> model;
+		// Cosines of the half cone angles and the slope between them.
+		std::vector<float> coneOuterCos, coneScale, coneOuterGain;
+		std::vector<VoiceHandle> voice;
+		// Occlusion targets and the values glided towards them.
+		std::vector<float> occlusionTarget, cutoffTarget;
+		std::vector<float> occlusion, cutoff;
+
+		// Results of the last update().
+		std::vector<float> gain, pan, pitch;
+		// Values last sent to the mixer, small changes are not resent.
+		std::vector<float> sentGain, sentPan, sentPitch;
+		// Low-pass cutoff the voice has, OCCLUSION_OPEN_CUTOFF when it has no filter.
+		std::vector<float> sentCutoff;
+		// Direction last sent to the voice, all 0 when none has been.
+		std::vector<float> sentDirX, sentDirY, sentDirZ;
+		// Head relative direction last sent for HRTF, all 0 when the voice is not using it.
+		std::vector<float> sentHrtfX, sentHrtfY, sentHrtfZ;
+
+		// Stable ids map to dense indices so removal can swap in the last emitter.
+		std::vector<uint32_t> idToIndex;
+		std::vector<EmitterId> indexToId;
+		std::vector<EmitterId> freeIds;
+
+		// Per batch scratch.
+		float distance[BATCH];
+		float localX[BATCH];
+		float facing[BATCH];
+		// Speed of the listener towards the emitter and of the emitter towards the listener.
+		float listenerApproach[BATCH];
+		float emitterApproach[BATCH];
+
+	public:
+		Spatializer() {};
+		~Spatializer() {};
+
+		EmitterId createEmitter(const EmitterSettings& settings = EmitterSettings());
+		void destroyEmitter(EmitterId emitter);
+		void setSettings(EmitterId emitter, const EmitterSettings& settings);
+
+		void setPosition(EmitterId emitter, const Vector3& position);
+		// Does not need to be normalised. Only matters for emitters with a cone.
+		void setDirection(EmitterId emitter, const Vector3& direction);
+		// World units per second.
+		void setVelocity(EmitterId emitter, const Vector3& velocity);
+		// Voice that plays through the emitter, INVALID_VOICE to detach.
+		void setVoice(EmitterId emitter, VoiceHandle voice);
+		// Gain through whatever is between the emitter and the listener and the low-pass cutoff it
+		// causes, OCCLUSION_OPEN_CUTOFF or above for none. Normally sent by OcclusionQueries.
+		void setOcclusion(EmitterId emitter, float gain, float cutoffFrequency);
+
+		// Snapshot of the listener used by the next update().
+		inline void setListener(const Listener& value) {
+			listener = value;
+		};
+		inline const Listener& getListener() const {
+			return listener;
+		};
+
+		// Units must match the listener and emitter velocities.
+		inline void setSpeedOfSound(float value) {
+			speedOfSound = value;
+		};
+		// Scales every doppler shift, 0 turns doppler off.
+		inline void setDopplerFactor(float value) {
+			dopplerFactor = value;
+		};
+		// Sends the voices their directions for the mixer's Ambisonics bus.
+		inline void setAmbisonic(bool value) {
+			ambisonic = value;
+		};
+		// Sends the voices within lodDistance their head relative directions for the mixer's HRTF.
+		inline void setHrtf(bool value, float lodDistance = 20.f) {
+			hrtf = value;
+			hrtfDistance = lodDistance;
+		};
+
+		// Recomputes every emitter against the listener and posts the changes to the mixer.
+		// Call once per game tick.
+		void update(Mixer& mixer);
+
+		// Distance, cone and occlusion gain of the emitter from the last update().
+		float getGain(EmitterId emitter) const;
+		// -1 to 1, from the last update().
+		float getPan(EmitterId emitter) const;
+		// Pitch multiplier from the relative motion of emitter and listener, from the last update().
+		float getDopplerRatio(EmitterId emitter) const;
+		// Occlusion low-pass cutoff from the last update().
+		float getOcclusionCutoff(EmitterId emitter) const;
+		inline int getEmitterCount() const {
+			return (int)indexToId.size();
+		};
+		// Emitters by dense index, 0 to getEmitterCount() - 1. Destroying an emitter reorders them.
+		inline EmitterId getEmitter(int index) const {
+			return indexToId[index];
+		};
+		Vector3 getPosition(EmitterId emitter) const;
+		VoiceHandle getVoice(EmitterId emitter) const;
+
+	private:
+		bool isValid(EmitterId emitter) const;
+		void computeBatch(int first, int count);
+	};
+};
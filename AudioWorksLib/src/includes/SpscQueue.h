@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace Banshee {
+
+	// Bounded single-producer/single-consumer ring buffer.
+	// push() and pop() are wait-free: no locks, no retries and no allocation after construction.
+	// Exactly one thread may push and exactly one (other) thread may pop.
+	template<typename T>
+	class SpscQueue {
+	private:
+		// Padding keeps the producer and consumer indices on separate cache lines.
+		static constexpr size_t CACHE_LINE = 64;
+
+		std::vector<T> items;
+		size_t mask = 0;
+
+		char pad0[CACHE_LINE];
+		// Next slot to read. Written by the consumer.
+		std::atomic<size_t> head{0};
+		// Consumer's copy of tail so it only reloads the shared index when it looks empty.
+		size_t cachedTail = 0;
+
+		char pad1[CACHE_LINE];
+		// Next slot to write. Written by the producer.
+		std::atomic<size_t> tail{0};
+		// Producer's copy of head so it only reloads the shared index when it looks full.
+		size_t cachedHead = 0;
+
+		char pad2[CACHE_LINE];
+
+	public:
+		// Capacity is rounded up to a power of two.
+		explicit SpscQueue(size_t capacity) {
+			size_t size = 2;
+			while(size < capacity) {
+				size <<= 1;
+			}
+			items.resize(size);
+			mask = size - 1;
+		};
+
+		SpscQueue(const SpscQueue&) = delete;
+		SpscQueue& operator=(const SpscQueue&) = delete;
+
+		// Producer only. Returns false and drops the item if the queue is full.
+		bool push(const T& item) {
+			size_t t = tail.load(std::memory_order_relaxed);
+			if(t - cachedHead > mask) {
+				cachedHead = head.load(std::memory_order_acquire);
+				if(t - cachedHead > mask) {
+					return false;
+				}
+			}
+
+			items[t & mask] = item;
+			tail.store(t + 1, std::memory_order_release);
+			return true;
+		};
+
+		// Consumer only. Returns false if the queue is empty.
+		bool pop(T& item) {
+			size_t h = head.load(std::memory_order_relaxed);
+			if(h == cachedTail) {
+				cachedTail = tail.load(std::memory_order_acquire);
+				if(h == cachedTail) {
+					return false;
+				}
+			}
+
+			item = items[h & mask];
+			head.store(h + 1, std::memory_order_release);
+			return true;
+		};
+
+		// Only exact when called from the producer or consumer while the other side is idle.
+		inline size_t sizeApprox() const {
+			return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+		};
+		inline size_t capacity() const {
+			return mask + 1;
+		};
+	};
+};
@@ -0,0 +1,98 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "SoundBank.h"
+
+using namespace Banshee;
+
+// Clips are named after their file without the folder or extension, "sfx/door_open.wav" is "door_open".
+static std::string clipName(const std::string& path) {
+	size_t start = path.find_last_of("/\\");
+	start = start == std::string::npos ? 0 : start + 1;
+	size_t end = path.find_last_of('.');
+	if(end == std::string::npos || end < start) {
+		end = path.size();
+	}
+	return path.substr(start, end - start);
+}
+
+// A response file lists one WAV per line, for more files than fit on a command line.
+static bool readList(const std::string& path, std::vector<std::string>& inputs) {
+	std::ifstream list(path);
+	if(!list) {
+		std::cout << "Could not open file list: " << path << std::endl;
+		return false;
+	}
+
+	std::string line;
+	while(std::getline(list, line)) {
+		while(!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t')) {
+			line.pop_back();
+		}
+		if(!line.empty() && line[0] != '#') {
+			inputs.push_back(line);
+		}
+	}
+	return true;
+}
+
+static int listBank(const std::string& path) {
+	SoundBank bank;
+	if(!bank.open(path)) {
+		return 1;
+	}
+
+	for(int i = 0; i < bank.getClipCount(); i++) {
+		FrameView clip = bank.getClip(i);
+		std::cout << bank.getClipName(i) << "\t" << clip.frameCount << " frames\t" << clip.format.channels << " ch\t"
+			<< clip.format.sampleRate << " Hz" << (clip.format.sampleFormat == SampleFormat::IMA_ADPCM ? "\tadpcm" : "") << std::endl;
+	}
+	std::cout << bank.getClipCount() << " clips" << std::endl;
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	if(argc == 3 && std::string(argv[1]) == "-l") {
+		return listBank(argv[2]);
+	}
+
+	// -c stores every clip as IMA ADPCM, for short sounds that stay loaded.
+	bool compress = argc > 1 && std::string(argv[1]) == "-c";
+	int first = compress ? 2 : 1;
+
+	if(argc - first < 2) {
+		std::cout << "Usage: AudioWorksBankPacker [-c] <out.bank> <clip.wav | @list.txt>..." << std::endl;
+		std::cout << "       AudioWorksBankPacker -l <in.bank>" << std::endl;
+		return 1;
+	}
+
+	std::vector<std::string> inputs;
+	for(int i = first + 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if(arg[0] == '@') {
+			if(!readList(arg.substr(1), inputs)) {
+				return 1;
+			}
+		}
+		else {
+			inputs.push_back(arg);
+		}
+	}
+
+	SoundBankWriter writer;
+	for(const std::string& input : inputs) {
+		if(!writer.addFile(clipName(input), input, compress)) {
+			std::cout << "Failed to pack " << input << std::endl;
+			return 1;
+		}
+	}
+
+	if(!writer.write(argv[first])) {
+		return 1;
+	}
+
+	std::cout << "Packed " << writer.getClipCount() << " clips into " << argv[first] << std::endl;
+	return 0;
+}
@@ -1,6 +1,16 @@
+#include <cmath>
+#include <fstream>
 #include <iostream>
 
+#include "AcousticTracer.h"
+#include "Ambisonics.h"
+#include "AudioDevice.h"
 #include "AudioReader.h"
+#include "Hrtf.h"
+#include "Mixer.h"
+#include "Occlusion.h"
+#include "SampleBuffer.h"
+#include "Spatializer.h"
 
 #include "GL/glew.h"
 #include "GLFW/glfw3.h"
@@ -18,12 +28,26 @@
 GLFWwindow* window;
 Camera camera;
 Renderer* renderer;
+Banshee::Mixer* mixer;
+Banshee::AmbisonicBus* ambisonics;
+Banshee::HrtfSet* hrtf;
+Banshee::Spatializer* spatializer;
+Banshee::OcclusionQueries* occlusion;
+Banshee::AcousticScene* acousticScene;
+Banshee::AcousticTracer* acousticTracer;
+Banshee::AudioDevice* audioDevice;
 Mouse mouse;
 bool running = false;
 bool noClipToggle = true;
 bool debug = false;
 
 std::vector<GameObject*> objects;
+// Emitter of every object, each playing a looping sound from where the object is.
+std::vector<std::pair<GameObject*, Banshee::EmitterId>> emitters;
+// Occluder of every model with collision, kept in step with its transform.
+std::vector<std::pair<Model*, Banshee::OccluderId>> occluders;
+// Trace source of each emitter, indexed by its EmitterId.
+std::vector<Banshee::TraceSourceId> traceSources;
 
 const int VSYNC_OFF = 0;
 const int VSYNC_ON = 1;
@@ -65,6 +89,117 @@ bool initGLEW() {
 	return true;
 }
 
+bool initAudio() {
+	// One voice per emitter is fine, only the 64 most important ones are actually mixed.
+	mixer = new Banshee::Mixer(4096, 64, 48000, 4096);
+	spatializer = new Banshee::Spatializer();
+	occlusion = new Banshee::OcclusionQueries();
+
+	// Emitters are encoded into a third order soundfield that turns with the camera, heard binaurally.
+	ambisonics = new Banshee::AmbisonicBus(3, Banshee::AmbisonicDecode::BINAURAL, mixer->getSampleRate(), Banshee::BLOCK_FRAMES);
+	mixer->setAmbisonics(ambisonics);
+	spatializer->setAmbisonic(true);
+
+	// With an HRIR set, the 16 most important emitters within 10m are rendered through it instead.
+	// None ships with the simulator, so a missing file is not an error.
+	const char* hrirPath = "res/Audio/default.hrir";
+	hrtf = new Banshee::HrtfSet();
+	if(std::ifstream(hrirPath).good() && hrtf->load(hrirPath, mixer->getSampleRate()) && mixer->setHrtf(hrtf, 16)) {
+		spatializer->setHrtf(true, 10.f);
+	}
+
+	// No hardware backend yet, the null device still runs the full render path in real time.
+	Banshee::DeviceConfig config;
+	config.sampleRate = mixer->getSampleRate();
+	audioDevice = new Banshee::NullDevice();
+
+	if(!audioDevice->open(config, Banshee::Mixer::renderCallback, mixer) || !audioDevice->start()) {
+		return false;
+	}
+
+	std::cout << "Audio device: " << audioDevice->getName() << std::endl;
+	return true;
+}
+
+// Model matrix built the same way Cube::update() builds it, the top three rows.
+void modelTransform(const Model* model, float (&out)[3][4]) {
+	Mat4f transform;
+	Mat4f::scaleVec(transform, model->scale);
+	Mat4f::rotate(transform, Vec3f(1.f, 1.f, 1.f), model->rotationAngles);
+	Mat4f::translate(transform, model->position);
+
+	for(int row = 0; row < 3; row++) {
+		for(int column = 0; column < 4; column++) {
+			out[row][column] = transform.matrix[row][column];
+		}
+	}
+}
+
+// Scene the reverb paths are traced in: every cube, and the sphere mesh.
+// The objects do not move yet, so the BVH is built once.
+void initAcoustics() {
+	acousticScene = new Banshee::AcousticScene();
+
+	for(GameObject* object : objects) {
+		Cube* cube = dynamic_cast<Cube*>(object);
+		if(cube == nullptr) continue;
+
+		float transform[3][4];
+		modelTransform(cube, transform);
+		acousticScene->addMesh(cube->getVertices(), cube->getVertexCount(), 8, cube->getIndices(), cube->getIndexCount(), transform);
+	}
+
+	// Not drawn yet, there is no OBJ path in the renderer.
+	std::vector<float> vertices;
+	std::vector<uint32_t> indices;
+	if(Banshee::AcousticScene::loadObj("res/Models/Sphere.obj", vertices, indices)) {
+		const float transform[3][4] = {
+			{1.f, 0.f, 0.f, 3.f},
+			{0.f, 1.f, 0.f, 0.f},
+			{0.f, 0.f, 1.f, -4.f}
+		};
+		acousticScene->addMesh(vertices.data(), vertices.size() / 3, 3, indices.data(), indices.size(), transform);
+	}
+
+	acousticScene->build();
+	acousticTracer = new Banshee::AcousticTracer(*acousticScene);
+}
+
+// Sound object index plays. The clip if there is one, otherwise a buzz with enough harmonics for
+// the occlusion low-pass to be heard, a whole number of cycles long so it loops without a click.
+Banshee::SampleBuffer emitterSound(int index) {
+	const char* clipPath = "res/Audio/emitter.wav";
+	Banshee::AudioReader reader;
+	if(std::ifstream(clipPath).good() && reader.open(clipPath)) {
+		Banshee::SampleBuffer clip = Banshee::SampleBuffer::fromReader(reader);
+		if(clip.isValid()) return clip;
+	}
+
+	const int sampleRate = mixer->getSampleRate();
+	const int frequency = 110 * (index + 1);
+	std::vector<float> samples(sampleRate);
+	for(int i = 0; i < sampleRate; i++) {
+		double phase = 6.283185307179586 * (double)(((int64_t)frequency * i) % sampleRate) / sampleRate;
+		double sample = 0.0;
+		for(int harmonic = 1; harmonic <= 8; harmonic++) {
+			sample += sin(phase * harmonic) / harmonic;
+		}
+		samples[i] = (float)(0.2 * sample);
+	}
+	return Banshee::SampleBuffer::fromFloat(samples.data(), samples.size(), 1, sampleRate);
+}
+
+// Gives every object an emitter and starts its sound. The mixer keeps the buffers alive.
+void initEmitters() {
+	for(size_t i = 0; i < objects.size(); i++) {
+		GameObject* object = objects[i];
+		Banshee::EmitterId emitter = spatializer->createEmitter();
+		spatializer->setPosition(emitter, {object->position.x, object->position.y, object->position.z});
+		spatializer->setVoice(emitter, mixer->play(emitterSound((int)i), 1.f, 0.f, true));
+		emitters.push_back({object, emitter});
+	}
+}
+
 bool initALL() {
 
 	if(!initGLFW()) {
@@ -79,21 +214,110 @@ bool initALL() {
 
 	std::cout << glGetString(GL_VERSION) << std::endl;
 
+	if(!initAudio()) {
+		std::cout << "Audio initialisation failed" << std::endl;
+		return false;
+	}
+
 	// Init objects here
 	renderer = new Renderer();
 	renderer->init();
 
 	Cube* cube1 = new Cube({0.0, 0.0, -2.0});
+	cube1->useCollision = true;
+
+	// Behind cube1 from where the camera starts, so it is heard through it. A sounding cube with
+	// collision is solid too, so cube1 muffles its own sound as well.
+	Cube* cube2 = new Cube({0.0, 0.0, -6.0});
 
 	objects.push_back(cube1);
+	objects.push_back(cube2);
 
 	for(int i = 0; i < objects.size(); i++) {
 		objects.at(i)->init();
 	}
 
+	// Cubes with collision muffle the sounds behind them.
+	for(GameObject* object : objects) {
+		Cube* cube = dynamic_cast<Cube*>(object);
+		if(cube == nullptr || !cube->useCollision) continue;
+		occluders.push_back({cube, occlusion->addOccluder(Banshee::OccluderBox())});
+	}
+
+	initAcoustics();
+	initEmitters();
+
 	return true;
 }
 
+// Moves the emitters to their objects. The velocity is the distance covered this tick, for doppler.
+void updateEmitters(double timestep) {
+	const float perSecond = (float)(1.0 / timestep);
+	for(auto& emitter : emitters) {
+		const Vec3f& position = emitter.first->position;
+		Banshee::Vector3 last = spatializer->getPosition(emitter.second);
+		spatializer->setVelocity(emitter.second, {(position.x - last.x) * perSecond, (position.y - last.y) * perSecond, (position.z - last.z) * perSecond});
+		spatializer->setPosition(emitter.second, {position.x, position.y, position.z});
+	}
+}
+
+// Moves the occluders to their models.
+void updateOccluders() {
+	for(auto& occluder : occluders) {
+		Banshee::OccluderBox box;
+		modelTransform(occluder.first, box.transform);
+		occlusion->setOccluder(occluder.second, box);
+	}
+}
+
+// Gives every emitter a trace source at its position and starts the next round of rays.
+void updateAcoustics() {
+	std::vector<bool> live(traceSources.size(), false);
+	for(int i = 0; i < spatializer->getEmitterCount(); i++) {
+		Banshee::EmitterId emitter = spatializer->getEmitter(i);
+		if(emitter >= traceSources.size()) {
+			traceSources.resize(emitter + 1, Banshee::INVALID_TRACE_SOURCE);
+			live.resize(emitter + 1, false);
+		}
+
+		Banshee::Vector3 position = spatializer->getPosition(emitter);
+		if(traceSources[emitter] == Banshee::INVALID_TRACE_SOURCE) {
+			traceSources[emitter] = acousticTracer->addSource(position);
+		}
+		else {
+			acousticTracer->setSourcePosition(traceSources[emitter], position);
+		}
+		live[emitter] = true;
+	}
+
+	for(size_t emitter = 0; emitter < traceSources.size(); emitter++) {
+		if(live[emitter] || traceSources[emitter] == Banshee::INVALID_TRACE_SOURCE) continue;
+		acousticTracer->removeSource(traceSources[emitter]);
+		traceSources[emitter] = Banshee::INVALID_TRACE_SOURCE;
+	}
+
+	acousticTracer->setListener(spatializer->getListener().position);
+	acousticTracer->update();
+}
+
+// Listener taken from the camera basis built by Renderer::lookAt().
+Banshee::Listener cameraListener() {
+	Banshee::Listener listener;
+	listener.position = {renderer->camPos.x, renderer->camPos.y, renderer->camPos.z};
+	listener.right = {renderer->xaxis.x, renderer->xaxis.y, renderer->xaxis.z};
+	listener.up = {renderer->yaxis.x, renderer->yaxis.y, renderer->yaxis.z};
+	// zaxis points away from the view direction.
+	listener.forward = {-renderer->zaxis.x, -renderer->zaxis.y, -renderer->zaxis.z};
+
+	// Same motion Renderer::update() applies to camPos.
+	Vec3f velocity;
+	Vec3f::scale(velocity, renderer->xaxis, renderer->camSpeedX);
+	Vec3f::increment(velocity, {0.f, 1.f, 0.f}, renderer->camSpeedY);
+	Vec3f::increment(velocity, renderer->zaxis, renderer->camSpeedZ);
+	listener.velocity = {velocity.x, velocity.y, velocity.z};
+	return listener;
+}
+
 void update(double timestep) {
 	const float radius = 50.f;
 	float camX = sin(glfwGetTime()) * radius;
@@ -109,6 +333,19 @@ void update(double timestep) {
 
 	renderer->update(timestep);
 
+	// Spatial audio is recomputed once per tick, the mixer only ramps between the results.
+	// Occlusion rays are traced in the background, a few emitters per tick.
+	// Head rotation only reaches the Ambisonics bus, which turns the whole soundfield per block.
+	spatializer->setListener(cameraListener());
+	ambisonics->setListener(spatializer->getListener());
+	updateEmitters(timestep);
+	updateOccluders();
+	occlusion->update(*spatializer);
+	spatializer->update(*mixer);
+	// Impulse responses build up over several ticks on every core.
+	updateAcoustics();
+	mixer->update();
+
 	//camera.setPos(camX, 0.f, camZ);
 
 }
@@ -265,9 +502,40 @@ void processInput(double dt) {
 	renderer->updateCameraState(mouse.mouseOffsetX, mouse.mouseOffsetY, mouse.mouseSensitivity);
 }
 
+// One line of audio figures for the last second, printed under the ups/fps line.
+void printAudioStats() {
+	static Banshee::AudioStatsSnapshot previous;
+
+	Banshee::AudioStatsSnapshot current;
+	mixer->getStats().read(current);
+	Banshee::AudioStatsSnapshot second = current.since(previous);
+	previous = current;
+
+	std::cout << "audio load: " << second.getLoad() << "% peak: " << second.getPeakLoad() << "%"
+		<< " voices: " << second.realVoices << " real " << second.virtualVoices << " virtual"
+		<< " underruns: " << second.underruns
+		<< " command latency p50/p99: " << second.commandLatency.getPercentile(0.5) << "/" << second.commandLatency.getPercentile(0.99) << "us" << std::endl;
+}
+
 void deleteHeapObjects() {
+	// Stop the audio thread before anything it reads is freed.
+	if(audioDevice != nullptr) {
+		audioDevice->close();
+	}
+	delete(audioDevice);
+	delete(acousticTracer);
+	delete(acousticScene);
+	delete(occlusion);
+	delete(spatializer);
+	delete(mixer);
+	delete(ambisonics);
+	delete(hrtf);
+
 	delete(renderer);
 
+	occluders.clear();
+	emitters.clear();
+	traceSources.clear();
 	for(GameObject* elem : objects) {
 		delete(elem);
 	}
@@ -320,6 +588,7 @@ int main() {
 			ups = ticks;
 			fps = frames;
 			std::cout << "ups: " << ups << " fps: " << fps << std::endl;
+			printAudioStats();
 			std::cout << "Camera Pos " << camera.pos.x << ", " << camera.pos.y << ", " << camera.pos.z << std::endl;
 			ticks = 0;
 			frames = 0;
@@ -71,4 +71,18 @@ public:
 
 	void init();
 	void update(double dt);
+
+	// Interleaved position, normal and uv, 8 floats per vertex.
+	inline const float* getVertices() const {
+		return cubeVertices;
+	};
+	inline const GLuint* getIndices() const {
+		return indices;
+	};
+	inline int getVertexCount() const {
+		return sizeof(cubeVertices) / sizeof(float) / 8;
+	};
+	inline int getIndexCount() const {
+		return sizeof(indices) / sizeof(GLuint);
+	};
 };
\ No newline at end of file